@@ -38,6 +38,11 @@
 # Change to this for no debug statements
 #       DBG=-all
 
+# Build profile. With "debug" every debug mode is compiled in, for DBG to
+# choose from, and KASSERTs are checked. "release" compiles in only the
+# "error" mode and leaves KASSERTs out, for kernels which are being timed.
+     PROFILE=debug
+
 # Switches for non-required components. If you wish to try implementing
 # some extra features in Weenix, there are some pre-designed features
 # you can add. Turn on one of these flags and re-compile Weenix. Please
@@ -57,6 +62,7 @@
         UPREEMPT=0 # userland preemption
              MTP=0 # multiple kernel threads per process
            PIPES=0 # pipe(2) functionality
+          KTRACE=1 # kernel event trace buffer (util/ktrace.h)
 
 # Set the number of terminals that we should be launching.
         NTERMS=3
@@ -80,6 +86,6 @@
 
 # Boolean options specified in this specified in this file that should be
 # included as definitions at compile time
-        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT PIPES "
+        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT PIPES KTRACE "
 # As above, but not booleans
         COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE "
@@ -12,6 +12,7 @@
 #include "util/string.h"
 #include "util/debug.h"
 #include "util/list.h"
+#include "util/ktrace.h"
 
 #include "mm/mman.h"
 #include "mm/mm.h"
@@ -21,6 +22,7 @@
 
 #include "fs/vfs_syscall.h"
 #include "fs/vnode.h"
+#include "fs/vfs.h"
 
 #include "test/kshell/kshell.h"
 
@@ -141,7 +143,8 @@ sys_write(write_args_t *arg)
         count = 0;
         while (count < kern_args.nbytes && !(count % PAGE_SIZE)) {
                 int size = MIN(PAGE_SIZE, kern_args.nbytes - count);
-                KASSERT(!copy_from_user(buf, (void *)((uint32_t)kern_args.buf + count), size));
+                err = copy_from_user(buf, (void *)((uint32_t)kern_args.buf + count), size);
+                KASSERT(!err);
                 if (0 > (err = do_write(kern_args.fd, buf, size))) {
                         page_free(buf);
                         if (count != 0) {
@@ -225,6 +228,47 @@ sys_getdents(getdents_args_t *arg)
         return -1;
 }
 
+/*
+ * Like sys_getdents(), but each entry comes with the stat() of the file
+ * it names. At most a page worth of entries are returned per call.
+ */
+static int
+sys_getdentsplus(getdentsplus_args_t *arg)
+{
+        getdentsplus_args_t kern_args;
+        direntplus_t *dp;
+        int n, ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        if (kern_args.count < sizeof(direntplus_t)) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        n = MIN(kern_args.count, PAGE_SIZE) / sizeof(direntplus_t);
+        if (NULL == (dp = (direntplus_t *)kmalloc(n * sizeof(direntplus_t)))) {
+                curthr->kt_errno = ENOMEM;
+                return -1;
+        }
+
+        if ((ret = do_getdentsplus(kern_args.fd, dp, n)) > 0) {
+                n = ret * sizeof(direntplus_t);
+                if ((ret = copy_to_user(kern_args.dirp, dp, n)) == 0)
+                        ret = n;
+        }
+        kfree(dp);
+
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
 #ifdef __MOUNTING__
 static int sys_mount(mount_args_t *arg)
 {
@@ -522,6 +566,85 @@ static int sys_lseek(lseek_args_t *args)
         } else return err;
 }
 
+static int sys_fallocate(fallocate_args_t *args)
+{
+        fallocate_args_t        kargs;
+        int                     err;
+
+        if ((err = copy_from_user(&kargs, args, sizeof(fallocate_args_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        err = do_fallocate(kargs.fd, kargs.mode, kargs.offset, kargs.len);
+
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
+static int sys_fadvise(fadvise_args_t *args)
+{
+        fadvise_args_t          kargs;
+        int                     err;
+
+        if ((err = copy_from_user(&kargs, args, sizeof(fadvise_args_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        err = do_fadvise(kargs.fd, kargs.offset, kargs.len, kargs.advice);
+
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
+static int sys_truncate(truncate_args_t *arg)
+{
+        truncate_args_t         kern_args;
+        char                   *path;
+        int                     err;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(truncate_args_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        path = user_strdup(&kern_args.path);
+        if (!path) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        err = do_truncate(path, kern_args.length);
+        kfree(path);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
+static int sys_ftruncate(ftruncate_args_t *args)
+{
+        ftruncate_args_t        kargs;
+        int                     err;
+
+        if ((err = copy_from_user(&kargs, args, sizeof(ftruncate_args_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        err = do_ftruncate(kargs.fd, kargs.length);
+
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
 static int sys_open(open_args_t *arg)
 {
         open_args_t             kern_args;
@@ -624,7 +747,9 @@ static void *sys_brk(void *addr)
 
 static void sys_sync(void)
 {
+        /* clean pages first, so the journal commit picks up their metadata */
         pframe_clean_all();
+        vfs_sync();
 }
 
 static void sys_halt(void)
@@ -665,6 +790,219 @@ static int sys_stat(stat_args_t *arg)
         return 0;
 }
 
+static int sys_statfs(statfs_args_t *arg)
+{
+        statfs_args_t kern_args;
+        struct statfs buf;
+        char *path;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        if ((path = user_strdup(&kern_args.path)) == NULL) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        ret = do_statfs(path, &buf);
+        kfree(path);
+
+        if (ret == 0)
+                ret = copy_to_user(kern_args.buf, &buf, sizeof(struct statfs));
+
+        if (ret != 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_fstatfs(fstatfs_args_t *arg)
+{
+        fstatfs_args_t kern_args;
+        struct statfs buf;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        ret = do_fstatfs(kern_args.fd, &buf);
+
+        if (ret == 0)
+                ret = copy_to_user(kern_args.buf, &buf, sizeof(struct statfs));
+
+        if (ret != 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_pcstat(pcstat_args_t *arg)
+{
+        pcstat_args_t kern_args;
+        struct pcstat buf;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        ret = do_pcstat(kern_args.fd, &buf);
+
+        if (ret == 0)
+                ret = copy_to_user(kern_args.buf, &buf, sizeof(struct pcstat));
+
+        if (ret != 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_defrag(defrag_args_t *arg)
+{
+        defrag_args_t kern_args;
+        struct defrag_info info;
+        int ret;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        ret = do_defrag(kern_args.fd, &info);
+
+        if (ret == 0)
+                ret = copy_to_user(kern_args.info, &info, sizeof(info));
+
+        if (ret != 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * The offset, if any, is copied in and back out around do_sendfile().
+ */
+static int sys_sendfile(sendfile_args_t *arg)
+{
+        sendfile_args_t kern_args;
+        off_t offset;
+        int ret, err;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        if (NULL != kern_args.offset
+            && (ret = copy_from_user(&offset, kern_args.offset, sizeof(offset))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        ret = do_sendfile(kern_args.out_fd, kern_args.in_fd,
+                          (NULL != kern_args.offset) ? &offset : NULL,
+                          kern_args.count);
+
+        if (NULL != kern_args.offset
+            && (err = copy_to_user(kern_args.offset, &offset, sizeof(offset))) < 0)
+                ret = err;
+
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+/*
+ * Like sys_sendfile(), with an offset for either side.
+ */
+static int sys_splice(splice_args_t *arg)
+{
+        splice_args_t kern_args;
+        off_t off_in, off_out;
+        int ret, err;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        if ((NULL != kern_args.off_in
+             && (ret = copy_from_user(&off_in, kern_args.off_in, sizeof(off_in))) < 0)
+            || (NULL != kern_args.off_out
+                && (ret = copy_from_user(&off_out, kern_args.off_out, sizeof(off_out))) < 0)) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        ret = do_splice(kern_args.fd_in, (NULL != kern_args.off_in) ? &off_in : NULL,
+                        kern_args.fd_out, (NULL != kern_args.off_out) ? &off_out : NULL,
+                        kern_args.len);
+
+        if (NULL != kern_args.off_in
+            && (err = copy_to_user(kern_args.off_in, &off_in, sizeof(off_in))) < 0)
+                ret = err;
+        if (NULL != kern_args.off_out
+            && (err = copy_to_user(kern_args.off_out, &off_out, sizeof(off_out))) < 0)
+                ret = err;
+
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
+/*
+ * Like sys_splice(), with flags for do_copy_file_range().
+ */
+static int sys_copy_file_range(copy_file_range_args_t *arg)
+{
+        copy_file_range_args_t kern_args;
+        off_t off_in, off_out;
+        int ret, err;
+
+        if ((ret = copy_from_user(&kern_args, arg, sizeof(kern_args))) < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        if ((NULL != kern_args.off_in
+             && (ret = copy_from_user(&off_in, kern_args.off_in, sizeof(off_in))) < 0)
+            || (NULL != kern_args.off_out
+                && (ret = copy_from_user(&off_out, kern_args.off_out, sizeof(off_out))) < 0)) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+
+        ret = do_copy_file_range(kern_args.fd_in,
+                                 (NULL != kern_args.off_in) ? &off_in : NULL,
+                                 kern_args.fd_out,
+                                 (NULL != kern_args.off_out) ? &off_out : NULL,
+                                 kern_args.len, kern_args.flags);
+
+        if (NULL != kern_args.off_in
+            && (err = copy_to_user(kern_args.off_in, &off_in, sizeof(off_in))) < 0)
+                ret = err;
+        if (NULL != kern_args.off_out
+            && (err = copy_to_user(kern_args.off_out, &off_out, sizeof(off_out))) < 0)
+                ret = err;
+
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
 static int sys_pipe(int arg[2])
 {
         int kern_args[2];
@@ -843,7 +1181,9 @@ static void syscall_handler(regs_t *regs)
 
         dbginfo(DBG_VMMAP, vmmap_mapping_info, curproc->p_vmmap);
 
+        ktrace(KT_SYSCALL_ENTER, sysnum, args, 0);
         int ret = syscall_dispatch(sysnum, args, regs);
+        ktrace(KT_SYSCALL_EXIT, sysnum, ret, (ret < 0) ? curthr->kt_errno : 0);
 
         if (curthr->kt_cancelled) {
                 dbg(DBG_SYSCALL, "trap: CANCELLING: thread %p of proc %d "
@@ -941,12 +1281,26 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_getdents:
                         return sys_getdents((getdents_args_t *)args);
 
+                case SYS_getdentsplus:
+                        return sys_getdentsplus((getdentsplus_args_t *)args);
+
                 case SYS_brk:
                         return (int) sys_brk((void *)args);
 
                 case SYS_lseek:
                         return sys_lseek((lseek_args_t *)args);
 
+                case SYS_fallocate:
+                        return sys_fallocate((fallocate_args_t *)args);
+                case SYS_fadvise:
+                        return sys_fadvise((fadvise_args_t *)args);
+
+                case SYS_truncate:
+                        return sys_truncate((truncate_args_t *)args);
+
+                case SYS_ftruncate:
+                        return sys_ftruncate((ftruncate_args_t *)args);
+
                 case SYS_halt:
                         sys_halt();
                         return -1;
@@ -964,6 +1318,25 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_stat:
                         return sys_stat((stat_args_t *)args);
 
+                case SYS_statfs:
+                        return sys_statfs((statfs_args_t *)args);
+
+                case SYS_fstatfs:
+                        return sys_fstatfs((fstatfs_args_t *)args);
+                case SYS_pcstat:
+                        return sys_pcstat((pcstat_args_t *)args);
+
+                case SYS_defrag:
+                        return sys_defrag((defrag_args_t *)args);
+
+                case SYS_sendfile:
+                        return sys_sendfile((sendfile_args_t *)args);
+
+                case SYS_splice:
+                        return sys_splice((splice_args_t *)args);
+                case SYS_copy_file_range:
+                        return sys_copy_file_range((copy_file_range_args_t *)args);
+
                 case SYS_pipe:
                         return sys_pipe((int *)args);
 
@@ -31,7 +31,7 @@ init_func(file_init);
 void
 fref(file_t *f)
 {
-        KASSERT(f->f_mode >= 0 && f->f_mode < 8);
+        KASSERT(f->f_mode >= 0 && f->f_mode < 16);
         KASSERT(f->f_pos >= -1);
         KASSERT(f->f_refcount >= 0);
         if (f->f_refcount != 0) KASSERT(f->f_vnode);
@@ -86,7 +86,7 @@ void
 fput(file_t *f)
 {
         KASSERT(f);
-        KASSERT(f->f_mode >= 0 && f->f_mode < 8);
+        KASSERT(f->f_mode >= 0 && f->f_mode < 16);
         KASSERT(f->f_pos >= -1);
         KASSERT(f->f_refcount > 0);
         if (f->f_refcount != 1) KASSERT(f->f_vnode);
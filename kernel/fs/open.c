@@ -39,12 +39,15 @@ get_empty_fd(proc_t *p)
  *      1. Get the next empty file descriptor.
  *      2. Call fget to get a fresh file_t.
  *      3. Save the file_t in curproc's file descriptor table.
- *      4. Set file_t->f_mode to OR of FMODE_(READ|WRITE|APPEND) based on
- *         oflags, which can be O_RDONLY, O_WRONLY or O_RDWR, possibly OR'd with
- *         O_APPEND.
+ *      4. Set file_t->f_mode to OR of FMODE_(READ|WRITE|APPEND|DIRECT) based
+ *         on oflags, which can be O_RDONLY, O_WRONLY or O_RDWR, possibly OR'd
+ *         with O_APPEND and O_DIRECT.
  *      5. Use open_namev() to get the vnode for the file_t.
  *      6. Fill in the fields of the file_t.
- *      7. Return new fd.
+ *      7. If O_TRUNC is given and the file is a regular file opened for
+ *         writing, truncate it to zero length with its truncate() vnode
+ *         operation.
+ *      8. Return new fd.
  *
  * If anything goes wrong at any point (specifically if the call to open_namev
  * fails), be sure to remove the fd from curproc, fput the file_t and return an
@@ -52,7 +55,8 @@ get_empty_fd(proc_t *p)
  *
  * Error cases you must handle for this function at the VFS level:
  *      o EINVAL
- *        oflags is not valid.
+ *        oflags is not valid. Or, O_DIRECT is set and the file has no
+ *        read_direct vnode operation.
  *      o EMFILE
  *        The process already has the maximum number of files open.
  *      o ENOMEM
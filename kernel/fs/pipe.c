@@ -55,15 +55,24 @@ static int pipe_release(vnode_t *vnode, file_t *file);
 static vnode_ops_t pipe_vops = {
         .read = pipe_read,
         .write = pipe_write,
+        .read_direct = NULL,
+        .write_direct = NULL,
         .mmap = NULL,
+        .fallocate = NULL,
+        .truncate = NULL,
+        .seek_hole = NULL,
+        .defrag = NULL,
+        .clone_range = NULL,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
         .link = NULL,
         .unlink = NULL,
+        .rename = NULL,
         .mkdir = NULL,
         .rmdir = NULL,
         .readdir = NULL,
+        .readdirplus = NULL,
         .stat = pipe_stat,
         .acquire = pipe_acquire,
         .release = pipe_release,
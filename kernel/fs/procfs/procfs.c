@@ -0,0 +1,460 @@
+/*
+ * A read-only pseudo filesystem which makes what the kernel's *_info()
+ * functions print for gdb and dbginfo() readable as files, so that
+ * kernel statistics can be looked at without a debugger:
+ *
+ *    /processes        every process (proc_list_info)
+ *    /slabinfo         slab allocator usage (slab_allocators_info)
+ *    /buddyinfo        free page blocks of each order (page_info)
+ *    /pcstat           page cache statistics (pframe_info)
+ *    /schedstat        scheduler counters (sched_info)
+ *    /ktrace           the kernel trace buffer, as ktrace_event_t's
+ *    /<pid>/status     a process (proc_info)
+ *    /<pid>/maps       its address space (vmmap_mapping_info)
+ *
+ * Nothing is stored: a file's contents are printed into a page every
+ * time it is read, so they are at most a page long, and a file read in
+ * pieces may change between them. Files have no length until read,
+ * like their namesakes on Linux. A file can instead be read directly
+ * through its pe_read function, which is how /ktrace holds more than a
+ * page.
+ *
+ * The vnode number says what a vnode is: its low byte is which entry of
+ * procfs_root_entries or procfs_pid_entries it is, counting from 1, or
+ * 0 for a directory, and the rest is the pid plus one, 0 for the root.
+ */
+
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/string.h"
+#include "util/printf.h"
+#include "util/debug.h"
+#include "util/ktrace.h"
+
+#include "mm/page.h"
+#include "mm/slab.h"
+#include "mm/pframe.h"
+
+#include "proc/proc.h"
+#include "proc/sched.h"
+
+#include "vm/vmmap.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/stat.h"
+#include "fs/dirent.h"
+
+#include "fs/procfs/procfs.h"
+
+#define PROCFS_INO(pid, entry)  ((((ino_t)(pid) + 1) << 8) | (entry))
+#define PROCFS_INO_PID(ino)     ((pid_t)((ino) >> 8) - 1)
+#define PROCFS_INO_ENTRY(ino)   ((ino) & 0xff)
+
+#define PROCFS_ROOT_INO         PROCFS_INO(-1, 0)
+
+static size_t procfs_status_info(const void *arg, char *buf, size_t size);
+#ifdef __VM__
+static size_t procfs_maps_info(const void *arg, char *buf, size_t size);
+#endif
+
+typedef struct procfs_entry {
+        const char     *pe_name;
+        dbg_infofunc_t  pe_info;
+        int           (*pe_read)(off_t offset, void *buf, size_t count);
+} procfs_entry_t;
+
+static const procfs_entry_t procfs_root_entries[] = {
+        { "processes", proc_list_info, NULL },
+        { "slabinfo",  slab_allocators_info, NULL },
+        { "buddyinfo", page_info, NULL },
+        { "pcstat",    pframe_info, NULL },
+        { "schedstat", sched_info, NULL },
+#ifdef __KTRACE__
+        { "ktrace",    NULL, ktrace_read },
+#endif
+};
+
+/* The info functions of these are given the process */
+static const procfs_entry_t procfs_pid_entries[] = {
+        { "status", procfs_status_info, NULL },
+#ifdef __VM__
+        { "maps",   procfs_maps_info, NULL },
+#endif
+};
+
+#define PROCFS_NROOT    (sizeof(procfs_root_entries) / sizeof(procfs_entry_t))
+#define PROCFS_NPID     (sizeof(procfs_pid_entries) / sizeof(procfs_entry_t))
+
+/*
+ * Filesystem operations
+ */
+static void procfs_read_vnode(vnode_t *vn);
+static int procfs_query_vnode(vnode_t *vn);
+
+static fs_ops_t procfs_ops = {
+        .read_vnode   = procfs_read_vnode,
+        .delete_vnode = NULL,
+        .query_vnode  = procfs_query_vnode,
+        .umount       = NULL,
+        .statfs       = NULL
+};
+
+/*
+ * vnode operations
+ */
+static int procfs_read(vnode_t *file, off_t offset, void *buf, size_t count);
+static int procfs_write(vnode_t *file, off_t offset, const void *buf, size_t count);
+static int procfs_truncate(vnode_t *file, off_t len);
+static int procfs_create(vnode_t *dir, const char *name, size_t name_len,
+                         vnode_t **result);
+static int procfs_mknod(struct vnode *dir, const char *name, size_t name_len,
+                        int mode, devid_t devid);
+static int procfs_lookup(vnode_t *dir, const char *name, size_t name_len,
+                         vnode_t **result);
+static int procfs_link(vnode_t *oldvnode, vnode_t *dir,
+                       const char *name, size_t name_len);
+static int procfs_unlink(vnode_t *dir, const char *name, size_t name_len);
+static int procfs_rename(vnode_t *olddir, const char *oldname, size_t oldname_len,
+                         vnode_t *newdir, const char *newname, size_t newname_len);
+static int procfs_mkdir(vnode_t *dir, const char *name, size_t name_len);
+static int procfs_rmdir(vnode_t *dir, const char *name, size_t name_len);
+static int procfs_readdir(vnode_t *dir, off_t offset, struct dirent *d);
+static int procfs_stat(vnode_t *vnode, struct stat *buf);
+
+static vnode_ops_t procfs_dir_vops = {
+        .read = NULL,
+        .write = NULL,
+        .read_direct = NULL,
+        .write_direct = NULL,
+        .mmap = NULL,
+        .fallocate = NULL,
+        .truncate = NULL,
+        .seek_hole = NULL,
+        .defrag = NULL,
+        .clone_range = NULL,
+        .create = procfs_create,
+        .mknod = procfs_mknod,
+        .lookup = procfs_lookup,
+        .link = procfs_link,
+        .unlink = procfs_unlink,
+        .rename = procfs_rename,
+        .mkdir = procfs_mkdir,
+        .rmdir = procfs_rmdir,
+        .readdir = procfs_readdir,
+        .readdirplus = NULL,
+        .stat = procfs_stat,
+        .acquire = NULL,
+        .release = NULL,
+        .fillpage = NULL,
+        .dirtypage = NULL,
+        .cleanpage = NULL
+};
+
+static vnode_ops_t procfs_file_vops = {
+        .read = procfs_read,
+        .write = procfs_write,
+        .read_direct = NULL,
+        .write_direct = NULL,
+        .mmap = NULL,
+        .fallocate = NULL,
+        .truncate = procfs_truncate,
+        .seek_hole = NULL,
+        .defrag = NULL,
+        .clone_range = NULL,
+        .create = NULL,
+        .mknod = NULL,
+        .lookup = NULL,
+        .link = NULL,
+        .unlink = NULL,
+        .rename = NULL,
+        .mkdir = NULL,
+        .rmdir = NULL,
+        .readdir = NULL,
+        .readdirplus = NULL,
+        .stat = procfs_stat,
+        .acquire = NULL,
+        .release = NULL,
+        .fillpage = NULL,
+        .dirtypage = NULL,
+        .cleanpage = NULL
+};
+
+/* Helper functions */
+static size_t
+procfs_status_info(const void *arg, char *buf, size_t size)
+{
+        return proc_info(arg, buf, size);
+}
+
+#ifdef __VM__
+static size_t
+procfs_maps_info(const void *arg, char *buf, size_t size)
+{
+        const proc_t *p = arg;
+
+        /* kernel processes have no user address space */
+        if (NULL == p->p_vmmap)
+                return 0;
+        return vmmap_mapping_info(p->p_vmmap, buf, size);
+}
+#endif
+
+/*
+ * The process a vnode belongs to, or NULL if it is gone (or if the vnode
+ * is the root or one of its files).
+ */
+static proc_t *
+procfs_proc(vnode_t *vn)
+{
+        pid_t pid = PROCFS_INO_PID(vn->vn_vno);
+
+        if (0 > pid)
+                return NULL;
+        return proc_lookup(pid);
+}
+
+/*
+ * Function implementations
+ */
+
+int
+procfs_mount(struct fs *fs)
+{
+        fs->fs_i = NULL;
+        fs->fs_op = &procfs_ops;
+        fs->fs_root = vget(fs, PROCFS_ROOT_INO);
+
+        return 0;
+}
+
+static void
+procfs_read_vnode(vnode_t *vn)
+{
+        vn->vn_i = NULL;
+        vn->vn_len = 0;
+
+        if (0 == PROCFS_INO_ENTRY(vn->vn_vno)) {
+                vn->vn_mode = S_IFDIR;
+                vn->vn_ops = &procfs_dir_vops;
+        } else {
+                vn->vn_mode = S_IFREG;
+                vn->vn_ops = &procfs_file_vops;
+        }
+}
+
+/* There is nothing to keep a vnode for once it isn't used */
+static int
+procfs_query_vnode(vnode_t *vn)
+{
+        return 0;
+}
+
+static int
+procfs_read(vnode_t *file, off_t offset, void *buf, size_t count)
+{
+        uint32_t entry = PROCFS_INO_ENTRY(file->vn_vno);
+        const procfs_entry_t *pe;
+        const void *arg = NULL;
+        char *page;
+        int ret;
+
+        if (0 > PROCFS_INO_PID(file->vn_vno)) {
+                KASSERT(entry <= PROCFS_NROOT);
+                pe = &procfs_root_entries[entry - 1];
+        } else {
+                KASSERT(entry <= PROCFS_NPID);
+                pe = &procfs_pid_entries[entry - 1];
+                if (NULL == (arg = procfs_proc(file)))
+                        return -ESRCH;
+        }
+
+        if (NULL != pe->pe_read)
+                return pe->pe_read(offset, buf, count);
+
+        if (NULL == (page = page_alloc()))
+                return -ENOMEM;
+
+        /* the *_info() functions don't agree on what they return */
+        page[0] = '\0';
+        pe->pe_info(arg, page, PAGE_SIZE);
+        ret = MAX(0, MIN((off_t)count, (off_t)strlen(page) - offset));
+        memcpy(buf, page + offset, ret);
+
+        page_free(page);
+        return ret;
+}
+
+static int
+procfs_write(vnode_t *file, off_t offset, const void *buf, size_t count)
+{
+        return -EROFS;
+}
+
+static int
+procfs_truncate(vnode_t *file, off_t len)
+{
+        return -EROFS;
+}
+
+static int
+procfs_create(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
+{
+        return -EROFS;
+}
+
+static int
+procfs_mknod(struct vnode *dir, const char *name, size_t name_len, int mode, devid_t devid)
+{
+        return -EROFS;
+}
+
+static int
+procfs_lookup(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
+{
+        pid_t pid = PROCFS_INO_PID(dir->vn_vno);
+        const procfs_entry_t *entries;
+        size_t i, nentries;
+
+        if (name_match(".", name, name_len)) {
+                vref(dir);
+                *result = dir;
+                return 0;
+        }
+        if (name_match("..", name, name_len)) {
+                *result = vget(dir->vn_fs, PROCFS_ROOT_INO);
+                return 0;
+        }
+
+        if (0 > pid) {
+                entries = procfs_root_entries;
+                nentries = PROCFS_NROOT;
+        } else {
+                entries = procfs_pid_entries;
+                nentries = PROCFS_NPID;
+        }
+        for (i = 0; i < nentries; ++i) {
+                if (name_match(entries[i].pe_name, name, name_len)) {
+                        *result = vget(dir->vn_fs, PROCFS_INO(pid, i + 1));
+                        return 0;
+                }
+        }
+
+        /* the root also has a directory for each process */
+        if (0 > pid && 0 < name_len) {
+                pid = 0;
+                for (i = 0; i < name_len; ++i) {
+                        if ('0' > name[i] || '9' < name[i])
+                                return -ENOENT;
+                        /* stop before a long name overflows pid */
+                        if (PROC_MAX_COUNT <= (pid = pid * 10 + (name[i] - '0')))
+                                return -ENOENT;
+                }
+                if (NULL != proc_lookup(pid)) {
+                        *result = vget(dir->vn_fs, PROCFS_INO(pid, 0));
+                        return 0;
+                }
+        }
+
+        return -ENOENT;
+}
+
+static int
+procfs_link(vnode_t *oldvnode, vnode_t *dir, const char *name, size_t name_len)
+{
+        return -EROFS;
+}
+
+static int
+procfs_unlink(vnode_t *dir, const char *name, size_t name_len)
+{
+        return -EROFS;
+}
+
+static int
+procfs_rename(vnode_t *olddir, const char *oldname, size_t oldname_len,
+              vnode_t *newdir, const char *newname, size_t newname_len)
+{
+        return -EROFS;
+}
+
+static int
+procfs_mkdir(vnode_t *dir, const char *name, size_t name_len)
+{
+        return -EROFS;
+}
+
+static int
+procfs_rmdir(vnode_t *dir, const char *name, size_t name_len)
+{
+        return -EROFS;
+}
+
+/*
+ * The offset counts entries: ".", "..", then the files, then in the root
+ * a directory for each process, in the order of the process list.
+ */
+static int
+procfs_readdir(vnode_t *dir, off_t offset, struct dirent *d)
+{
+        pid_t pid = PROCFS_INO_PID(dir->vn_vno);
+        const procfs_entry_t *entries;
+        size_t nentries;
+        off_t i = offset;
+        proc_t *p;
+
+        KASSERT(S_ISDIR(dir->vn_mode));
+
+        if (0 > pid) {
+                entries = procfs_root_entries;
+                nentries = PROCFS_NROOT;
+        } else {
+                entries = procfs_pid_entries;
+                nentries = PROCFS_NPID;
+        }
+
+        d->d_off = 0; /* unused */
+        if (0 == i || 1 == i) {
+                d->d_ino = (0 == i) ? dir->vn_vno : PROCFS_ROOT_INO;
+                strcpy(d->d_name, (0 == i) ? "." : "..");
+                return 1;
+        }
+        i -= 2;
+
+        if (i < (off_t)nentries) {
+                d->d_ino = PROCFS_INO(pid, i + 1);
+                strncpy(d->d_name, entries[i].pe_name, NAME_LEN - 1);
+                d->d_name[NAME_LEN - 1] = '\0';
+                return 1;
+        }
+        i -= nentries;
+
+        if (0 > pid) {
+                list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                        if (0 == i--) {
+                                d->d_ino = PROCFS_INO(p->p_pid, 0);
+                                snprintf(d->d_name, NAME_LEN, "%d", p->p_pid);
+                                return 1;
+                        }
+                } list_iterate_end();
+        }
+
+        return 0;
+}
+
+static int
+procfs_stat(vnode_t *vnode, struct stat *buf)
+{
+        memset(buf, 0, sizeof(struct stat));
+        buf->st_mode    = vnode->vn_mode;
+        buf->st_ino     = (int) vnode->vn_vno;
+        buf->st_dev     = 0;
+        buf->st_nlink   = S_ISDIR(vnode->vn_mode) ? 2 : 1;
+        buf->st_size    = 0;
+        buf->st_blksize = (int) PAGE_SIZE;
+        buf->st_blocks  = 0;
+
+        return 0;
+}
@@ -22,6 +22,7 @@
 #include "util/string.h"
 #include "util/printf.h"
 #include "fs/stat.h"
+#include "fs/statfs.h"
 #include "fs/dirent.h"
 #include "util/debug.h"
 #include "mm/kmalloc.h"
@@ -35,12 +36,14 @@ static void ramfs_read_vnode(vnode_t *vn);
 static void ramfs_delete_vnode(vnode_t *vn);
 static int ramfs_query_vnode(vnode_t *vn);
 static int ramfs_umount(fs_t *fs);
+static int ramfs_statfs(fs_t *fs, struct statfs *buf);
 
 static fs_ops_t ramfs_ops = {
         .read_vnode   = ramfs_read_vnode,
         .delete_vnode = ramfs_delete_vnode,
         .query_vnode  = ramfs_query_vnode,
-        .umount       = ramfs_umount
+        .umount       = ramfs_umount,
+        .statfs       = ramfs_statfs
 };
 
 /*
@@ -58,23 +61,35 @@ static int ramfs_lookup(vnode_t *dir, const char *name, size_t name_len,
 static int ramfs_link(vnode_t *oldvnode, vnode_t *dir,
                       const char *name, size_t name_len);
 static int ramfs_unlink(vnode_t *dir, const char *name, size_t name_len);
+static int ramfs_rename(vnode_t *olddir, const char *oldname, size_t oldname_len,
+                        vnode_t *newdir, const char *newname, size_t newname_len);
 static int ramfs_mkdir(vnode_t *dir, const char *name, size_t name_len);
 static int ramfs_rmdir(vnode_t *dir, const char *name, size_t name_len);
 static int ramfs_readdir(vnode_t *dir, off_t offset, struct dirent *d);
 static int ramfs_stat(vnode_t *file, struct stat *buf);
+static int ramfs_truncate(vnode_t *file, off_t len);
 
 static vnode_ops_t ramfs_dir_vops = {
         .read = NULL,
         .write = NULL,
+        .read_direct = NULL,
+        .write_direct = NULL,
         .mmap = NULL,
+        .fallocate = NULL,
+        .truncate = NULL,
+        .seek_hole = NULL,
+        .defrag = NULL,
+        .clone_range = NULL,
         .create = ramfs_create,
         .mknod = ramfs_mknod,
         .lookup = ramfs_lookup,
         .link = ramfs_link,
         .unlink = ramfs_unlink,
+        .rename = ramfs_rename,
         .mkdir = ramfs_mkdir,
         .rmdir = ramfs_rmdir,
         .readdir = ramfs_readdir,
+        .readdirplus = NULL,
         .stat = ramfs_stat,
         .acquire = NULL,
         .release = NULL,
@@ -86,14 +101,23 @@ static vnode_ops_t ramfs_dir_vops = {
 static vnode_ops_t ramfs_file_vops = {
         .read = ramfs_read,
         .write = ramfs_write,
+        .read_direct = NULL,
+        .write_direct = NULL,
         .mmap = NULL,
+        .fallocate = NULL,
+        .truncate = ramfs_truncate,
+        .seek_hole = NULL,
+        .defrag = NULL,
+        .clone_range = NULL,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
         .link = NULL,
         .unlink = NULL,
+        .rename = NULL,
         .mkdir = NULL,
         .rmdir = NULL,
+        .readdirplus = NULL,
         .stat = ramfs_stat,
         .acquire = NULL,
         .release = NULL,
@@ -132,6 +156,8 @@ typedef struct ramfs_inode {
 
 typedef struct ramfs {
         ramfs_inode_t *rfs_inodes[RAMFS_MAX_FILES];  /* Array of all files */
+        int            rfs_nfree;    /* Empty slots in rfs_inodes */
+        int            rfs_npages;   /* Pages holding file contents */
 } ramfs_t;
 
 /*
@@ -173,6 +199,7 @@ ramfs_alloc_inode(fs_t *fs, int type, devid_t devid)
                                         return -ENOSPC;
                                 }
                                 memset(inode->rf_mem, 0, PAGE_SIZE);
+                                rfs->rfs_npages++;
                         }
                         inode->rf_size = 0;
                         inode->rf_ino = i;
@@ -181,6 +208,7 @@ ramfs_alloc_inode(fs_t *fs, int type, devid_t devid)
 
                         /* Install in table and return */
                         rfs->rfs_inodes[i] = inode;
+                        rfs->rfs_nfree--;
                         return i;
                 }
         }
@@ -201,6 +229,8 @@ ramfs_mount(struct fs *fs)
                 return -ENOMEM;
 
         memset(rfs->rfs_inodes, 0, sizeof(rfs->rfs_inodes));
+        rfs->rfs_nfree = RAMFS_MAX_FILES;
+        rfs->rfs_npages = 0;
 
         fs->fs_i = rfs;
         fs->fs_op = &ramfs_ops;
@@ -280,9 +310,11 @@ ramfs_delete_vnode(vnode_t *vn)
                 KASSERT(rfs->rfs_inodes[vn->vn_vno] == inode);
 
                 rfs->rfs_inodes[vn->vn_vno] = NULL;
+                rfs->rfs_nfree++;
                 if (inode->rf_mode == RAMFS_TYPE_DATA
                     || inode->rf_mode == RAMFS_TYPE_DIR) {
                         page_free(inode->rf_mem);
+                        rfs->rfs_npages--;
                 }
                 /* otherwise, inode->rf_mem is a devid */
 
@@ -321,6 +353,23 @@ ramfs_umount(fs_t *fs)
         return 0;
 }
 
+/* Every file gets at most one page, so there is a page per inode slot */
+static int
+ramfs_statfs(fs_t *fs, struct statfs *buf)
+{
+        ramfs_t *rfs = (ramfs_t *) fs->fs_i;
+
+        buf->f_bsize = PAGE_SIZE;
+        buf->f_blocks = RAMFS_MAX_FILES;
+        buf->f_bfree = RAMFS_MAX_FILES - rfs->rfs_npages;
+        buf->f_bpending = 0;
+        buf->f_files = RAMFS_MAX_FILES;
+        buf->f_ffree = rfs->rfs_nfree;
+        buf->f_namelen = NAME_LEN - 1;
+
+        return 0;
+}
+
 static int
 ramfs_create(vnode_t *dir, const char *name, size_t name_len, vnode_t **result)
 {
@@ -485,6 +534,74 @@ ramfs_unlink(vnode_t *dir, const char *name, size_t namelen)
         return 0;
 }
 
+static int
+ramfs_rename(vnode_t *olddir, const char *oldname, size_t oldname_len,
+             vnode_t *newdir, const char *newname, size_t newname_len)
+{
+        vnode_t *vn;
+        off_t i;
+        ramfs_dirent_t *entry, *from = NULL, *to = NULL, *empty = NULL;
+
+        KASSERT(olddir->vn_fs == newdir->vn_fs);
+
+        entry = VNODE_TO_DIRENT(olddir);
+        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
+                if (name_match(entry->rd_name, oldname, oldname_len)) {
+                        from = entry;
+                        break;
+                }
+        }
+        if (NULL == from)
+                return -ENOENT;
+
+        /* Find the entry being replaced, or space for a new one */
+        entry = VNODE_TO_DIRENT(newdir);
+        for (i = 0; i < RAMFS_MAX_DIRENT; i++, entry++) {
+                if (name_match(entry->rd_name, newname, newname_len)) {
+                        to = entry;
+                        break;
+                }
+                if (NULL == empty && !entry->rd_name[0])
+                        empty = entry;
+        }
+        if (NULL != to && to->rd_ino == from->rd_ino)
+                return 0;
+
+        vn = vget(olddir->vn_fs, from->rd_ino);
+        if (S_ISDIR(vn->vn_mode)) {
+                vput(vn);
+                return -EPERM;
+        }
+        vput(vn);
+
+        if (NULL != to) {
+                vn = vget(newdir->vn_fs, to->rd_ino);
+                if (S_ISDIR(vn->vn_mode)) {
+                        vput(vn);
+                        return -EISDIR;
+                }
+                to->rd_ino = from->rd_ino;
+                VNODE_TO_RAMFSINODE(vn)->rf_linkcount--;
+                vput(vn);
+        } else {
+                /* Within a directory the entry is just renamed in place */
+                if (olddir == newdir)
+                        empty = from;
+                else if (NULL == empty)
+                        return -ENOSPC;
+                empty->rd_ino = from->rd_ino;
+                strncpy(empty->rd_name, newname, MIN(newname_len, NAME_LEN - 1));
+                empty->rd_name[MIN(newname_len, NAME_LEN - 1)] = '\0';
+                if (empty == from)
+                        return 0;
+                VNODE_TO_RAMFSINODE(newdir)->rf_size += sizeof(ramfs_dirent_t);
+        }
+
+        from->rd_name[0] = '\0';
+        VNODE_TO_RAMFSINODE(olddir)->rf_size -= sizeof(ramfs_dirent_t);
+        return 0;
+}
+
 static int
 ramfs_mkdir(vnode_t *dir, const char *name, size_t name_len)
 {
@@ -612,6 +729,23 @@ ramfs_write(vnode_t *file, off_t offset, const void *buf, size_t count)
         return ret;
 }
 
+static int
+ramfs_truncate(vnode_t *file, off_t len)
+{
+        ramfs_inode_t *inode = VNODE_TO_RAMFSINODE(file);
+
+        KASSERT(!S_ISDIR(file->vn_mode));
+
+        if (len > (off_t)PAGE_SIZE)
+                return -EFBIG;
+        if (len > inode->rf_size)
+                memset(inode->rf_mem + inode->rf_size, 0, len - inode->rf_size);
+
+        file->vn_len = inode->rf_size = len;
+
+        return 0;
+}
+
 static int
 ramfs_readdir(vnode_t *dir, off_t offset, struct dirent *d)
 {
@@ -0,0 +1,254 @@
+/*
+ *  FILE: readahead.c
+ *  DESC: reading file pages in ahead of time, and dropping them early
+ */
+
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "proc/sched.h"
+
+#include "mm/slab.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+
+#include "fs/vnode.h"
+#include "fs/fcntl.h"
+#include "fs/readahead.h"
+
+/*
+ * A read() only brings in the pages it touches, so a reader going
+ * through a file a page at a time waits on the disk for every one of
+ * them. readaheadd reads the next few pages while the reader is busy
+ * with the last, so that they are usually resident by the time it asks.
+ *
+ * How far ahead to read is decided per vnode, from the advice given
+ * with fadvise(), kept in vn_advice:
+ *
+ *   - POSIX_FADV_NORMAL reads READAHEAD_PAGES ahead, but only of a read
+ *     which starts where the last one ended.
+ *   - POSIX_FADV_SEQUENTIAL reads READAHEAD_SEQ_PAGES ahead of any read.
+ *   - POSIX_FADV_RANDOM never reads ahead.
+ *   - POSIX_FADV_NOREUSE reads ahead like POSIX_FADV_NORMAL, and drops
+ *     the pages a read has finished with, so that a file read once
+ *     doesn't push out pages which will be used again.
+ *
+ * vn_ranext is where the last read ended, and vn_raend the page after
+ * the last one asked for; more is asked for when a reader gets within
+ * half a window of it, so that a sequential reader keeps one request
+ * ahead of it. A read anywhere else starts over.
+ *
+ * Requests queue up for readaheadd, which holds a reference on the
+ * vnode until it is done with it. There are at most READAHEAD_MAX_QUEUED
+ * of them; readahead is only ever a guess, so more are just dropped.
+ */
+
+#define READAHEAD_MAX_QUEUED    16
+
+typedef struct ra_request {
+        vnode_t        *rr_vnode;
+        uint32_t        rr_first;
+        uint32_t        rr_npages;
+        list_link_t     rr_link;
+} ra_request_t;
+
+static slab_allocator_t *ra_request_allocator = NULL;
+
+static list_t ra_queue;                 /* ra_request_t's, oldest first */
+static int ra_nqueued = 0;
+static ktqueue_t ra_waitq;              /* readaheadd sleeps here */
+static proc_t *readaheadd = NULL;
+static kthread_t *readaheadd_thr = NULL;
+
+static void *readaheadd_run(int arg1, void *arg2);
+
+/*
+ * Ask readaheadd to read in pages first through first + npages - 1 of
+ * vn, those which are within the file and not already resident. Does
+ * not block.
+ */
+void
+vnode_readahead(vnode_t *vn, uint32_t first, uint32_t npages)
+{
+        ra_request_t *rr;
+
+        if (0 == npages || NULL == readaheadd_thr)
+                return;
+        if (READAHEAD_MAX_QUEUED <= ra_nqueued)
+                return;
+        if (NULL == (rr = slab_obj_alloc(ra_request_allocator)))
+                return;
+
+        vref(vn);
+        rr->rr_vnode = vn;
+        rr->rr_first = first;
+        rr->rr_npages = npages;
+        list_insert_tail(&ra_queue, &rr->rr_link);
+        ra_nqueued++;
+
+        sched_wakeup_on(&ra_waitq);
+}
+
+/*
+ * Called by a file system's read() once it has read len bytes at pos
+ * from vn through its pages. Asks for the pages after them according to
+ * vn's advice, and with POSIX_FADV_NOREUSE drops the pages read.
+ */
+void
+vnode_read_done(vnode_t *vn, off_t pos, size_t len)
+{
+        uint32_t last, window, first;
+
+        if (0 == len)
+                return;
+        last = ADDR_TO_PN(pos + len - 1);
+
+        switch (vn->vn_advice) {
+                case POSIX_FADV_RANDOM:
+                        window = 0;
+                        break;
+                case POSIX_FADV_SEQUENTIAL:
+                        window = READAHEAD_SEQ_PAGES;
+                        break;
+                default:
+                        window = (pos == vn->vn_ranext) ? READAHEAD_PAGES : 0;
+                        break;
+        }
+        /* a reader which has moved starts a new window */
+        if (pos != vn->vn_ranext)
+                vn->vn_raend = 0;
+        vn->vn_ranext = pos + len;
+
+        /* only once we are within half a window of the last request */
+        if (0 != window && vn->vn_raend <= last + window / 2) {
+                first = MAX(vn->vn_raend, last + 1);
+                vn->vn_raend = last + 1 + window;
+                vnode_readahead(vn, first, vn->vn_raend - first);
+        }
+
+        /* but not the page the next read starts in */
+        if (POSIX_FADV_NOREUSE == vn->vn_advice)
+                vnode_evict(vn, ADDR_TO_PN(pos), ADDR_TO_PN(pos + len) - ADDR_TO_PN(pos));
+}
+
+/*
+ * Drop the resident pages first through first + npages - 1 of vn which
+ * can go without being written back: the clean, unpinned ones nobody is
+ * using. The caller must hold a reference on vn. May block.
+ */
+void
+vnode_evict(vnode_t *vn, uint32_t first, uint32_t npages)
+{
+        uint32_t i;
+        pframe_t *pf;
+
+        /* no need to look for more pages than there are */
+        for (i = first; i - first < npages && 0 < vn->vn_mmobj.mmo_nrespages; ++i) {
+                if (NULL == (pf = pframe_get_resident(&vn->vn_mmobj, i)))
+                        continue;
+                if (pframe_is_busy(pf) || pframe_is_dirty(pf) || pframe_is_pinned(pf))
+                        continue;
+                pframe_free(pf);
+        }
+}
+
+/*
+ * Read in the pages of each request in turn, and sleep when there are
+ * none. Stops early when cancelled, so that shutdown need not wait for
+ * the disk.
+ */
+static void *
+readaheadd_run(int arg1, void *arg2)
+{
+        ra_request_t *rr;
+        vnode_t *vn;
+        pframe_t *pf;
+        uint32_t i;
+
+        while (1) {
+                while (!list_empty(&ra_queue) && !curthr->kt_cancelled) {
+                        rr = list_head(&ra_queue, ra_request_t, rr_link);
+                        list_remove(&rr->rr_link);
+                        ra_nqueued--;
+
+                        vn = rr->rr_vnode;
+                        for (i = rr->rr_first; i - rr->rr_first < rr->rr_npages; ++i) {
+                                if (curthr->kt_cancelled || (off_t)PN_TO_ADDR(i) >= vn->vn_len)
+                                        break;
+                                if (NULL != pframe_get_resident(&vn->vn_mmobj, i))
+                                        continue;
+                                if (0 > pframe_get(&vn->vn_mmobj, i, &pf))
+                                        break;
+                        }
+
+                        vput(vn);
+                        slab_obj_free(ra_request_allocator, rr);
+                }
+
+                if (sched_cancellable_sleep_on(&ra_waitq))
+                        kthread_exit((void *)0);
+        }
+        return NULL;
+}
+
+#ifdef __VFS__
+/*
+ * Start readaheadd. Called from idleproc.
+ */
+static __attribute__((unused)) void
+readaheadd_init(void)
+{
+        ra_request_allocator = slab_allocator_create("ra_request",
+                                                     sizeof(ra_request_t));
+        KASSERT(NULL != ra_request_allocator);
+
+        list_init(&ra_queue);
+        sched_queue_init(&ra_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        readaheadd = proc_create("readaheadd");
+        KASSERT(NULL != readaheadd);
+        readaheadd_thr = kthread_create(readaheadd, readaheadd_run, 0, NULL);
+        KASSERT(NULL != readaheadd_thr);
+
+        sched_make_runnable(readaheadd_thr);
+}
+init_func(readaheadd_init);
+init_depends(sched_init);
+#endif
+
+/*
+ * Stop readaheadd, wait for it, and drop whatever it had left to do.
+ * Must be called before vfs_shutdown(), as the requests hold vnodes.
+ */
+void
+readaheadd_shutdown(void)
+{
+        ra_request_t *rr;
+        pid_t pid, child;
+
+        KASSERT(NULL != readaheadd_thr);
+
+        pid = readaheadd->p_pid;
+        kthread_cancel(readaheadd_thr, (void *)0);
+        readaheadd_thr = NULL;
+
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than readaheadd");
+
+        while (!list_empty(&ra_queue)) {
+                rr = list_head(&ra_queue, ra_request_t, rr_link);
+                list_remove(&rr->rr_link);
+                ra_nqueued--;
+                vput(rr->rr_vnode);
+                slab_obj_free(ra_request_allocator, rr);
+        }
+}
@@ -17,11 +17,16 @@
 
 #include "fs/s5fs/s5fs_subr.h"
 #include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_journal.h"
 #include "fs/dirent.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 #include "fs/file.h"
 #include "fs/stat.h"
+#include "fs/statfs.h"
+#include "fs/defrag.h"
+#include "fs/fcntl.h"
+#include "fs/readahead.h"
 
 #include "drivers/dev.h"
 #include "drivers/blockdev.h"
@@ -37,6 +42,7 @@
 
 /* Diagnostic/Utility: */
 static int s5_check_super(s5_super_t *super);
+static int s5_write_super(s5fs_t *s5);
 static int s5fs_check_refcounts(fs_t *fs);
 
 /* fs_t entry points: */
@@ -44,19 +50,31 @@ static void s5fs_read_vnode(vnode_t *vnode);
 static void s5fs_delete_vnode(vnode_t *vnode);
 static int  s5fs_query_vnode(vnode_t *vnode);
 static int  s5fs_umount(fs_t *fs);
+static int  s5fs_sync(fs_t *fs);
+static int  s5fs_statfs(fs_t *fs, struct statfs *buf);
 
 /* vnode_t entry points: */
 static int  s5fs_read(vnode_t *vnode, off_t offset, void *buf, size_t len);
 static int  s5fs_write(vnode_t *vnode, off_t offset, const void *buf, size_t len);
+static int  s5fs_read_direct(vnode_t *vnode, off_t offset, void *buf, size_t len);
+static int  s5fs_write_direct(vnode_t *vnode, off_t offset, const void *buf, size_t len);
 static int  s5fs_mmap(vnode_t *file, vmarea_t *vma, mmobj_t **ret);
+static int  s5fs_fallocate(vnode_t *vnode, int mode, off_t offset, off_t len);
+static int  s5fs_truncate(vnode_t *vnode, off_t len);
+static int  s5fs_seek_hole(vnode_t *vnode, off_t offset, int whence);
+static int  s5fs_defrag(vnode_t *vnode, struct defrag_info *info);
+static int  s5fs_clone_range(vnode_t *in, off_t inoff, vnode_t *out, off_t outoff, size_t len);
 static int  s5fs_create(vnode_t *vdir, const char *name, size_t namelen, vnode_t **result);
 static int  s5fs_mknod(struct vnode *dir, const char *name, size_t namelen, int mode, devid_t devid);
 static int  s5fs_lookup(vnode_t *base, const char *name, size_t namelen, vnode_t **result);
 static int  s5fs_link(vnode_t *src, vnode_t *dir, const char *name, size_t namelen);
 static int  s5fs_unlink(vnode_t *vdir, const char *name, size_t namelen);
+static int  s5fs_rename(vnode_t *olddir, const char *oldname, size_t oldnamelen,
+                        vnode_t *newdir, const char *newname, size_t newnamelen);
 static int  s5fs_mkdir(vnode_t *vdir, const char *name, size_t namelen);
 static int  s5fs_rmdir(vnode_t *parent, const char *name, size_t namelen);
 static int  s5fs_readdir(vnode_t *vnode, int offset, struct dirent *d);
+static int  s5fs_readdirplus(vnode_t *vnode, off_t *offset, direntplus_t *dp, int count);
 static int  s5fs_stat(vnode_t *vnode, struct stat *ss);
 static int  s5fs_release(vnode_t *vnode, file_t *file);
 static int  s5fs_fillpage(vnode_t *vnode, off_t offset, void *pagebuf);
@@ -67,22 +85,33 @@ fs_ops_t s5fs_fsops = {
         s5fs_read_vnode,
         s5fs_delete_vnode,
         s5fs_query_vnode,
-        s5fs_umount
+        s5fs_umount,
+        s5fs_sync,
+        s5fs_statfs
 };
 
 /* vnode operations table for directory files: */
 static vnode_ops_t s5fs_dir_vops = {
         .read = NULL,
         .write = NULL,
+        .read_direct = NULL,
+        .write_direct = NULL,
         .mmap = NULL,
+        .fallocate = NULL,
+        .truncate = NULL,
+        .seek_hole = NULL,
+        .defrag = NULL,
+        .clone_range = NULL,
         .create = s5fs_create,
         .mknod = s5fs_mknod,
         .lookup = s5fs_lookup,
         .link = s5fs_link,
         .unlink = s5fs_unlink,
+        .rename = s5fs_rename,
         .mkdir = s5fs_mkdir,
         .rmdir = s5fs_rmdir,
         .readdir = s5fs_readdir,
+        .readdirplus = s5fs_readdirplus,
         .stat = s5fs_stat,
         .acquire = NULL,
         .release = NULL,
@@ -95,15 +124,24 @@ static vnode_ops_t s5fs_dir_vops = {
 static vnode_ops_t s5fs_file_vops = {
         .read = s5fs_read,
         .write = s5fs_write,
+        .read_direct = s5fs_read_direct,
+        .write_direct = s5fs_write_direct,
         .mmap = s5fs_mmap,
+        .fallocate = s5fs_fallocate,
+        .truncate = s5fs_truncate,
+        .seek_hole = s5fs_seek_hole,
+        .defrag = s5fs_defrag,
+        .clone_range = s5fs_clone_range,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
         .link = NULL,
         .unlink = NULL,
+        .rename = NULL,
         .mkdir = NULL,
         .rmdir = NULL,
         .readdir = NULL,
+        .readdirplus = NULL,
         .stat = s5fs_stat,
         .acquire = NULL,
         .release = NULL,
@@ -128,6 +166,7 @@ s5fs_mount(struct fs *fs)
         blockdev_t *dev;
         s5fs_t *s5;
         pframe_t *vp;
+        int ret;
 
         KASSERT(fs);
 
@@ -163,12 +202,54 @@ s5fs_mount(struct fs *fs)
 
         pframe_pin(vp);
 
-        /*     init s5f_mutex: */
-        kmutex_init(&s5->s5f_mutex);
+        /*     init s5f_inode_mutex and s5f_block_mutex: */
+        kmutex_init(&s5->s5f_inode_mutex);
+        kmutex_init(&s5->s5f_block_mutex);
 
         /*     init s5f_fs: */
         s5->s5f_fs = fs;
 
+        /*     init s5f_dirslots and s5f_dirty_inodes: */
+        list_init(&s5->s5f_dirslots);
+        list_init(&s5->s5f_dirty_inodes);
+
+        /*     init s5f_journal, replaying it if we crashed: */
+        if (0 > (ret = s5_journal_mount(s5))) {
+                pframe_unpin(vp);
+                kfree(s5);
+                return ret;
+        }
+
+        /*     init the free counts, trusting the superblock's copies
+         *     if the disk was unmounted cleanly: */
+        s5->s5f_unclean = (S5_STATE_CLEAN != s5->s5f_super->s5s_state);
+        if (s5->s5f_unclean) {
+                dbg(DBG_PRINT, "s5fs: disk was not unmounted cleanly, "
+                    "counting free blocks and inodes\n");
+                s5->s5f_nfree_blocks = s5_count_free_blocks(s5);
+                s5->s5f_nfree_inodes = s5_count_free_inodes(s5);
+        } else {
+                s5->s5f_nfree_blocks = s5->s5f_super->s5s_nfree_blocks;
+                s5->s5f_nfree_inodes = s5->s5f_super->s5s_nfree_inodes;
+        }
+        s5->s5f_nreserved = 0;
+        list_init(&s5->s5f_delalloc);
+
+        /*     init the deferred reclamation of unlinked inodes: */
+        s5->s5f_npending = s5_count_pending_blocks(s5);
+        list_link_init(&s5->s5f_reclaim_link);
+        s5->s5f_reclaiming = 0;
+        sched_queue_init(&s5->s5f_reclaim_waitq);
+
+        /*     the counts go stale from here until s5fs_umount(): */
+        s5->s5f_super->s5s_state = S5_STATE_DIRTY;
+        if (0 > (ret = s5_write_super(s5))) {
+                s5_journal_umount(s5);
+                pframe_unpin(vp);
+                kfree(s5);
+                return ret;
+        }
+
 
         /* Init the members of fs that we (the fs-implementation) are
          * responsible for initializing: */
@@ -176,6 +257,10 @@ s5fs_mount(struct fs *fs)
         fs->fs_op = &s5fs_fsops;
         fs->fs_root = vget(fs, s5->s5f_super->s5s_root_inode);
 
+        /* finish what a crash interrupted */
+        if ((uint32_t) -1 != s5->s5f_super->s5s_orphan_inode)
+                s5_reclaim_start(s5);
+
         return 0;
 }
 
@@ -193,15 +278,15 @@ s5fs_mount(struct fs *fs)
 /*
  * See the comment in vfs.h for what is expected of this function.
  *
- * When this function returns, the inode link count should be incremented.
- * Note that most UNIX filesystems don't do this, they have a separate
- * flag to indicate that the VFS is using a file. However, this is
- * simpler to implement.
+ * The inode link count only counts directory entries: the VFS's use of
+ * the file is its vnode's refcount, as in most UNIX filesystems, so
+ * getting a vnode doesn't change the inode and doesn't have to log it.
  *
  * To get the inode you need to use pframe_get then use the pf_addr
  * and the S5_INODE_OFFSET(vnode->vn_vno) to get the inode
  *
- * Don't forget to update linkcounts and pin the page.
+ * The vnode gets an in-core copy of the inode (an s5_icore_t), so the
+ * inode table page is not pinned for as long as the vnode lives.
  *
  * Note that the indirect_block field in the inode is the devid in the case
  * of a char or block device.
@@ -213,40 +298,104 @@ s5fs_mount(struct fs *fs)
 static void
 s5fs_read_vnode(vnode_t *vnode)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_read_vnode");
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_icore_t *ic;
+        s5_inode_t *inode;
+        pframe_t *pf;
+
+        ic = (s5_icore_t *)kmalloc(sizeof(s5_icore_t));
+        KASSERT(ic && "out of memory for in-core inodes");
+
+        pframe_get(S5FS_TO_VMOBJ(fs), S5_INODE_BLOCK(vnode->vn_vno), &pf);
+        KASSERT(pf && "because never fails for block_device vm_objects");
+
+        inode = (s5_inode_t *)pf->pf_addr + S5_INODE_OFFSET(vnode->vn_vno);
+        KASSERT(inode->s5_number == vnode->vn_vno);
+        memcpy(&ic->ic_inode, inode, sizeof(s5_inode_t));
+        ic->ic_dirty = 0;
+        list_link_init(&ic->ic_link);
+        vnode->vn_i = ic;
+        inode = &ic->ic_inode;
+
+        vnode->vn_len = inode->s5_size;
+        switch (inode->s5_type) {
+                case S5_TYPE_DATA:
+                        vnode->vn_mode = S_IFREG;
+                        vnode->vn_ops = &s5fs_file_vops;
+                        break;
+                case S5_TYPE_DIR:
+                        vnode->vn_mode = S_IFDIR;
+                        vnode->vn_ops = &s5fs_dir_vops;
+                        break;
+                case S5_TYPE_CHR:
+                        vnode->vn_mode = S_IFCHR;
+                        vnode->vn_ops = NULL;
+                        vnode->vn_devid = (devid_t)inode->s5_indirect_block;
+                        break;
+                case S5_TYPE_BLK:
+                        vnode->vn_mode = S_IFBLK;
+                        vnode->vn_ops = NULL;
+                        vnode->vn_devid = (devid_t)inode->s5_indirect_block;
+                        break;
+                default:
+                        panic("inode %d has unknown/invalid type %d!!\n",
+                              (int)vnode->vn_vno, (int)inode->s5_type);
+        }
 }
 
 /*
  * See the comment in vfs.h for what is expected of this function.
  *
- * When this function returns, the inode refcount should be decremented.
- *
  * You probably want to use s5_free_inode() if there are no more links to
- * the inode, and dont forget to unpin the page
+ * the inode. Otherwise the in-core inode is written back, if it changed,
+ * and freed.
  */
 static void
 s5fs_delete_vnode(vnode_t *vnode)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_delete_vnode");
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_icore_t *ic = (s5_icore_t *)vnode->vn_i;
+        s5_inode_t *inode = &ic->ic_inode;
+        s5_jhandle_t h;
+
+        if (S_ISDIR(vnode->vn_mode))
+                s5_dirslots_release(vnode);
+
+        /* an inode which is still linked and hasn't changed is left be */
+        if (0 == inode->s5_linkcount || ic->ic_dirty) {
+                s5_journal_begin(fs, &h, S5_JCREDITS_INODE);
+                if (0 == inode->s5_linkcount) {
+                        s5_free_inode(vnode);
+                } else {
+                        /* this may be nested in another update, so don't
+                         * wait for s5_journal_end() to write it back */
+                        s5_sync_inode(vnode);
+                }
+                s5_journal_end(fs, &h);
+        }
+
+        KASSERT(!ic->ic_dirty);
+        kfree(ic);
+        vnode->vn_i = NULL;
 }
 
 /*
  * See the comment in vfs.h for what is expected of this function.
  *
- * The vnode still exists on disk if it has a linkcount greater than 1.
- * (Remember, VFS takes a reference on the inode as long as it uses it.)
+ * The vnode still exists on disk if it has any links. (The VFS's
+ * reference is not one of them; see s5fs_read_vnode().)
  *
  */
 static int
 s5fs_query_vnode(vnode_t *vnode)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_query_vnode");
-        return 0;
+        return VNODE_TO_S5INODE(vnode)->s5_linkcount > 0;
 }
 
 /*
- * s5fs_check_refcounts()
+ * s5fs_check_refcounts(), if the disk was not unmounted cleanly last time
  * vput root vnode
+ * write everything home, then mark the superblock clean
  */
 static int
 s5fs_umount(fs_t *fs)
@@ -256,7 +405,7 @@ s5fs_umount(fs_t *fs)
         pframe_t *sbp;
         int ret;
 
-        if (s5fs_check_refcounts(fs)) {
+        if (s5->s5f_unclean && s5fs_check_refcounts(fs)) {
                 dbg(DBG_PRINT, "s5fs_umount: WARNING: linkcount corruption "
                     "discovered in fs on block device with major %d "
                     "and minor %d!!\n", MAJOR(bd->bd_id), MINOR(bd->bd_id));
@@ -278,6 +427,19 @@ s5fs_umount(fs_t *fs)
 
         vput(fs->fs_root);
 
+        /* nothing is orphaned after this, the last files having been
+         * closed */
+        s5_reclaim_stop(s5);
+
+        /* flushing allocated blocks for every delayed page */
+        KASSERT(0 == s5->s5f_nreserved);
+        KASSERT(list_empty(&s5->s5f_delalloc));
+        KASSERT(list_empty(&s5->s5f_dirty_inodes));
+
+        s5_dirslots_release_all(fs);
+
+        s5_journal_umount(s5);
+
         if (0 > (ret = pframe_get(S5FS_TO_VMOBJ(s5), S5_SUPER_BLOCK, &sbp))) {
                 panic("s5fs_umount: failed to pframe_get super block. "
                       "This should never happen (the page should already "
@@ -288,6 +450,15 @@ s5fs_umount(fs_t *fs)
 
         KASSERT(sbp);
 
+        /* the counts may only be trusted once everything else is home */
+        blockdev_flush_all(bd);
+        s5->s5f_super->s5s_nfree_blocks = s5->s5f_nfree_blocks;
+        s5->s5f_super->s5s_nfree_inodes = s5->s5f_nfree_inodes;
+        s5->s5f_super->s5s_state = S5_STATE_CLEAN;
+        if (0 > s5_write_super(s5))
+                dbg(DBG_PRINT, "s5fs_umount: failed to mark the disk clean, "
+                    "it will be checked at the next mount\n");
+
         pframe_unpin(sbp);
 
         kfree(s5);
@@ -297,6 +468,44 @@ s5fs_umount(fs_t *fs)
         return 0;
 }
 
+/*
+ * Commit the running journal transaction, so that everything done so far
+ * survives a crash.
+ */
+static int
+s5fs_sync(fs_t *fs)
+{
+        return s5_journal_commit(FS_TO_S5FS(fs));
+}
+
+/*
+ * Report the disk's size and the free counts kept by the allocators.
+ * Only blocks which could be allocated right now are free: not those
+ * promised to delayed allocations, nor those of unlinked files which
+ * s5_reclaimd has yet to put on the free list, which are reported as
+ * pending instead. Only the data blocks
+ * count, not the superblock, inode table, journal or reference counts.
+ */
+static int
+s5fs_statfs(fs_t *fs, struct statfs *buf)
+{
+        s5fs_t *s5 = FS_TO_S5FS(fs);
+        s5_super_t *s = s5->s5f_super;
+        uint32_t iblocks = (s->s5s_num_inodes - 1) / S5_INODES_PER_BLOCK + 1;
+
+        buf->f_bsize = S5_BLOCK_SIZE;
+        buf->f_blocks = s->s5s_num_blocks - (1 + iblocks + s->s5s_journal_nblocks
+                                             + s->s5s_refcnt_nblocks);
+        /* nothing here blocks, so the counts are read all at once */
+        buf->f_bfree = s5->s5f_nfree_blocks - s5->s5f_nreserved;
+        buf->f_bpending = s5->s5f_npending;
+        buf->f_files = s->s5s_num_inodes;
+        buf->f_ffree = s5->s5f_nfree_inodes;
+        buf->f_namelen = S5_NAME_LEN - 1;
+
+        return 0;
+}
+
 
 
 
@@ -325,20 +534,108 @@ s5fs_umount(fs_t *fs)
  */
 
 
-/* Simply call s5_read_file. */
+/* Call s5_read_file, then tell readahead what was read. */
 static int
 s5fs_read(vnode_t *vnode, off_t offset, void *buf, size_t len)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_read");
-        return -1;
+        int ret;
+
+        kmutex_lock(&vnode->vn_mutex);
+        ret = s5_read_file(vnode, offset, buf, len);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        if (0 < ret)
+                vnode_read_done(vnode, offset, ret);
+        return ret;
 }
 
-/* Simply call s5_write_file. */
+/*
+ * Pages written per transaction by s5fs_write(). Each one may reserve a
+ * block, or give up a shared one; see S5_WRITE_CREDITS.
+ */
+#define S5_WRITE_STEP           (4 * S5_BLOCK_SIZE)
+/* the pages of a step, the page zeroed past the old end, and a new
+ * indirect block */
+#define S5_WRITE_CREDITS        (S5_JCREDITS_INODE + S5_JCREDITS_ALLOC(1)  \
+                                 + S5_JCREDITS_FREE(S5_WRITE_STEP / S5_BLOCK_SIZE + 1))
+
+/*
+ * Call s5_write_file, S5_WRITE_STEP bytes at a time so that a large
+ * write doesn't have to fit in one transaction.
+ */
 static int
 s5fs_write(vnode_t *vnode, off_t offset, const void *buf, size_t len)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_write");
-        return -1;
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_jhandle_t h;
+        size_t written = 0, n;
+        int ret;
+
+        kmutex_lock(&vnode->vn_mutex);
+        do {
+                n = MIN(len - written,
+                        (size_t)(S5_WRITE_STEP - (offset + written) % S5_WRITE_STEP));
+                s5_journal_begin(fs, &h, S5_WRITE_CREDITS);
+                ret = s5_write_file(vnode, offset + written,
+                                    (const char *)buf + written, n);
+                s5_journal_end(fs, &h);
+                if (0 < ret)
+                        written += ret;
+        } while ((size_t)ret == n && written < len);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        return (0 < written) ? (int)written : ret;
+}
+
+/* Simply call s5_read_direct. */
+static int
+s5fs_read_direct(vnode_t *vnode, off_t offset, void *buf, size_t len)
+{
+        int ret;
+
+        kmutex_lock(&vnode->vn_mutex);
+        ret = s5_read_direct(vnode, offset, buf, len);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        return ret;
+}
+
+/*
+ * Blocks written per transaction by s5fs_write_direct(). Each one may
+ * be allocated, with the indirect block logged for it, and may replace
+ * a shared block.
+ */
+#define S5_DIRECT_STEP          (4 * S5_BLOCK_SIZE)
+/* the blocks of a step, plus a new indirect block and the tail of the
+ * old end zeroed through the cache */
+#define S5_DIRECT_CREDITS       (S5_JCREDITS_INODE + S5_JCREDITS_ALLOC(1)  \
+                                 + S5_JCREDITS_FREE(1)                  \
+                                 + (S5_DIRECT_STEP / S5_BLOCK_SIZE)     \
+                                   * (S5_JCREDITS_ALLOC(1) + 1 + S5_JCREDITS_FREE(1)))
+
+/* Call s5_write_direct, S5_DIRECT_STEP bytes at a time, like s5fs_write(). */
+static int
+s5fs_write_direct(vnode_t *vnode, off_t offset, const void *buf, size_t len)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_jhandle_t h;
+        size_t written = 0, n;
+        int ret;
+
+        kmutex_lock(&vnode->vn_mutex);
+        do {
+                n = MIN(len - written,
+                        (size_t)(S5_DIRECT_STEP - (offset + written) % S5_DIRECT_STEP));
+                s5_journal_begin(fs, &h, S5_DIRECT_CREDITS);
+                ret = s5_write_direct(vnode, offset + written,
+                                      (const char *)buf + written, n);
+                s5_journal_end(fs, &h);
+                if (0 < ret)
+                        written += ret;
+        } while ((size_t)ret == n && written < len);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        return (0 < written) ? (int)written : ret;
 }
 
 /* This function is deceptivly simple, just return the vnode's
@@ -361,11 +658,137 @@ s5fs_mmap(vnode_t *file, vmarea_t *vma, mmobj_t **ret)
         return 0;
 }
 
+/*
+ * Bytes of the file given blocks per transaction by s5fs_fallocate():
+ * allocating them, taking a new indirect block, and giving back those
+ * which turn out not to be needed.
+ */
+#define S5_FALLOC_STEP          (8 * S5_BLOCK_SIZE)
+#define S5_FALLOC_CREDITS       (S5_JCREDITS_INODE + S5_JCREDITS_ALLOC(1)  \
+                                 + S5_JCREDITS_ALLOC(S5_FALLOC_STEP / S5_BLOCK_SIZE) \
+                                 + S5_JCREDITS_FREE(S5_FALLOC_STEP / S5_BLOCK_SIZE))
+
+/*
+ * See the comment in vnode.h for what is expected of this function.
+ *
+ * s5_alloc_range() gives the sparse parts of the range zeroed blocks,
+ * allocated in batches so that they end up contiguous on disk. It is
+ * called S5_FALLOC_STEP bytes at a time, each a transaction of its own.
+ */
+static int
+s5fs_fallocate(vnode_t *vnode, int mode, off_t offset, off_t len)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_jhandle_t h;
+        off_t pos, n;
+        int ret = 0;
+
+        KASSERT(S_ISREG(vnode->vn_mode));
+
+        kmutex_lock(&vnode->vn_mutex);
+        for (pos = offset; 0 == ret && pos < offset + len; pos += n) {
+                n = MIN(offset + len - pos, S5_FALLOC_STEP - pos % S5_FALLOC_STEP);
+                s5_journal_begin(fs, &h, S5_FALLOC_CREDITS);
+                ret = s5_alloc_range(vnode, pos, n);
+                s5_journal_end(fs, &h);
+        }
+        if (0 == ret && !(mode & FALLOC_FL_KEEP_SIZE)
+            && offset + len > vnode->vn_len)
+                ret = s5_truncate_file(vnode, offset + len);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        return ret;
+}
+
+/*
+ * See the comment in vnode.h for what is expected of this function.
+ *
+ * Simply call s5_truncate_file, which opens its own handles.
+ */
+static int
+s5fs_truncate(vnode_t *vnode, off_t len)
+{
+        int ret;
+
+        KASSERT(S_ISREG(vnode->vn_mode));
+
+        kmutex_lock(&vnode->vn_mutex);
+        ret = s5_truncate_file(vnode, len);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        return ret;
+}
+
+/*
+ * See the comment in vnode.h for what is expected of this function.
+ *
+ * Simply call s5_seek_hole.
+ */
+static int
+s5fs_seek_hole(vnode_t *vnode, off_t offset, int whence)
+{
+        int ret;
+
+        kmutex_lock(&vnode->vn_mutex);
+        ret = s5_seek_hole(vnode, offset, whence);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        return ret;
+}
+
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
- * When this function returns, the inode refcount of the file should be 2
- * and the vnode refcount should be 1.
+ * Simply call s5_defrag_file.
+ */
+static int
+s5fs_defrag(vnode_t *vnode, struct defrag_info *info)
+{
+        int ret;
+
+        KASSERT(S_ISREG(vnode->vn_mode));
+
+        kmutex_lock(&vnode->vn_mutex);
+        ret = s5_defrag_file(vnode, info);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        return ret;
+}
+
+/*
+ * See the comment in vnode.h for what is expected of this function.
+ *
+ * Both files are locked, the one with the lower inode number first as
+ * in s5fs_rename(), and s5_clone_range() does the rest.
+ */
+static int
+s5fs_clone_range(vnode_t *in, off_t inoff, vnode_t *out, off_t outoff, size_t len)
+{
+        vnode_t *first = in, *second = out;
+        int ret;
+
+        KASSERT(in != out);
+        KASSERT(S_ISREG(in->vn_mode) && S_ISREG(out->vn_mode));
+
+        if (first->vn_vno > second->vn_vno) {
+                first = out;
+                second = in;
+        }
+        kmutex_lock(&first->vn_mutex);
+        kmutex_lock(&second->vn_mutex);
+        ret = s5_clone_range(in, inoff, out, outoff, len);
+        kmutex_unlock(&second->vn_mutex);
+        kmutex_unlock(&first->vn_mutex);
+
+        return ret;
+}
+
+/*
+ * See the comment in vnode.h for what is expected of this function.
+ *
+ * When this function returns, the inode link count of the file should be
+ * 1, for its entry in dir, and the vnode refcount should be 1. The
+ * vnode's reference is not a link (see s5fs_read_vnode()).
  *
  * You probably want to use s5_alloc_inode(), s5_link(), and vget().
  */
@@ -409,7 +832,7 @@ s5fs_lookup(vnode_t *base, const char *name, size_t namelen, vnode_t **result)
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
- * When this function returns, the inode refcount of the linked file
+ * When this function returns, the inode link count of the linked file
  * should be incremented.
  *
  * You probably want to use s5_link().
@@ -424,8 +847,9 @@ s5fs_link(vnode_t *src, vnode_t *dir, const char *name, size_t namelen)
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
- * When this function returns, the inode refcount of the unlinked file
- * should be decremented.
+ * When this function returns, the inode link count of the unlinked file
+ * should be decremented. If that was its last link the inode is freed
+ * once its last vnode reference goes away (see s5fs_delete_vnode()).
  *
  * You probably want to use s5_remove_dirent().
  */
@@ -436,6 +860,36 @@ s5fs_unlink(vnode_t *dir, const char *name, size_t namelen)
         return -1;
 }
 
+/*
+ * See the comment in vnode.h for what is expected of this function.
+ *
+ * Both directories are locked for the move, the one with the lower
+ * inode number first so that two renames in opposite directions can't
+ * deadlock.
+ */
+static int
+s5fs_rename(vnode_t *olddir, const char *oldname, size_t oldnamelen,
+            vnode_t *newdir, const char *newname, size_t newnamelen)
+{
+        vnode_t *first = olddir, *second = newdir;
+        int ret;
+
+        if (first->vn_vno > second->vn_vno) {
+                first = newdir;
+                second = olddir;
+        }
+        kmutex_lock(&first->vn_mutex);
+        if (second != first)
+                kmutex_lock(&second->vn_mutex);
+
+        ret = s5_rename(olddir, oldname, oldnamelen, newdir, newname, newnamelen);
+
+        if (second != first)
+                kmutex_unlock(&second->vn_mutex);
+        kmutex_unlock(&first->vn_mutex);
+        return ret;
+}
+
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
@@ -445,7 +899,8 @@ s5fs_unlink(vnode_t *dir, const char *name, size_t namelen)
  *
  * When this function returns, the inode linkcount on the parent should
  * be incremented, and the inode linkcount on the new directory should be
- * 1 (one from the parent directory).
+ * 1 (one from the parent directory). The vnode references taken while
+ * making it are not links (see s5fs_read_vnode()).
  *
  * It might make more sense for the inode linkcount on the new
  * directory to be 3 (since "." refers to it as well as its entry in the
@@ -469,7 +924,7 @@ s5fs_mkdir(vnode_t *dir, const char *name, size_t namelen)
  * When this function returns, the inode linkcount on the parent should be
  * decremented (since ".." in the removed directory no longer references
  * it). Remember that the directory must be empty (except for "." and
- * "..").
+ * ".."). Unused slots (entries with an empty name) don't count.
  *
  * You probably want to use s5_find_dirent() and s5_remove_dirent().
  */
@@ -484,19 +939,197 @@ s5fs_rmdir(vnode_t *parent, const char *name, size_t namelen)
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
- * Here you need to use s5_read_file() to read a s5_dirent_t from a directory
- * and copy that data into the given dirent. The value of d_off is dependent on
- * your implementation and may or may not b e necessary.  Finally, return the
- * number of bytes read.
+ * Reads s5_dirent_t's from the directory with s5_read_file(), skipping
+ * over unused slots (ones with an empty name, left behind by
+ * s5_remove_dirent()), and copies the first live one into the given
+ * dirent. Returns the number of bytes of the directory consumed, so
+ * that offset + return value is where the next call should start.
  */
 static int
 s5fs_readdir(vnode_t *vnode, off_t offset, struct dirent *d)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_readdir");
-        return -1;
+        s5_dirent_t s5d;
+        int ret, nbytes = 0;
+
+        KASSERT(S_ISDIR(vnode->vn_mode));
+
+        kmutex_lock(&vnode->vn_mutex);
+        do {
+                if (0 >= (ret = s5_read_file(vnode, offset + nbytes, (char *)&s5d,
+                                             sizeof(s5_dirent_t)))) {
+                        kmutex_unlock(&vnode->vn_mutex);
+                        return ret;
+                }
+                KASSERT(sizeof(s5_dirent_t) == ret);
+                nbytes += ret;
+        } while ('\0' == s5d.s5d_name[0]);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        d->d_ino = s5d.s5d_inode;
+        d->d_off = offset + nbytes;
+        strncpy(d->d_name, s5d.s5d_name, S5_NAME_LEN);
+        d->d_name[S5_NAME_LEN] = '\0';
+
+        return nbytes;
 }
 
 
+/*
+ * Fill in everything but st_blocks from an inode, for s5fs_stat() and
+ * for the inodes s5fs_readdirplus() finds without a vnode. Counting the
+ * blocks of a large file reads its indirect block and may block, so the
+ * callers do that themselves.
+ */
+static void
+s5_stat_inode(s5_inode_t *inode, struct stat *ss)
+{
+        memset(ss, 0, sizeof(struct stat));
+        ss->st_ino = inode->s5_number;
+        ss->st_nlink = inode->s5_linkcount;
+        ss->st_size = inode->s5_size;
+        ss->st_blksize = S5_BLOCK_SIZE;
+
+        switch (inode->s5_type) {
+                case S5_TYPE_CHR:
+                case S5_TYPE_BLK:
+                        ss->st_mode = (S5_TYPE_CHR == inode->s5_type) ? S_IFCHR : S_IFBLK;
+                        ss->st_rdev = inode->s5_indirect_block;
+                        break;
+                case S5_TYPE_DIR:
+                        ss->st_mode = S_IFDIR;
+                        break;
+                default:
+                        ss->st_mode = S_IFREG;
+                        break;
+        }
+}
+
+/*
+ * See the comment in vnode.h for what is expected of this function.
+ *
+ * The entries are read like s5fs_readdir() reads them. Then, instead of
+ * a vget() per entry, their inodes are visited in inode block order, so
+ * that each inode block is read (and pinned) once for all of the
+ * entries in it. A file which is in use is stat()ed through its vnode,
+ * since its in-core inode may be newer than its inode block.
+ *
+ * The directory is unlocked while the inodes are visited, so an entry
+ * may be removed, and its inode freed, after it was read. Entries whose
+ * inode has no links left by then are dropped, as if they had been
+ * removed first.
+ */
+static int
+s5fs_readdirplus(vnode_t *vnode, off_t *offset, direntplus_t *dp, int count)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_dirent_t s5d;
+        s5_inode_t inode;
+        pframe_t *pf = NULL;
+        vnode_t *vn;
+        off_t off = *offset;
+        int *order;
+        int i, j, n, ret, err = 0;
+        ino_t ino;
+
+        KASSERT(S_ISDIR(vnode->vn_mode));
+
+        if (0 >= count)
+                return 0;
+        if (NULL == (order = (int *)kmalloc(count * sizeof(int))))
+                return -ENOMEM;
+
+        do {
+                kmutex_lock(&vnode->vn_mutex);
+                for (n = 0; n < count; ) {
+                        if (0 >= (ret = s5_read_file(vnode, off, (char *)&s5d,
+                                                     sizeof(s5_dirent_t))))
+                                break;
+                        KASSERT(sizeof(s5_dirent_t) == ret);
+                        off += ret;
+                        if ('\0' == s5d.s5d_name[0])
+                                continue;
+
+                        dp[n].dp_dirent.d_ino = s5d.s5d_inode;
+                        dp[n].dp_dirent.d_off = off;
+                        strncpy(dp[n].dp_dirent.d_name, s5d.s5d_name, S5_NAME_LEN);
+                        dp[n].dp_dirent.d_name[S5_NAME_LEN] = '\0';
+
+                        /* insertion sort by inode block; directories are short */
+                        for (i = n; i > 0 && S5_INODE_BLOCK(dp[order[i - 1]].dp_dirent.d_ino)
+                             > S5_INODE_BLOCK(s5d.s5d_inode); --i)
+                                order[i] = order[i - 1];
+                        order[i] = n++;
+                }
+                kmutex_unlock(&vnode->vn_mutex);
+
+                if (0 > ret && 0 == n) {
+                        err = ret;
+                        break;
+                }
+
+                for (i = 0; i < n; ++i) {
+                        j = order[i];
+                        ino = dp[j].dp_dirent.d_ino;
+
+                        if (NULL == pf || pf->pf_pagenum != S5_INODE_BLOCK(ino)) {
+                                if (NULL != pf)
+                                        pframe_unpin(pf);
+                                pframe_get(S5FS_TO_VMOBJ(fs), S5_INODE_BLOCK(ino), &pf);
+                                KASSERT(pf && "because never fails for block_device vm_objects");
+                                pframe_pin(pf);
+                        }
+
+                        if (NULL != (vn = vget_resident(vnode->vn_fs, ino))) {
+                                KASSERT(vn->vn_ops && vn->vn_ops->stat);
+                                if (vn->vn_fs == vnode->vn_fs
+                                    && 0 == VNODE_TO_S5INODE(vn)->s5_linkcount)
+                                        dp[j].dp_dirent.d_name[0] = '\0';
+                                else
+                                        err = vn->vn_ops->stat(vn, &dp[j].dp_stat);
+                                vput(vn);
+                                if (0 > err)
+                                        break;
+                        } else {
+                                memcpy(&inode, (s5_inode_t *)pf->pf_addr + S5_INODE_OFFSET(ino),
+                                       sizeof(s5_inode_t));
+                                KASSERT(inode.s5_number == ino);
+                                if (S5_TYPE_FREE == inode.s5_type || 0 == inode.s5_linkcount)
+                                        dp[j].dp_dirent.d_name[0] = '\0';
+                                else {
+                                        s5_stat_inode(&inode, &dp[j].dp_stat);
+                                        if (!(S5_INODE_INLINE & inode.s5_flags)
+                                            && (S5_TYPE_DATA == inode.s5_type
+                                                || S5_TYPE_DIR == inode.s5_type))
+                                                dp[j].dp_stat.st_blocks =
+                                                        s5_inode_nblocks(fs, &inode);
+                                }
+                        }
+                }
+                if (NULL != pf)
+                        pframe_unpin(pf);
+                pf = NULL;
+
+                /* the entries were stat()ed out of order, so if one
+                 * fails none of them are returned */
+                if (i < n)
+                        break;
+
+                for (i = j = 0; i < n; ++i)
+                        if ('\0' != dp[i].dp_dirent.d_name[0] && j++ != i)
+                                dp[j - 1] = dp[i];
+                n = j;
+                *offset = off;
+
+                /* if every entry was dropped, read on rather than
+                 * returning 0, which would mean the end of the directory */
+        } while (0 == n && 0 < ret);
+
+        kfree(order);
+        if (0 > err)
+                return err;
+        return (0 == n && 0 > ret) ? ret : n;
+}
+
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
@@ -509,22 +1142,50 @@ s5fs_readdir(vnode_t *vnode, off_t offset, struct dirent *d)
 static int
 s5fs_stat(vnode_t *vnode, struct stat *ss)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_stat");
-        return -1;
+        kmutex_lock(&vnode->vn_mutex);
+        s5_stat_inode(VNODE_TO_S5INODE(vnode), ss);
+        ss->st_blocks = s5_inode_blocks(vnode);
+        kmutex_unlock(&vnode->vn_mutex);
+
+        return 0;
 }
 
 
 /*
  * See the comment in vnode.h for what is expected of this function.
  *
- * You'll probably want to use s5_seek_to_block and the device's
- * read_block function.
+ * Pages without a disk block (sparse ones) are filled with zeros. The
+ * data of an inline file is copied out of its inode.
  */
 static int
 s5fs_fillpage(vnode_t *vnode, off_t offset, void *pagebuf)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_fillpage");
-        return -1;
+        blockdev_t *bdev = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        int blockno;
+
+        if (S5_INODE_INLINE & inode->s5_flags) {
+                KASSERT(vnode->vn_len <= S5_INLINE_SIZE);
+                memset(pagebuf, 0, S5_BLOCK_SIZE);
+                if (0 == offset)
+                        memcpy(pagebuf, inode->s5_inline, vnode->vn_len);
+                return 0;
+        }
+
+        if (0 > (blockno = s5_seek_to_block(vnode, offset, 0)))
+                return blockno;
+
+        if (0 == blockno) {
+                memset(pagebuf, 0, S5_BLOCK_SIZE);
+                return 0;
+        }
+
+        /* a directory block may not have made it home from the journal */
+        if (S_ISDIR(vnode->vn_mode)
+            && s5_journal_read(VNODE_TO_S5FS(vnode), blockno, pagebuf))
+                return 0;
+
+        return bdev->bd_ops->read_block(bdev, pagebuf, blockno, 1);
 }
 
 
@@ -532,31 +1193,102 @@ s5fs_fillpage(vnode_t *vnode, off_t offset, void *pagebuf)
  * if this offset is NOT within a sparse region of the file
  *     return 0;
  *
- * attempt to make the region containing this offset no longer
- * sparse
- *     - attempt to allocate a free block
- *     - if no free blocks available, return -ENOSPC
- *     - associate this block with the inode; alter the inode as
- *       appropriate
- *         - dirty the page containing this inode
+ * otherwise reserve a disk block for the page; if no unreserved blocks
+ * are available, return -ENOSPC
+ *
+ * Allocation is delayed until the page is cleaned (see
+ * s5fs_cleanpage()), so that blocks get handed out in file order for
+ * whole runs of pages, and files which are deleted before they are ever
+ * written back never allocate anything. Reserving here means the write
+ * still fails right away when the disk is full.
  *
- * Much of this can be done with s5_seek_to_block()
+ * A page whose block is shared with other files is copied on write: it
+ * gets a reservation the same way, and gives up the shared block (see
+ * s5_unshare_block()).
+ *
+ * Both change the block map, so they need vn_mutex, like truncating or
+ * defragmenting the file. s5_write_file() and vlookuppage() dirty pages
+ * with it held; only a mapped page cleaned again before the fault
+ * handler dirtied it gets here without, and takes it.
  */
 static int
 s5fs_dirtypage(vnode_t *vnode, off_t offset)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_dirtypage");
-        return -1;
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_jhandle_t h;
+        int locked = 0, ret;
+
+        if (!kmutex_owns_mutex(&vnode->vn_mutex)) {
+                kmutex_lock(&vnode->vn_mutex);
+                locked = 1;
+        }
+
+        /* an inline file's data goes back into its inode */
+        ret = 0;
+        if (S5_INODE_INLINE & VNODE_TO_S5INODE(vnode)->s5_flags)
+                goto out;
+
+        if (0 > (ret = s5_seek_to_block(vnode, offset, 0)))
+                goto out;
+        if (0 == ret) {
+                /* this may need an indirect block */
+                s5_journal_begin(fs, &h, S5_JCREDITS_INODE + S5_JCREDITS_ALLOC(1));
+                ret = s5_reserve_block(vnode, offset);
+                s5_journal_end(fs, &h);
+                goto out;
+        }
+
+        if (0 < (ret = s5_unshare_block(vnode, offset, 0)))
+                ret = 0;
+
+out:
+        if (locked)
+                kmutex_unlock(&vnode->vn_mutex);
+        return ret;
 }
 
 /*
  * Like fillpage, but for writing.
+ *
+ * A page which was dirtied while sparse gets its disk block here, along
+ * with any other dirty pages next to it waiting for one.
+ *
+ * Directory blocks are metadata, so they go to the journal rather than
+ * straight home. An inline file's page is copied back into its inode.
  */
 static int
 s5fs_cleanpage(vnode_t *vnode, off_t offset, void *pagebuf)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5fs_cleanpage");
-        return -1;
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        blockdev_t *bdev = fs->s5f_bdev;
+        s5_jhandle_t h;
+        int blockno;
+
+        s5_journal_begin_clean(fs, &h, S5_JCREDITS_CLEAN);
+        if (S5_INODE_INLINE & inode->s5_flags) {
+                /* anything past the end of the file is dropped */
+                if (0 == offset) {
+                        KASSERT(vnode->vn_len <= S5_INLINE_SIZE);
+                        memcpy(inode->s5_inline, pagebuf, vnode->vn_len);
+                        memset(inode->s5_inline + vnode->vn_len, 0,
+                               S5_INLINE_SIZE - vnode->vn_len);
+                        s5_dirty_inode(fs, inode);
+                }
+                s5_journal_end(fs, &h);
+                return 0;
+        }
+        if (0 <= (blockno = s5_seek_to_block(vnode, offset, 0))
+            && 0 == blockno)
+                blockno = s5_alloc_delayed(vnode, offset);
+        if (0 <= blockno && S_ISDIR(vnode->vn_mode)
+            && s5_journal_log(fs, blockno, pagebuf))
+                blockno = 0;
+        s5_journal_end(fs, &h);
+
+        if (0 >= blockno)
+                return blockno;
+        return bdev->bd_ops->write_block(bdev, pagebuf, blockno, 1);
 }
 
 /* Diagnostic/Utility: */
@@ -579,9 +1311,27 @@ s5_check_super(s5_super_t *super)
                     super->s5s_version, S5_CURRENT_VERSION);
                 return -1;
         }
+        if (0 != super->s5s_refcnt_nblocks
+            && super->s5s_refcnt_nblocks * S5_REFCNTS_PER_BLOCK < super->s5s_num_blocks) {
+                dbg(DBG_PRINT, "Filesystem's reference count table is too "
+                    "small for its %d blocks.\n", super->s5s_num_blocks);
+                return -1;
+        }
         return 0;
 }
 
+/*
+ * Write the superblock straight to disk. It stays pinned, so it can't go
+ * through pframe_clean().
+ */
+static int
+s5_write_super(s5fs_t *s5)
+{
+        return s5->s5f_bdev->bd_ops->write_block(s5->s5f_bdev,
+                                                 (char *)s5->s5f_super,
+                                                 S5_SUPER_BLOCK, 1);
+}
+
 static void
 calculate_refcounts(int *counts, vnode_t *vnode)
 {
@@ -652,9 +1402,9 @@ s5fs_check_refcounts(fs_t *fs)
                 vn = vget(fs, i);
                 KASSERT(vn);
 
-                if (refcounts[i] != VNODE_TO_S5INODE(vn)->s5_linkcount - 1) {
+                if (refcounts[i] != VNODE_TO_S5INODE(vn)->s5_linkcount) {
                         dbg(DBG_PRINT, "   Inode %d, expecting %d, found %d\n", i,
-                            refcounts[i], VNODE_TO_S5INODE(vn)->s5_linkcount - 1);
+                            refcounts[i], VNODE_TO_S5INODE(vn)->s5_linkcount);
                         ret = -1;
                 }
                 vput(vn);
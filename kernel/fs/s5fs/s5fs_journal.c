@@ -0,0 +1,762 @@
+/*
+ *   FILE: s5fs_journal.c
+ *  DESCR: S5 metadata journal
+ *
+ * Metadata updates are collected into a running transaction instead of
+ * being written back one page at a time. Block device pages logged by
+ * the transaction are pinned so pageoutd can't write them home early.
+ * Directory blocks live in their directory's mmobj, so the journal keeps
+ * a copy of those instead. Once enough blocks have been logged and no
+ * update is in progress, the whole transaction is written to the
+ * journal with a single request (group commit). After that the pages are
+ * unpinned and reach their home locations whenever pageoutd gets to
+ * them. When the journal is close to full, any that haven't are written
+ * out and the journal starts over (a checkpoint).
+ */
+
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+
+#include "proc/sched.h"
+#include "proc/kthread.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "mm/mmobj.h"
+
+#include "drivers/blockdev.h"
+
+#include "fs/vnode.h"
+#include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_subr.h"
+#include "fs/s5fs/s5fs_journal.h"
+
+#define dprintf(...) dbg(DBG_S5FS, __VA_ARGS__)
+
+/* Pages in jn_buf: the descriptor, the logged blocks, the commit record */
+#define S5_JBUF_PAGES           (S5_JOURNAL_MAX_TRANS + 2)
+
+/* Where the data of the i'th logged block is put together in jn_buf */
+#define S5_JBUF_SLOT(j, i)      ((j)->jn_buf + ((i) + 1) * S5_BLOCK_SIZE)
+
+static int s5_journal_write(s5fs_t *fs);
+static int s5_journal_checkpoint(s5fs_t *fs);
+
+/*
+ * Fold one logged block into the checksum of a transaction. Transactions
+ * start out with their sequence number as the checksum.
+ */
+static uint32_t
+s5_journal_checksum(uint32_t sum, const void *block)
+{
+        const uint32_t *w = (const uint32_t *)block;
+        uint32_t i;
+
+        for (i = 0; i < S5_BLOCK_SIZE / sizeof(uint32_t); ++i)
+                sum = (sum << 1 | sum >> 31) ^ w[i];
+        return sum;
+}
+
+/* Returns the index of blockno in the running transaction, or -1 */
+static int
+s5_journal_find(s5_journal_t *j, uint32_t blockno)
+{
+        uint32_t i;
+
+        for (i = 0; i < j->jn_nentries; ++i) {
+                if (j->jn_entries[i].je_blockno == blockno)
+                        return i;
+        }
+        return -1;
+}
+
+/* Remove the i'th block from the running transaction. */
+static void
+s5_journal_drop(s5_journal_t *j, uint32_t i)
+{
+        uint32_t last = --j->jn_nentries;
+
+        if (NULL != j->jn_entries[i].je_pframe)
+                pframe_unpin(j->jn_entries[i].je_pframe);
+        if (i != last) {
+                j->jn_entries[i] = j->jn_entries[last];
+                if (NULL == j->jn_entries[i].je_pframe)
+                        memcpy(S5_JBUF_SLOT(j, i), S5_JBUF_SLOT(j, last),
+                               S5_BLOCK_SIZE);
+        }
+}
+
+/* A block which is logged again no longer needs to be revoked. */
+static void
+s5_journal_unrevoke(s5_journal_t *j, uint32_t blockno)
+{
+        uint32_t i;
+
+        for (i = 0; i < j->jn_nrevoked; ++i) {
+                if (j->jn_revoked[i] == blockno) {
+                        j->jn_revoked[i] = j->jn_revoked[--j->jn_nrevoked];
+                        return;
+                }
+        }
+}
+
+static void
+s5_journal_ckpt_add(s5_journal_t *j, uint32_t blockno)
+{
+        uint32_t i;
+
+        for (i = 0; i < j->jn_nckpt; ++i) {
+                if (j->jn_ckpt[i] == blockno)
+                        return;
+        }
+        KASSERT(j->jn_nckpt < j->jn_nblocks);
+        j->jn_ckpt[j->jn_nckpt++] = blockno;
+}
+
+/* The handle the current thread has open, or NULL */
+static s5_jhandle_t *
+s5_journal_handle(s5_journal_t *j)
+{
+        s5_jhandle_t *h;
+
+        list_iterate_begin(&j->jn_handles, h, s5_jhandle_t, jh_link) {
+                if (h->jh_thr == curthr)
+                        return h;
+        } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * Returns non-zero if the running transaction has room for n more
+ * credits to be handed out, over and above those which are already,
+ * leaving keep more to spare.
+ */
+static int
+s5_journal_has_room(s5_journal_t *j, uint32_t n, uint32_t keep)
+{
+        return j->jn_nentries + j->jn_reserved + n + keep <= S5_JOURNAL_MAX_TRANS
+               && j->jn_nrevoked + j->jn_reserved + n + keep <= S5_JOURNAL_MAX_REVOKE;
+}
+
+/*
+ * Open a handle for an update which logs or revokes at most nblocks
+ * blocks, and reserve room for them in the running transaction. If
+ * there isn't enough, wait for the open handles to close and commit the
+ * transaction to start a new one.
+ *
+ * A thread which already has a handle open can't wait, since the
+ * transaction can't commit until it is done. Its credits go to that
+ * handle if there is room, and otherwise it makes do with those.
+ */
+static void
+s5_journal_start(s5fs_t *fs, s5_jhandle_t *h, uint32_t nblocks, uint32_t keep)
+{
+        s5_journal_t *j = fs->s5f_journal;
+        s5_jhandle_t *outer;
+
+        KASSERT(S5_JOURNAL_MAX_TRANS >= nblocks + S5_JOURNAL_KEEP);
+
+        h->jh_thr = curthr;
+        h->jh_nested = 0;
+        h->jh_credits = 0;
+        if (NULL == j)
+                return;
+
+        if (NULL != (outer = s5_journal_handle(j))) {
+                h->jh_nested = 1;
+                if (s5_journal_has_room(j, nblocks, keep)) {
+                        outer->jh_credits += nblocks;
+                        j->jn_reserved += nblocks;
+                }
+                return;
+        }
+
+        while (j->jn_frozen || !s5_journal_has_room(j, nblocks, keep)) {
+                if (!j->jn_frozen && list_empty(&j->jn_handles)) {
+                        dprintf("transaction %d is full, committing it\n",
+                                j->jn_seq);
+                        if (0 > s5_journal_write(fs))
+                                panic("s5fs: can't commit the journal to make "
+                                      "room for an update\n");
+                        continue;
+                }
+                sched_sleep_on(&j->jn_waitq);
+        }
+
+        h->jh_credits = nblocks;
+        j->jn_reserved += nblocks;
+        list_insert_tail(&j->jn_handles, &h->jh_link);
+}
+
+/* Open a handle; see s5_journal_start(). */
+void
+s5_journal_begin(s5fs_t *fs, s5_jhandle_t *h, uint32_t nblocks)
+{
+        s5_journal_start(fs, h, nblocks, S5_JOURNAL_KEEP);
+}
+
+/*
+ * Open a handle for cleaning a page, which may use the room kept back
+ * from other updates (S5_JOURNAL_KEEP): the thread cleaning the page may
+ * be pageoutd, and an update in progress may be waiting for it.
+ */
+void
+s5_journal_begin_clean(s5fs_t *fs, s5_jhandle_t *h, uint32_t nblocks)
+{
+        s5_journal_start(fs, h, nblocks, 0);
+}
+
+/*
+ * Close a handle. The in-core inodes the update changed are copied back
+ * to the inode table, so that they are logged with the rest of it, and
+ * the credits it didn't use are given back. The last handle closed then
+ * commits the running transaction if it has logged enough blocks.
+ */
+void
+s5_journal_end(s5fs_t *fs, s5_jhandle_t *h)
+{
+        s5_journal_t *j = fs->s5f_journal;
+
+        if (h->jh_nested)
+                return;
+
+        s5_sync_inodes(fs);
+        if (NULL == j)
+                return;
+
+        KASSERT(h->jh_thr == curthr);
+        list_remove(&h->jh_link);
+        KASSERT(j->jn_reserved >= h->jh_credits);
+        j->jn_reserved -= h->jh_credits;
+
+        sched_broadcast_on(&j->jn_waitq);
+        if (!list_empty(&j->jn_handles))
+                return;
+
+        if (S5_JOURNAL_COMMIT_AT <= j->jn_nentries
+            || S5_JOURNAL_MAX_REVOKE / 2 <= j->jn_nrevoked)
+                s5_journal_write(fs);
+}
+
+/*
+ * Wait for a commit in progress to finish. Only a thread without a
+ * handle open can find one in progress, as a commit waits for every
+ * handle to close.
+ */
+static void
+s5_journal_wait(s5_journal_t *j)
+{
+        while (j->jn_frozen)
+                sched_sleep_on(&j->jn_waitq);
+}
+
+/*
+ * Account for one more block logged by the running transaction (or
+ * revoked, if revoke is set), against the credits of the current
+ * thread's handle. An update which logs more than it said it would gets
+ * room nobody has reserved, or failing that credits some other handle
+ * has not used yet. If there are none the transaction can't hold the
+ * block, and rather than lose it we panic.
+ */
+static void
+s5_journal_charge(s5_journal_t *j, int revoke)
+{
+        s5_jhandle_t *h;
+
+        if (NULL != (h = s5_journal_handle(j)) && 0 < h->jh_credits)
+                goto take;
+
+        if (revoke ? j->jn_nrevoked + j->jn_reserved < S5_JOURNAL_MAX_REVOKE
+                   : j->jn_nentries + j->jn_reserved < S5_JOURNAL_MAX_TRANS)
+                return;
+
+        list_iterate_begin(&j->jn_handles, h, s5_jhandle_t, jh_link) {
+                if (0 < h->jh_credits)
+                        goto take;
+        } list_iterate_end();
+
+        panic("s5fs: transaction %d is out of room for %s\n", j->jn_seq,
+              revoke ? "revoked blocks" : "logged blocks");
+
+take:
+        h->jh_credits--;
+        j->jn_reserved--;
+}
+
+/*
+ * Log a block device page which has just been changed. The page stays
+ * pinned until the transaction commits.
+ */
+void
+s5_journal_dirty(s5fs_t *fs, pframe_t *pf)
+{
+        s5_journal_t *j = fs->s5f_journal;
+        uint32_t i;
+
+        if (NULL == j)
+                return;
+
+        s5_journal_wait(j);
+        if (0 <= s5_journal_find(j, pf->pf_pagenum))
+                return;
+
+        s5_journal_charge(j, 0);
+        KASSERT(S5_JOURNAL_MAX_TRANS > j->jn_nentries);
+
+        s5_journal_unrevoke(j, pf->pf_pagenum);
+        pframe_pin(pf);
+        i = j->jn_nentries++;
+        j->jn_entries[i].je_blockno = pf->pf_pagenum;
+        j->jn_entries[i].je_pframe = pf;
+}
+
+/*
+ * Log a copy of a directory block, which is written home once its
+ * transaction has committed.
+ *
+ * Returns 1 if the block was logged, or 0 if the file system has no
+ * journal and the caller has to write it out itself.
+ */
+int
+s5_journal_log(s5fs_t *fs, uint32_t blockno, const void *buf)
+{
+        s5_journal_t *j = fs->s5f_journal;
+        int i;
+
+        if (NULL == j)
+                return 0;
+
+        s5_journal_wait(j);
+        if (0 > (i = s5_journal_find(j, blockno))) {
+                s5_journal_charge(j, 0);
+                KASSERT(S5_JOURNAL_MAX_TRANS > j->jn_nentries);
+                s5_journal_unrevoke(j, blockno);
+                i = j->jn_nentries++;
+                j->jn_entries[i].je_blockno = blockno;
+                j->jn_entries[i].je_pframe = NULL;
+        }
+
+        KASSERT(NULL == j->jn_entries[i].je_pframe);
+        memcpy(S5_JBUF_SLOT(j, i), buf, S5_BLOCK_SIZE);
+        return 1;
+}
+
+/*
+ * If the journal has a copy of the given block which has not been
+ * written home yet, copy it into buf and return 1. Otherwise return 0.
+ */
+int
+s5_journal_read(s5fs_t *fs, uint32_t blockno, void *buf)
+{
+        s5_journal_t *j = fs->s5f_journal;
+        int i;
+
+        if (NULL == j || 0 > (i = s5_journal_find(j, blockno))
+            || NULL != j->jn_entries[i].je_pframe)
+                return 0;
+
+        memcpy(buf, S5_JBUF_SLOT(j, i), S5_BLOCK_SIZE);
+        return 1;
+}
+
+/*
+ * The given block has been freed. Drop it from the running transaction,
+ * and if an earlier transaction still in the journal logged it, record
+ * that it must not be replayed: it may hold file data by then.
+ */
+void
+s5_journal_revoke(s5fs_t *fs, uint32_t blockno)
+{
+        s5_journal_t *j = fs->s5f_journal;
+        uint32_t i;
+        int e;
+
+        if (NULL == j)
+                return;
+
+        s5_journal_wait(j);
+        if (0 <= (e = s5_journal_find(j, blockno)))
+                s5_journal_drop(j, e);
+
+        for (i = 0; i < j->jn_nckpt; ++i) {
+                if (j->jn_ckpt[i] != blockno)
+                        continue;
+                s5_journal_charge(j, 1);
+                KASSERT(S5_JOURNAL_MAX_REVOKE > j->jn_nrevoked);
+                j->jn_ckpt[i] = j->jn_ckpt[--j->jn_nckpt];
+                j->jn_revoked[j->jn_nrevoked++] = blockno;
+                return;
+        }
+}
+
+/*
+ * Write the running transaction to the journal, and once it is there
+ * let its blocks go home. Called with no handles open; new ones wait
+ * until this is done.
+ */
+static int
+s5_journal_write(s5fs_t *fs)
+{
+        s5_journal_t *j = fs->s5f_journal;
+        blockdev_t *bdev = fs->s5f_bdev;
+        s5_jdesc_t *desc = (s5_jdesc_t *)j->jn_buf;
+        s5_jcommit_t *commit;
+        s5_jentry_t *je;
+        uint32_t i, n = j->jn_nentries;
+        int ret;
+
+        KASSERT(list_empty(&j->jn_handles) && !j->jn_frozen);
+
+        if (0 == n && 0 == j->jn_nrevoked)
+                return 0;
+        j->jn_frozen = 1;
+
+        memset(desc, 0, S5_BLOCK_SIZE);
+        desc->sjd_magic = S5_JDESC_MAGIC;
+        desc->sjd_seq = j->jn_seq;
+        desc->sjd_nblocks = n;
+        desc->sjd_nrevoked = j->jn_nrevoked;
+
+        commit = (s5_jcommit_t *)S5_JBUF_SLOT(j, n);
+        memset(commit, 0, S5_BLOCK_SIZE);
+        commit->sjc_magic = S5_JCOMMIT_MAGIC;
+        commit->sjc_seq = j->jn_seq;
+        commit->sjc_checksum = j->jn_seq;
+
+        for (i = 0; i < n; ++i) {
+                je = &j->jn_entries[i];
+                if (NULL != je->je_pframe)
+                        memcpy(S5_JBUF_SLOT(j, i), je->je_pframe->pf_addr,
+                               S5_BLOCK_SIZE);
+                desc->sjd_blocks[i] = je->je_blockno;
+                commit->sjc_checksum = s5_journal_checksum(commit->sjc_checksum,
+                                                           S5_JBUF_SLOT(j, i));
+        }
+        memcpy(&desc->sjd_blocks[n], j->jn_revoked,
+               j->jn_nrevoked * sizeof(uint32_t));
+
+        KASSERT(j->jn_head + n + 2 <= j->jn_nblocks);
+        dprintf("committing transaction %d: %d blocks, %d revoked\n",
+                j->jn_seq, n, j->jn_nrevoked);
+
+        if (0 > (ret = bdev->bd_ops->write_block(bdev, j->jn_buf,
+                                                 j->jn_start + j->jn_head, n + 2))) {
+                /* the transaction keeps running, and is tried again later */
+                dprintf("writing transaction %d failed: %d\n", j->jn_seq, ret);
+                goto out;
+        }
+        j->jn_head += n + 2;
+        ++j->jn_seq;
+
+        for (i = 0; i < n; ++i) {
+                je = &j->jn_entries[i];
+                s5_journal_ckpt_add(j, je->je_blockno);
+                if (NULL != je->je_pframe) {
+                        pframe_unpin(je->je_pframe);
+                } else if (0 > (ret = bdev->bd_ops->write_block(bdev, S5_JBUF_SLOT(j, i),
+                                                                je->je_blockno, 1))) {
+                        /* replaying the journal will still bring it back */
+                        dprintf("writing directory block %d failed: %d\n",
+                                je->je_blockno, ret);
+                }
+        }
+        j->jn_nentries = 0;
+        j->jn_nrevoked = 0;
+
+        ret = 0;
+        if (j->jn_head + S5_JBUF_PAGES > j->jn_nblocks)
+                ret = s5_journal_checkpoint(fs);
+
+out:
+        j->jn_frozen = 0;
+        sched_broadcast_on(&j->jn_waitq);
+        return ret;
+}
+
+/*
+ * Write every block logged since the journal last started over to its
+ * home location, then start the journal over. Called right after a
+ * commit, with the journal frozen, so what is in memory is what has been
+ * committed.
+ */
+static int
+s5_journal_checkpoint(s5fs_t *fs)
+{
+        s5_journal_t *j = fs->s5f_journal;
+        blockdev_t *bdev = fs->s5f_bdev;
+        s5_jheader_t *hdr = (s5_jheader_t *)j->jn_buf;
+        pframe_t *pf;
+        uint32_t i;
+        int ret;
+
+        KASSERT(j->jn_frozen && 0 == j->jn_nentries);
+
+        for (i = 0; i < j->jn_nckpt; ++i) {
+                while (NULL != (pf = pframe_get_resident(S5FS_TO_VMOBJ(fs),
+                                                         j->jn_ckpt[i]))
+                       && pframe_is_busy(pf))
+                        sched_sleep_on(&pf->pf_waitq);
+
+                /* blocks no longer cached, or clean, are home already */
+                if (NULL == pf || !pframe_is_dirty(pf))
+                        continue;
+
+                /* the superblock stays pinned */
+                if (pframe_is_pinned(pf))
+                        ret = bdev->bd_ops->write_block(bdev, pf->pf_addr,
+                                                        pf->pf_pagenum, 1);
+                else
+                        ret = pframe_clean(pf);
+                if (0 > ret)
+                        return ret;
+        }
+
+        memset(hdr, 0, S5_BLOCK_SIZE);
+        hdr->sjh_magic = S5_JOURNAL_MAGIC;
+        hdr->sjh_seq = j->jn_seq;
+        if (0 > (ret = bdev->bd_ops->write_block(bdev, j->jn_buf, j->jn_start, 1)))
+                return ret;
+
+        dprintf("checkpointed %d blocks, journal starts over at "
+                "transaction %d\n", j->jn_nckpt, j->jn_seq);
+        j->jn_head = 1;
+        j->jn_nckpt = 0;
+        return 0;
+}
+
+/*
+ * Commit the running transaction now, waiting for the updates in
+ * progress to finish first. Must not be called with a handle open.
+ */
+int
+s5_journal_commit(s5fs_t *fs)
+{
+        s5_journal_t *j = fs->s5f_journal;
+
+        if (NULL == j)
+                return 0;
+
+        while (j->jn_frozen || !list_empty(&j->jn_handles))
+                sched_sleep_on(&j->jn_waitq);
+        return s5_journal_write(fs);
+}
+
+/*
+ * Returns 1 if blockno, logged by transaction t of the ntrans read from
+ * the journal, was revoked by a later one.
+ */
+static int
+s5_journal_is_revoked(s5_jdesc_t **descs, uint32_t t, uint32_t ntrans,
+                      uint32_t blockno)
+{
+        uint32_t u, i;
+
+        for (u = t + 1; u < ntrans; ++u) {
+                for (i = 0; i < descs[u]->sjd_nrevoked; ++i) {
+                        if (descs[u]->sjd_blocks[descs[u]->sjd_nblocks + i] == blockno)
+                                return 1;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Find the transactions which made it into the journal whole, and copy
+ * the blocks they logged to their home locations. Then start the
+ * journal over.
+ */
+static int
+s5_journal_replay(s5fs_t *fs)
+{
+        s5_journal_t *j = fs->s5f_journal;
+        blockdev_t *bdev = fs->s5f_bdev;
+        uint32_t maxtrans = j->jn_nblocks / 2;
+        s5_jheader_t *hdr;
+        s5_jcommit_t *commit;
+        s5_jdesc_t **descs, *desc = NULL;
+        uint32_t off, seq, ntrans = 0, t, i, sum;
+        pframe_t *pf;
+        char *buf;
+        int ret;
+
+        if (NULL == (buf = page_alloc()))
+                return -ENOMEM;
+        if (NULL == (descs = kmalloc(maxtrans * sizeof(s5_jdesc_t *)))) {
+                page_free(buf);
+                return -ENOMEM;
+        }
+
+        if (0 > (ret = bdev->bd_ops->read_block(bdev, buf, j->jn_start, 1)))
+                goto out;
+        hdr = (s5_jheader_t *)buf;
+        if (S5_JOURNAL_MAGIC != hdr->sjh_magic) {
+                dprintf("journal was never used\n");
+                j->jn_seq = 1;
+                goto reset;
+        }
+        seq = hdr->sjh_seq;
+
+        for (off = 1; off + 2 <= j->jn_nblocks && ntrans < maxtrans; ++ntrans) {
+                if (NULL == desc && NULL == (desc = page_alloc())) {
+                        ret = -ENOMEM;
+                        goto out;
+                }
+                if (0 > (ret = bdev->bd_ops->read_block(bdev, (char *)desc,
+                                                        j->jn_start + off, 1)))
+                        goto out;
+                if (S5_JDESC_MAGIC != desc->sjd_magic
+                    || seq + ntrans != desc->sjd_seq
+                    || S5_JDESC_MAX < desc->sjd_nblocks + desc->sjd_nrevoked
+                    || j->jn_nblocks < off + desc->sjd_nblocks + 2)
+                        break;
+
+                sum = desc->sjd_seq;
+                for (i = 0; i < desc->sjd_nblocks; ++i) {
+                        if (0 > (ret = bdev->bd_ops->read_block(bdev, buf,
+                                                                j->jn_start + off + 1 + i, 1)))
+                                goto out;
+                        sum = s5_journal_checksum(sum, buf);
+                }
+                if (0 > (ret = bdev->bd_ops->read_block(bdev, buf,
+                                                        j->jn_start + off + 1 + i, 1)))
+                        goto out;
+                commit = (s5_jcommit_t *)buf;
+                if (S5_JCOMMIT_MAGIC != commit->sjc_magic
+                    || desc->sjd_seq != commit->sjc_seq
+                    || sum != commit->sjc_checksum)
+                        break;
+
+                descs[ntrans] = desc;
+                desc = NULL;
+                off += descs[ntrans]->sjd_nblocks + 2;
+        }
+
+        dprintf("replaying %d transactions\n", ntrans);
+        for (t = 0, off = 1; t < ntrans; off += descs[t]->sjd_nblocks + 2, ++t) {
+                desc = descs[t];
+                for (i = 0; i < desc->sjd_nblocks; ++i) {
+                        if (s5_journal_is_revoked(descs, t, ntrans, desc->sjd_blocks[i]))
+                                continue;
+                        if (0 > (ret = bdev->bd_ops->read_block(bdev, buf,
+                                                                j->jn_start + off + 1 + i, 1))
+                            || 0 > (ret = bdev->bd_ops->write_block(bdev, buf,
+                                                                    desc->sjd_blocks[i], 1)))
+                                goto out;
+                        /* keep what's cached (the superblock, at least) in step */
+                        if (NULL != (pf = pframe_get_resident(S5FS_TO_VMOBJ(fs),
+                                                              desc->sjd_blocks[i])))
+                                memcpy(pf->pf_addr, buf, S5_BLOCK_SIZE);
+                }
+        }
+        j->jn_seq = seq + ntrans;
+
+reset:
+        hdr = (s5_jheader_t *)buf;
+        memset(hdr, 0, S5_BLOCK_SIZE);
+        hdr->sjh_magic = S5_JOURNAL_MAGIC;
+        hdr->sjh_seq = j->jn_seq;
+        ret = bdev->bd_ops->write_block(bdev, buf, j->jn_start, 1);
+        j->jn_head = 1;
+
+out:
+        if (NULL != desc)
+                page_free(desc);
+        for (t = 0; t < ntrans; ++t)
+                page_free(descs[t]);
+        kfree(descs);
+        page_free(buf);
+        return ret;
+}
+
+/*
+ * Set up the journal described by the superblock, if there is one, and
+ * replay it.
+ */
+int
+s5_journal_mount(s5fs_t *fs)
+{
+        s5_super_t *s = fs->s5f_super;
+        s5_journal_t *j;
+        int ret;
+
+        fs->s5f_journal = NULL;
+        if (0 == s->s5s_journal_nblocks)
+                return 0;
+
+        if (S5_JBUF_PAGES + 1 > s->s5s_journal_nblocks) {
+                dbg(DBG_PRINT, "s5fs: journal has %d blocks, at least %d "
+                    "are needed\n", s->s5s_journal_nblocks, S5_JBUF_PAGES + 1);
+                return -EINVAL;
+        }
+
+        if (NULL == (j = kmalloc(sizeof(s5_journal_t))))
+                return -ENOMEM;
+        j->jn_start = s->s5s_journal_start;
+        j->jn_nblocks = s->s5s_journal_nblocks;
+        j->jn_head = 1;
+        j->jn_seq = 1;
+        list_init(&j->jn_handles);
+        j->jn_frozen = 0;
+        sched_queue_init(&j->jn_waitq);
+        j->jn_reserved = 0;
+        j->jn_nentries = 0;
+        j->jn_nrevoked = 0;
+        j->jn_nckpt = 0;
+
+        j->jn_ckpt = kmalloc(j->jn_nblocks * sizeof(uint32_t));
+        j->jn_buf = page_alloc_n(S5_JBUF_PAGES);
+        if (NULL == j->jn_ckpt || NULL == j->jn_buf) {
+                ret = -ENOMEM;
+                goto fail;
+        }
+
+        fs->s5f_journal = j;
+        if (0 > (ret = s5_journal_replay(fs)))
+                goto fail;
+
+        return 0;
+
+fail:
+        fs->s5f_journal = NULL;
+        if (NULL != j->jn_ckpt)
+                kfree(j->jn_ckpt);
+        if (NULL != j->jn_buf)
+                page_free_n(j->jn_buf, S5_JBUF_PAGES);
+        kfree(j);
+        return ret;
+}
+
+/*
+ * Commit what is left, write everything home and leave the journal
+ * empty.
+ */
+void
+s5_journal_umount(s5fs_t *fs)
+{
+        s5_journal_t *j = fs->s5f_journal;
+
+        if (NULL == j)
+                return;
+
+        s5_journal_commit(fs);
+        while (0 < j->jn_nentries) {
+                dprintf("block %d was never committed\n",
+                        j->jn_entries[0].je_blockno);
+                s5_journal_drop(j, 0);
+        }
+
+        j->jn_frozen = 1;
+        if (0 > s5_journal_checkpoint(fs))
+                dbg(DBG_PRINT, "s5fs: checkpointing the journal failed, it "
+                    "will be replayed at the next mount\n");
+
+        fs->s5f_journal = NULL;
+        kfree(j->jn_ckpt);
+        page_free_n(j->jn_buf, S5_JBUF_PAGES);
+        kfree(j);
+}
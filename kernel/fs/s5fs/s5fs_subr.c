@@ -11,6 +11,9 @@
 #include "globals.h"
 #include "proc/sched.h"
 #include "proc/kmutex.h"
+#include "proc/proc.h"
+#include "proc/kthread.h"
+#include "util/init.h"
 #include "errno.h"
 #include "util/string.h"
 #include "util/printf.h"
@@ -19,10 +22,13 @@
 #include "drivers/dev.h"
 #include "drivers/blockdev.h"
 #include "fs/stat.h"
+#include "fs/lseek.h"
+#include "fs/defrag.h"
 #include "fs/vfs.h"
 #include "fs/vnode.h"
 #include "fs/s5fs/s5fs_subr.h"
 #include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_journal.h"
 #include "mm/mm.h"
 #include "mm/page.h"
 
@@ -38,395 +44,3069 @@
                 KASSERT(!err                                         \
                         && "shouldn\'t fail for a page belonging "   \
                         "to a block device");                        \
+                s5_journal_dirty((fs), p);                           \
         } while (0)
 
 
 static void s5_free_block(s5fs_t *fs, int block);
+static void s5_put_free_block(s5fs_t *fs, int blockno);
 static int s5_alloc_block(s5fs_t *);
+static int s5_alloc_indirect(vnode_t *vnode);
+static void s5_delalloc_put(s5fs_t *fs, ino_t ino, uint32_t n);
+static void s5_unreserve_blocks(vnode_t *vnode, uint32_t n);
+static void s5_orphan_inode(vnode_t *vnode, uint32_t nblocks);
+
+static s5_dirslots_t *s5_dirslots_get(vnode_t *dir);
+static int s5_clear_dirent(vnode_t *vnode, const char *name, size_t namelen);
+static int s5_add_dirent(vnode_t *parent, vnode_t *child, const char *name,
+                         size_t namelen);
+static int s5_move_dirent(vnode_t *olddir, const char *oldname, size_t oldnamelen,
+                          vnode_t *newdir, const char *newname, size_t newnamelen);
+static int s5_put_dirent(vnode_t *parent, ino_t ino, const char *name,
+                         size_t namelen);
+static int s5_empty_slot(vnode_t *vnode, uint32_t slot);
+static void s5_journal_dir(vnode_t *dir);
+static void s5_dirslots_free(s5_dirslots_t *ds);
 
 
 /*
- * Return the disk-block number for the given seek pointer (aka file
- * position).
+ * Locking
  *
- * If the seek pointer refers to a sparse block, and alloc is false,
- * then return 0. If the seek pointer refers to a sparse block, and
- * alloc is true, then allocate a new disk block (and make the inode
- * point to it) and return it.
+ * There is no lock for the whole file system. An inode and the blocks
+ * it maps are protected by its vnode's vn_mutex, which the s5fs_*
+ * entry points take. The two free lists in the superblock each have a
+ * mutex of their own, held only while taking from or putting back onto
+ * that list, so a thread waiting on disk while it works on one file
+ * does not hold up threads working on others.
  *
- * Be sure to handle indirect blocks!
+ * Locks are always taken in this order:
  *
- * If there is an error, return -errno.
+ *     vn_mutex (a directory before the files in it)
+ *       journal handle
+ *         s5f_inode_mutex
+ *           s5f_block_mutex
  *
- * You probably want to use s5_alloc_block, pframe_get, pframe_pin, 
- * pframe_unpin, pframe_dirty.
+ * A journal handle counts as a lock since s5_journal_begin() may wait
+ * for the other handles to close to make room (see s5fs_journal.h).
  */
-int
-s5_seek_to_block(vnode_t *vnode, off_t seekptr, int alloc)
-{
-        NOT_YET_IMPLEMENTED("S5FS: s5_seek_to_block");
-        return -1;
-}
-
 
 /*
- * Locks the mutex for the whole file system
+ * Locks the inode free list
  */
 static void
-lock_s5(s5fs_t *fs)
+lock_s5_inodes(s5fs_t *fs)
 {
-        kmutex_lock(&fs->s5f_mutex);
+        kmutex_lock(&fs->s5f_inode_mutex);
 }
 
 /*
- * Unlocks the mutex for the whole file system
+ * Unlocks the inode free list
  */
 static void
-unlock_s5(s5fs_t *fs)
+unlock_s5_inodes(s5fs_t *fs)
 {
-        kmutex_unlock(&fs->s5f_mutex);
+        kmutex_unlock(&fs->s5f_inode_mutex);
 }
 
-
 /*
- * Write len bytes to the given inode, starting at seek bytes from the
- * beginning of the inode. On success, return the number of bytes
- * actually written (which should be 'len', unless there's only enough
- * room for a partial write); on failure, return -errno.
- *
- * This function should allow writing to files or directories, treating
- * them identically.
- *
- * Writing to a sparse block of the file should cause that block to be
- * allocated.  Writing past the end of the file should increase the size
- * of the file. Blocks between the end and where you start writing will
- * be sparse. In addition, bytes between where the old end of the file was and
- * the beginning of where you start writing should also be null.
- *
- * You cannot count on the contents of a block being null. Thus, if the seek
- * offset is not block aligned, be sure to set to null everything from where the
- * file ended to where the write begins.
- *
- * Do not call s5_seek_to_block() directly from this function.  You will
- * use the vnode's pframe functions, which will eventually result in a
- * call to s5_seek_to_block().
- *
- * You will need pframe_dirty(), pframe_get(), memcpy().
+ * Locks the block free list and the block counts
  */
-int
-s5_write_file(vnode_t *vnode, off_t seek, const char *bytes, size_t len)
+static void
+lock_s5_blocks(s5fs_t *fs)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_write_file");
-        return -1;
+        kmutex_lock(&fs->s5f_block_mutex);
 }
 
 /*
- * Read up to len bytes from the given inode, starting at seek bytes
- * from the beginning of the inode. On success, return the number of
- * bytes actually read, or 0 if the end of the file has been reached; on
- * failure, return -errno.
- *
- * This function should allow reading from files or directories,
- * treating them identically.
- *
- * Reading from a sparse block of the file should act like reading
- * zeros; it should not cause the sparse blocks to be allocated.
- *
- * Similarly as in s5_write_file(), do not call s5_seek_to_block()
- * directly from this function.
- *
- * If the region to be read would extend past the end of the file, less
- * data will be read than was requested.
- *
- * You probably want to use pframe_get(), memcpy().
+ * Unlocks the block free list and the block counts
  */
-int
-s5_read_file(struct vnode *vnode, off_t seek, char *dest, size_t len)
+static void
+unlock_s5_blocks(s5fs_t *fs)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_read_file");
-        return -1;
+        kmutex_unlock(&fs->s5f_block_mutex);
 }
 
 /*
- * Allocate a new disk-block off the block free list and return it. If
- * there are no free blocks, return -ENOSPC.
- *
- * This will not initialize the contents of an allocated block; these
- * contents are undefined.
+ * Return the disk-block number for the given seek pointer (aka file
+ * position).
  *
- * If the super block's s5s_nfree is 0, you need to refill
- * s5s_free_blocks and reset s5s_nfree.  You need to read the contents
- * of this page using the pframe system in order to obtain the next set of
- * free block numbers.
+ * If the seek pointer refers to a sparse block, and alloc is false,
+ * then return 0. If the seek pointer refers to a sparse block, and
+ * alloc is true, then allocate a new disk block (and make the inode
+ * point to it) and return it.
  *
- * Don't forget to dirty the appropriate blocks!
+ * Note that with delayed allocation a page which has been written but
+ * not yet cleaned has no disk block either, so this returns 0 for it.
  *
- * You'll probably want to use lock_s5(), unlock_s5(), pframe_get(),
- * and s5_dirty_super()
+ * If there is an error, return -errno.
  */
-static int
-s5_alloc_block(s5fs_t *fs)
+int
+s5_seek_to_block(vnode_t *vnode, off_t seekptr, int alloc)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_alloc_block");
-        return -1;
-}
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        uint32_t blk = S5_DATA_BLOCK(seekptr);
+        uint32_t *blockp;
+        pframe_t *ibp = NULL;
+        int ret;
+
+        KASSERT(!(S5_INODE_INLINE & inode->s5_flags));
+
+        if (S5_MAX_FILE_BLOCKS <= blk)
+                return -EFBIG;
+
+        if (S5_NDIRECT_BLOCKS > blk) {
+                blockp = &inode->s5_direct_blocks[blk];
+        } else {
+                if (0 == inode->s5_indirect_block) {
+                        if (!alloc)
+                                return 0;
+                        if (0 > (ret = s5_alloc_indirect(vnode)))
+                                return ret;
+                }
+                if (0 > (ret = pframe_get(S5FS_TO_VMOBJ(fs),
+                                          inode->s5_indirect_block, &ibp)))
+                        return ret;
+                blockp = (uint32_t *)ibp->pf_addr + (blk - S5_NDIRECT_BLOCKS);
+        }
+
+        if (0 != *blockp || !alloc)
+                return *blockp;
+
+        if (NULL != ibp)
+                pframe_pin(ibp);
+        if (0 <= (ret = s5_alloc_block(fs))) {
+                *blockp = ret;
+                if (NULL != ibp) {
+                        pframe_dirty(ibp);
+                        s5_journal_dirty(fs, ibp);
+                } else
+                        s5_dirty_inode(fs, inode);
+        }
+        if (NULL != ibp)
+                pframe_unpin(ibp);
 
+        return ret;
+}
 
 /*
- * Given a filesystem and a block number, frees the given block in the
- * filesystem.
- *
- * This function may potentially block.
- *
- * The caller is responsible for ensuring that the block being placed on
- * the free list is actually free and is not resident.
+ * Point block blk of the file at blockno. The file's indirect block
+ * must already exist if blk needs it.
  */
 static void
-s5_free_block(s5fs_t *fs, int blockno)
+s5_set_block(vnode_t *vnode, uint32_t blk, uint32_t blockno)
 {
-        s5_super_t *s = fs->s5f_super;
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        pframe_t *ibp;
 
+        KASSERT(S5_MAX_FILE_BLOCKS > blk);
 
-        lock_s5(fs);
+        if (S5_NDIRECT_BLOCKS > blk) {
+                inode->s5_direct_blocks[blk] = blockno;
+                s5_dirty_inode(fs, inode);
+        } else {
+                KASSERT(inode->s5_indirect_block);
+                pframe_get(S5FS_TO_VMOBJ(fs), inode->s5_indirect_block, &ibp);
+                KASSERT(ibp && "never fails for block device vm_objects");
+                ((uint32_t *)ibp->pf_addr)[blk - S5_NDIRECT_BLOCKS] = blockno;
+                pframe_dirty(ibp);
+                s5_journal_dirty(fs, ibp);
+        }
+}
 
-        KASSERT(S5_NBLKS_PER_FNODE > s->s5s_nfree);
+/*
+ * Give the file an (empty) indirect block.
+ */
+static int
+s5_alloc_indirect(vnode_t *vnode)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        pframe_t *ibp;
+        int blockno;
 
-        if ((S5_NBLKS_PER_FNODE - 1) == s->s5s_nfree) {
-                /* get the pframe where we will store the free block nums */
-                pframe_t *prev_free_blocks = NULL;
-                KASSERT(fs->s5f_bdev);
-                pframe_get(&fs->s5f_bdev->bd_mmobj, blockno, &prev_free_blocks);
-                KASSERT(prev_free_blocks->pf_addr);
+        KASSERT(0 == inode->s5_indirect_block);
 
-                /* copy from the superblock to the new block on disk */
-                memcpy(prev_free_blocks->pf_addr, (void *)(s->s5s_free_blocks),
-                       S5_NBLKS_PER_FNODE * sizeof(int));
-                KASSERT(pframe_dirty(prev_free_blocks) == 0);
+        if (0 > (blockno = s5_alloc_block(fs)))
+                return blockno;
 
-                /* reset s->s5s_nfree and s->s5s_free_blocks */
-                s->s5s_nfree = 0;
-                s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = blockno;
-        } else {
-                s->s5s_free_blocks[s->s5s_nfree++] = blockno;
-        }
+        pframe_get(S5FS_TO_VMOBJ(fs), blockno, &ibp);
+        KASSERT(ibp && "never fails for block device vm_objects");
+        memset(ibp->pf_addr, 0, S5_BLOCK_SIZE);
+        pframe_dirty(ibp);
+        s5_journal_dirty(fs, ibp);
 
-        s5_dirty_super(fs);
+        inode->s5_indirect_block = blockno;
+        s5_dirty_inode(fs, inode);
+        return 0;
+}
+
+/*
+ * Returns non-zero if the given page of the file has been written but
+ * has no disk block yet, without blocking. Gives up (returns 0) if the
+ * indirect block would have to be read in to tell.
+ */
+static int
+s5_page_is_delayed(vnode_t *vnode, pframe_t *pf)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        uint32_t blk = pf->pf_pagenum;
+        pframe_t *ibp;
 
-        unlock_s5(fs);
+        if (!pframe_is_dirty(pf) || pframe_is_busy(pf) || S5_MAX_FILE_BLOCKS <= blk)
+                return 0;
+        if (S5_NDIRECT_BLOCKS > blk)
+                return 0 == inode->s5_direct_blocks[blk];
+        if (0 == inode->s5_indirect_block
+            || NULL == (ibp = pframe_get_resident(S5FS_TO_VMOBJ(fs),
+                                                  inode->s5_indirect_block))
+            || pframe_is_busy(ibp))
+                return 0;
+        return 0 == ((uint32_t *)ibp->pf_addr)[blk - S5_NDIRECT_BLOCKS];
 }
 
 /*
- * Creates a new inode from the free list and initializes its fields.
- * Uses S5_INODE_BLOCK to get the page from which to create the inode
+ * Reserve a disk block for the page at seekptr, which is about to be
+ * dirtied and has no disk block. The block itself is allocated when the
+ * page is cleaned, by s5_alloc_delayed(). If the page is past the
+ * direct blocks the file's indirect block is allocated right away,
+ * once the reservation has been made, so that nothing needs to be
+ * undone but the reservation if it can't be.
  *
- * This function may block.
+ * Returns 0 on success or -ENOSPC if there are no unreserved blocks
+ * left.
  */
 int
-s5_alloc_inode(fs_t *fs, uint16_t type, devid_t devid)
+s5_reserve_block(vnode_t *vnode, off_t seekptr)
 {
-        s5fs_t *s5fs = FS_TO_S5FS(fs);
-        pframe_t *inodep;
-        s5_inode_t *inode;
-        int ret = -1;
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        s5_delalloc_t *dl;
+        int ret;
 
-        KASSERT((S5_TYPE_DATA == type)
-                || (S5_TYPE_DIR == type)
-                || (S5_TYPE_CHR == type)
-                || (S5_TYPE_BLK == type));
+        if (S5_MAX_FILE_BLOCKS <= (uint32_t)S5_DATA_BLOCK(seekptr))
+                return -EFBIG;
 
+        list_iterate_begin(&fs->s5f_delalloc, dl, s5_delalloc_t, dl_link) {
+                if (dl->dl_ino == vnode->vn_vno)
+                        goto found;
+        } list_iterate_end();
 
-        lock_s5(s5fs);
+        if (NULL == (dl = (s5_delalloc_t *)kmalloc(sizeof(s5_delalloc_t))))
+                return -ENOMEM;
+        dl->dl_ino = vnode->vn_vno;
+        dl->dl_nreserved = 0;
+        list_insert_tail(&fs->s5f_delalloc, &dl->dl_link);
 
-        if (s5fs->s5f_super->s5s_free_inode == (uint32_t) -1) {
-                unlock_s5(s5fs);
+found:
+        lock_s5_blocks(fs);
+        if (fs->s5f_nfree_blocks <= fs->s5f_nreserved) {
+                unlock_s5_blocks(fs);
+                s5_delalloc_put(fs, vnode->vn_vno, 0);
                 return -ENOSPC;
         }
+        fs->s5f_nreserved++;
+        unlock_s5_blocks(fs);
 
-        pframe_get(&s5fs->s5f_bdev->bd_mmobj,
-                   S5_INODE_BLOCK(s5fs->s5f_super->s5s_free_inode),
-                   &inodep);
-        KASSERT(inodep);
+        dl->dl_nreserved++;
 
-        inode = (s5_inode_t *)(inodep->pf_addr)
-                + S5_INODE_OFFSET(s5fs->s5f_super->s5s_free_inode);
-
-        KASSERT(inode->s5_number == s5fs->s5f_super->s5s_free_inode);
+        if (S5_NDIRECT_BLOCKS <= S5_DATA_BLOCK(seekptr)
+            && 0 == inode->s5_indirect_block
+            && 0 > (ret = s5_alloc_indirect(vnode))) {
+                s5_unreserve_blocks(vnode, 1);
+                return ret;
+        }
+        return 0;
+}
 
-        ret = inode->s5_number;
+/*
+ * Drop n blocks from the reservation count of the given file (without
+ * touching s5f_nreserved), freeing its record if none are left.
+ */
+static void
+s5_delalloc_put(s5fs_t *fs, ino_t ino, uint32_t n)
+{
+        s5_delalloc_t *dl;
 
-        /* reset s5s_free_inode; remove the inode from the inode free list: */
-        s5fs->s5f_super->s5s_free_inode = inode->s5_next_free;
-        pframe_pin(inodep);
-        s5_dirty_super(s5fs);
-        pframe_unpin(inodep);
+        list_iterate_begin(&fs->s5f_delalloc, dl, s5_delalloc_t, dl_link) {
+                if (dl->dl_ino == ino) {
+                        KASSERT(dl->dl_nreserved >= n);
+                        if (0 == (dl->dl_nreserved -= n)) {
+                                list_remove(&dl->dl_link);
+                                kfree(dl);
+                        }
+                        return;
+                }
+        } list_iterate_end();
 
+        KASSERT(0 == n);
+}
 
-        /* init the newly-allocated inode: */
-        inode->s5_size = 0;
-        inode->s5_type = type;
-        inode->s5_linkcount = 0;
-        memset(inode->s5_direct_blocks, 0, S5_NDIRECT_BLOCKS * sizeof(int));
-        if ((S5_TYPE_CHR == type) || (S5_TYPE_BLK == type))
-                inode->s5_indirect_block = devid;
-        else
-                inode->s5_indirect_block = 0;
+/*
+ * Give back n reservations held by the given file, for pages which were
+ * thrown away without being cleaned.
+ */
+static void
+s5_unreserve_blocks(vnode_t *vnode, uint32_t n)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
 
-        s5_dirty_inode(s5fs, inode);
+        if (0 == n)
+                return;
 
-        unlock_s5(s5fs);
+        lock_s5_blocks(fs);
+        KASSERT(fs->s5f_nreserved >= n);
+        fs->s5f_nreserved -= n;
+        unlock_s5_blocks(fs);
 
-        return ret;
+        s5_delalloc_put(fs, vnode->vn_vno, n);
 }
 
-
 /*
- * Free an inode by freeing its disk blocks and putting it back on the
- * inode free list.
- *
- * You should also reset the inode to an unused state (eg. zero-ing its
- * list of blocks and setting its type to S5_FREE_TYPE).
+ * Inline files
  *
- * Don't forget to free the indirect block if it exists.
- *
- * You probably want to use s5_free_block().
+ * A regular file starts out with its contents in the inode itself
+ * (s5_inline, flagged with S5_INODE_INLINE), so a small file needs no
+ * data block and is read along with its inode. While the file is in
+ * use its data is in page 0 like any other file's: s5fs_fillpage() and
+ * s5fs_cleanpage() copy between that page and the inode. Once the file
+ * needs to grow past S5_INLINE_SIZE bytes it is converted for good to
+ * an ordinary block-mapped file by s5_uninline().
  */
-void
-s5_free_inode(vnode_t *vnode)
+
+/*
+ * Move an inline file's data out of its inode and give it a block map.
+ * The data stays in page 0, which is left dirty with a block reserved
+ * for it. Does nothing for a file which is not inline.
+ */
+static int
+s5_uninline(vnode_t *vnode)
 {
-        uint32_t i;
-        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
         s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        pframe_t *pf = NULL;
+        int ret;
 
-        KASSERT((S5_TYPE_DATA == inode->s5_type)
-                || (S5_TYPE_DIR == inode->s5_type)
-                || (S5_TYPE_CHR == inode->s5_type)
-                || (S5_TYPE_BLK == inode->s5_type));
-
-        /* free any direct blocks */
-        for (i = 0; i < S5_NDIRECT_BLOCKS; ++i) {
-                if (inode->s5_direct_blocks[i]) {
-                        dprintf("freeing block %d\n", inode->s5_direct_blocks[i]);
-                        s5_free_block(fs, inode->s5_direct_blocks[i]);
+        if (!(S5_INODE_INLINE & inode->s5_flags))
+                return 0;
 
-                        s5_dirty_inode(fs, inode);
-                        inode->s5_direct_blocks[i] = 0;
+        if (0 < vnode->vn_len) {
+                /* fill the page from the inode while we still can; keep
+                 * pageoutd away from it until it has a reservation */
+                if (0 > (ret = pframe_get(&vnode->vn_mmobj, 0, &pf)))
+                        return ret;
+                pframe_pin(pf);
+                if (0 > (ret = s5_reserve_block(vnode, 0))) {
+                        pframe_unpin(pf);
+                        return ret;
                 }
         }
 
-        if (((S5_TYPE_DATA == inode->s5_type)
-             || (S5_TYPE_DIR == inode->s5_type))
-            && inode->s5_indirect_block) {
-                pframe_t *ibp;
-                uint32_t *b;
+        dprintf("inode %d no longer fits inline\n", vnode->vn_vno);
+        inode->s5_flags &= ~S5_INODE_INLINE;
+        memset(inode->s5_inline, 0, S5_INLINE_SIZE);
+        s5_dirty_inode(fs, inode);
 
-                pframe_get(S5FS_TO_VMOBJ(fs),
-                           (unsigned)inode->s5_indirect_block,
-                           &ibp);
-                KASSERT(ibp
-                        && "because never fails for block_device "
-                        "vm_objects");
-                pframe_pin(ibp);
+        if (NULL != pf) {
+                /* the reservation is already made, so don't go through
+                 * s5fs_dirtypage() to make another one */
+                pframe_set_dirty(pf);
+                pframe_unpin(pf);
+        }
+        return 0;
+}
 
-                b = (uint32_t *)(ibp->pf_addr);
-                for (i = 0; i < S5_NIDIRECT_BLOCKS; ++i) {
-                        KASSERT(b[i] != inode->s5_indirect_block);
-                        if (b[i])
-                                s5_free_block(fs, b[i]);
-                }
+/*
+ * s5_truncate_file() for an inline file, which only has page 0 and
+ * the copy in the inode to deal with.
+ */
+static int
+s5_truncate_inline(vnode_t *vnode, off_t newsize)
+{
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        pframe_t *pf;
+        int ret;
 
-                pframe_unpin(ibp);
+        KASSERT(newsize <= vnode->vn_len);
 
-                s5_free_block(fs, inode->s5_indirect_block);
+        /* what is cut off must read back as zeros if the file grows */
+        if (0 < vnode->vn_len) {
+                if (0 > (ret = pframe_get(&vnode->vn_mmobj, 0, &pf)))
+                        return ret;
+                memset((char *)pf->pf_addr + newsize, 0, vnode->vn_len - newsize);
         }
+        memset(inode->s5_inline + newsize, 0, S5_INLINE_SIZE - newsize);
 
-        inode->s5_indirect_block = 0;
-        inode->s5_type = S5_TYPE_FREE;
-        s5_dirty_inode(fs, inode);
-
-        lock_s5(fs);
-        inode->s5_next_free = fs->s5f_super->s5s_free_inode;
-        fs->s5f_super->s5s_free_inode = inode->s5_number;
-        unlock_s5(fs);
-
-        s5_dirty_inode(fs, inode);
-        s5_dirty_super(fs);
+        vnode->vn_len = inode->s5_size = newsize;
+        s5_dirty_inode(VNODE_TO_S5FS(vnode), inode);
+        return 0;
 }
 
 /*
- * Locate the directory entry in the given inode with the given name,
- * and return its inode number. If there is no entry with the given
- * name, return -ENOENT.
- *
- * You'll probably want to use s5_read_file and name_match
- *
- * You can either read one dirent at a time or optimize and read more.
- * Either is fine.
+ * Zero the part of the file's last block past the end of the file,
+ * which may hold stale data, before the file is extended over it.
  */
-int
-s5_find_dirent(vnode_t *vnode, const char *name, size_t namelen)
+static int
+s5_zero_tail(vnode_t *vnode)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_find_dirent");
-        return -1;
+        pframe_t *pf;
+        int ret;
+
+        if (0 == S5_DATA_OFFSET(vnode->vn_len))
+                return 0;
+
+        if (0 > (ret = pframe_get(&vnode->vn_mmobj, S5_DATA_BLOCK(vnode->vn_len), &pf))
+            || 0 > (ret = pframe_dirty(pf)))
+                return ret;
+        memset((char *)pf->pf_addr + S5_DATA_OFFSET(vnode->vn_len), 0,
+               S5_BLOCK_SIZE - S5_DATA_OFFSET(vnode->vn_len));
+        return 0;
 }
 
 /*
- * Locate the directory entry in the given inode with the given name,
- * and delete it. If there is no entry with the given name, return
- * -ENOENT.
- *
- * In order to ensure that the directory entries are contiguous in the
- * directory file, you will need to move the last directory entry into
- * the remove dirent's place.
- *
- * When this function returns, the inode refcount on the removed file
- * should be decremented.
- *
- * It would be a nice (but optional!) extension to free blocks from the end of
- * the directory file which are no longer needed.
- *
- * Don't forget to dirty appropriate blocks!
- *
- * You probably want to use vget(), vput(), s5_read_file(),
- * s5_write_file(), and s5_dirty_inode().
+ * Grow the file to newsize bytes without writing anything. The new part
+ * of the file reads as zeros.
  */
 int
-s5_remove_dirent(vnode_t *vnode, const char *name, size_t namelen)
+s5_extend_file(vnode_t *vnode, off_t newsize)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_remove_dirent");
-        return -1;
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        int ret;
+
+        KASSERT(newsize >= vnode->vn_len);
+
+        if (newsize > (off_t)(S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE))
+                return -EFBIG;
+        if (newsize > S5_INLINE_SIZE && 0 > (ret = s5_uninline(vnode)))
+                return ret;
+        if (0 > (ret = s5_zero_tail(vnode)))
+                return ret;
+
+        vnode->vn_len = inode->s5_size = newsize;
+        s5_dirty_inode(VNODE_TO_S5FS(vnode), inode);
+        return 0;
 }
 
 /*
- * Create a new directory entry in directory 'parent' with the given name, which
- * refers to the same file as 'child'.
+ * Write len bytes to the given inode, starting at seek bytes from the
+ * beginning of the inode. On success, return the number of bytes
+ * actually written (which should be 'len', unless there's only enough
+ * room for a partial write); on failure, return -errno.
  *
- * When this function returns, the inode refcount on the file that was linked to
- * should be incremented.
+ * This function allows writing to files or directories, treating
+ * them identically.
  *
- * Remember to incrament the ref counts appropriately
+ * Writing past the end of the file increases the size of the file.
+ * Blocks between the end and where the write starts are left sparse,
+ * and the rest of the block the old end was in is zeroed.
  *
- * You probably want to use s5_find_dirent(), s5_write_file(), and s5_dirty_inode().
+ * Pages are only dirtied here; disk blocks for them are reserved by
+ * s5fs_dirtypage() and allocated when they are cleaned, so running out
+ * of space is still reported here as -ENOSPC. An inline file which
+ * outgrows its inode is converted first.
  */
 int
-s5_link(vnode_t *parent, vnode_t *child, const char *name, size_t namelen)
+s5_write_file(vnode_t *vnode, off_t seek, const char *bytes, size_t len)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_link");
-        return -1;
-}
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        pframe_t *pf;
+        size_t written = 0, n;
+        off_t pos;
+        int ret = 0;
 
-/*
- * Return the number of blocks that this inode has allocated on disk.
- * This should include the indirect block, but not include sparse
- * blocks.
- *
- * This is only used by s5fs_stat().
+        if ((off_t)(S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE) <= seek)
+                return -EFBIG;
+        len = MIN(len, S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE - seek);
+
+        if (seek + (off_t)len > S5_INLINE_SIZE && 0 > (ret = s5_uninline(vnode)))
+                return ret;
+        if (seek > vnode->vn_len && 0 > (ret = s5_zero_tail(vnode)))
+                return ret;
+
+        while (written < len) {
+                pos = seek + written;
+                if (0 > (ret = pframe_get(&vnode->vn_mmobj, S5_DATA_BLOCK(pos), &pf))
+                    || 0 > (ret = pframe_dirty(pf)))
+                        break;
+
+                n = MIN(len - written, (size_t)(S5_BLOCK_SIZE - S5_DATA_OFFSET(pos)));
+                memcpy((char *)pf->pf_addr + S5_DATA_OFFSET(pos), bytes + written, n);
+                written += n;
+        }
+
+        if (seek + (off_t)written > vnode->vn_len) {
+                vnode->vn_len = inode->s5_size = seek + written;
+                s5_dirty_inode(VNODE_TO_S5FS(vnode), inode);
+        }
+
+        return (0 < written) ? (int)written : ret;
+}
+
+/*
+ * Read up to len bytes from the given inode, starting at seek bytes
+ * from the beginning of the inode. On success, return the number of
+ * bytes actually read, or 0 if the end of the file has been reached; on
+ * failure, return -errno.
+ *
+ * This function allows reading from files or directories, treating
+ * them identically. Sparse blocks read as zeros and are not allocated.
+ */
+int
+s5_read_file(struct vnode *vnode, off_t seek, char *dest, size_t len)
+{
+        pframe_t *pf;
+        size_t nread = 0, n;
+        off_t pos;
+        int ret;
+
+        if (seek >= vnode->vn_len)
+                return 0;
+        len = MIN(len, (size_t)(vnode->vn_len - seek));
+
+        while (nread < len) {
+                pos = seek + nread;
+                if (0 > (ret = pframe_get(&vnode->vn_mmobj, S5_DATA_BLOCK(pos), &pf)))
+                        return (0 < nread) ? (int)nread : ret;
+
+                n = MIN(len - nread, (size_t)(S5_BLOCK_SIZE - S5_DATA_OFFSET(pos)));
+                memcpy(dest + nread, (char *)pf->pf_addr + S5_DATA_OFFSET(pos), n);
+                nread += n;
+        }
+
+        return nread;
+}
+
+/*
+ * Direct I/O
+ *
+ * A file opened with O_DIRECT is read and written a block at a time
+ * straight between the caller's buffer and the disk, so that streaming
+ * through a large file once doesn't push everything else out of the
+ * page cache. Only whole blocks at block-aligned offsets, to or from a
+ * page-aligned buffer as the block device wants, go this way; the rest,
+ * and inline files, go through the cache as usual.
+ *
+ * Before its block is read, a cached page of the file is written back
+ * if it is dirty; before its block is written, it is dropped as well.
+ * A page which somebody has pinned can be neither, so the transfer goes
+ * through it instead.
+ */
+
+#define S5_DIRECT_ALIGNED(seek, buf)                                    \
+        (0 == S5_DATA_OFFSET(seek) && PAGE_ALIGNED(buf))
+
+/*
+ * Get the cached copy of the file's page at seekptr, if any, out of the
+ * way of direct I/O: write it back if it is dirty, and if drop is set
+ * throw it away. Returns 1 if the page is pinned, so that it has to be
+ * used instead, 0 if the disk can be used, or -errno.
+ */
+static int
+s5_direct_flush(vnode_t *vnode, off_t seekptr, int drop)
+{
+        pframe_t *pf;
+        int ret;
+
+        while (NULL != (pf = pframe_get_resident(&vnode->vn_mmobj,
+                                                 S5_DATA_BLOCK(seekptr)))) {
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(&pf->pf_waitq);
+                        continue;
+                }
+                if (pframe_is_pinned(pf))
+                        return 1;
+                if (pframe_is_dirty(pf)) {
+                        /* this gives a delayed page its block, too */
+                        if (0 > (ret = pframe_clean(pf)))
+                                return ret;
+                        continue;
+                }
+                if (drop)
+                        pframe_free(pf);
+                break;
+        }
+
+        return 0;
+}
+
+/*
+ * Like s5_read_file(), but reading whole blocks directly from the disk
+ * where it can (see above). Only for regular files.
+ */
+int
+s5_read_direct(struct vnode *vnode, off_t seek, char *dest, size_t len)
+{
+        blockdev_t *bdev = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        size_t nread = 0;
+        off_t pos;
+        int ret = 0;
+
+        KASSERT(S_ISREG(vnode->vn_mode));
+
+        if ((S5_INODE_INLINE & VNODE_TO_S5INODE(vnode)->s5_flags)
+            || !S5_DIRECT_ALIGNED(seek, dest))
+                return s5_read_file(vnode, seek, dest, len);
+
+        if (seek >= vnode->vn_len)
+                return 0;
+        len = MIN(len, (size_t)(vnode->vn_len - seek));
+
+        for (; S5_BLOCK_SIZE <= len - nread; nread += S5_BLOCK_SIZE) {
+                pos = seek + nread;
+                if (0 > (ret = s5_direct_flush(vnode, pos, 0)))
+                        break;
+                if (0 < ret) {
+                        if (0 > (ret = s5_read_file(vnode, pos, dest + nread,
+                                                    S5_BLOCK_SIZE)))
+                                break;
+                        continue;
+                }
+
+                if (0 > (ret = s5_seek_to_block(vnode, pos, 0)))
+                        break;
+                if (0 == ret)
+                        memset(dest + nread, 0, S5_BLOCK_SIZE);
+                else if (0 > (ret = bdev->bd_ops->read_block(bdev, dest + nread,
+                                                             ret, 1)))
+                        break;
+        }
+
+        /* the end of the file may leave part of a block */
+        if (0 <= ret && nread < len
+            && 0 < (ret = s5_read_file(vnode, seek + nread, dest + nread,
+                                       len - nread)))
+                nread += ret;
+
+        return (0 < nread) ? (int)nread : ret;
+}
+
+/*
+ * Like s5_write_file(), but writing whole blocks directly to the disk
+ * where it can (see above). Holes get their blocks right away rather
+ * than when a page is cleaned. Only for regular files. Called with a
+ * journal handle open with credits for len bytes; see s5fs_write_direct().
+ */
+int
+s5_write_direct(vnode_t *vnode, off_t seek, const char *bytes, size_t len)
+{
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        blockdev_t *bdev = VNODE_TO_S5FS(vnode)->s5f_bdev;
+        size_t written = 0;
+        off_t pos;
+        int ret = 0;
+
+        KASSERT(S_ISREG(vnode->vn_mode));
+
+        if ((off_t)(S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE) <= seek)
+                return -EFBIG;
+        len = MIN(len, S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE - seek);
+
+        if (seek + (off_t)len > S5_INLINE_SIZE && 0 > (ret = s5_uninline(vnode)))
+                return ret;
+        if ((S5_INODE_INLINE & inode->s5_flags)
+            || !S5_DIRECT_ALIGNED(seek, bytes))
+                return s5_write_file(vnode, seek, bytes, len);
+        if (seek > vnode->vn_len && 0 > (ret = s5_zero_tail(vnode)))
+                return ret;
+
+        for (; S5_BLOCK_SIZE <= len - written; written += S5_BLOCK_SIZE) {
+                pos = seek + written;
+                if (0 > (ret = s5_direct_flush(vnode, pos, 1)))
+                        break;
+                if (0 < ret) {
+                        if (0 > (ret = s5_write_file(vnode, pos, bytes + written,
+                                                     S5_BLOCK_SIZE)))
+                                break;
+                        continue;
+                }
+
+                /* a shared block is replaced rather than written over */
+                if (0 > (ret = s5_seek_to_block(vnode, pos, 1))
+                    || 0 > (ret = s5_unshare_block(vnode, pos, 1))
+                    || 0 > (ret = bdev->bd_ops->write_block(bdev, bytes + written,
+                                                            ret, 1)))
+                        break;
+
+                /* grow the file as we go, so that whatever goes through
+                 * the cache next doesn't zero what was just written */
+                if (pos + S5_BLOCK_SIZE > vnode->vn_len) {
+                        vnode->vn_len = inode->s5_size = pos + S5_BLOCK_SIZE;
+                        s5_dirty_inode(VNODE_TO_S5FS(vnode), inode);
+                }
+        }
+
+        /* a partial last block goes through the cache */
+        if (0 <= ret && written < len
+            && 0 < (ret = s5_write_file(vnode, seek + written, bytes + written,
+                                        len - written)))
+                written += ret;
+
+        return (0 < written) ? (int)written : ret;
+}
+
+/*
+ * Drop any copy of the given block cached by the block device's
+ * mmobj. Blocks are handed out to files, whose data lives in the file's
+ * own mmobj, so a stale (possibly dirty) copy there must not be written
+ * back over it later.
+ */
+static void
+s5_forget_block(s5fs_t *fs, uint32_t blockno)
+{
+        pframe_t *pf;
+
+        while (NULL != (pf = pframe_get_resident(S5FS_TO_VMOBJ(fs), blockno))) {
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(&pf->pf_waitq);
+                        continue;
+                }
+                KASSERT(!pframe_is_pinned(pf));
+                pframe_free(pf);
+                break;
+        }
+}
+
+/*
+ * Take one block off the free list, refilling s5s_free_blocks from the
+ * next free list node when it is empty. The node block itself is the
+ * one handed out in that case. Called with s5f_block_mutex held.
+ */
+static int
+s5_take_free_block(s5fs_t *fs)
+{
+        s5_super_t *s = fs->s5f_super;
+        pframe_t *next;
+        int blockno;
+
+        KASSERT(S5_NBLKS_PER_FNODE > s->s5s_nfree);
+
+        if (0 == s->s5s_nfree) {
+                blockno = s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1];
+                if ((uint32_t) -1 == (uint32_t)blockno)
+                        return -ENOSPC;
+
+                pframe_get(S5FS_TO_VMOBJ(fs), blockno, &next);
+                KASSERT(next && "never fails for block device vm_objects");
+                memcpy(s->s5s_free_blocks, next->pf_addr,
+                       S5_NBLKS_PER_FNODE * sizeof(uint32_t));
+                s->s5s_nfree = S5_NBLKS_PER_FNODE - 1;
+                /* the node is about to be handed out as an ordinary block */
+                s5_journal_revoke(fs, blockno);
+        } else {
+                blockno = s->s5s_free_blocks[--s->s5s_nfree];
+        }
+
+        KASSERT(0 < fs->s5f_nfree_blocks);
+        fs->s5f_nfree_blocks--;
+        return blockno;
+}
+
+/*
+ * Allocate a new disk-block off the block free list and return it. If
+ * there are no free blocks, return -ENOSPC. Blocks which are reserved
+ * for delayed allocations are not available here.
+ *
+ * This will not initialize the contents of an allocated block; these
+ * contents are undefined.
+ */
+static int
+s5_alloc_block(s5fs_t *fs)
+{
+        int blockno;
+
+        lock_s5_blocks(fs);
+        if (fs->s5f_nfree_blocks <= fs->s5f_nreserved) {
+                unlock_s5_blocks(fs);
+                return -ENOSPC;
+        }
+        if (0 <= (blockno = s5_take_free_block(fs)))
+                s5_dirty_super(fs);
+        unlock_s5_blocks(fs);
+
+        if (0 <= blockno)
+                s5_forget_block(fs, blockno);
+        return blockno;
+}
+
+/*
+ * Finish handing out a batch of n blocks taken off the free list: drop
+ * any cached copies of them and sort them into ascending order. The
+ * free list hands out blocks in roughly descending order, so sorting a
+ * batch gives a file mostly contiguous blocks.
+ */
+static void
+s5_finish_run(s5fs_t *fs, uint32_t n, uint32_t *blocks)
+{
+        uint32_t i, j, b;
+
+        for (i = 0; i < n; ++i) {
+                s5_forget_block(fs, blocks[i]);
+                for (b = blocks[i], j = i; j > 0 && blocks[j - 1] > b; --j)
+                        blocks[j] = blocks[j - 1];
+                blocks[j] = b;
+        }
+}
+
+/*
+ * Allocate n blocks which were reserved with s5_reserve_block(), and
+ * return them in ascending order.
+ */
+static void
+s5_alloc_reserved(s5fs_t *fs, uint32_t n, uint32_t *blocks)
+{
+        uint32_t i;
+        int ret;
+
+        lock_s5_blocks(fs);
+        KASSERT(fs->s5f_nreserved >= n);
+        for (i = 0; i < n; ++i) {
+                ret = s5_take_free_block(fs);
+                KASSERT(0 <= ret && "reserved block went missing");
+                blocks[i] = ret;
+        }
+        fs->s5f_nreserved -= n;
+        s5_dirty_super(fs);
+        unlock_s5_blocks(fs);
+
+        s5_finish_run(fs, n, blocks);
+}
+
+/*
+ * Allocate n unreserved blocks and return them in ascending order.
+ * Either all n are allocated or, if there are not enough free blocks,
+ * none are and -ENOSPC is returned.
+ */
+static int
+s5_alloc_blocks(s5fs_t *fs, uint32_t n, uint32_t *blocks)
+{
+        uint32_t i;
+        int ret;
+
+        lock_s5_blocks(fs);
+        if (fs->s5f_nfree_blocks < fs->s5f_nreserved + n) {
+                unlock_s5_blocks(fs);
+                return -ENOSPC;
+        }
+        for (i = 0; i < n; ++i) {
+                ret = s5_take_free_block(fs);
+                KASSERT(0 <= ret && "free block count is wrong");
+                blocks[i] = ret;
+        }
+        s5_dirty_super(fs);
+        unlock_s5_blocks(fs);
+
+        s5_finish_run(fs, n, blocks);
+        return 0;
+}
+
+/*
+ * Return a pointer to the entry for block blk in the file's block map:
+ * either in the inode or in the (resident) indirect block ibp.
+ */
+static uint32_t *
+s5_block_entry(s5_inode_t *inode, pframe_t *ibp, uint32_t blk)
+{
+        KASSERT(S5_MAX_FILE_BLOCKS > blk);
+
+        if (S5_NDIRECT_BLOCKS > blk)
+                return &inode->s5_direct_blocks[blk];
+        KASSERT(NULL != ibp);
+        return (uint32_t *)ibp->pf_addr + (blk - S5_NDIRECT_BLOCKS);
+}
+
+/*
+ * Give every sparse block of the file in [seekptr, seekptr + len) a
+ * zeroed disk block, so that writing there later does not have to
+ * allocate anything. Blocks are allocated S5_ALLOC_MAX_RUN at a time
+ * and handed out in ascending order, which gives a contiguous layout
+ * as long as the free list allows it.
+ *
+ * Pages which have been written but are still waiting for their
+ * delayed allocation already have a reservation and are skipped.
+ *
+ * Returns 0 on success or -errno. If the disk fills up part way
+ * through, the blocks allocated so far stay allocated.
+ */
+int
+s5_alloc_range(vnode_t *vnode, off_t seekptr, off_t len)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        blockdev_t *bdev = fs->s5f_bdev;
+        uint32_t blk = S5_DATA_BLOCK(seekptr);
+        uint32_t end = S5_DATA_BLOCK(seekptr + len - 1) + 1;
+        uint32_t want[S5_ALLOC_MAX_RUN], blocks[S5_ALLOC_MAX_RUN];
+        uint32_t n, i, *entry;
+        pframe_t *ibp = NULL, *pf;
+        void *zeros;
+        int ret = 0;
+
+        KASSERT(0 <= seekptr && 0 < len);
+
+        if (S5_MAX_FILE_BLOCKS < end)
+                return -EFBIG;
+
+        /* the inode itself has room for the range */
+        if ((S5_INODE_INLINE & inode->s5_flags) && seekptr + len <= S5_INLINE_SIZE)
+                return 0;
+        if (0 > (ret = s5_uninline(vnode)))
+                return ret;
+
+        if (S5_NDIRECT_BLOCKS < end) {
+                if (0 == inode->s5_indirect_block
+                    && 0 > (ret = s5_alloc_indirect(vnode)))
+                        return ret;
+                pframe_get(S5FS_TO_VMOBJ(fs), inode->s5_indirect_block, &ibp);
+                KASSERT(ibp && "never fails for block device vm_objects");
+                pframe_pin(ibp);
+        }
+
+        if (NULL == (zeros = page_alloc())) {
+                ret = -ENOMEM;
+                goto out;
+        }
+        memset(zeros, 0, S5_BLOCK_SIZE);
+
+        while (blk < end) {
+                for (n = 0; blk < end && S5_ALLOC_MAX_RUN > n; ++blk) {
+                        if (0 == *s5_block_entry(inode, ibp, blk))
+                                want[n++] = blk;
+                }
+                if (0 == n)
+                        continue;
+
+                if (0 > (ret = s5_alloc_blocks(fs, n, blocks)))
+                        break;
+                for (i = 0; i < n && 0 <= ret; ++i)
+                        ret = bdev->bd_ops->write_block(bdev, zeros, blocks[i], 1);
+                if (0 > ret) {
+                        for (i = 0; i < n; ++i)
+                                s5_free_block(fs, blocks[i]);
+                        break;
+                }
+
+                /*
+                 * Nothing in this loop blocks. A page which got written
+                 * while we were allocating has a reservation (or a
+                 * block) of its own by now, so its block goes back.
+                 */
+                for (i = 0; i < n; ++i) {
+                        entry = s5_block_entry(inode, ibp, want[i]);
+                        pf = pframe_get_resident(&vnode->vn_mmobj, want[i]);
+                        if (0 != *entry || (NULL != pf && (pframe_is_dirty(pf)
+                                                           || pframe_is_busy(pf))))
+                                continue;
+                        *entry = blocks[i];
+                        blocks[i] = 0;
+                }
+
+                if (NULL != ibp) {
+                        pframe_dirty(ibp);
+                        s5_journal_dirty(fs, ibp);
+                }
+                s5_dirty_inode(fs, inode);
+
+                for (i = 0; i < n; ++i) {
+                        if (0 != blocks[i])
+                                s5_free_block(fs, blocks[i]);
+                }
+        }
+
+        page_free(zeros);
+out:
+        if (NULL != ibp)
+                pframe_unpin(ibp);
+        return ret;
+}
+
+/*
+ * Called when the page at seekptr is being cleaned and has no disk
+ * block (see s5fs_cleanpage()). Allocates blocks for the whole run of
+ * contiguous written-but-unallocated pages around it at once, using
+ * the reservations made for them, and returns the block for seekptr.
+ *
+ * The page being cleaned is busy. Its neighbours in the run are marked
+ * busy as well while their blocks are allocated so that nobody else
+ * cleans or throws them away in the meantime.
+ */
+int
+s5_alloc_delayed(vnode_t *vnode, off_t seekptr)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        uint32_t pagenum = S5_DATA_BLOCK(seekptr);
+        uint32_t blocks[S5_ALLOC_MAX_RUN];
+        pframe_t *run[S5_ALLOC_MAX_RUN];
+        pframe_t *pf;
+        uint32_t first = pagenum, n = 1, i;
+
+        /* collect the run; nothing here blocks */
+        while (0 < first && S5_ALLOC_MAX_RUN > n
+               && NULL != (pf = pframe_get_resident(&vnode->vn_mmobj, first - 1))
+               && s5_page_is_delayed(vnode, pf)) {
+                --first;
+                ++n;
+        }
+        while (S5_ALLOC_MAX_RUN > n
+               && NULL != (pf = pframe_get_resident(&vnode->vn_mmobj, first + n))
+               && s5_page_is_delayed(vnode, pf))
+                ++n;
+
+        for (i = 0; i < n; ++i) {
+                if (first + i == pagenum) {
+                        run[i] = NULL;
+                        continue;
+                }
+                run[i] = pframe_get_resident(&vnode->vn_mmobj, first + i);
+                KASSERT(NULL != run[i]);
+                pframe_set_busy(run[i]);
+        }
+
+        dprintf("allocating %d blocks for pages %d-%d of inode %d\n",
+                n, first, first + n - 1, vnode->vn_vno);
+
+        s5_alloc_reserved(fs, n, blocks);
+        for (i = 0; i < n; ++i)
+                s5_set_block(vnode, first + i, blocks[i]);
+        s5_delalloc_put(fs, vnode->vn_vno, n);
+
+        for (i = 0; i < n; ++i) {
+                if (NULL == run[i])
+                        continue;
+                pframe_clear_busy(run[i]);
+                sched_broadcast_on(&run[i]->pf_waitq);
+        }
+
+        return blocks[pagenum - first];
+}
+
+/* Blocks freed per transaction by s5_truncate_file() */
+#define S5_TRUNCATE_BATCH       8
+
+/*
+ * Set the length of the file to newsize.
+ *
+ * Growing the file just extends it (see s5_extend_file()). Otherwise
+ * every cached page past the new end is thrown away without being
+ * written back, giving back the reservations of those that were waiting
+ * for a delayed allocation, and the file gets its new size. Then all
+ * blocks past the new end are freed, the last ones first and
+ * S5_TRUNCATE_BATCH of them per transaction, like s5_reclaimd does: a
+ * block left past the end of the file is just preallocated, so the file
+ * is whole after each one. The indirect block goes as well if nothing
+ * is left in it. This includes blocks preallocated past the old end of
+ * the file.
+ *
+ * Opens its own journal handles, so that a large file doesn't have to
+ * be truncated in one transaction. Called with vn_mutex held.
+ */
+int
+s5_truncate_file(vnode_t *vnode, off_t newsize)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        uint32_t first = S5_DATA_BLOCK(newsize + S5_BLOCK_SIZE - 1);
+        uint32_t blk, n, *entry, nunreserved = 0;
+        pframe_t *pf, *ibp = NULL;
+        s5_jhandle_t h;
+        int ret = 0;
+
+        KASSERT(0 <= newsize);
+        KASSERT(S_ISREG(vnode->vn_mode) || S_ISDIR(vnode->vn_mode));
+
+        if (newsize > vnode->vn_len || (S5_INODE_INLINE & inode->s5_flags)) {
+                /* zeroing the old last page may reserve a block for it,
+                 * or give up a shared one */
+                s5_journal_begin(fs, &h, S5_JCREDITS_INODE + S5_JCREDITS_ALLOC(1)
+                                 + S5_JCREDITS_FREE(1));
+                if (newsize > vnode->vn_len)
+                        ret = s5_extend_file(vnode, newsize);
+                else
+                        ret = s5_truncate_inline(vnode, newsize);
+                s5_journal_end(fs, &h);
+                return ret;
+        }
+
+        /* keep the indirect block resident so looking at it won't block */
+        if (inode->s5_indirect_block) {
+                pframe_get(S5FS_TO_VMOBJ(fs), inode->s5_indirect_block, &ibp);
+                KASSERT(ibp && "never fails for block device vm_objects");
+                pframe_pin(ibp);
+        }
+
+        /* drop the pages; start over whenever we might have blocked */
+again:
+        list_iterate_begin(&vnode->vn_mmobj.mmo_respages, pf, pframe_t, pf_olink) {
+                if (pf->pf_pagenum < first)
+                        continue;
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(&pf->pf_waitq);
+                        goto again;
+                }
+                KASSERT(!pframe_is_pinned(pf));
+                /* a written page without a block holds a reservation */
+                if (pframe_is_dirty(pf)
+                    && (S5_NDIRECT_BLOCKS > pf->pf_pagenum || NULL != ibp)
+                    && 0 == *s5_block_entry(inode, ibp, pf->pf_pagenum))
+                        ++nunreserved;
+                pframe_free(pf);
+                goto again;
+        } list_iterate_end();
+
+        s5_journal_begin(fs, &h, S5_JCREDITS_INODE);
+        s5_unreserve_blocks(vnode, nunreserved);
+        vnode->vn_len = inode->s5_size = newsize;
+        s5_dirty_inode(fs, inode);
+        s5_journal_end(fs, &h);
+
+        blk = (NULL != ibp) ? S5_MAX_FILE_BLOCKS : S5_NDIRECT_BLOCKS;
+        while (blk > first) {
+                s5_journal_begin(fs, &h, S5_JCREDITS_INODE
+                                 + S5_JCREDITS_FREE(S5_TRUNCATE_BATCH + 1));
+                lock_s5_blocks(fs);
+                for (n = 0; blk > first && S5_TRUNCATE_BATCH > n; ) {
+                        entry = s5_block_entry(inode, ibp, --blk);
+                        if (0 != *entry) {
+                                s5_put_free_block(fs, *entry);
+                                *entry = 0;
+                                ++n;
+                        }
+                }
+                if (NULL != ibp && S5_NDIRECT_BLOCKS >= blk) {
+                        /* only a file ending within the direct blocks
+                         * gets this far, so the indirect block goes */
+                        s5_put_free_block(fs, inode->s5_indirect_block);
+                        inode->s5_indirect_block = 0;
+                        pframe_unpin(ibp);
+                        ibp = NULL;
+                } else if (NULL != ibp) {
+                        pframe_dirty(ibp);
+                        s5_journal_dirty(fs, ibp);
+                }
+                s5_dirty_super(fs);
+                unlock_s5_blocks(fs);
+                s5_dirty_inode(fs, inode);
+                s5_journal_end(fs, &h);
+        }
+
+        if (NULL != ibp)
+                pframe_unpin(ibp);
+        return 0;
+}
+
+/*
+ * Find the first data (whence is SEEK_DATA) or hole (SEEK_HOLE) at or
+ * after offset, by looking at the block map. A block counts as data if
+ * it is mapped, or if its page has been written but has no block yet.
+ * The rest of the file is never read.
+ *
+ * Returns the offset found, or -ENXIO if offset is not before the end of
+ * the file or there is no data after it.
+ */
+int
+s5_seek_hole(vnode_t *vnode, off_t offset, int whence)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        uint32_t blk, nblocks = S5_DATA_BLOCK(vnode->vn_len + S5_BLOCK_SIZE - 1);
+        pframe_t *pf, *ibp = NULL;
+        int data;
+
+        KASSERT(SEEK_DATA == whence || SEEK_HOLE == whence);
+
+        if (0 > offset || offset >= vnode->vn_len)
+                return -ENXIO;
+
+        /* an inline file has no holes */
+        if (S5_INODE_INLINE & inode->s5_flags)
+                return SEEK_DATA == whence ? offset : vnode->vn_len;
+
+        if (inode->s5_indirect_block && S5_NDIRECT_BLOCKS < nblocks) {
+                pframe_get(S5FS_TO_VMOBJ(fs), inode->s5_indirect_block, &ibp);
+                KASSERT(ibp && "never fails for block device vm_objects");
+                pframe_pin(ibp);
+        }
+
+        for (blk = S5_DATA_BLOCK(offset); blk < nblocks; ++blk) {
+                data = (S5_NDIRECT_BLOCKS > blk || NULL != ibp)
+                       && 0 != *s5_block_entry(inode, ibp, blk);
+                /* busy pages may be between losing the dirty bit and
+                 * getting their block, so count them as data too */
+                if (!data && NULL != (pf = pframe_get_resident(&vnode->vn_mmobj, blk)))
+                        data = pframe_is_dirty(pf) || pframe_is_busy(pf);
+                if (data == (SEEK_DATA == whence))
+                        break;
+        }
+
+        if (NULL != ibp)
+                pframe_unpin(ibp);
+
+        if (blk == nblocks)
+                return SEEK_DATA == whence ? -ENXIO : vnode->vn_len;
+        return MAX(offset, (off_t)(blk * S5_BLOCK_SIZE));
+}
+
+/*
+ * Count the blocks on the free list by walking it. Each node in the
+ * chain holds S5_NBLKS_PER_FNODE - 1 free block numbers and is itself
+ * free. Used at mount time, when the superblock's count can't be trusted.
+ */
+uint32_t
+s5_count_free_blocks(s5fs_t *fs)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t count = s->s5s_nfree;
+        uint32_t next = s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1];
+        pframe_t *pf;
+
+        while ((uint32_t) -1 != next) {
+                pframe_get(S5FS_TO_VMOBJ(fs), next, &pf);
+                KASSERT(pf && "never fails for block device vm_objects");
+                count += S5_NBLKS_PER_FNODE;
+                next = ((uint32_t *)pf->pf_addr)[S5_NBLKS_PER_FNODE - 1];
+        }
+
+        return count;
+}
+
+/*
+ * Count the inodes on the inode free list by walking it. Used at mount
+ * time, when the superblock's count can't be trusted.
+ */
+uint32_t
+s5_count_free_inodes(s5fs_t *fs)
+{
+        uint32_t count = 0;
+        uint32_t next = fs->s5f_super->s5s_free_inode;
+        pframe_t *pf;
+
+        while ((uint32_t) -1 != next) {
+                pframe_get(S5FS_TO_VMOBJ(fs), S5_INODE_BLOCK(next), &pf);
+                KASSERT(pf && "never fails for block device vm_objects");
+                count++;
+                next = ((s5_inode_t *)pf->pf_addr + S5_INODE_OFFSET(next))->s5_next_free;
+        }
+
+        return count;
+}
+
+/*
+ * Defragmenting
+ *
+ * s5_defrag_file() moves the data blocks of a file into one run of
+ * free blocks, in file order. The run is found by marking every block
+ * on the free list in a bitmap. Its blocks are then taken off the free
+ * list one at a time with s5_claim_free_block(), each in a transaction
+ * of its own, so that other threads can go on allocating meanwhile; if
+ * one of them gets to a block of the run first, we give up with
+ * -EAGAIN. Each data block is then copied through the file's page cache
+ * to its new home, and its block map entry switched over and the old
+ * block freed in one transaction, so a crash leaves the file either
+ * where it was or where it was going.
+ */
+
+/*
+ * Count the runs of physically contiguous blocks in a block map of n
+ * entries. Sparse blocks end a run.
+ */
+static uint32_t
+s5_count_extents(const uint32_t *map, uint32_t n)
+{
+        uint32_t i, count = 0;
+
+        for (i = 0; i < n; ++i) {
+                if (0 != map[i] && (0 == i || map[i - 1] + 1 != map[i]))
+                        count++;
+        }
+        return count;
+}
+
+/*
+ * Find the first run of n free blocks on the disk and return its first
+ * block in *start. Returns -ENOSPC if there is none.
+ */
+static int
+s5_find_free_run(s5fs_t *fs, uint32_t n, uint32_t *start)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t nblocks = s->s5s_num_blocks;
+        uint32_t i, run, next, *node;
+        uint8_t *free;
+        pframe_t *pf;
+        int ret = -ENOSPC;
+
+        if (NULL == (free = kmalloc(nblocks / 8 + 1)))
+                return -ENOMEM;
+        memset(free, 0, nblocks / 8 + 1);
+
+#define S5_MARK_FREE(b)                                 \
+        do {                                            \
+                KASSERT((b) < nblocks);                 \
+                free[(b) / 8] |= 1 << ((b) % 8);        \
+        } while (0)
+
+        lock_s5_blocks(fs);
+        for (i = 0; i < s->s5s_nfree; ++i)
+                S5_MARK_FREE(s->s5s_free_blocks[i]);
+        next = s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1];
+        while ((uint32_t) -1 != next) {
+                S5_MARK_FREE(next);
+                pframe_get(S5FS_TO_VMOBJ(fs), next, &pf);
+                KASSERT(pf && "never fails for block device vm_objects");
+                node = (uint32_t *)pf->pf_addr;
+                for (i = 0; i < S5_NBLKS_PER_FNODE - 1; ++i)
+                        S5_MARK_FREE(node[i]);
+                next = node[S5_NBLKS_PER_FNODE - 1];
+        }
+        unlock_s5_blocks(fs);
+
+#undef S5_MARK_FREE
+
+        for (i = 0, run = 0; i < nblocks; ++i) {
+                run = (free[i / 8] & (1 << (i % 8))) ? run + 1 : 0;
+                if (run == n) {
+                        *start = i + 1 - n;
+                        ret = 0;
+                        break;
+                }
+        }
+
+        kfree(free);
+        return ret;
+}
+
+/*
+ * Take the given block off the free list, wherever it is on it. A block
+ * in a free list node is replaced there by one from s5s_free_blocks; a
+ * block which is itself a node has its contents moved to one from
+ * s5s_free_blocks. Called with s5f_block_mutex held; the caller forgets
+ * the block once it has let go of the mutex.
+ *
+ * Returns 0 on success, or -ENOENT if the block is not free.
+ */
+static int
+s5_claim_free_block(s5fs_t *fs, uint32_t blockno)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t *prev = &s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1];
+        uint32_t i, r, *node;
+        pframe_t *pf, *prevpf = NULL, *rpf;
+        int spare = -1, ret = -ENOENT;
+
+        /* the nodes are patched with blocks from s5s_free_blocks, so it
+         * must not be empty; the node emptied into it is kept aside */
+        if (0 == s->s5s_nfree) {
+                if (0 > (spare = s5_take_free_block(fs)))
+                        return -ENOENT;
+                if ((uint32_t)spare == blockno) {
+                        s5_dirty_super(fs);
+                        return 0;
+                }
+        }
+
+        for (i = 0; i < s->s5s_nfree; ++i) {
+                if (s->s5s_free_blocks[i] == blockno) {
+                        s->s5s_free_blocks[i] = s->s5s_free_blocks[--s->s5s_nfree];
+                        ret = 0;
+                        goto out;
+                }
+        }
+
+        while ((uint32_t) -1 != *prev) {
+                pframe_get(S5FS_TO_VMOBJ(fs), *prev, &pf);
+                KASSERT(pf && "never fails for block device vm_objects");
+                pframe_pin(pf);
+                node = (uint32_t *)pf->pf_addr;
+
+                if (*prev == blockno) {
+                        KASSERT(0 < s->s5s_nfree);
+                        r = s->s5s_free_blocks[--s->s5s_nfree];
+                        pframe_get(S5FS_TO_VMOBJ(fs), r, &rpf);
+                        KASSERT(rpf && "never fails for block device vm_objects");
+                        memcpy(rpf->pf_addr, node, S5_NBLKS_PER_FNODE * sizeof(uint32_t));
+                        pframe_dirty(rpf);
+                        s5_journal_dirty(fs, rpf);
+
+                        *prev = r;
+                        if (NULL != prevpf) {
+                                pframe_dirty(prevpf);
+                                s5_journal_dirty(fs, prevpf);
+                        }
+                        /* the old node is about to be handed out */
+                        pframe_unpin(pf);
+                        s5_journal_revoke(fs, blockno);
+                        ret = 0;
+                        break;
+                }
+
+                for (i = 0; i < S5_NBLKS_PER_FNODE - 1; ++i) {
+                        if (node[i] == blockno)
+                                break;
+                }
+                if (S5_NBLKS_PER_FNODE - 1 > i) {
+                        KASSERT(0 < s->s5s_nfree);
+                        node[i] = s->s5s_free_blocks[--s->s5s_nfree];
+                        pframe_dirty(pf);
+                        s5_journal_dirty(fs, pf);
+                        pframe_unpin(pf);
+                        ret = 0;
+                        break;
+                }
+
+                if (NULL != prevpf)
+                        pframe_unpin(prevpf);
+                prevpf = pf;
+                prev = &node[S5_NBLKS_PER_FNODE - 1];
+        }
+        if (NULL != prevpf)
+                pframe_unpin(prevpf);
+
+out:
+        if (0 == ret) {
+                KASSERT(0 < fs->s5f_nfree_blocks);
+                fs->s5f_nfree_blocks--;
+        }
+        if (0 <= spare)
+                s5_put_free_block(fs, spare);
+        s5_dirty_super(fs);
+        return ret;
+}
+
+/*
+ * Give back blocks [first, first + n) of a run claimed for
+ * defragmenting which did not get used.
+ */
+static void
+s5_free_run(s5fs_t *fs, uint32_t first, uint32_t n)
+{
+        s5_jhandle_t h;
+
+        for (; n > 0; --n, ++first) {
+                s5_journal_begin(fs, &h, S5_JCREDITS_FREE(1) + 1);
+                s5_free_block(fs, first);
+                s5_journal_end(fs, &h);
+        }
+}
+
+/*
+ * Move the data blocks of a regular file into one contiguous run, and
+ * report how many extents it was in before and is in after. Inline
+ * files have no blocks to move. Called with the vnode's vn_mutex held,
+ * which keeps the block map still: nothing, not even a page being
+ * dirtied, can reserve or unshare a block meanwhile. Called without a
+ * journal handle open, since every block moved is a transaction of its
+ * own. A block still shared with another file is copied like the rest,
+ * and the file lets go of its reference to it.
+ *
+ * Returns 0 on success, or -ENOSPC if there is no free run long enough,
+ * -EAGAIN if a block of the run got allocated by someone else, or
+ * another -errno. The blocks moved before an error stay moved.
+ */
+int
+s5_defrag_file(vnode_t *vnode, struct defrag_info *info)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        blockdev_t *bdev = fs->s5f_bdev;
+        uint32_t nblocks, n, ideal, start, i, j, *map, *entry;
+        pframe_t *ibp = NULL, *pf;
+        s5_jhandle_t h;
+        int ret = 0;
+
+        KASSERT(S_ISREG(vnode->vn_mode));
+
+        memset(info, 0, sizeof(*info));
+        if ((S5_INODE_INLINE & inode->s5_flags) || 0 == vnode->vn_len)
+                return 0;
+        nblocks = S5_DATA_BLOCK(vnode->vn_len - 1) + 1;
+
+        /* pages waiting on a delayed allocation get their blocks now, so
+         * that they are moved along with the rest */
+restart:
+        list_iterate_begin(&vnode->vn_mmobj.mmo_respages, pf, pframe_t, pf_olink) {
+                if (pframe_is_dirty(pf) && !pframe_is_busy(pf)
+                    && !pframe_is_pinned(pf)) {
+                        if (0 > (ret = pframe_clean(pf)))
+                                return ret;
+                        goto restart;
+                }
+        } list_iterate_end();
+
+        if (NULL == (map = kmalloc(nblocks * sizeof(uint32_t))))
+                return -ENOMEM;
+        if (S5_NDIRECT_BLOCKS < nblocks && 0 != inode->s5_indirect_block) {
+                pframe_get(S5FS_TO_VMOBJ(fs), inode->s5_indirect_block, &ibp);
+                KASSERT(ibp && "never fails for block device vm_objects");
+                pframe_pin(ibp);
+        }
+
+        for (i = 0, n = 0, ideal = 0; i < nblocks; ++i) {
+                if (S5_NDIRECT_BLOCKS <= i && NULL == ibp)
+                        map[i] = 0;
+                else
+                        map[i] = *s5_block_entry(inode, ibp, i);
+                if (0 != map[i]) {
+                        n++;
+                        if (0 == i || 0 == map[i - 1])
+                                ideal++;
+                }
+        }
+        info->di_blocks = n;
+        info->di_before = info->di_after = s5_count_extents(map, nblocks);
+        if ((uint32_t)info->di_before == ideal)
+                goto out;
+
+        if (0 > (ret = s5_find_free_run(fs, n, &start)))
+                goto out;
+        for (j = 0; j < n; ++j) {
+                /* two free list nodes patched, and a spare block taken
+                 * and given back */
+                s5_journal_begin(fs, &h, S5_JCREDITS_INODE + 2 + S5_JCREDITS_ALLOC(1)
+                                 + S5_JCREDITS_FREE(1));
+                lock_s5_blocks(fs);
+                if (fs->s5f_nfree_blocks <= fs->s5f_nreserved)
+                        ret = -ENOSPC;
+                else if (0 > (ret = s5_claim_free_block(fs, start + j)))
+                        ret = -EAGAIN;
+                unlock_s5_blocks(fs);
+                s5_journal_end(fs, &h);
+
+                if (0 > ret) {
+                        s5_free_run(fs, start, j);
+                        goto out;
+                }
+                s5_forget_block(fs, start + j);
+        }
+
+        for (i = 0, j = 0; i < nblocks; ++i) {
+                if (0 == map[i])
+                        continue;
+
+                if (0 > (ret = pframe_get(&vnode->vn_mmobj, i, &pf))) {
+                        s5_free_run(fs, start + j, n - j);
+                        break;
+                }
+                pframe_pin(pf);
+                if (0 > (ret = bdev->bd_ops->write_block(bdev, pf->pf_addr,
+                                                         start + j, 1))) {
+                        pframe_unpin(pf);
+                        s5_free_run(fs, start + j, n - j);
+                        break;
+                }
+
+                /* truncation and copy on write (s5fs_dirtypage()) are
+                 * all that change a block entry, and both need vn_mutex */
+                s5_journal_begin(fs, &h, S5_JCREDITS_INODE + S5_JCREDITS_FREE(1));
+                entry = s5_block_entry(inode, ibp, i);
+                KASSERT(*entry == map[i]);
+                *entry = start + j;
+                if (S5_NDIRECT_BLOCKS <= i) {
+                        pframe_dirty(ibp);
+                        s5_journal_dirty(fs, ibp);
+                } else {
+                        s5_dirty_inode(fs, inode);
+                }
+                s5_free_block(fs, map[i]);
+                s5_journal_end(fs, &h);
+
+                pframe_unpin(pf);
+                map[i] = start + j++;
+        }
+        info->di_after = s5_count_extents(map, nblocks);
+
+out:
+        if (NULL != ibp)
+                pframe_unpin(ibp);
+        kfree(map);
+        return ret;
+}
+
+/*
+ * Shared blocks
+ *
+ * s5_clone_range() lets files share data blocks, so that copying a file
+ * only has to copy its block map. The disk has a table of reference
+ * counts after the journal, with a byte for every block on the disk
+ * holding the number of references to it beyond the first; a block
+ * which isn't shared has 0 there, so a new table is all zeros. Freeing
+ * a shared block just drops a reference (see s5_put_free_block()).
+ *
+ * A shared block is never written to. A page whose block is shared
+ * gets a block of its own when it is dirtied (see s5_unshare_block()),
+ * and direct I/O replaces a shared block rather than writing over it.
+ *
+ * The table is protected by s5f_block_mutex.
+ */
+
+/*
+ * Return the block device page holding blockno's reference count.
+ */
+static pframe_t *
+s5_refcnt_page(s5fs_t *fs, uint32_t blockno)
+{
+        pframe_t *pf;
+
+        KASSERT(blockno < fs->s5f_super->s5s_num_blocks);
+        pframe_get(S5FS_TO_VMOBJ(fs), fs->s5f_super->s5s_refcnt_start
+                   + blockno / S5_REFCNTS_PER_BLOCK, &pf);
+        KASSERT(pf && "never fails for block device vm_objects");
+        return pf;
+}
+
+/*
+ * Return the number of references to blockno beyond the first. Called
+ * with s5f_block_mutex held.
+ */
+static uint32_t
+s5_block_refs(s5fs_t *fs, uint32_t blockno)
+{
+        pframe_t *pf;
+
+        if (0 == fs->s5f_super->s5s_refcnt_nblocks)
+                return 0;
+        pf = s5_refcnt_page(fs, blockno);
+        return ((uint8_t *)pf->pf_addr)[blockno % S5_REFCNTS_PER_BLOCK];
+}
+
+/*
+ * Set the number of references to blockno beyond the first. Called
+ * with s5f_block_mutex held.
+ */
+static void
+s5_set_block_refs(s5fs_t *fs, uint32_t blockno, uint32_t refs)
+{
+        pframe_t *pf;
+
+        KASSERT(S5_REFCNT_MAX >= refs);
+        KASSERT(0 != fs->s5f_super->s5s_refcnt_nblocks);
+
+        pf = s5_refcnt_page(fs, blockno);
+        ((uint8_t *)pf->pf_addr)[blockno % S5_REFCNTS_PER_BLOCK] = refs;
+        pframe_dirty(pf);
+        s5_journal_dirty(fs, pf);
+}
+
+/*
+ * Point out's block at outpos at the block in's block at inpos is in,
+ * taking a reference to it, and let go of whatever block out had
+ * there. A hole in in makes a hole in out.
+ *
+ * Returns 0 on success, 1 if in's block already has S5_REFCNT_MAX
+ * extra references, or -errno.
+ */
+static int
+s5_share_block(vnode_t *in, off_t inpos, vnode_t *out, off_t outpos)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(in);
+        int iblock, oblock;
+        uint32_t refs;
+
+        if (0 > (iblock = s5_seek_to_block(in, inpos, 0)))
+                return iblock;
+        if (0 > (oblock = s5_seek_to_block(out, outpos, 0)))
+                return oblock;
+        if (iblock == oblock)
+                return 0;
+
+        lock_s5_blocks(fs);
+        if (0 != iblock) {
+                if (S5_REFCNT_MAX == (refs = s5_block_refs(fs, iblock))) {
+                        unlock_s5_blocks(fs);
+                        return 1;
+                }
+                s5_set_block_refs(fs, iblock, refs + 1);
+        }
+        s5_set_block(out, S5_DATA_BLOCK(outpos), iblock);
+        if (0 != oblock) {
+                s5_put_free_block(fs, oblock);
+                s5_dirty_super(fs);
+        }
+        unlock_s5_blocks(fs);
+
+        return 0;
+}
+
+/* Blocks shared per transaction by s5_clone_range(): each takes a
+ * reference to one block and lets go of another */
+#define S5_CLONE_BATCH          8
+#define S5_CLONE_CREDITS        (S5_JCREDITS_INODE + S5_CLONE_BATCH     \
+                                 + S5_JCREDITS_FREE(S5_CLONE_BATCH))
+
+/*
+ * Make out's blocks from outoff on share in's blocks from inoff, for
+ * as many whole blocks of in's data as len covers. Both offsets are
+ * block aligned. The blocks out had there are freed (or lose a
+ * reference), and out grows if it ends before the last one.
+ *
+ * In's cached pages in the range are written back first so that its
+ * blocks hold what the file does, and out's are thrown away. A pinned
+ * page can't be either, and ends the range there, as does a block
+ * which already has S5_REFCNT_MAX extra references.
+ *
+ * Called with both vnodes' vn_mutex held and without a journal handle
+ * open; every S5_CLONE_BATCH blocks are a transaction of their own.
+ *
+ * Returns the number of bytes shared, for the caller to copy the rest,
+ * or -errno if none were: -EOPNOTSUPP if the disk has no reference
+ * count table.
+ */
+int
+s5_clone_range(vnode_t *in, off_t inoff, vnode_t *out, off_t outoff, size_t len)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(in);
+        s5_inode_t *oinode = VNODE_TO_S5INODE(out);
+        uint32_t n = 0, end, nblocks;
+        s5_jhandle_t h;
+        int ret = 0;
+
+        KASSERT(S_ISREG(in->vn_mode) && S_ISREG(out->vn_mode));
+        KASSERT(0 == S5_DATA_OFFSET(inoff) && 0 == S5_DATA_OFFSET(outoff));
+
+        if (0 == fs->s5f_super->s5s_refcnt_nblocks)
+                return -EOPNOTSUPP;
+        if (S5_MAX_FILE_BLOCKS <= (uint32_t)S5_DATA_BLOCK(outoff))
+                return -EFBIG;
+        if (inoff >= in->vn_len)
+                return 0;
+        nblocks = MIN(len, (size_t)(in->vn_len - inoff)) / S5_BLOCK_SIZE;
+        nblocks = MIN(nblocks, S5_MAX_FILE_BLOCKS - S5_DATA_BLOCK(outoff));
+        if (0 == nblocks)
+                return 0;
+
+        s5_journal_begin(fs, &h, S5_JCREDITS_INODE + S5_JCREDITS_ALLOC(2)
+                         + S5_JCREDITS_FREE(1));
+        if (outoff > out->vn_len)
+                ret = s5_extend_file(out, outoff);
+        if (0 <= ret)
+                ret = s5_uninline(out);
+        if (0 <= ret && S5_NDIRECT_BLOCKS < S5_DATA_BLOCK(outoff) + nblocks
+            && 0 == oinode->s5_indirect_block)
+                ret = s5_alloc_indirect(out);
+        s5_journal_end(fs, &h);
+        if (0 > ret)
+                return ret;
+
+        while (0 == ret && n < nblocks) {
+                /* get the pages of the next batch out of the way; ret is
+                 * 1 at a pinned one */
+                end = n;
+                while (0 == ret && end < nblocks && S5_CLONE_BATCH > end - n) {
+                        if (0 == (ret = s5_direct_flush(in, inoff + (off_t)end * S5_BLOCK_SIZE, 0))
+                            && 0 == (ret = s5_direct_flush(out, outoff + (off_t)end * S5_BLOCK_SIZE, 1)))
+                                ++end;
+                }
+
+                s5_journal_begin(fs, &h, S5_CLONE_CREDITS);
+                for (; n < end; ++n) {
+                        if (0 != (ret = s5_share_block(in, inoff + (off_t)n * S5_BLOCK_SIZE,
+                                                       out, outoff + (off_t)n * S5_BLOCK_SIZE)))
+                                break;
+                }
+                s5_journal_end(fs, &h);
+        }
+
+        if (0 < n && outoff + (off_t)n * S5_BLOCK_SIZE > out->vn_len) {
+                s5_journal_begin(fs, &h, S5_JCREDITS_INODE);
+                out->vn_len = oinode->s5_size = outoff + (off_t)n * S5_BLOCK_SIZE;
+                s5_dirty_inode(fs, oinode);
+                s5_journal_end(fs, &h);
+        }
+
+        dprintf("inode %d shares %d blocks with inode %d\n",
+                out->vn_vno, n, in->vn_vno);
+        return (0 < n) ? (int)(n * S5_BLOCK_SIZE) : MIN(ret, 0);
+}
+
+/*
+ * Give the file's page at seekptr a block of its own if its block is
+ * shared, before the page is written to. With alloc clear the page gets
+ * a reservation, as if it were sparse, and its data goes to a new block
+ * when it is cleaned (see s5_alloc_delayed()); with alloc set a new
+ * block is allocated right away, for a caller about to write it
+ * directly. Either way the file lets go of the shared block.
+ *
+ * Returns the file's block at seekptr from now on (0 if it is waiting
+ * for a delayed allocation), or -errno.
+ */
+int
+s5_unshare_block(vnode_t *vnode, off_t seekptr, int alloc)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_jhandle_t h;
+        uint32_t refs;
+        int blockno, ret;
+
+        if (0 >= (blockno = s5_seek_to_block(vnode, seekptr, 0)))
+                return blockno;
+
+        lock_s5_blocks(fs);
+        refs = s5_block_refs(fs, blockno);
+        unlock_s5_blocks(fs);
+        if (0 == refs)
+                return blockno;
+
+        dprintf("copying block %d of inode %d on write\n",
+                S5_DATA_BLOCK(seekptr), vnode->vn_vno);
+
+        s5_journal_begin(fs, &h, S5_JCREDITS_INODE + S5_JCREDITS_ALLOC(1)
+                         + S5_JCREDITS_FREE(1));
+        if (alloc)
+                ret = s5_alloc_block(fs);
+        else
+                ret = s5_reserve_block(vnode, seekptr);
+        if (0 <= ret) {
+                s5_set_block(vnode, S5_DATA_BLOCK(seekptr), ret);
+                s5_free_block(fs, blockno);
+        }
+        s5_journal_end(fs, &h);
+
+        return ret;
+}
+
+/*
+ * Put the given block on the free list, or if it is shared just drop a
+ * reference to it. Called with s5f_block_mutex held; the caller dirties
+ * the superblock.
+ *
+ * This function may potentially block.
+ */
+static void
+s5_put_free_block(s5fs_t *fs, int blockno)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t refs;
+
+        KASSERT(S5_NBLKS_PER_FNODE > s->s5s_nfree);
+
+        if (0 < (refs = s5_block_refs(fs, blockno))) {
+                s5_set_block_refs(fs, blockno, refs - 1);
+                return;
+        }
+
+        /* whatever the journal logged for this block is stale now */
+        s5_journal_revoke(fs, blockno);
+
+        if ((S5_NBLKS_PER_FNODE - 1) == s->s5s_nfree) {
+                /* get the pframe where we will store the free block nums */
+                pframe_t *prev_free_blocks = NULL;
+                KASSERT(fs->s5f_bdev);
+                pframe_get(&fs->s5f_bdev->bd_mmobj, blockno, &prev_free_blocks);
+                KASSERT(prev_free_blocks->pf_addr);
+
+                /* copy from the superblock to the new block on disk */
+                memcpy(prev_free_blocks->pf_addr, (void *)(s->s5s_free_blocks),
+                       S5_NBLKS_PER_FNODE * sizeof(int));
+                int err = pframe_dirty(prev_free_blocks);
+                KASSERT(0 == err);
+                s5_journal_dirty(fs, prev_free_blocks);
+
+                /* reset s->s5s_nfree and s->s5s_free_blocks */
+                s->s5s_nfree = 0;
+                s->s5s_free_blocks[S5_NBLKS_PER_FNODE - 1] = blockno;
+        } else {
+                s->s5s_free_blocks[s->s5s_nfree++] = blockno;
+        }
+        fs->s5f_nfree_blocks++;
+}
+
+/*
+ * Given a filesystem and a block number, frees the given block in the
+ * filesystem.
+ *
+ * This function may potentially block.
+ *
+ * The caller is responsible for ensuring that the block being placed on
+ * the free list is actually free and is not resident.
+ */
+static void
+s5_free_block(s5fs_t *fs, int blockno)
+{
+        lock_s5_blocks(fs);
+        s5_put_free_block(fs, blockno);
+        s5_dirty_super(fs);
+        unlock_s5_blocks(fs);
+}
+
+/*
+ * Creates a new inode from the free list and initializes its fields.
+ * Uses S5_INODE_BLOCK to get the page from which to create the inode
+ *
+ * This function may block.
+ */
+int
+s5_alloc_inode(fs_t *fs, uint16_t type, devid_t devid)
+{
+        s5fs_t *s5fs = FS_TO_S5FS(fs);
+        pframe_t *inodep;
+        s5_inode_t *inode;
+        s5_jhandle_t h;
+        int ret = -1;
+
+        KASSERT((S5_TYPE_DATA == type)
+                || (S5_TYPE_DIR == type)
+                || (S5_TYPE_CHR == type)
+                || (S5_TYPE_BLK == type));
+
+        s5_journal_begin(s5fs, &h, S5_JCREDITS_INODE);
+        lock_s5_inodes(s5fs);
+
+        if (s5fs->s5f_super->s5s_free_inode == (uint32_t) -1) {
+                unlock_s5_inodes(s5fs);
+                s5_journal_end(s5fs, &h);
+                return -ENOSPC;
+        }
+
+        pframe_get(&s5fs->s5f_bdev->bd_mmobj,
+                   S5_INODE_BLOCK(s5fs->s5f_super->s5s_free_inode),
+                   &inodep);
+        KASSERT(inodep);
+
+        inode = (s5_inode_t *)(inodep->pf_addr)
+                + S5_INODE_OFFSET(s5fs->s5f_super->s5s_free_inode);
+
+        KASSERT(inode->s5_number == s5fs->s5f_super->s5s_free_inode);
+
+        ret = inode->s5_number;
+
+        /* reset s5s_free_inode; remove the inode from the inode free list: */
+        s5fs->s5f_super->s5s_free_inode = inode->s5_next_free;
+        KASSERT(0 < s5fs->s5f_nfree_inodes);
+        s5fs->s5f_nfree_inodes--;
+        pframe_pin(inodep);
+        s5_dirty_super(s5fs);
+        pframe_unpin(inodep);
+
+
+        /* init the newly-allocated inode; it has no vnode, and so no
+         * in-core copy, yet: */
+        inode->s5_size = 0;
+        inode->s5_type = type;
+        inode->s5_linkcount = 0;
+        memset(inode->s5_inline, 0, S5_INLINE_SIZE);
+        if ((S5_TYPE_CHR == type) || (S5_TYPE_BLK == type))
+                inode->s5_indirect_block = devid;
+        /* regular files start out with their data in the inode */
+        inode->s5_flags = (S5_TYPE_DATA == type) ? S5_INODE_INLINE : 0;
+
+        pframe_dirty(inodep);
+        s5_journal_dirty(s5fs, inodep);
+
+        unlock_s5_inodes(s5fs);
+        s5_journal_end(s5fs, &h);
+
+        return ret;
+}
+
+
+/*
+ * Free an inode by freeing its disk blocks and putting it back on the
+ * inode free list.
+ *
+ * You should also reset the inode to an unused state (eg. zero-ing its
+ * list of blocks and setting its type to S5_FREE_TYPE).
+ *
+ * An inode which still has blocks goes on the orphan list instead, and
+ * s5_reclaimd frees its blocks and the inode later (see below).
+ */
+void
+s5_free_inode(vnode_t *vnode)
+{
+        uint32_t nblocks;
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_delalloc_t *dl;
+        s5_jhandle_t h;
+
+        KASSERT((S5_TYPE_DATA == inode->s5_type)
+                || (S5_TYPE_DIR == inode->s5_type)
+                || (S5_TYPE_CHR == inode->s5_type)
+                || (S5_TYPE_BLK == inode->s5_type));
+
+        s5_journal_begin(fs, &h, S5_JCREDITS_INODE);
+
+        /* pages which were never cleaned no longer need their blocks */
+        list_iterate_begin(&fs->s5f_delalloc, dl, s5_delalloc_t, dl_link) {
+                if (dl->dl_ino == vnode->vn_vno) {
+                        s5_unreserve_blocks(vnode, dl->dl_nreserved);
+                        break;
+                }
+        } list_iterate_end();
+
+        /* a file with blocks is left to s5_reclaimd, so that whoever
+         * dropped the last reference doesn't wait for them to be freed */
+        if (!(S5_INODE_INLINE & inode->s5_flags)
+            && ((S5_TYPE_DATA == inode->s5_type)
+                || (S5_TYPE_DIR == inode->s5_type))
+            && 0 < (nblocks = s5_inode_nblocks(fs, inode))) {
+                s5_orphan_inode(vnode, nblocks);
+                s5_journal_end(fs, &h);
+                return;
+        }
+
+        if (S5_INODE_INLINE & inode->s5_flags) {
+                inode->s5_flags = 0;
+                memset(inode->s5_inline, 0, S5_INLINE_SIZE);
+        }
+        inode->s5_type = S5_TYPE_FREE;
+
+        /* s5_alloc_inode() works on the inode table, so it has to be up
+         * to date before the inode goes on the free list */
+        lock_s5_inodes(fs);
+        inode->s5_next_free = fs->s5f_super->s5s_free_inode;
+        s5_dirty_inode(fs, inode);
+        s5_sync_inode(vnode);
+        fs->s5f_super->s5s_free_inode = inode->s5_number;
+        fs->s5f_nfree_inodes++;
+        unlock_s5_inodes(fs);
+
+        s5_dirty_super(fs);
+        s5_journal_end(fs, &h);
+}
+
+/*
+ * Deferred reclamation
+ *
+ * Freeing every block of a large file takes a while, and unlink() or
+ * the last close() shouldn't have to wait for it. So s5_free_inode()
+ * puts an inode which has blocks on the orphan list, which starts in
+ * the superblock and is chained through s5_next_free like the inode
+ * free list, and s5_reclaimd frees the blocks in the background: at
+ * most S5_RECLAIM_BATCH of them per transaction, from the end of the
+ * file backwards, so the inode is consistent after each one. Once it
+ * has none left the inode goes on the free list. The orphan list is
+ * on disk, so whatever was left of it at a crash is picked up at the
+ * next mount.
+ *
+ * Until they are freed the blocks are counted in s5f_npending, which
+ * s5fs_statfs() reports as pending rather than free. The allocators don't wait for them
+ * though: they may be holding a journal handle, which s5_reclaimd
+ * needs.
+ */
+
+#define S5_RECLAIM_BATCH        16
+
+static list_t s5_reclaim_list;          /* s5fs_t's with orphans */
+static ktqueue_t s5_reclaim_waitq;      /* s5_reclaimd sleeps here */
+static proc_t *s5_reclaimd = NULL;
+static kthread_t *s5_reclaimd_thr = NULL;
+
+static void *s5_reclaimd_run(int arg1, void *arg2);
+
+/*
+ * Count the blocks an inode's block map holds, its indirect block
+ * included. May block reading the indirect block, so the inode must not
+ * change meanwhile.
+ */
+uint32_t
+s5_inode_nblocks(s5fs_t *fs, s5_inode_t *inode)
+{
+        uint32_t i, n = 0, *ind;
+        pframe_t *pf;
+
+        KASSERT(!(S5_INODE_INLINE & inode->s5_flags));
+
+        for (i = 0; i < S5_NDIRECT_BLOCKS; ++i) {
+                if (0 != inode->s5_direct_blocks[i])
+                        n++;
+        }
+        if (0 != inode->s5_indirect_block) {
+                pframe_get(S5FS_TO_VMOBJ(fs), inode->s5_indirect_block, &pf);
+                KASSERT(pf && "because never fails for block_device vm_objects");
+                ind = (uint32_t *)pf->pf_addr;
+                for (i = 0; i < S5_NIDIRECT_BLOCKS; ++i) {
+                        if (0 != ind[i])
+                                n++;
+                }
+                n++;
+        }
+
+        return n;
+}
+
+/*
+ * Count the blocks still held by orphaned inodes by walking the orphan
+ * list. Used at mount time.
+ */
+uint32_t
+s5_count_pending_blocks(s5fs_t *fs)
+{
+        uint32_t count = 0;
+        uint32_t next = fs->s5f_super->s5s_orphan_inode;
+        s5_inode_t inode;
+        pframe_t *pf;
+
+        while ((uint32_t) -1 != next) {
+                pframe_get(S5FS_TO_VMOBJ(fs), S5_INODE_BLOCK(next), &pf);
+                KASSERT(pf && "never fails for block device vm_objects");
+                /* reading the indirect block may push the page out */
+                inode = *((s5_inode_t *)pf->pf_addr + S5_INODE_OFFSET(next));
+                count += s5_inode_nblocks(fs, &inode);
+                next = inode.s5_next_free;
+        }
+
+        return count;
+}
+
+/*
+ * Put an unlinked inode, which holds nblocks blocks, on the orphan list
+ * and let s5_reclaimd know. Called within a transaction.
+ */
+static void
+s5_orphan_inode(vnode_t *vnode, uint32_t nblocks)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+
+        /* s5_reclaimd works on the inode table, so it has to be up to
+         * date before the inode goes on the orphan list */
+        lock_s5_inodes(fs);
+        inode->s5_next_free = fs->s5f_super->s5s_orphan_inode;
+        s5_dirty_inode(fs, inode);
+        s5_sync_inode(vnode);
+        fs->s5f_super->s5s_orphan_inode = inode->s5_number;
+        unlock_s5_inodes(fs);
+
+        lock_s5_blocks(fs);
+        fs->s5f_npending += nblocks;
+        s5_dirty_super(fs);
+        unlock_s5_blocks(fs);
+
+        s5_reclaim_start(fs);
+}
+
+/*
+ * Free one block of an orphaned inode. May block.
+ */
+static void
+s5_reclaim_block(s5fs_t *fs, uint32_t blockno)
+{
+        lock_s5_blocks(fs);
+        s5_put_free_block(fs, blockno);
+        KASSERT(0 < fs->s5f_npending);
+        fs->s5f_npending--;
+        s5_dirty_super(fs);
+        unlock_s5_blocks(fs);
+}
+
+/*
+ * Free up to S5_RECLAIM_BATCH blocks of the inode at the head of the
+ * orphan list in one transaction, and if that was the last of them move
+ * the inode to the free list.
+ *
+ * Returns 1 if the orphan list was empty, 0 otherwise.
+ */
+static int
+s5_reclaim_some(s5fs_t *fs)
+{
+        s5_super_t *s = fs->s5f_super;
+        uint32_t ino, next, n = 0, *ind, *prev;
+        s5_inode_t *inode;
+        pframe_t *pf, *ibp, *ppf = NULL;
+        int i, done = 0;
+        s5_jhandle_t h;
+
+        if ((uint32_t) -1 == (ino = s->s5s_orphan_inode))
+                return 1;
+
+        /* the inode, and the one before it on the orphan list */
+        s5_journal_begin(fs, &h, S5_JCREDITS_INODE + 1
+                         + S5_JCREDITS_FREE(S5_RECLAIM_BATCH + 1));
+
+        /* nothing else touches an orphan, so it can be worked on in
+         * place in the inode table */
+        pframe_get(S5FS_TO_VMOBJ(fs), S5_INODE_BLOCK(ino), &pf);
+        KASSERT(pf && "because never fails for block_device vm_objects");
+        pframe_pin(pf);
+        inode = (s5_inode_t *)pf->pf_addr + S5_INODE_OFFSET(ino);
+        KASSERT(0 == inode->s5_linkcount);
+        KASSERT(!(S5_INODE_INLINE & inode->s5_flags));
+
+        if (0 != inode->s5_indirect_block) {
+                pframe_get(S5FS_TO_VMOBJ(fs), inode->s5_indirect_block, &ibp);
+                KASSERT(ibp && "because never fails for block_device vm_objects");
+                pframe_pin(ibp);
+                ind = (uint32_t *)ibp->pf_addr;
+                for (i = S5_NIDIRECT_BLOCKS - 1; 0 <= i && S5_RECLAIM_BATCH > n; --i) {
+                        if (0 != ind[i]) {
+                                s5_reclaim_block(fs, ind[i]);
+                                ind[i] = 0;
+                                n++;
+                        }
+                }
+                if (0 > i) {
+                        pframe_unpin(ibp);
+                        s5_reclaim_block(fs, inode->s5_indirect_block);
+                        inode->s5_indirect_block = 0;
+                } else {
+                        pframe_dirty(ibp);
+                        s5_journal_dirty(fs, ibp);
+                        pframe_unpin(ibp);
+                }
+        }
+
+        if (0 == inode->s5_indirect_block) {
+                for (i = S5_NDIRECT_BLOCKS - 1; 0 <= i && S5_RECLAIM_BATCH > n; --i) {
+                        if (0 != inode->s5_direct_blocks[i]) {
+                                s5_reclaim_block(fs, inode->s5_direct_blocks[i]);
+                                inode->s5_direct_blocks[i] = 0;
+                                n++;
+                        }
+                }
+                done = (0 > i);
+        }
+
+        if (done) {
+                lock_s5_inodes(fs);
+
+                /* other inodes may have been orphaned in front of it
+                 * while we blocked */
+                prev = &s->s5s_orphan_inode;
+                next = *prev;
+                while (ino != next) {
+                        KASSERT((uint32_t) -1 != next);
+                        if (NULL != ppf)
+                                pframe_unpin(ppf);
+                        pframe_get(S5FS_TO_VMOBJ(fs), S5_INODE_BLOCK(next), &ppf);
+                        KASSERT(ppf && "because never fails for block_device vm_objects");
+                        pframe_pin(ppf);
+                        prev = &((s5_inode_t *)ppf->pf_addr + S5_INODE_OFFSET(next))->s5_next_free;
+                        next = *prev;
+                }
+                *prev = inode->s5_next_free;
+                if (NULL != ppf) {
+                        pframe_dirty(ppf);
+                        s5_journal_dirty(fs, ppf);
+                        pframe_unpin(ppf);
+                }
+
+                inode->s5_type = S5_TYPE_FREE;
+                inode->s5_flags = 0;
+                inode->s5_next_free = s->s5s_free_inode;
+                s->s5s_free_inode = ino;
+                fs->s5f_nfree_inodes++;
+                unlock_s5_inodes(fs);
+
+                s5_dirty_super(fs);
+        }
+
+        pframe_dirty(pf);
+        s5_journal_dirty(fs, pf);
+        pframe_unpin(pf);
+
+        s5_journal_end(fs, &h);
+        return 0;
+}
+
+/*
+ * Have s5_reclaimd look at fs's orphan list. Does not block.
+ */
+void
+s5_reclaim_start(s5fs_t *fs)
+{
+        if (!list_link_is_linked(&fs->s5f_reclaim_link))
+                list_insert_tail(&s5_reclaim_list, &fs->s5f_reclaim_link);
+        sched_wakeup_on(&s5_reclaim_waitq);
+}
+
+/*
+ * Take fs away from s5_reclaimd and free what is left of its orphans in
+ * the calling thread, which must not be in a transaction. For
+ * unmounting.
+ */
+void
+s5_reclaim_stop(s5fs_t *fs)
+{
+        if (list_link_is_linked(&fs->s5f_reclaim_link))
+                list_remove(&fs->s5f_reclaim_link);
+        while (fs->s5f_reclaiming)
+                sched_sleep_on(&fs->s5f_reclaim_waitq);
+
+        while (!s5_reclaim_some(fs))
+                ;
+        KASSERT(0 == fs->s5f_npending);
+}
+
+/*
+ * Take turns at the file systems with orphans, a batch at a time, and
+ * sleep when there are none.
+ */
+static void *
+s5_reclaimd_run(int arg1, void *arg2)
+{
+        s5fs_t *fs;
+        int done;
+
+        while (1) {
+                while (!list_empty(&s5_reclaim_list)) {
+                        fs = list_head(&s5_reclaim_list, s5fs_t, s5f_reclaim_link);
+                        fs->s5f_reclaiming = 1;
+                        done = s5_reclaim_some(fs);
+
+                        /* s5_reclaim_stop() may have taken it off the
+                         * list while we blocked */
+                        if (list_link_is_linked(&fs->s5f_reclaim_link)) {
+                                list_remove(&fs->s5f_reclaim_link);
+                                if (!done)
+                                        list_insert_tail(&s5_reclaim_list,
+                                                         &fs->s5f_reclaim_link);
+                        }
+
+                        /* the unmount waiting for us may free fs */
+                        fs->s5f_reclaiming = 0;
+                        sched_broadcast_on(&fs->s5f_reclaim_waitq);
+                }
+
+                if (sched_cancellable_sleep_on(&s5_reclaim_waitq))
+                        kthread_exit((void *)0);
+        }
+        return NULL;
+}
+
+#ifdef __S5FS__
+/*
+ * Start s5_reclaimd. Called from idleproc, before the root file system
+ * is mounted.
+ */
+static __attribute__((unused)) void
+s5_reclaimd_init(void)
+{
+        list_init(&s5_reclaim_list);
+        sched_queue_init(&s5_reclaim_waitq);
+
+        KASSERT(curproc && (PID_IDLE == curproc->p_pid)
+                && "should be calling this from idleproc");
+        s5_reclaimd = proc_create("s5_reclaimd");
+        KASSERT(NULL != s5_reclaimd);
+        s5_reclaimd_thr = kthread_create(s5_reclaimd, s5_reclaimd_run, 0, NULL);
+        KASSERT(NULL != s5_reclaimd_thr);
+
+        sched_make_runnable(s5_reclaimd_thr);
+}
+init_func(s5_reclaimd_init);
+init_depends(sched_init);
+#endif
+
+/*
+ * Stop s5_reclaimd and wait for it. Every s5 file system must have been
+ * unmounted.
+ */
+void
+s5_reclaimd_shutdown(void)
+{
+        pid_t pid, child;
+
+        KASSERT(NULL != s5_reclaimd_thr);
+        KASSERT(list_empty(&s5_reclaim_list));
+
+        pid = s5_reclaimd->p_pid;
+        kthread_cancel(s5_reclaimd_thr, (void *)0);
+        s5_reclaimd_thr = NULL;
+
+        child = do_waitpid(pid, 0, NULL);
+        KASSERT(pid == child && "waited on process other than s5_reclaimd");
+}
+
+/*
+ * Copy an in-core inode back into pf, the inode table page holding it.
+ * Does not block.
+ */
+static void
+s5_write_inode(s5fs_t *fs, s5_icore_t *ic, pframe_t *pf)
+{
+        KASSERT(ic->ic_dirty);
+        KASSERT(pf->pf_pagenum == S5_INODE_BLOCK(ic->ic_inode.s5_number));
+
+        memcpy((s5_inode_t *)pf->pf_addr + S5_INODE_OFFSET(ic->ic_inode.s5_number),
+               &ic->ic_inode, sizeof(s5_inode_t));
+        list_remove(&ic->ic_link);
+        ic->ic_dirty = 0;
+        pframe_dirty(pf);
+        s5_journal_dirty(fs, pf);
+}
+
+/*
+ * Write back the given vnode's inode, if it has changed.
+ */
+void
+s5_sync_inode(vnode_t *vnode)
+{
+        s5_icore_t *ic = (s5_icore_t *)vnode->vn_i;
+        pframe_t *pf;
+
+        if (!ic->ic_dirty)
+                return;
+
+        pframe_get(S5FS_TO_VMOBJ(VNODE_TO_S5FS(vnode)),
+                   S5_INODE_BLOCK(vnode->vn_vno), &pf);
+        KASSERT(pf && "because never fails for block_device vm_objects");
+
+        /* another thread may have written it back while we blocked */
+        if (ic->ic_dirty)
+                s5_write_inode(VNODE_TO_S5FS(vnode), ic, pf);
+}
+
+/*
+ * Write back every in-core inode which has changed.
+ *
+ * The vnodes on the list are not ours, so one may be gone by the time a
+ * blocking pframe_get() returns. Pages are only read in here; the copy
+ * is made once the page is resident, without blocking.
+ */
+void
+s5_sync_inodes(s5fs_t *fs)
+{
+        s5_icore_t *ic;
+        pframe_t *pf;
+        uint32_t blockno;
+
+        while (!list_empty(&fs->s5f_dirty_inodes)) {
+                ic = list_head(&fs->s5f_dirty_inodes, s5_icore_t, ic_link);
+                blockno = S5_INODE_BLOCK(ic->ic_inode.s5_number);
+
+                pf = pframe_get_resident(S5FS_TO_VMOBJ(fs), blockno);
+                if (NULL == pf || pframe_is_busy(pf)) {
+                        pframe_get(S5FS_TO_VMOBJ(fs), blockno, &pf);
+                        KASSERT(pf && "because never fails for block_device "
+                                "vm_objects");
+                        continue;
+                }
+                s5_write_inode(fs, ic, pf);
+        }
+}
+
+/*
+ * Free dirent slot tracking.
+ *
+ * Removing an entry just clears its name, leaving a hole in the
+ * directory. Each directory keeps a bitmap of its holes so that
+ * s5_link() can fill the lowest one without reading the directory,
+ * and so that s5_remove_dirent() knows when the directory has become
+ * mostly empty and is worth compacting.
+ */
+
+/* Compact a directory when more than half of its slots are unused and
+ * it spans more than one block, but no more than S5_DIR_COMPACT_MAX, so
+ * that compacting it fits in the transaction removing the entry. */
+#define S5_DIR_COMPACT_MAX      4
+#define S5_DIR_SHOULD_COMPACT(ds)                                       \
+        ((ds)->sd_nslots > S5_DIRENTS_PER_BLOCK                         \
+         && (ds)->sd_nslots <= S5_DIR_COMPACT_MAX * S5_DIRENTS_PER_BLOCK \
+         && 2 * (ds)->sd_nfree > (ds)->sd_nslots)
+
+/*
+ * Credits for adding or removing a directory entry: the directory
+ * block, a new block for the directory to grow into, the inode of the
+ * file, and compacting the directory, which rewrites its blocks and
+ * frees those left over.
+ */
+#define S5_JCREDITS_DIRENT      (S5_JCREDITS_INODE + S5_JCREDITS_ALLOC(1) + 2 \
+                                 + S5_DIR_COMPACT_MAX                   \
+                                 + S5_JCREDITS_FREE(S5_DIR_COMPACT_MAX))
+
+#define SLOT_WORD(slot)         ((slot) / 32)
+#define SLOT_BIT(slot)          (1U << ((slot) % 32))
+
+static int
+s5_slot_is_free(s5_dirslots_t *ds, uint32_t slot)
+{
+        KASSERT(slot < ds->sd_nslots);
+        return 0 != (ds->sd_map[SLOT_WORD(slot)] & SLOT_BIT(slot));
+}
+
+/*
+ * Make sure that the map has room for nslots slots. Returns 0 on
+ * success or -ENOMEM.
+ */
+static int
+s5_dirslots_grow(s5_dirslots_t *ds, uint32_t nslots)
+{
+        uint32_t words, *map;
+
+        if (SLOT_WORD(nslots + 31) <= ds->sd_mapwords)
+                return 0;
+
+        /* grow geometrically so appending stays cheap */
+        words = MAX(SLOT_WORD(nslots + 31), 2 * ds->sd_mapwords);
+        if (NULL == (map = (uint32_t *)kmalloc(words * sizeof(uint32_t))))
+                return -ENOMEM;
+        memset(map, 0, words * sizeof(uint32_t));
+        if (NULL != ds->sd_map) {
+                memcpy(map, ds->sd_map, ds->sd_mapwords * sizeof(uint32_t));
+                kfree(ds->sd_map);
+        }
+        ds->sd_map = map;
+        ds->sd_mapwords = words;
+        return 0;
+}
+
+static void
+s5_dirslots_mark_free(s5_dirslots_t *ds, uint32_t slot)
+{
+        KASSERT(!s5_slot_is_free(ds, slot));
+        ds->sd_map[SLOT_WORD(slot)] |= SLOT_BIT(slot);
+        ds->sd_nfree++;
+        if (slot < ds->sd_hint)
+                ds->sd_hint = slot;
+}
+
+/*
+ * Take the lowest unused slot out of the map and return its index, or
+ * return -1 if the directory has no holes.
+ */
+static int
+s5_dirslots_take(s5_dirslots_t *ds)
+{
+        uint32_t w, bit, slot;
+
+        if (0 == ds->sd_nfree)
+                return -1;
+
+        for (w = SLOT_WORD(ds->sd_hint); w < ds->sd_mapwords; ++w) {
+                if (0 == ds->sd_map[w])
+                        continue;
+                for (bit = 0; !(ds->sd_map[w] & (1U << bit)); ++bit)
+                        ;
+                slot = w * 32 + bit;
+                KASSERT(slot < ds->sd_nslots);
+                ds->sd_map[w] &= ~(1U << bit);
+                ds->sd_nfree--;
+                ds->sd_hint = slot + 1;
+                return slot;
+        }
+
+        panic("s5fs: dirent slot map of inode %d lost %d free slots\n",
+              ds->sd_ino, ds->sd_nfree);
+        return -1;
+}
+
+static void
+s5_dirslots_free(s5_dirslots_t *ds)
+{
+        list_remove(&ds->sd_link);
+        if (NULL != ds->sd_map)
+                kfree(ds->sd_map);
+        kfree(ds);
+}
+
+/*
+ * Return the slot map for the given directory, reading the directory
+ * once to build it if this is the first time it is needed. Returns
+ * NULL if there is not enough memory (or the directory can't be read),
+ * in which case callers just go without the map.
+ */
+static s5_dirslots_t *
+s5_dirslots_get(vnode_t *dir)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(dir);
+        s5_dirslots_t *ds;
+        s5_dirent_t d;
+        uint32_t slot;
+        int ret;
+
+        KASSERT(S_ISDIR(dir->vn_mode));
+
+        list_iterate_begin(&fs->s5f_dirslots, ds, s5_dirslots_t, sd_link) {
+                if (ds->sd_ino == dir->vn_vno)
+                        return ds;
+        } list_iterate_end();
+
+        if (NULL == (ds = (s5_dirslots_t *)kmalloc(sizeof(s5_dirslots_t))))
+                return NULL;
+        ds->sd_ino = dir->vn_vno;
+        ds->sd_nslots = dir->vn_len / sizeof(s5_dirent_t);
+        ds->sd_nfree = 0;
+        ds->sd_hint = ds->sd_nslots;
+        ds->sd_mapwords = 0;
+        ds->sd_map = NULL;
+        list_link_init(&ds->sd_link);
+
+        if (0 > s5_dirslots_grow(ds, ds->sd_nslots)) {
+                kfree(ds);
+                return NULL;
+        }
+
+        for (slot = 0; slot < ds->sd_nslots; ++slot) {
+                ret = s5_read_file(dir, slot * sizeof(s5_dirent_t),
+                                   (char *)&d, sizeof(s5_dirent_t));
+                if (ret != sizeof(s5_dirent_t)) {
+                        kfree(ds->sd_map);
+                        kfree(ds);
+                        return NULL;
+                }
+                if ('\0' == d.s5d_name[0])
+                        s5_dirslots_mark_free(ds, slot);
+        }
+
+        list_insert_tail(&fs->s5f_dirslots, &ds->sd_link);
+        return ds;
+}
+
+/*
+ * Throw away the slot map of the given directory, if it has one. Called
+ * when the directory's vnode goes away, so that there is never a map
+ * for a directory which is not in memory.
+ */
+void
+s5_dirslots_release(vnode_t *dir)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(dir);
+        s5_dirslots_t *ds;
+
+        list_iterate_begin(&fs->s5f_dirslots, ds, s5_dirslots_t, sd_link) {
+                if (ds->sd_ino == dir->vn_vno) {
+                        s5_dirslots_free(ds);
+                        return;
+                }
+        } list_iterate_end();
+}
+
+/*
+ * Throw away the slot maps of every directory on this file system.
+ * Called at unmount.
+ */
+void
+s5_dirslots_release_all(fs_t *fs)
+{
+        s5fs_t *s5fs = FS_TO_S5FS(fs);
+        s5_dirslots_t *ds;
+
+        list_iterate_begin(&s5fs->s5f_dirslots, ds, s5_dirslots_t, sd_link) {
+                s5_dirslots_free(ds);
+        } list_iterate_end();
+}
+
+/*
+ * Move every live entry of the directory down into the holes below it,
+ * preserving their order, and free the blocks that are no longer
+ * needed. Since "." and ".." are always the first two entries they do
+ * not move.
+ *
+ * Note that this changes the offsets of entries, so a readdir() in
+ * progress on the directory may see an entry twice or miss it.
+ */
+static int
+s5_dir_compact(vnode_t *dir, s5_dirslots_t *ds)
+{
+        s5_dirent_t d, empty;
+        uint32_t from, to = 0;
+        int ret;
+
+        dprintf("compacting directory %d: %d of %d slots unused\n",
+                dir->vn_vno, ds->sd_nfree, ds->sd_nslots);
+
+        memset(&empty, 0, sizeof(s5_dirent_t));
+        for (from = 0; from < ds->sd_nslots; ++from) {
+                if (s5_slot_is_free(ds, from))
+                        continue;
+                if (from != to) {
+                        /* every entry is always in exactly one slot, so
+                         * stopping part way leaves a valid directory */
+                        if (0 > (ret = s5_read_file(dir, from * sizeof(s5_dirent_t),
+                                                    (char *)&d, sizeof(s5_dirent_t)))
+                            || 0 > (ret = s5_write_file(dir, to * sizeof(s5_dirent_t),
+                                                        (const char *)&d,
+                                                        sizeof(s5_dirent_t)))
+                            || 0 > (ret = s5_write_file(dir, from * sizeof(s5_dirent_t),
+                                                        (const char *)&empty,
+                                                        sizeof(s5_dirent_t)))) {
+                                /* the map is stale now, rebuild it later */
+                                s5_dirslots_free(ds);
+                                return ret;
+                        }
+                }
+                ++to;
+        }
+
+        KASSERT(to == ds->sd_nslots - ds->sd_nfree);
+        s5_truncate_file(dir, to * sizeof(s5_dirent_t));
+
+        memset(ds->sd_map, 0, ds->sd_mapwords * sizeof(uint32_t));
+        ds->sd_nslots = to;
+        ds->sd_nfree = 0;
+        ds->sd_hint = to;
+        return 0;
+}
+
+/*
+ * Locate the directory entry in the given inode with the given name,
+ * and return its inode number. If there is no entry with the given
+ * name, return -ENOENT.
+ *
+ * Unused slots have an empty name and never match. If slotp is non-NULL
+ * the index of the matching slot is stored there.
+ */
+static int
+s5_find_slot(vnode_t *vnode, const char *name, size_t namelen, uint32_t *slotp)
+{
+        s5_dirent_t d;
+        off_t off;
+        int ret;
+
+        KASSERT(S_ISDIR(vnode->vn_mode));
+
+        if (0 == namelen)
+                return -ENOENT;
+
+        for (off = 0; off < vnode->vn_len; off += sizeof(s5_dirent_t)) {
+                ret = s5_read_file(vnode, off, (char *)&d, sizeof(s5_dirent_t));
+                if (0 > ret)
+                        return ret;
+                KASSERT(sizeof(s5_dirent_t) == ret);
+
+                if ('\0' != d.s5d_name[0] && name_match(d.s5d_name, name, namelen)) {
+                        if (NULL != slotp)
+                                *slotp = off / sizeof(s5_dirent_t);
+                        return d.s5d_inode;
+                }
+        }
+
+        return -ENOENT;
+}
+
+/*
+ * Locate the directory entry in the given inode with the given name,
+ * and return its inode number. If there is no entry with the given
+ * name, return -ENOENT.
+ */
+int
+s5_find_dirent(vnode_t *vnode, const char *name, size_t namelen)
+{
+        return s5_find_slot(vnode, name, namelen, NULL);
+}
+
+/*
+ * Locate the directory entry in the given inode with the given name,
+ * and delete it. If there is no entry with the given name, return
+ * -ENOENT.
+ *
+ * The entry is deleted by clearing its name and the slot is recorded in
+ * the directory's slot map for s5_link() to reuse. Removing the last
+ * entry shrinks the directory past any trailing holes, and a directory
+ * which has become mostly holes is compacted.
+ *
+ * When this function returns, the inode link count on the removed file
+ * should be decremented.
+ */
+int
+s5_remove_dirent(vnode_t *vnode, const char *name, size_t namelen)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        s5_jhandle_t h;
+        int ret;
+
+        s5_journal_begin(fs, &h, S5_JCREDITS_DIRENT);
+        if (0 == (ret = s5_clear_dirent(vnode, name, namelen)))
+                s5_journal_dir(vnode);
+        s5_journal_end(fs, &h);
+        return ret;
+}
+
+/*
+ * Create a new directory entry in directory 'parent' with the given name, which
+ * refers to the same file as 'child'.
+ *
+ * The entry goes into the lowest unused slot from the directory's slot
+ * map, or is appended when the directory has no holes.
+ *
+ * When this function returns, the inode link count on the file that was linked to
+ * should be incremented, unless the entry is "." (parent == child).
+ */
+int
+s5_link(vnode_t *parent, vnode_t *child, const char *name, size_t namelen)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(parent);
+        s5_jhandle_t h;
+        int ret;
+
+        s5_journal_begin(fs, &h, S5_JCREDITS_DIRENT);
+        if (0 == (ret = s5_add_dirent(parent, child, name, namelen)))
+                s5_journal_dir(parent);
+        s5_journal_end(fs, &h);
+        return ret;
+}
+
+/*
+ * Move the entry 'oldname' in 'olddir' to 'newname' in 'newdir', which
+ * must be on the same file system. An existing non-directory entry
+ * called 'newname' is pointed at the moved file in place and loses a
+ * link; otherwise the new entry is made like s5_link() makes one. The
+ * old entry is then cleared like s5_remove_dirent() clears one.
+ *
+ * Unlike s5_link() followed by s5_remove_dirent(), the moved file's
+ * link count is never touched and the whole move is one transaction,
+ * so a crash leaves either the old name or the new one.
+ *
+ * Directories can't be moved (-EPERM) or replaced (-EISDIR). Renaming a
+ * file to a name which already refers to it does nothing.
+ */
+int
+s5_rename(vnode_t *olddir, const char *oldname, size_t oldnamelen,
+          vnode_t *newdir, const char *newname, size_t newnamelen)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(olddir);
+        s5_jhandle_t h;
+        int ret;
+
+        KASSERT(olddir->vn_fs == newdir->vn_fs);
+
+        /* the new entry may replace a file's, or grow newdir */
+        s5_journal_begin(fs, &h, S5_JCREDITS_DIRENT + S5_JCREDITS_INODE
+                         + S5_JCREDITS_ALLOC(1) + 1);
+        if (0 == (ret = s5_move_dirent(olddir, oldname, oldnamelen,
+                                       newdir, newname, newnamelen))) {
+                s5_journal_dir(newdir);
+                if (olddir != newdir)
+                        s5_journal_dir(olddir);
+        }
+        s5_journal_end(fs, &h);
+        return ret;
+}
+
+/* Does the work of s5_remove_dirent(). */
+static int
+s5_clear_dirent(vnode_t *vnode, const char *name, size_t namelen)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(vnode);
+        vnode_t *child;
+        uint32_t slot;
+        int ino, ret;
+
+        if (0 > (ino = s5_find_slot(vnode, name, namelen, &slot)))
+                return ino;
+
+        /* "." and ".." are only ever removed along with the directory */
+        KASSERT((uint32_t)ino != vnode->vn_vno);
+
+        if (0 > (ret = s5_empty_slot(vnode, slot)))
+                return ret;
+
+        child = vget(vnode->vn_fs, ino);
+        KASSERT(child);
+        VNODE_TO_S5INODE(child)->s5_linkcount--;
+        s5_dirty_inode(fs, VNODE_TO_S5INODE(child));
+        vput(child);
+        return 0;
+}
+
+/*
+ * Clear the given slot of the directory and record it in the slot map,
+ * shrinking or compacting the directory as s5_remove_dirent()
+ * describes.
+ */
+static int
+s5_empty_slot(vnode_t *vnode, uint32_t slot)
+{
+        s5_dirslots_t *ds;
+        s5_dirent_t empty;
+        uint32_t nslots;
+        int ret;
+
+        /* build the map while the directory still has this entry */
+        ds = s5_dirslots_get(vnode);
+
+        memset(&empty, 0, sizeof(s5_dirent_t));
+        if (0 > (ret = s5_write_file(vnode, slot * sizeof(s5_dirent_t),
+                                     (const char *)&empty, sizeof(s5_dirent_t))))
+                return ret;
+
+        if (NULL == ds)
+                return 0;
+
+        s5_dirslots_mark_free(ds, slot);
+
+        /* drop trailing holes */
+        for (nslots = ds->sd_nslots; nslots > 0 && s5_slot_is_free(ds, nslots - 1);
+             --nslots) {
+                ds->sd_map[SLOT_WORD(nslots - 1)] &= ~SLOT_BIT(nslots - 1);
+                ds->sd_nfree--;
+        }
+        if (nslots < ds->sd_nslots) {
+                ds->sd_nslots = nslots;
+                ds->sd_hint = MIN(ds->sd_hint, nslots);
+                s5_truncate_file(vnode, nslots * sizeof(s5_dirent_t));
+        }
+
+        if (S5_DIR_SHOULD_COMPACT(ds))
+                return s5_dir_compact(vnode, ds);
+        return 0;
+}
+
+/* Does the work of s5_link(). */
+static int
+s5_add_dirent(vnode_t *parent, vnode_t *child, const char *name, size_t namelen)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(parent);
+        s5_inode_t *inode = VNODE_TO_S5INODE(child);
+        int ret;
+
+        KASSERT(S_ISDIR(parent->vn_mode));
+        KASSERT(0 < namelen);
+
+        if (S5_NAME_LEN <= namelen)
+                return -ENAMETOOLONG;
+        if (0 <= (ret = s5_find_dirent(parent, name, namelen)))
+                return -EEXIST;
+        if (-ENOENT != ret)
+                return ret;
+
+        if (0 > (ret = s5_put_dirent(parent, child->vn_vno, name, namelen)))
+                return ret;
+
+        /* "." does not count towards the link count */
+        if (parent != child) {
+                inode->s5_linkcount++;
+                s5_dirty_inode(fs, inode);
+        }
+        return 0;
+}
+
+/*
+ * Write an entry for inode 'ino' into the lowest unused slot of the
+ * directory, or append it when the directory has no holes. The caller
+ * has made sure that the name is free.
+ */
+static int
+s5_put_dirent(vnode_t *parent, ino_t ino, const char *name, size_t namelen)
+{
+        s5_dirslots_t *ds;
+        s5_dirent_t d;
+        int slot, ret;
+
+        memset(&d, 0, sizeof(s5_dirent_t));
+        d.s5d_inode = ino;
+        memcpy(d.s5d_name, name, namelen);
+
+        ds = s5_dirslots_get(parent);
+        if (NULL == ds || 0 > (slot = s5_dirslots_take(ds)))
+                slot = parent->vn_len / sizeof(s5_dirent_t);
+
+        if (0 > (ret = s5_write_file(parent, slot * sizeof(s5_dirent_t),
+                                     (const char *)&d, sizeof(s5_dirent_t)))) {
+                if (NULL != ds && (uint32_t)slot < ds->sd_nslots)
+                        s5_dirslots_mark_free(ds, slot);
+                return ret;
+        }
+        KASSERT(sizeof(s5_dirent_t) == ret);
+
+        if (NULL != ds && (uint32_t)slot == ds->sd_nslots) {
+                /* if the map can't grow, forget it and rebuild it later */
+                if (0 > s5_dirslots_grow(ds, slot + 1))
+                        s5_dirslots_free(ds);
+                else
+                        ds->sd_nslots = ds->sd_hint = slot + 1;
+        }
+
+        return 0;
+}
+
+/* Does the work of s5_rename(). */
+static int
+s5_move_dirent(vnode_t *olddir, const char *oldname, size_t oldnamelen,
+               vnode_t *newdir, const char *newname, size_t newnamelen)
+{
+        s5fs_t *fs = VNODE_TO_S5FS(olddir);
+        vnode_t *vn;
+        uint32_t oldslot, newslot, ino;
+        int ret, target;
+
+        KASSERT(S_ISDIR(olddir->vn_mode) && S_ISDIR(newdir->vn_mode));
+        KASSERT(0 < newnamelen);
+
+        if (S5_NAME_LEN <= newnamelen)
+                return -ENAMETOOLONG;
+        if (0 > (ret = s5_find_slot(olddir, oldname, oldnamelen, &oldslot)))
+                return ret;
+        ino = ret;
+
+        vn = vget(olddir->vn_fs, ino);
+        KASSERT(vn);
+        ret = S_ISDIR(vn->vn_mode) ? -EPERM : 0;
+        vput(vn);
+        if (0 > ret)
+                return ret;
+
+        target = s5_find_slot(newdir, newname, newnamelen, &newslot);
+        if ((uint32_t)target == ino)
+                return 0;
+
+        if (0 <= target) {
+                vn = vget(newdir->vn_fs, target);
+                KASSERT(vn);
+                if (S_ISDIR(vn->vn_mode)) {
+                        vput(vn);
+                        return -EISDIR;
+                }
+                /* only the inode number of the existing entry changes */
+                ret = s5_write_file(newdir, newslot * sizeof(s5_dirent_t)
+                                    + offsetof(s5_dirent_t, s5d_inode),
+                                    (const char *)&ino, sizeof(uint32_t));
+                if (0 <= ret) {
+                        VNODE_TO_S5INODE(vn)->s5_linkcount--;
+                        s5_dirty_inode(fs, VNODE_TO_S5INODE(vn));
+                }
+                vput(vn);
+                if (0 > ret)
+                        return ret;
+        } else if (-ENOENT != target) {
+                return target;
+        } else if (0 > (ret = s5_put_dirent(newdir, ino, newname, newnamelen))) {
+                return ret;
+        }
+
+        /* putting the new entry never moves the old one */
+        return s5_empty_slot(olddir, oldslot);
+}
+
+/*
+ * Directory blocks live in the directory's own memory object, so the
+ * journal cannot pin them the way it pins block device pages. Instead,
+ * clean every dirty page of 'dir' while the caller's handle is open;
+ * s5fs_cleanpage() hands each one to s5_journal_log(), which keeps a
+ * copy for the running transaction.
+ */
+static void
+s5_journal_dir(vnode_t *dir)
+{
+        pframe_t *pf;
+
+        if (NULL == VNODE_TO_S5FS(dir)->s5f_journal)
+                return;
+restart:
+        list_iterate_begin(&dir->vn_mmobj.mmo_respages, pf, pframe_t, pf_olink) {
+                if (pframe_is_dirty(pf) && !pframe_is_busy(pf)
+                    && !pframe_is_pinned(pf)) {
+                        /* a failed write leaves the page for pageoutd */
+                        if (0 > pframe_clean(pf))
+                                return;
+                        /* cleaning may block, so the list may have changed */
+                        goto restart;
+                }
+        } list_iterate_end();
+}
+
+/*
+ * Return the number of blocks that this inode has allocated on disk.
+ * This should include the indirect block, but not include sparse
+ * blocks.
  *
- * You'll probably want to use pframe_get().
+ * This is only used by s5fs_stat(), which holds the vnode's mutex so
+ * that the block map doesn't change while the indirect block is read.
  */
 int
 s5_inode_blocks(vnode_t *vnode)
 {
-        NOT_YET_IMPLEMENTED("S5FS: s5_inode_blocks");
-        return -1;
+        s5_inode_t *inode = VNODE_TO_S5INODE(vnode);
+
+        KASSERT(kmutex_owns_mutex(&vnode->vn_mutex));
+
+        /* an inline file's data is in its inode, and a device's
+         * indirect block field holds its devid */
+        if ((S5_INODE_INLINE & inode->s5_flags)
+            || ((S5_TYPE_DATA != inode->s5_type)
+                && (S5_TYPE_DIR != inode->s5_type)))
+                return 0;
+
+        return s5_inode_nblocks(VNODE_TO_S5FS(vnode), inode);
 }
 
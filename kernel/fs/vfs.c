@@ -20,6 +20,7 @@
 #include "fs/vnode.h"
 #include "fs/vfs_syscall.h"
 #include "fs/ramfs/ramfs.h"
+#include "fs/procfs/procfs.h"
 
 #include "fs/stat.h"
 #include "fs/fcntl.h"
@@ -132,6 +133,9 @@ vfs_init(void)
 init_func(vfs_init);
 init_depends(vnode_init);
 init_depends(file_init);
+#ifdef __S5FS__
+init_depends(s5_reclaimd_init);
+#endif
 
 int
 vfs_shutdown()
@@ -183,6 +187,22 @@ vfs_shutdown()
         return ret;
 }
 
+void
+vfs_sync(void)
+{
+        fs_t *fs = vfs_root_vn->vn_fs;
+
+        if (fs->fs_op->sync)
+                fs->fs_op->sync(fs);
+
+#ifdef __MOUNTING__
+        list_iterate_begin(&mounted_fs_list, fs, fs_t, fs_link) {
+                if (fs->fs_op->sync)
+                        fs->fs_op->sync(fs);
+        } list_iterate_end();
+#endif
+}
+
 /*
  * Given an fs_t, we search through the list of known file systems
  * and call the proper mount function.
@@ -198,6 +218,7 @@ mountfunc(fs_t *fs)
                 { "s5fs", s5fs_mount },
 #endif
                 { "ramfs", ramfs_mount },
+                { "procfs", procfs_mount },
         };
         unsigned i;
 
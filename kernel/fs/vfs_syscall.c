@@ -16,7 +16,11 @@
 #include "fs/open.h"
 #include "fs/fcntl.h"
 #include "fs/lseek.h"
+#include "fs/readahead.h"
 #include "mm/kmalloc.h"
+#include "mm/page.h"
+#include "mm/pframe.h"
+#include "proc/sched.h"
 #include "util/string.h"
 #include "util/printf.h"
 #include "fs/stat.h"
@@ -30,7 +34,8 @@
 
 /* To read a file:
  *      o fget(fd)
- *      o call its virtual read vn_op
+ *      o call its virtual read vn_op, or its read_direct vn_op if
+ *        f_mode & FMODE_DIRECT
  *      o update f_pos
  *      o fput() it
  *      o return the number of bytes read, or an error
@@ -53,7 +58,8 @@ do_read(int fd, void *buf, size_t nbytes)
 
 /* Very similar to do_read.  Check f_mode to be sure the file is writable.  If
  * f_mode & FMODE_APPEND, do_lseek() to the end of the file, call the write
- * vn_op, and fput the file.  As always, be mindful of refcount leaks.
+ * vn_op (write_direct if f_mode & FMODE_DIRECT), and fput the file.  As
+ * always, be mindful of refcount leaks.
  *
  * Error cases you must handle for this function at the VFS level:
  *      o EBADF
@@ -246,19 +252,59 @@ do_link(const char *from, const char *to)
         return -1;
 }
 
-/*      o link newname to oldname
- *      o unlink oldname
- *      o return the value of unlink, or an error
+/*
+ * Move oldname to newname with the rename() vnode operation of the
+ * directory containing oldname, replacing newname if it exists. The
+ * file system does this in one step, so unlike linking newname and then
+ * unlinking oldname there is never a moment where both names (or
+ * neither) exist.
+ *
+ * Remember to vput the vnodes returned from dir_namev.
  *
- * Note that this does not provide the same behavior as the
- * Linux system call (if unlink fails then two links to the
- * file could exist).
+ * Error cases you must handle for this function at the VFS level:
+ *      o ENOENT
+ *        oldname does not exist, or a directory component in oldname
+ *        or newname does not exist.
+ *      o ENOTDIR
+ *        A component used as a directory in oldname or newname is not,
+ *        in fact, a directory.
+ *      o ENAMETOOLONG
+ *        A component of oldname or newname was too long.
+ *      o EXDEV
+ *        oldname and newname are on different file systems.
+ *      o EPERM
+ *        oldname is a directory (as with do_link()).
+ *      o EISDIR
+ *        newname is a directory.
  */
 int
 do_rename(const char *oldname, const char *newname)
 {
-        NOT_YET_IMPLEMENTED("VFS: do_rename");
-        return -1;
+        vnode_t *olddir, *newdir;
+        const char *oldbase, *newbase;
+        size_t oldlen, newlen;
+        int ret;
+
+        if (0 > (ret = dir_namev(oldname, &oldlen, &oldbase, NULL, &olddir)))
+                return ret;
+        if (0 > (ret = dir_namev(newname, &newlen, &newbase, NULL, &newdir))) {
+                vput(olddir);
+                return ret;
+        }
+
+        if (0 == oldlen || 0 == newlen)
+                ret = -ENOENT;
+        else if (NAME_LEN < oldlen || NAME_LEN < newlen)
+                ret = -ENAMETOOLONG;
+        else if (olddir->vn_fs != newdir->vn_fs)
+                ret = -EXDEV;
+        else
+                ret = olddir->vn_ops->rename(olddir, oldbase, oldlen,
+                                             newdir, newbase, newlen);
+
+        vput(newdir);
+        vput(olddir);
+        return ret;
 }
 
 /* Make the named directory the current process's cwd (current working
@@ -303,21 +349,262 @@ do_getdent(int fd, struct dirent *dirp)
         return -1;
 }
 
+/*
+ * The readdirplus() vnode operation for file systems which don't have
+ * one: read each entry with readdir() and stat the file it names through
+ * its vnode. That still saves the path walk a stat() by name would do.
+ */
+static int
+readdirplus_vnode(vnode_t *dir, off_t *offset, direntplus_t *dp, int count)
+{
+        vnode_t *vn;
+        int n, ret;
+
+        for (n = 0; n < count; ++n, ++dp) {
+                if (0 >= (ret = dir->vn_ops->readdir(dir, *offset, &dp->dp_dirent)))
+                        return (0 < n) ? n : ret;
+
+                vn = vget(dir->vn_fs, dp->dp_dirent.d_ino);
+                KASSERT(vn->vn_ops && vn->vn_ops->stat);
+                if (0 > (ret = vn->vn_ops->stat(vn, &dp->dp_stat))) {
+                        vput(vn);
+                        return (0 < n) ? n : ret;
+                }
+                vput(vn);
+                *offset += ret;
+        }
+        return n;
+}
+
+/*
+ * Read up to count directory entries from fd into dp, each together
+ * with the stat() of the file it names, and advance f_pos past them.
+ * Returns the number of entries read, 0 at the end of the directory.
+ *
+ * This is what `ls -l` wants: the file system can stat the entries
+ * without a path walk each, and s5fs reads each inode block once for
+ * all of the entries in it.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        Invalid file descriptor fd.
+ *      o ENOTDIR
+ *        File descriptor does not refer to a directory.
+ */
+int
+do_getdentsplus(int fd, direntplus_t *dp, int count)
+{
+        file_t *f;
+        vnode_t *vn;
+        int ret;
+
+        if (NULL == (f = fget(fd)))
+                return -EBADF;
+        vn = f->f_vnode;
+
+        if (!S_ISDIR(vn->vn_mode))
+                ret = -ENOTDIR;
+        else if (NULL != vn->vn_ops->readdirplus)
+                ret = vn->vn_ops->readdirplus(vn, &f->f_pos, dp, count);
+        else
+                ret = readdirplus_vnode(vn, &f->f_pos, dp, count);
+
+        fput(f);
+        return ret;
+}
+
 /*
  * Modify f_pos according to offset and whence.
  *
+ * SEEK_DATA and SEEK_HOLE move to the first data or hole at or after
+ * offset, using the seek_hole() vnode operation. If the vnode has no
+ * seek_hole(), the whole file is data and the only hole is at the end.
+ *
  * Error cases you must handle for this function at the VFS level:
  *      o EBADF
  *        fd is not an open file descriptor.
  *      o EINVAL
- *        whence is not one of SEEK_SET, SEEK_CUR, SEEK_END; or the resulting
- *        file offset would be negative.
+ *        whence is not one of SEEK_SET, SEEK_CUR, SEEK_END, SEEK_DATA,
+ *        SEEK_HOLE; or the resulting file offset would be negative.
+ *      o ENXIO
+ *        whence is SEEK_DATA or SEEK_HOLE and offset is negative or not
+ *        before the end of the file, or whence is SEEK_DATA and there is
+ *        no data after offset.
  */
 int
 do_lseek(int fd, int offset, int whence)
 {
-        NOT_YET_IMPLEMENTED("VFS: do_lseek");
-        return -1;
+        file_t *f;
+        vnode_t *vn;
+        int pos;
+
+        if (NULL == (f = fget(fd)))
+                return -EBADF;
+        vn = f->f_vnode;
+
+        switch (whence) {
+                case SEEK_SET:
+                        pos = offset;
+                        break;
+                case SEEK_CUR:
+                        pos = f->f_pos + offset;
+                        break;
+                case SEEK_END:
+                        pos = vn->vn_len + offset;
+                        break;
+                case SEEK_DATA:
+                case SEEK_HOLE:
+                        if (NULL != vn->vn_ops->seek_hole)
+                                pos = vn->vn_ops->seek_hole(vn, offset, whence);
+                        else if (0 > offset || offset >= vn->vn_len)
+                                pos = -ENXIO;
+                        else
+                                pos = SEEK_DATA == whence ? offset : vn->vn_len;
+                        break;
+                default:
+                        pos = -EINVAL;
+                        break;
+        }
+
+        if (0 > pos) {
+                fput(f);
+                return (SEEK_DATA == whence || SEEK_HOLE == whence) ? pos : -EINVAL;
+        }
+
+        f->f_pos = pos;
+        fput(f);
+        return pos;
+}
+
+/*
+ * Allocate storage for len bytes of the file open on fd starting at
+ * offset, by calling the fallocate() vnode operation. The only mode
+ * flag is FALLOC_FL_KEEP_SIZE.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor, or is not open for writing.
+ *      o EINVAL
+ *        offset is negative, len is not positive, or mode has an unknown
+ *        flag set.
+ *      o EFBIG
+ *        offset + len overflows.
+ *      o ESPIPE
+ *        fd refers to a pipe.
+ *      o ENODEV
+ *        fd refers to something other than a regular file.
+ *      o EOPNOTSUPP
+ *        The file system does not support preallocation.
+ */
+int
+do_fallocate(int fd, int mode, off_t offset, off_t len)
+{
+        file_t *f;
+        vnode_t *vn;
+        int ret;
+
+        if (0 > offset || 0 >= len || (mode & ~FALLOC_FL_KEEP_SIZE))
+                return -EINVAL;
+        if (offset + len < offset)
+                return -EFBIG;
+
+        if (NULL == (f = fget(fd)))
+                return -EBADF;
+        vn = f->f_vnode;
+
+        if (!(f->f_mode & FMODE_WRITE))
+                ret = -EBADF;
+        else if (S_ISFIFO(vn->vn_mode))
+                ret = -ESPIPE;
+        else if (!S_ISREG(vn->vn_mode))
+                ret = -ENODEV;
+        else if (NULL == vn->vn_ops->fallocate)
+                ret = -EOPNOTSUPP;
+        else
+                ret = vn->vn_ops->fallocate(vn, mode, offset, len);
+
+        fput(f);
+        return ret;
+}
+
+/*
+ * Set the length of the file referred to by vn, which came from a path or
+ * a file descriptor, by calling its truncate() vnode operation.
+ */
+static int
+truncate_vnode(vnode_t *vn, off_t length)
+{
+        if (S_ISDIR(vn->vn_mode))
+                return -EISDIR;
+        if (!S_ISREG(vn->vn_mode) || NULL == vn->vn_ops->truncate)
+                return -EINVAL;
+        return vn->vn_ops->truncate(vn, length);
+}
+
+/*
+ * Use open_namev() to find the vnode for path, and set its length to
+ * length bytes with the truncate() vnode operation.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EINVAL
+ *        length is negative, path is an empty string, or path does not
+ *        refer to a regular file.
+ *      o EISDIR
+ *        path refers to a directory.
+ *      o ENOENT
+ *        A component of path does not exist.
+ *      o ENOTDIR
+ *        A component of the path prefix of path is not a directory.
+ *      o ENAMETOOLONG
+ *        A component of path was too long.
+ */
+int
+do_truncate(const char *path, off_t length)
+{
+        vnode_t *vn;
+        int ret;
+
+        if (0 > length || '\0' == *path)
+                return -EINVAL;
+
+        if (0 > (ret = open_namev(path, 0, &vn, NULL)))
+                return ret;
+        ret = truncate_vnode(vn, length);
+        vput(vn);
+
+        return ret;
+}
+
+/*
+ * Like do_truncate(), but for the file open on fd. The file position is
+ * not changed.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor, or is not open for writing.
+ *      o EINVAL
+ *        length is negative, or fd does not refer to a regular file.
+ *      o EISDIR
+ *        fd refers to a directory.
+ */
+int
+do_ftruncate(int fd, off_t length)
+{
+        file_t *f;
+        int ret;
+
+        if (0 > length)
+                return -EINVAL;
+
+        if (NULL == (f = fget(fd)))
+                return -EBADF;
+        if (!(f->f_mode & FMODE_WRITE))
+                ret = -EBADF;
+        else
+                ret = truncate_vnode(f->f_vnode, length);
+        fput(f);
+
+        return ret;
 }
 
 /*
@@ -340,6 +627,520 @@ do_stat(const char *path, struct stat *buf)
         return -1;
 }
 
+/*
+ * Ask the filesystem vn lives on how big it is and how much of it is free,
+ * with its statfs() fs operation.
+ */
+static int
+statfs_vnode(vnode_t *vn, struct statfs *buf)
+{
+        if (NULL == vn->vn_fs->fs_op->statfs)
+                return -ENOSYS;
+        memset(buf, 0, sizeof(*buf));
+        return vn->vn_fs->fs_op->statfs(vn->vn_fs, buf);
+}
+
+/*
+ * Use open_namev() to find the vnode for path, and report on the
+ * filesystem it is on.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o ENOENT
+ *        A component of path does not exist.
+ *      o ENOTDIR
+ *        A component of the path prefix of path is not a directory.
+ *      o ENAMETOOLONG
+ *        A component of path was too long.
+ *      o EINVAL
+ *        path is an empty string.
+ *      o ENOSYS
+ *        The filesystem does not keep track of its usage.
+ */
+int
+do_statfs(const char *path, struct statfs *buf)
+{
+        vnode_t *vn;
+        int ret;
+
+        if ('\0' == *path)
+                return -EINVAL;
+
+        if (0 > (ret = open_namev(path, 0, &vn, NULL)))
+                return ret;
+        ret = statfs_vnode(vn, buf);
+        vput(vn);
+
+        return ret;
+}
+
+/*
+ * Like do_statfs(), but for the file open on fd.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ *      o ENOSYS
+ *        The filesystem does not keep track of its usage.
+ */
+int
+do_fstatfs(int fd, struct statfs *buf)
+{
+        file_t *f;
+        int ret;
+
+        if (NULL == (f = fget(fd)))
+                return -EBADF;
+        ret = statfs_vnode(f->f_vnode, buf);
+        fput(f);
+
+        return ret;
+}
+
+/*
+ * Fill in buf with the page cache statistics of the file open on fd, or
+ * of the whole page cache if fd is -1. Files whose data isn't kept in
+ * pages, like pipes and devices, have all their counts 0.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor, or -1.
+ */
+int
+do_pcstat(int fd, struct pcstat *buf)
+{
+        file_t *f;
+
+        if (-1 == fd) {
+                pframe_stats(NULL, buf);
+                return 0;
+        }
+
+        if (NULL == (f = fget(fd)))
+                return -EBADF;
+        pframe_stats(&f->f_vnode->vn_mmobj, buf);
+        fput(f);
+
+        return 0;
+}
+
+/*
+ * Lay the data of the file open on fd out contiguously on disk with the
+ * defrag() vnode operation. The file's contents do not change, so any
+ * open file will do.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ *      o EISDIR
+ *        fd refers to a directory.
+ *      o EINVAL
+ *        fd refers to something other than a regular file.
+ *      o EOPNOTSUPP
+ *        The file system can't defragment files.
+ */
+int
+do_defrag(int fd, struct defrag_info *info)
+{
+        file_t *f;
+        vnode_t *vn;
+        int ret;
+
+        if (NULL == (f = fget(fd)))
+                return -EBADF;
+        vn = f->f_vnode;
+
+        if (S_ISDIR(vn->vn_mode))
+                ret = -EISDIR;
+        else if (!S_ISREG(vn->vn_mode))
+                ret = -EINVAL;
+        else if (NULL == vn->vn_ops->defrag)
+                ret = -EOPNOTSUPP;
+        else
+                ret = vn->vn_ops->defrag(vn, info);
+
+        fput(f);
+        return ret;
+}
+
+/*
+ * Whether vn's pages hold its contents, so that they can be copied out
+ * of directly: a regular file which can be mmap()ed.
+ */
+#define VNODE_IS_PAGED(vn)                                              \
+        (S_ISREG((vn)->vn_mode) && NULL != (vn)->vn_ops->mmap           \
+         && NULL != (vn)->vn_ops->fillpage)
+
+/*
+ * Move up to count bytes from in, starting at *inpos, to out at *outpos,
+ * advancing both. Either may be a pipe, whose position is ignored.
+ *
+ * The data goes a page at a time through a kernel page: a page of in
+ * is copied out of in's page cache, without going through read(), and
+ * then handed to out's write() vnode operation. Nothing of in is held
+ * while out is written, as out may block for as long as it likes (a
+ * full pipe, say) and in's page may be needed meanwhile. Files without
+ * pages, like pipes and devices, are read() into the kernel page; a
+ * short read from one ends the transfer, as it would end a read().
+ *
+ * Returns the number of bytes moved, or -errno if nothing was.
+ */
+static int
+splice_files(file_t *in, off_t *inpos, file_t *out, off_t *outpos, size_t count)
+{
+        vnode_t *ivn = in->f_vnode, *ovn = out->f_vnode;
+        size_t done = 0, n;
+        char *page = NULL;
+        pframe_t *pf;
+        int ret = 0;
+
+        if (NULL == (page = page_alloc()))
+                return -ENOMEM;
+
+        while (done < count) {
+                if (VNODE_IS_PAGED(ivn)) {
+                        if (*inpos >= ivn->vn_len)
+                                break;
+                        if (0 > (ret = pframe_get(&ivn->vn_mmobj, ADDR_TO_PN(*inpos), &pf)))
+                                break;
+                        /* the file may have shrunk while we blocked */
+                        if (*inpos >= ivn->vn_len)
+                                break;
+                        n = MIN(count - done, PAGE_SIZE - PAGE_OFFSET(*inpos));
+                        n = MIN(n, (size_t)(ivn->vn_len - *inpos));
+                        /* doesn't block, so the page can't go away first */
+                        memcpy(page, (char *)pf->pf_addr + PAGE_OFFSET(*inpos), n);
+                } else {
+                        n = MIN(count - done, PAGE_SIZE);
+                        if (0 >= (ret = ivn->vn_ops->read(ivn, *inpos, page, n)))
+                                break;
+                        if ((size_t)ret < n)
+                                count = done + ret;
+                        n = ret;
+                }
+
+                if (FMODE_APPEND & out->f_mode)
+                        *outpos = ovn->vn_len;
+                ret = ovn->vn_ops->write(ovn, *outpos, page, n);
+                if (0 > ret)
+                        break;
+                *inpos += ret;
+                *outpos += ret;
+                done += ret;
+                if ((size_t)ret < n)
+                        break;
+        }
+
+        page_free(page);
+        return (0 < done) ? (int)done : ret;
+}
+
+/*
+ * Check that data can be moved from in to out with splice_files().
+ */
+static int
+splice_check(file_t *in, file_t *out)
+{
+        if (!(in->f_mode & FMODE_READ) || !(out->f_mode & FMODE_WRITE))
+                return -EBADF;
+        if (S_ISDIR(in->f_vnode->vn_mode))
+                return -EISDIR;
+        if (S_ISDIR(out->f_vnode->vn_mode))
+                return -EBADF;
+        if (NULL == in->f_vnode->vn_ops->read || NULL == out->f_vnode->vn_ops->write)
+                return -EINVAL;
+        /* the ranges could overlap */
+        if (in->f_vnode == out->f_vnode)
+                return -EINVAL;
+        return 0;
+}
+
+/*
+ * Copy up to count bytes from in_fd to out_fd inside the kernel. Reading
+ * starts at *offset, which is advanced, if offset is not NULL; otherwise
+ * at in_fd's position, which is. Returns the number of bytes copied, 0
+ * at the end of in_fd.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        in_fd is not open for reading, or out_fd is not open for
+ *        writing.
+ *      o EINVAL
+ *        *offset is negative, or in_fd and out_fd refer to the same
+ *        file, or one of them can't be read or written.
+ *      o EISDIR
+ *        in_fd refers to a directory.
+ *      o ESPIPE
+ *        offset is not NULL and in_fd refers to a pipe.
+ */
+int
+do_sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+        file_t *in, *out;
+        off_t pos;
+        int ret;
+
+        if (NULL != offset && 0 > *offset)
+                return -EINVAL;
+
+        if (NULL == (in = fget(in_fd)))
+                return -EBADF;
+        if (NULL == (out = fget(out_fd))) {
+                fput(in);
+                return -EBADF;
+        }
+
+        if (0 > (ret = splice_check(in, out)))
+                goto out;
+        if (NULL != offset && S_ISFIFO(in->f_vnode->vn_mode)) {
+                ret = -ESPIPE;
+                goto out;
+        }
+
+        pos = (NULL != offset) ? *offset : in->f_pos;
+        ret = splice_files(in, &pos, out, &out->f_pos, count);
+        if (NULL != offset)
+                *offset = pos;
+        else
+                in->f_pos = pos;
+
+out:
+        fput(out);
+        fput(in);
+        return ret;
+}
+
+/*
+ * Move up to len bytes from fd_in to fd_out inside the kernel, one of
+ * which must be a pipe. For the other one, off_in or off_out works like
+ * sendfile()'s offset: if it is not NULL the transfer starts at, and
+ * advances, the offset it points to rather than the file position.
+ * Returns the number of bytes moved, 0 at the end of fd_in.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd_in is not open for reading, or fd_out is not open for
+ *        writing.
+ *      o EINVAL
+ *        Neither file descriptor refers to a pipe, or they refer to the
+ *        same one, or an offset is negative.
+ *      o EISDIR
+ *        fd_in refers to a directory.
+ *      o ESPIPE
+ *        An offset is given for a pipe.
+ */
+int
+do_splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len)
+{
+        file_t *in, *out;
+        off_t ipos, opos;
+        int ret;
+
+        if ((NULL != off_in && 0 > *off_in) || (NULL != off_out && 0 > *off_out))
+                return -EINVAL;
+
+        if (NULL == (in = fget(fd_in)))
+                return -EBADF;
+        if (NULL == (out = fget(fd_out))) {
+                fput(in);
+                return -EBADF;
+        }
+
+        if (0 > (ret = splice_check(in, out)))
+                goto out;
+        if (!S_ISFIFO(in->f_vnode->vn_mode) && !S_ISFIFO(out->f_vnode->vn_mode)) {
+                ret = -EINVAL;
+                goto out;
+        }
+        if ((NULL != off_in && S_ISFIFO(in->f_vnode->vn_mode))
+            || (NULL != off_out && S_ISFIFO(out->f_vnode->vn_mode))) {
+                ret = -ESPIPE;
+                goto out;
+        }
+
+        ipos = (NULL != off_in) ? *off_in : in->f_pos;
+        opos = (NULL != off_out) ? *off_out : out->f_pos;
+        ret = splice_files(in, &ipos, out, &opos, len);
+        if (NULL != off_in)
+                *off_in = ipos;
+        else
+                in->f_pos = ipos;
+        if (NULL != off_out)
+                *off_out = opos;
+        else
+                out->f_pos = opos;
+
+out:
+        fput(out);
+        fput(in);
+        return ret;
+}
+
+/*
+ * Copy up to len bytes from the regular file fd_in to the regular file
+ * fd_out inside the kernel. off_in and off_out work as they do for
+ * splice(). Returns the number of bytes copied, 0 at the end of fd_in.
+ *
+ * If both files are on a file system with a clone_range() vnode
+ * operation, the pages of fd_in which line up with whole pages of
+ * fd_out are not copied at all: fd_out is made to share them, and they
+ * are only copied when one of the files writes to them. The rest, like
+ * a partial page at either end, or whatever the file system could not
+ * share, is copied with splice_files().
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd_in is not open for reading, or fd_out is not open for
+ *        writing or is open for appending.
+ *      o EINVAL
+ *        flags is not 0, an offset is negative, either file is not a
+ *        regular file, or they are the same file.
+ *      o EISDIR
+ *        fd_in refers to a directory.
+ */
+int
+do_copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                   size_t len, unsigned int flags)
+{
+        file_t *in, *out;
+        vnode_t *ivn, *ovn;
+        off_t ipos, opos;
+        size_t done = 0, n;
+        int ret;
+
+        if (0 != flags || (NULL != off_in && 0 > *off_in)
+            || (NULL != off_out && 0 > *off_out))
+                return -EINVAL;
+
+        if (NULL == (in = fget(fd_in)))
+                return -EBADF;
+        if (NULL == (out = fget(fd_out))) {
+                fput(in);
+                return -EBADF;
+        }
+        ivn = in->f_vnode;
+        ovn = out->f_vnode;
+
+        if (0 > (ret = splice_check(in, out)))
+                goto out;
+        if (FMODE_APPEND & out->f_mode) {
+                ret = -EBADF;
+                goto out;
+        }
+        if (!S_ISREG(ivn->vn_mode) || !S_ISREG(ovn->vn_mode)) {
+                ret = -EINVAL;
+                goto out;
+        }
+
+        ipos = (NULL != off_in) ? *off_in : in->f_pos;
+        opos = (NULL != off_out) ? *off_out : out->f_pos;
+
+        if (ivn->vn_fs == ovn->vn_fs && NULL != ovn->vn_ops->clone_range
+            && PAGE_OFFSET(ipos) == PAGE_OFFSET(opos)) {
+                /* copy up to a page boundary, then share from there */
+                n = MIN(len, (PAGE_SIZE - PAGE_OFFSET(ipos)) % PAGE_SIZE);
+                if (0 < n && 0 < (ret = splice_files(in, &ipos, out, &opos, n)))
+                        done = ret;
+                if (done == n && done < len
+                    && 0 < (ret = ovn->vn_ops->clone_range(ivn, ipos, ovn, opos,
+                                                           len - done))) {
+                        ipos += ret;
+                        opos += ret;
+                        done += ret;
+                }
+        }
+        /* whatever clone_range() said, the copy now rests on splice_files(),
+         * so that a source at its end gives 0 rather than clone_range()'s
+         * error */
+        ret = 0;
+        if (done < len && 0 < (ret = splice_files(in, &ipos, out, &opos, len - done)))
+                done += ret;
+        if (0 < done)
+                ret = done;
+
+        if (NULL != off_in)
+                *off_in = ipos;
+        else
+                in->f_pos = ipos;
+        if (NULL != off_out)
+                *off_out = opos;
+        else
+                out->f_pos = opos;
+
+out:
+        fput(out);
+        fput(in);
+        return ret;
+}
+
+/*
+ * Give the kernel a hint about how the file open on fd is going to be
+ * read, from offset for len bytes, or to the end of the file if len is
+ * 0. It is only a hint: nothing read or written changes, however it is
+ * taken.
+ *
+ * POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM and
+ * POSIX_FADV_NOREUSE set how far ahead of reads the vnode's pages are
+ * read in (see fs/readahead.c). They apply to the whole file, not just
+ * the range. POSIX_FADV_WILLNEED starts reading in the pages of the
+ * range, and POSIX_FADV_DONTNEED drops those of them which are clean
+ * and not in use. These two only do anything for files with pages.
+ *
+ * Error cases you must handle for this function at the VFS level:
+ *      o EBADF
+ *        fd is not an open file descriptor.
+ *      o EINVAL
+ *        offset or len is negative, or advice is not one of the above.
+ *      o ESPIPE
+ *        fd refers to a pipe.
+ */
+int
+do_fadvise(int fd, off_t offset, off_t len, int advice)
+{
+        file_t *f;
+        vnode_t *vn;
+        off_t end;
+        uint32_t first, last;
+
+        if (0 > offset || 0 > len)
+                return -EINVAL;
+        if (POSIX_FADV_NORMAL > advice || POSIX_FADV_NOREUSE < advice)
+                return -EINVAL;
+
+        if (NULL == (f = fget(fd)))
+                return -EBADF;
+        vn = f->f_vnode;
+        if (S_ISFIFO(vn->vn_mode)) {
+                fput(f);
+                return -ESPIPE;
+        }
+
+        end = (0 == len || offset + len < offset) ? vn->vn_len : offset + len;
+        end = MIN(end, vn->vn_len);
+
+        switch (advice) {
+                case POSIX_FADV_WILLNEED:
+                        if (VNODE_IS_PAGED(vn) && offset < end)
+                                vnode_readahead(vn, ADDR_TO_PN(offset),
+                                                ADDR_TO_PN(end - 1) - ADDR_TO_PN(offset) + 1);
+                        break;
+                case POSIX_FADV_DONTNEED:
+                        /* only whole pages, or what the file has of its last */
+                        first = ADDR_TO_PN(offset + PAGE_SIZE - 1);
+                        last = (end == vn->vn_len) ? ADDR_TO_PN(end + PAGE_SIZE - 1)
+                               : ADDR_TO_PN(end);
+                        if (VNODE_IS_PAGED(vn) && first < last)
+                                vnode_evict(vn, first, last - first);
+                        break;
+                default:
+                        vn->vn_advice = advice;
+                        vn->vn_raend = 0;
+                        break;
+        }
+
+        fput(f);
+        return 0;
+}
+
 #ifdef __MOUNTING__
 /*
  * Implementing this function is not required and strongly discouraged unless
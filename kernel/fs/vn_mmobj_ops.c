@@ -22,17 +22,33 @@ vo_vput(mmobj_t *o)
         vput(mmobj_to_vnode(o));
 }
 
+/*
+ * A page looked up for writing is dirtied here, with the vnode's
+ * vn_mutex held, so that the file system's dirtypage runs under the
+ * vnode's lock, taken before the page is busy, as it is for write().
+ * The fault handler's own pframe_dirty() then finds it already dirty.
+ */
 int
 vlookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 {
+        vnode_t *vn = mmobj_to_vnode(o);
+        int ret;
+
         KASSERT(NULL != pf);
         KASSERT(NULL != o);
 
-        if ((uint32_t) mmobj_to_vnode(o)->vn_len <= pagenum * PAGE_SIZE) {
+        if ((uint32_t) vn->vn_len <= pagenum * PAGE_SIZE) {
                 return -EINVAL;
         }
 
-        return pframe_get(o, pagenum, pf);
+        if (!forwrite)
+                return pframe_get(o, pagenum, pf);
+
+        kmutex_lock(&vn->vn_mutex);
+        if (0 == (ret = pframe_get(o, pagenum, pf)) && !pframe_is_dirty(*pf))
+                ret = pframe_dirty(*pf);
+        kmutex_unlock(&vn->vn_mutex);
+        return ret;
 }
 
 int
@@ -16,6 +16,7 @@
 #include "mm/slab.h"
 #include "proc/sched.h"
 #include "util/debug.h"
+#include "util/ktrace.h"
 #include "vm/vmmap.h"
 #include "globals.h"
 
@@ -37,15 +38,24 @@ static int special_file_cleanpage(vnode_t *file, off_t offset, void *pagebuf);
 static vnode_ops_t bytedev_spec_vops = {
         .read = special_file_read,
         .write = special_file_write,
+        .read_direct = NULL,
+        .write_direct = NULL,
         .mmap = special_file_mmap,
+        .fallocate = NULL,
+        .truncate = NULL,
+        .seek_hole = NULL,
+        .defrag = NULL,
+        .clone_range = NULL,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
         .link = NULL,
         .unlink = NULL,
+        .rename = NULL,
         .mkdir = NULL,
         .rmdir = NULL,
         .readdir = NULL,
+        .readdirplus = NULL,
         .stat = special_file_stat,
         .fillpage = special_file_fillpage,
         .dirtypage = special_file_dirtypage,
@@ -64,15 +74,24 @@ static mmobj_ops_t vnode_mmobj_ops = {
 static vnode_ops_t blockdev_spec_vops = {
         .read = NULL,
         .write = NULL,
+        .read_direct = NULL,
+        .write_direct = NULL,
         .mmap = NULL,
+        .fallocate = NULL,
+        .truncate = NULL,
+        .seek_hole = NULL,
+        .defrag = NULL,
+        .clone_range = NULL,
         .create = NULL,
         .mknod = NULL,
         .lookup = NULL,
         .link = NULL,
         .unlink = NULL,
+        .rename = NULL,
         .mkdir = NULL,
         .rmdir = NULL,
         .readdir = NULL,
+        .readdirplus = NULL,
         .stat = special_file_stat,
         .fillpage = NULL,
         .dirtypage = NULL,
@@ -127,6 +146,7 @@ find:
                                 goto find;
                         }
 
+                        ktrace(KT_VGET, fs, vno, 0);
 #ifndef __MOUNTING__
                         /* If we are implementing mountpoint support
                            then we should get the mounted vnode,
@@ -190,10 +210,35 @@ find:
                 init_special_vnode(vn);
 
         vn->vn_refcount = 1;
+        ktrace(KT_VGET, fs, vno, 1);
 
         return vn;
 }
 
+vnode_t *
+vget_resident(struct fs *fs, ino_t vno)
+{
+        vnode_t *vn;
+
+        KASSERT(fs);
+
+        list_iterate_begin(&vnode_inuse_list, vn, vnode_t, vn_link) {
+                if ((vn->vn_fs == fs) && (vn->vn_vno == vno)) {
+                        if (VN_BUSY & vn->vn_flags)
+                                return NULL;
+#ifndef __MOUNTING__
+                        vref(vn);
+                        return vn;
+#else
+                        vref(vn->vn_mount);
+                        return vn->vn_mount;
+#endif
+                }
+        } list_iterate_end();
+
+        return NULL;
+}
+
 /*
  * - decrement vn->vn_refcount
  * - if it is zero
@@ -230,6 +275,7 @@ vput(struct vnode *vn)
 
         dbg(DBG_VNREF, "vput: 0x%p, 0x%p ino %ld, down to %d, nrespages = %d\n",
             vn, vn->vn_fs, (long)vn->vn_vno, vn->vn_refcount - 1, vn->vn_nrespages);
+        ktrace(KT_VPUT, vn->vn_fs, vn->vn_vno, vn->vn_refcount - 1);
 
         if ((vn->vn_nrespages == (vn->vn_refcount - 1))
             && !vn->vn_fs->fs_op->query_vnode(vn)) {
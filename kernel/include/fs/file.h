@@ -5,6 +5,7 @@
 #define FMODE_READ    1
 #define FMODE_WRITE   2
 #define FMODE_APPEND  4
+#define FMODE_DIRECT  8
 
 struct vnode;
 
@@ -18,9 +19,9 @@ typedef struct file {
 
         /*
          * The mode in which this file was opened. This is a mask of the flags
-         * FMODE_READ, FMODE_WRITE, and FMODE_APPEND. It is set when the file
-         * is first opened, and use to restrict the operations that can be
-         * performed on the underlying vnode.
+         * FMODE_READ, FMODE_WRITE, FMODE_APPEND, and FMODE_DIRECT. It is set
+         * when the file is first opened, and use to restrict the operations
+         * that can be performed on the underlying vnode.
          */
         int                     f_mode;
 
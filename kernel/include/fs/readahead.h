@@ -0,0 +1,20 @@
+/*
+ *  FILE: readahead.h
+ *  DESC: reading file pages in ahead of time, and dropping them early
+ */
+
+#pragma once
+
+#include "types.h"
+
+struct vnode;
+
+/* Pages read ahead of a sequential reader, and ahead of any reader of a
+ * file advised POSIX_FADV_SEQUENTIAL */
+#define READAHEAD_PAGES         4
+#define READAHEAD_SEQ_PAGES     16
+
+void vnode_readahead(struct vnode *vn, uint32_t first, uint32_t npages);
+void vnode_read_done(struct vnode *vn, off_t pos, size_t len);
+void vnode_evict(struct vnode *vn, uint32_t first, uint32_t npages);
+void readaheadd_shutdown(void);
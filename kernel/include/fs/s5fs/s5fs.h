@@ -34,11 +34,34 @@
 #define S5_TYPE_BLK             0x8
 
 #define S5_MAGIC                071177
-#define S5_CURRENT_VERSION      3
+#define S5_CURRENT_VERSION      9
+
+/* s5s_state */
+#define S5_STATE_DIRTY          0x0     /* mounted, or never unmounted */
+#define S5_STATE_CLEAN          0x1     /* the counts below can be trusted */
+
+#define S5_JOURNAL_MAGIC        0x6a6e6c68      /* journal header */
+#define S5_JDESC_MAGIC          0x6a6e6c64      /* transaction descriptor */
+#define S5_JCOMMIT_MAGIC        0x6a6e6c63      /* transaction commit record */
+
+/* Number of block numbers (logged plus revoked) one descriptor can hold */
+#define S5_JDESC_MAX            (S5_BLOCK_SIZE / sizeof(uint32_t) - 4)
+
+/* Bytes of file data an inode can hold itself; makes an inode 256 bytes */
+#define S5_INLINE_SIZE          240
+
+/* s5_flags: the file's data is in s5_inline rather than in blocks */
+#define S5_INODE_INLINE         0x1
 
 /* Number of blocks stored in the indirect block */
 #define S5_NIDIRECT_BLOCKS      (S5_BLOCK_SIZE / sizeof(uint32_t))
 
+/* Number of blocks whose reference counts one block of the table holds */
+#define S5_REFCNTS_PER_BLOCK    S5_BLOCK_SIZE
+
+/* Most references to a block beyond the first that the table can count */
+#define S5_REFCNT_MAX           0xff
+
 /* Given a file offset, returns the block number that it is in */
 #define S5_DATA_BLOCK(seekptr)  ((seekptr) / S5_BLOCK_SIZE)
 
@@ -80,6 +103,25 @@ typedef struct s5_super {
         uint32_t s5s_root_inode;         /* root inode */
         uint32_t s5s_num_inodes;         /* number of inodes */
         uint32_t s5s_version;            /* version of this disk format */
+
+        uint32_t s5s_journal_start;      /* first block of the journal */
+        uint32_t s5s_journal_nblocks;    /* size of the journal, 0 if the
+                                          * disk doesn't have one */
+
+        uint32_t s5s_state;              /* S5_STATE_{CLEAN,DIRTY} */
+        uint32_t s5s_nfree_blocks;       /* as of the last clean unmount */
+        uint32_t s5s_nfree_inodes;       /* as of the last clean unmount */
+        uint32_t s5s_num_blocks;         /* size of the disk, in blocks */
+
+        uint32_t s5s_orphan_inode;       /* first of the unlinked inodes
+                                          * whose blocks are still to be
+                                          * freed, chained through
+                                          * s5_next_free */
+
+        uint32_t s5s_refcnt_start;       /* first block of the reference
+                                          * count table */
+        uint32_t s5s_refcnt_nblocks;     /* size of the table, 0 if blocks
+                                          * can't be shared */
 } s5_super_t;
 
 /* The contents of an inode, as stored on disk. */
@@ -93,8 +135,18 @@ typedef struct s5_inode {
         uint32_t   s5_number;              /* this inode's number */
         uint16_t   s5_type;         /* one of S5_TYPE_{FREE,DATA,DIR,CHR,BLK} */
         int16_t    s5_linkcount;    /* link count of this inode */
-        uint32_t   s5_direct_blocks[S5_NDIRECT_BLOCKS];
-        uint32_t   s5_indirect_block;
+        union {
+                struct {
+                        uint32_t direct[S5_NDIRECT_BLOCKS];
+                        uint32_t indirect;
+                } s5_map;                     /* the block map */
+                char     s5_data[S5_INLINE_SIZE]; /* or, for S5_INODE_INLINE,
+                                                   * the file's contents */
+        } s5_dt;
+#define        s5_direct_blocks  s5_dt.s5_map.direct
+#define        s5_indirect_block s5_dt.s5_map.indirect
+#define        s5_inline         s5_dt.s5_data
+        uint32_t   s5_flags;        /* S5_INODE_* */
 } s5_inode_t;
 
 /* The contents of a directory entry, as stored on disk. */
@@ -103,14 +155,213 @@ typedef struct s5_dirent {
         char       s5d_name[S5_NAME_LEN];
 } s5_dirent_t;
 
+/*
+ * The metadata journal.
+ *
+ * The journal is a run of blocks set aside by fsmaker. Its first block
+ * holds an s5_jheader_t; the rest is filled from the front with
+ * transactions. Each transaction is one descriptor block (s5_jdesc_t),
+ * a copy of each block it logs, and a commit record (s5_jcommit_t), all
+ * written together with a single request. When the journal fills up, every
+ * logged block is written to its home location and the journal starts
+ * over with a new header.
+ *
+ * Transactions are numbered in order. When mounting, each transaction
+ * after the header whose sequence number is the next one expected, and
+ * whose commit record is intact, is replayed.
+ */
+typedef struct s5_jheader {
+        uint32_t sjh_magic;             /* S5_JOURNAL_MAGIC */
+        uint32_t sjh_seq;               /* number of the first transaction */
+} s5_jheader_t;
+
+typedef struct s5_jdesc {
+        uint32_t sjd_magic;             /* S5_JDESC_MAGIC */
+        uint32_t sjd_seq;               /* number of this transaction */
+        uint32_t sjd_nblocks;           /* number of blocks logged */
+        uint32_t sjd_nrevoked;          /* number of blocks revoked */
+        /* home locations of the logged blocks, in the order they follow
+         * the descriptor, then the revoked blocks: blocks which were
+         * freed, and which must not be replayed from earlier
+         * transactions */
+        uint32_t sjd_blocks[S5_JDESC_MAX];
+} s5_jdesc_t;
+
+typedef struct s5_jcommit {
+        uint32_t sjc_magic;             /* S5_JCOMMIT_MAGIC */
+        uint32_t sjc_seq;               /* number of this transaction */
+        uint32_t sjc_checksum;          /* of the logged blocks */
+} s5_jcommit_t;
+
 #ifndef __FSMAKER__
+/*
+ * In-core copy of an inode, which lives as long as its vnode (vn_i
+ * points here). Changes are made to this copy and marked with
+ * s5_dirty_inode(); s5_sync_inodes() copies them back into the inode
+ * table, so inode table pages don't need to stay pinned while the
+ * inodes in them are in use.
+ */
+typedef struct s5_icore {
+        s5_inode_t      ic_inode;       /* must be first */
+        int             ic_dirty;       /* changed since it was copied
+                                         * back */
+        list_link_t     ic_link;        /* link on s5f_dirty_inodes while
+                                         * dirty */
+} s5_icore_t;
+
+/*
+ * In-memory map of the unused dirent slots in a directory. A slot is
+ * unused when its name is empty. s5_link() takes the lowest free slot
+ * from here instead of rescanning the directory for a hole, and
+ * s5_remove_dirent() uses it to decide when to compact the directory.
+ *
+ * Maps are built the first time a directory is modified and are kept
+ * (keyed by inode number) as long as the directory's vnode is, so there
+ * are never more of them than there are directories in memory.
+ */
+typedef struct s5_dirslots {
+        ino_t           sd_ino;         /* inode number of the directory */
+        uint32_t        sd_nslots;      /* slots in the directory file */
+        uint32_t        sd_nfree;       /* how many of them are unused */
+        uint32_t        sd_hint;        /* no free slot below this index */
+        uint32_t        sd_mapwords;    /* size of sd_map in words */
+        uint32_t        *sd_map;        /* bit set == slot is unused */
+        list_link_t     sd_link;        /* link on s5f_dirslots */
+} s5_dirslots_t;
+
+/*
+ * Number of disk blocks reserved for the dirty pages of one file which
+ * do not have a disk block yet. Blocks are only allocated for such
+ * pages when they are cleaned (see s5fs_dirtypage()); the reservation
+ * makes sure the allocation can't fail then. Exists only while the
+ * count is non-zero.
+ */
+typedef struct s5_delalloc {
+        ino_t           dl_ino;         /* inode number of the file */
+        uint32_t        dl_nreserved;   /* blocks reserved for it */
+        list_link_t     dl_link;        /* link on s5f_delalloc */
+} s5_delalloc_t;
+
+/* Largest number of blocks handed out by one call into the allocator
+ * (see s5_alloc_delayed() and s5_alloc_range()). */
+#define S5_ALLOC_MAX_RUN        32
+
+/* Most blocks logged by one transaction */
+#define S5_JOURNAL_MAX_TRANS    32
+/* Commit once a transaction has logged this many */
+#define S5_JOURNAL_COMMIT_AT    16
+/* Most blocks revoked by one transaction */
+#define S5_JOURNAL_MAX_REVOKE   64
+
+/*
+ * Credits: s5_journal_begin() is told the most blocks an update may log
+ * or revoke, and waits until the running transaction has room for that
+ * many. Blocks logged again don't count. These are what the common
+ * parts of an update can take:
+ *
+ * the superblock, an inode table block and an indirect block
+ */
+#define S5_JCREDITS_INODE       3
+/* allocating n blocks: revoking each free list node used up */
+#define S5_JCREDITS_ALLOC(n)    ((n) / S5_NBLKS_PER_FNODE + 1)
+/* freeing n blocks: revoking each block (or changing its reference
+ * count), and each free list node started */
+#define S5_JCREDITS_FREE(n)     ((n) + (n) / S5_NBLKS_PER_FNODE + 1)
+/* cleaning a page: allocating a run of blocks for it, and logging it if
+ * it is a directory block */
+#define S5_JCREDITS_CLEAN       (S5_JCREDITS_INODE                      \
+                                 + S5_JCREDITS_ALLOC(S5_ALLOC_MAX_RUN) + 1)
+
+/* Room in a transaction which only s5fs_cleanpage() may reserve, since
+ * an update in progress may be waiting for pageoutd to clean a page */
+#define S5_JOURNAL_KEEP         S5_JCREDITS_CLEAN
+
+/* A block logged by the running transaction. */
+typedef struct s5_jentry {
+        uint32_t        je_blockno;     /* home location */
+        struct pframe   *je_pframe;     /* the block device page holding
+                                         * the block, pinned until the
+                                         * transaction commits; NULL if
+                                         * the journal holds a copy */
+} s5_jentry_t;
+
+/*
+ * Marks one thread's metadata update as in progress. A transaction is
+ * only committed when no handles are open, so an update is never split
+ * across two transactions.
+ */
+typedef struct s5_jhandle {
+        struct kthread  *jh_thr;        /* the thread it belongs to */
+        int             jh_nested;      /* the thread already had one open */
+        uint32_t        jh_credits;     /* blocks it may still log or
+                                         * revoke */
+        list_link_t     jh_link;        /* link on jn_handles */
+} s5_jhandle_t;
+
+typedef struct s5_journal {
+        uint32_t        jn_start;       /* first block of the journal */
+        uint32_t        jn_nblocks;     /* blocks in the journal */
+        uint32_t        jn_head;        /* where the next transaction goes */
+        uint32_t        jn_seq;         /* number of the running transaction */
+
+        list_t          jn_handles;     /* open s5_jhandle_t's */
+        int             jn_frozen;      /* a commit is being written; new
+                                         * handles have to wait */
+        ktqueue_t       jn_waitq;       /* waiting for jn_frozen, for room
+                                         * or for the handles to close */
+        uint32_t        jn_reserved;    /* credits left in open handles */
+
+        /* The running transaction: */
+        uint32_t        jn_nentries;
+        s5_jentry_t     jn_entries[S5_JOURNAL_MAX_TRANS];
+        uint32_t        jn_nrevoked;
+        uint32_t        jn_revoked[S5_JOURNAL_MAX_REVOKE];
+
+        /* Blocks logged since the journal last started over, which have
+         * to reach their home locations before it can start over again */
+        uint32_t        jn_nckpt;
+        uint32_t        *jn_ckpt;
+
+        /* Where transactions are put together before being written:
+         * the descriptor, S5_JOURNAL_MAX_TRANS blocks, and the commit
+         * record. Copies of directory blocks are kept here. */
+        char            *jn_buf;
+} s5_journal_t;
+
 /* Our in-memory representation of a s5fs filesytem (fs_i points to this) */
 typedef struct s5fs {
         blockdev_t              *s5f_bdev;
         s5_super_t              *s5f_super;
-        kmutex_t                s5f_mutex;
+        kmutex_t                s5f_inode_mutex; /* inode free and orphan
+                                                  * lists, s5f_nfree_inodes */
+        kmutex_t                s5f_block_mutex; /* block free list and
+                                                  * counts below */
         fs_t                    *s5f_fs;
+        list_t                  s5f_dirslots;   /* s5_dirslots_t's */
+        list_t                  s5f_dirty_inodes; /* s5_icore_t's */
+        uint32_t                s5f_nfree_inodes; /* inodes on the free list */
+        int                     s5f_unclean;    /* not unmounted cleanly
+                                                 * last time */
+
+        /* Block allocation (protected by s5f_block_mutex): */
+        uint32_t                s5f_nfree_blocks; /* blocks on the free list */
+        uint32_t                s5f_nreserved;  /* of which promised to
+                                                 * delayed allocations */
+        list_t                  s5f_delalloc;   /* s5_delalloc_t's */
+        uint32_t                s5f_npending;   /* blocks of orphaned inodes
+                                                 * not yet freed */
+
+        /* Deferred reclamation (see s5fs_subr.c): */
+        list_link_t             s5f_reclaim_link; /* on s5_reclaimd's list */
+        int                     s5f_reclaiming; /* s5_reclaimd is at work
+                                                 * on this file system */
+        ktqueue_t               s5f_reclaim_waitq; /* to wait for it to
+                                                    * finish */
+
+        s5_journal_t            *s5f_journal;   /* NULL if the disk has no
+                                                 * journal */
 } s5fs_t;
 
 int s5fs_mount(struct fs *fs);
+void s5_reclaimd_shutdown(void);
 #endif
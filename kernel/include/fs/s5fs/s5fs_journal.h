@@ -0,0 +1,44 @@
+/*
+ *   FILE: s5fs_journal.h
+ *  DESCR: S5 metadata journal
+ */
+
+#pragma once
+
+#include "types.h"
+
+struct s5fs;
+struct pframe;
+struct s5_jhandle;
+
+/*
+ * Every update to the superblock, inodes, indirect blocks, the free
+ * list, or directory blocks happens between s5_journal_begin() and
+ * s5_journal_end(). Handles nest within a thread. The blocks changed
+ * are logged with s5_journal_dirty() (block device pages) or
+ * s5_journal_log() (copies of directory blocks).
+ *
+ * s5_journal_begin() is told how many blocks the update may log or
+ * revoke at most (see S5_JCREDITS_INODE and friends in s5fs.h), and
+ * waits for the running transaction to have room for them. An update
+ * must not need more than that, so anything which can touch an
+ * unbounded number of blocks is done in steps, each with a handle of
+ * its own. A thread opens its first handle before taking s5f_inode_mutex
+ * or s5f_block_mutex, but after any vn_mutex.
+ *
+ * Other than s5_journal_end() writing back changed in-core inodes, all
+ * of these do nothing if the file system has no journal.
+ */
+int  s5_journal_mount(struct s5fs *fs);
+void s5_journal_umount(struct s5fs *fs);
+
+void s5_journal_begin(struct s5fs *fs, struct s5_jhandle *h, uint32_t nblocks);
+void s5_journal_begin_clean(struct s5fs *fs, struct s5_jhandle *h, uint32_t nblocks);
+void s5_journal_end(struct s5fs *fs, struct s5_jhandle *h);
+
+void s5_journal_dirty(struct s5fs *fs, struct pframe *pf);
+int  s5_journal_log(struct s5fs *fs, uint32_t blockno, const void *buf);
+int  s5_journal_read(struct s5fs *fs, uint32_t blockno, void *buf);
+void s5_journal_revoke(struct s5fs *fs, uint32_t blockno);
+
+int  s5_journal_commit(struct s5fs *fs);
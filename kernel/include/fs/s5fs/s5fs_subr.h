@@ -8,16 +8,29 @@
 
 #include "types.h"
 
+#include "fs/s5fs/s5fs_journal.h"
+
 struct fs;
 struct vnode;
+struct s5fs;
+struct s5_inode;
+struct defrag_info;
 
 int s5_alloc_inode(struct fs *fs, uint16_t type, devid_t devid);
 void s5_free_inode(struct vnode *vnode);
+void s5_sync_inode(struct vnode *vnode);
+void s5_sync_inodes(struct s5fs *fs);
 
 
 int s5_read_file(struct vnode *vn, off_t seek, char *dest, size_t len);
 int s5_write_file(struct vnode *vn, off_t seek, const char *bytes,
                   size_t len);
+int s5_read_direct(struct vnode *vn, off_t seek, char *dest, size_t len);
+int s5_write_direct(struct vnode *vn, off_t seek, const char *bytes,
+                    size_t len);
+int s5_extend_file(struct vnode *vn, off_t newsize);
+int s5_truncate_file(struct vnode *vn, off_t newsize);
+int s5_seek_hole(struct vnode *vn, off_t offset, int whence);
 
 /* TA BLANK {{{ */
 /* TODO: perhaps change the order of the arguments 'parent' and 'child' to
@@ -27,8 +40,26 @@ int s5_link(struct vnode *parent, struct vnode *child,
             const char *name, size_t namelen);
 int s5_find_dirent(struct vnode *vnode, const char *name, size_t namelen);
 int s5_remove_dirent(struct vnode *vnode, const char *name, size_t namelen);
+int s5_rename(struct vnode *olddir, const char *oldname, size_t oldnamelen,
+              struct vnode *newdir, const char *newname, size_t newnamelen);
 int s5_seek_to_block(struct vnode *vnode, off_t seekptr, int alloc);
 int s5_inode_blocks(struct vnode *vnode);
+void s5_dirslots_release(struct vnode *dir);
+void s5_dirslots_release_all(struct fs *fs);
+
+uint32_t s5_count_free_blocks(struct s5fs *fs);
+uint32_t s5_count_free_inodes(struct s5fs *fs);
+uint32_t s5_count_pending_blocks(struct s5fs *fs);
+uint32_t s5_inode_nblocks(struct s5fs *fs, struct s5_inode *inode);
+void s5_reclaim_start(struct s5fs *fs);
+void s5_reclaim_stop(struct s5fs *fs);
+int s5_defrag_file(struct vnode *vnode, struct defrag_info *info);
+int s5_reserve_block(struct vnode *vnode, off_t seekptr);
+int s5_alloc_delayed(struct vnode *vnode, off_t seekptr);
+int s5_alloc_range(struct vnode *vnode, off_t seekptr, off_t len);
+int s5_clone_range(struct vnode *in, off_t inoff, struct vnode *out,
+                   off_t outoff, size_t len);
+int s5_unshare_block(struct vnode *vnode, off_t seekptr, int alloc);
 
 #define VNODE_TO_S5FS(vn)       ( (s5fs_t *)((vn)->vn_fs->fs_i))
 #define VNODE_TO_S5INODE(vn)    ( (s5_inode_t *)(vn)->vn_i )
@@ -38,17 +69,19 @@ int s5_inode_blocks(struct vnode *vnode);
 /* TODO: change args to be more natural for how things are arranged in this
  * experimental version of things */
 /* TA BLANK }}} */
+/*
+ * 'inode' must be the in-core copy of an inode (from VNODE_TO_S5INODE()).
+ * It is copied back to the inode table by s5_sync_inodes(), which
+ * s5_journal_end() calls once the update is complete.
+ */
 #define s5_dirty_inode(fs, inode)                                       \
         do {                                                            \
-                pframe_t *p;                                            \
-                int err;                                                \
-                pframe_get(S5FS_TO_VMOBJ((fs)),                         \
-                           S5_INODE_BLOCK((inode)->s5_number), &p);     \
-                KASSERT(p);                                             \
-                err = pframe_dirty(p);                                  \
-                KASSERT(!err                                            \
-                        && "shouldn\'t fail for a page belonging "      \
-                        "to a block device");                           \
+                s5_icore_t *icp = (s5_icore_t *)(inode);                \
+                if (!icp->ic_dirty) {                                   \
+                        icp->ic_dirty = 1;                              \
+                        list_insert_tail(&(fs)->s5f_dirty_inodes,       \
+                                         &icp->ic_link);                \
+                }                                                       \
         } while (0)
 
 /*
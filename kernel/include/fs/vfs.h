@@ -9,6 +9,7 @@ struct vnode;
 struct file;
 struct vfs;
 struct fs;
+struct statfs;
 
 /* name_match: fname should be null-terminated, name is namelen long */
 #define name_match(fname, name, namelen) \
@@ -58,6 +59,22 @@ typedef struct fs_ops {
          * This entry point is ALLOWED TO BLOCK.
          */
         int (*umount)(struct fs *fs);
+
+        /*
+         * Make everything written to the filesystem so far durable, for
+         * filesystems which keep a journal or some other write-back state
+         * of their own. May be NULL. Called by vfs_sync().
+         *
+         * This entry point is ALLOWED TO BLOCK.
+         */
+        int (*sync)(struct fs *fs);
+
+        /*
+         * Fill in buf with the size of the filesystem and how much of it
+         * is free. Should not have to walk the filesystem to do so. May be
+         * NULL, in which case statfs() fails with ENOSYS.
+         */
+        int (*statfs)(struct fs *fs, struct statfs *buf);
 } fs_ops_t;
 
 #ifndef STR_MAX
@@ -141,6 +158,12 @@ extern struct vnode *vfs_root_vn;
  */
 int vfs_shutdown();
 
+/*
+ *     Calls the sync entry point of the root filesystem and of every
+ *     mounted one.
+ */
+void vfs_sync(void);
+
 /* Pathname resolution: */
 /* (the corresponding definitions live in namev.c) */
 int lookup(struct vnode *dir, const char *name, size_t len,
@@ -7,6 +7,9 @@
 #include "fs/open.h"
 #include "fs/pipe.h"
 #include "fs/stat.h"
+#include "fs/statfs.h"
+#include "mm/pcstat.h"
+#include "fs/defrag.h"
 
 int do_close(int fd);
 int do_read(int fd, void *buf, size_t nbytes);
@@ -21,8 +24,21 @@ int do_link(const char *from, const char *to);
 int do_rename(const char *oldname, const char *newname);
 int do_chdir(const char *path);
 int do_getdent(int fd, struct dirent *dirp);
+int do_getdentsplus(int fd, struct direntplus *dp, int count);
 int do_lseek(int fd, int offset, int whence);
+int do_fallocate(int fd, int mode, off_t offset, off_t len);
+int do_truncate(const char *path, off_t length);
+int do_ftruncate(int fd, off_t length);
 int do_stat(const char *path, struct stat *uf);
+int do_statfs(const char *path, struct statfs *buf);
+int do_fstatfs(int fd, struct statfs *buf);
+int do_defrag(int fd, struct defrag_info *info);
+int do_sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+int do_splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len);
+int do_copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                       size_t len, unsigned int flags);
+int do_fadvise(int fd, off_t offset, off_t len, int advice);
+int do_pcstat(int fd, struct pcstat *buf);
 
 #ifdef __MOUNTING__
 /* for mounting implementations only, not required */
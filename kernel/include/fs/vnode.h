@@ -18,10 +18,12 @@
 
 struct fs;
 struct dirent;
+struct direntplus;
 struct stat;
 struct file;
 struct vnode;
 struct vmarea;
+struct defrag_info;
 
 typedef struct vnode_ops {
         /* The following functions map directly to their corresponding
@@ -46,6 +48,17 @@ typedef struct vnode_ops {
          * transferred.
          */
         int (*write)(struct vnode *file, off_t offset, const void *buf, size_t count);
+        /*
+         * read_direct and write_direct are read and write for a file
+         * opened with O_DIRECT. They move the data between buf and the
+         * disk without leaving it in the page cache, at least when
+         * offset is a multiple of the block size and buf is
+         * page-aligned; other transfers may go through the cache. Pages
+         * of the file which are cached are kept coherent. Both are NULL
+         * if the file system doesn't support direct I/O.
+         */
+        int (*read_direct)(struct vnode *file, off_t offset, void *buf, size_t count);
+        int (*write_direct)(struct vnode *file, off_t offset, const void *buf, size_t count);
         /*
          * Everything within 'vma' other than vma->vma_obj (and
          * vma_plink--meaning that 'vma' has not yet been entered into
@@ -60,6 +73,48 @@ typedef struct vnode_ops {
          * the returned object if necessary), nor may it block.
          */
         int (*mmap)(struct vnode *file, struct vmarea *vma, struct mmobj **ret);
+        /*
+         * fallocate allocates storage for the len bytes of file starting
+         * at offset, without writing any data, so that later writes to
+         * the range will not fail for lack of space. Parts of the range
+         * which were not yet allocated read as zeros. Unless mode
+         * contains FALLOC_FL_KEEP_SIZE, the file is extended to offset +
+         * len if it is shorter than that.
+         */
+        int (*fallocate)(struct vnode *file, int mode, off_t offset, off_t len);
+        /*
+         * truncate sets the length of file to len bytes. Data past len
+         * is discarded and the storage it used is freed. If the file
+         * grows, the new part reads as zeros.
+         */
+        int (*truncate)(struct vnode *file, off_t len);
+        /*
+         * seek_hole returns the offset of the first byte at or after
+         * offset which is data (whence is SEEK_DATA) or in a hole (whence
+         * is SEEK_HOLE). The end of the file counts as a hole. Returns
+         * -ENXIO if offset is at or past the end of the file, or if
+         * there is no data after offset. May be NULL, in which case the
+         * whole file is taken to be data.
+         */
+        int (*seek_hole)(struct vnode *file, off_t offset, int whence);
+        /*
+         * defrag moves the file's data into as few contiguous runs on
+         * disk as it can, without changing what the file holds, and
+         * fills in info with how many runs it was in before and after.
+         * May be NULL if the file system can't do this.
+         */
+        int (*defrag)(struct vnode *file, struct defrag_info *info);
+        /*
+         * clone_range makes out share in's data from inoff on, starting
+         * at outoff in out, without copying it, for as much of len as
+         * it can; both offsets are page aligned, and both files are
+         * regular files of this file system. out grows if need be.
+         * Returns the number of bytes shared, which may be less than
+         * len (even 0), for the caller to copy the rest. May be NULL if
+         * the file system can't share data between files.
+         */
+        int (*clone_range)(struct vnode *in, off_t inoff, struct vnode *out,
+                           off_t outoff, size_t len);
 
         /* Operations that can be performed on directory files: */
 
@@ -91,6 +146,17 @@ typedef struct vnode_ops {
          * unlink removes the link to the vnode in dir specified by name
          */
         int (*unlink)(struct vnode *dir, const char *name, size_t name_len);
+        /*
+         * rename moves the entry oldname in olddir to newname in newdir
+         * (both on this file system), replacing any file already called
+         * newname. it is the same as link followed by unlink, except
+         * that it is done in one step and the link count of the file
+         * being moved never changes. renaming a directory, or over
+         * one, is not supported.
+         */
+        int (*rename)(struct vnode *olddir, const char *oldname,
+                      size_t oldname_len, struct vnode *newdir,
+                      const char *newname, size_t newname_len);
         /*
          * mkdir creates a directory called name in dir
          */
@@ -109,6 +175,16 @@ typedef struct vnode_ops {
          * read and 0 will be returned.
          */
         int (*readdir)(struct vnode *dir, off_t offset, struct dirent *d);
+        /*
+         * readdirplus reads up to count directory entries from dir,
+         * starting at *offset, along with the stat of the file each one
+         * names. *offset is advanced past the entries read, and the
+         * number read is returned (0 at the end of the directory). May
+         * be NULL, in which case the VFS calls readdir and stat for each
+         * entry instead.
+         */
+        int (*readdirplus)(struct vnode *dir, off_t *offset,
+                           struct direntplus *dp, int count);
 
         /* Operations that can be performed on any type of "file" (
          * includes normal file, directory, block/byte device */
@@ -245,6 +321,17 @@ typedef struct vnode {
          */
         kmutex_t           vn_mutex;
 
+        /*
+         * How the file's data is going to be read: one of the access
+         * patterns given to fadvise() (POSIX_FADV_NORMAL unless one has
+         * been). Along with it, what readahead (see fs/readahead.c)
+         * keeps track of: where the last read ended, and the page after
+         * the last one read ahead.
+         */
+        int                vn_advice;
+        off_t              vn_ranext;
+        uint32_t           vn_raend;
+
         /*
          * A generic pointer which the file system can use to store any extra
          * data it needs.
@@ -326,6 +413,16 @@ typedef struct vnode {
  */
 struct vnode *vget(struct fs *fs, ino_t vnum);
 
+/*
+ *     Like vget(), but only if the vnode is already in the system inode
+ *     table and not on its way in or out; returns NULL otherwise. File
+ *     systems use this to tell whether the in-core copy of an inode may
+ *     be newer than the one on disk.
+ *
+ *     DOES NOT BLOCK.
+ */
+struct vnode *vget_resident(struct fs *fs, ino_t vnum);
+
 /*
  *     Increment the reference count of the provided vnode.
  */
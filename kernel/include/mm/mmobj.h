@@ -1,6 +1,9 @@
 #pragma once
 
 #include "util/list.h"
+#include "util/string.h"
+
+#include "mm/pcstat.h"
 
 struct pframe;
 typedef struct mmobj_ops mmobj_ops_t;
@@ -15,6 +18,7 @@ typedef struct mmobj {
          */
         int                 mmo_nrespages;
         list_t              mmo_respages;
+        struct pcstat       mmo_stats;      /* see pframe_stats() */
         /*
          * For shadow objects, the mmo_bottom_obj member of the union should point
          * to the bottommost object in the shadow chain. For non-shadow objects, the
@@ -99,6 +103,7 @@ static inline void mmobj_init(mmobj_t *o, mmobj_ops_t *ops)
         (o)->mmo_refcount = 0;
         (o)->mmo_nrespages = 0;
         list_init(&(o)->mmo_respages);
+        memset(&(o)->mmo_stats, 0, sizeof((o)->mmo_stats));
         list_init(&(o)->mmo_un.mmo_vmas);
         (o)->mmo_shadowed = NULL;
 }
@@ -52,3 +52,6 @@ void  page_free_n(void *start, uint32_t npages);
  * system. Note that calls to page_alloc_n(npages) may
  * fail even if page_free_count() >= npages. */
 uint32_t page_free_count();
+
+/* Prints the free blocks of each order, for debugging and procfs. */
+size_t page_info(const void *arg, char *buf, size_t osize);
@@ -0,0 +1,25 @@
+/*
+ *  FILE: pcstat.h
+ *  DESC: page cache statistics, as reported by pcstat()
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+/*
+ * Kept for the whole page cache and for each object with pages in it,
+ * a file's pages being those of its vnode. All counts are since boot,
+ * or since the object came into memory.
+ */
+struct pcstat {
+        unsigned int pc_lookups;        /* pages asked for with pframe_get() */
+        unsigned int pc_hits;           /* ... which were resident */
+        unsigned int pc_misses;         /* ... which had to be brought in */
+        unsigned int pc_fills;          /* pages read in */
+        unsigned int pc_cleans;         /* dirty pages written back */
+        unsigned int pc_evictions;      /* pages dropped from the cache */
+        unsigned int pc_pageoutd_wakeups; /* times pageoutd ran (whole cache only) */
+        unsigned int pc_alloc_waits;    /* waits for pageoutd to free pages */
+        unsigned int pc_resident;       /* pages resident now */
+};
@@ -3,6 +3,7 @@
 #include "proc/sched.h"
 
 #include "mm/mmobj.h"
+#include "mm/pcstat.h"
 
 #include "util/list.h"
 #include "util/init.h"
@@ -67,4 +68,7 @@ void pframe_free(pframe_t *pf);
 
 void pframe_clean_all(void);
 
+void pframe_stats(struct mmobj *o, struct pcstat *st);
+size_t pframe_info(const void *arg, char *buf, size_t osize);
+
 void pframe_remove_from_pts(pframe_t *pf);
@@ -45,3 +45,11 @@ int  kmutex_lock_cancellable(kmutex_t *mtx);
  * @mtx the mutex to unlock
  */
 void kmutex_unlock(kmutex_t *mtx);
+
+/**
+ * Whether the current thread holds the specified mutex.
+ *
+ * @param mtx the mutex to check
+ * @return nonzero if the current thread holds the mutex
+ */
+int  kmutex_owns_mutex(kmutex_t *mtx);
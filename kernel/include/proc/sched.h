@@ -74,3 +74,8 @@ void sched_broadcast_on(ktqueue_t *q);
  * @param the thread to cancel sleep from
  */
 void sched_cancel(struct kthread *kthr);
+
+/**
+ * Prints the scheduler's counters, for debugging and procfs.
+ */
+size_t sched_info(const void *arg, char *buf, size_t osize);
@@ -159,15 +159,33 @@ void dbg_printinfo(dbg_infofunc_t func, const void *data);
 
 const char *dbg_color(uint64_t d_mode);
 
-#ifndef NDEBUG
+/*
+ * DBG_COMPILED is the set of modes compiled into the kernel, all of them
+ * unless the build says otherwise with __DBG_COMPILED__ (see PROFILE in
+ * Config.mk). A dbg() of any other mode is constant-folded away along
+ * with its arguments. One which is compiled in tests dbg_modes first, in a
+ * branch predicted not taken, so that a disabled mode costs a load and a
+ * branch and its arguments are not evaluated. The printing itself is out
+ * of line, in dbg_print_at(), to keep the hot paths small.
+ */
+#ifdef __DBG_COMPILED__
+#define DBG_COMPILED    (__DBG_COMPILED__)
+#else
+#define DBG_COMPILED    DBG_ALL
+#endif
+
+#define dbg_active(mode) \
+        __builtin_expect((DBG_COMPILED & (mode)) && (dbg_modes & (mode)), 0)
+
+void dbg_print_at(uint64_t mode, const char *file, int line, const char *func,
+                  const char *fmt, ...)
+        __attribute__((format(printf, 5, 6), cold, noinline));
+
 #define dbg(mode, ...)                                          \
         do {                                                    \
-                if (dbg_active(mode)) {                         \
-                        dbg_print("%s", dbg_color(mode));       \
-                        dbg_print("%s:%d %s(): ",__FILE__, __LINE__, __func__); \
-                        dbg_print(__VA_ARGS__);                 \
-                        dbg_print("%s", _NORMAL_);              \
-                }                                               \
+                if (dbg_active(mode))                           \
+                        dbg_print_at((mode), __FILE__, __LINE__, __func__, \
+                                     __VA_ARGS__);              \
         } while(0)
 
 #define dbgq(mode, ...)                                         \
@@ -188,15 +206,8 @@ const char *dbg_color(uint64_t d_mode);
                 }                                               \
         } while(0)
 
-#define dbg_active(mode) (dbg_modes & (mode))
 void dbg_add_mode(const char *mode);
 void dbg_add_modes(const char *modes);
-#else
-#define dbg(mode, arg)
-#define dbg_active(mode) 0
-#define dbg_add_mode(mode)
-#define dbg_add_modes(modes)
-#endif
 
 void dbg_panic(const char *file, int line, const char *func, const char *fmt, ...) __attribute__((format(printf, 4, 5)));
 #define panic(fmt, args...) dbg_panic(__FILE__, __LINE__, __func__, (fmt), ## args)
@@ -228,10 +239,15 @@ static int greaterthaneq(int l, int r) { return l >= r; }
 #define KASSERT_GREQ(l, r)      KASSERT_GENERIC(l, r, greaterthaneq, ">=")
 #define KASSERT_LESSEQ(l, r)    KASSERT_GENERIC(l, r, lessthaneq, "<=")
 #else
-#define KASSERT(x)
-#define KASSERTEQ(l,r) 
-#define KASSERT_GREATER(l,r)
-#define KASSERT_LESS(l,r)
-#define KASSERT_GREQ(l, r)
-#define KASSERT_LESSEQ(l, r)
+/* Not evaluated, but still type-checked, and the variables used */
+#define KASSERT(x)              do { (void)sizeof(!(x)); } while(0)
+#define KASSERT_GENERIC(left, right, comparator, comp_str)     \
+        do { (void)sizeof(left); (void)sizeof(right); } while(0)
+
+#define KASSERTEQ(l, r)         KASSERT_GENERIC(l, r, equals, "==")
+#define KASSERTNEQ(l, r)        KASSERT_GENERIC(l, r, notequals, "!=")
+#define KASSERT_GREATER(l, r)   KASSERT_GENERIC(l, r, greaterthan, ">")
+#define KASSERT_LESS(l, r)      KASSERT_GENERIC(l, r, lessthan, "<")
+#define KASSERT_GREQ(l, r)      KASSERT_GENERIC(l, r, greaterthaneq, ">=")
+#define KASSERT_LESSEQ(l, r)    KASSERT_GENERIC(l, r, lessthaneq, "<=")
 #endif
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "kernel.h"
+#include "types.h"
+
+/*
+ * ktrace: a ring buffer of fixed-size binary events, for finding out where
+ * the time goes without the printing of dbg() changing the answer.
+ *
+ * A tracepoint is a call to ktrace(type, a0, a1, a2). When tracing is on
+ * for that type of event it stores the cycle counter, the current pid,
+ * the type and the three arguments, as words, in the next slot of the
+ * ring, overwriting the oldest event once the ring is full; nothing is
+ * formatted until the ring is dumped. When it is off the tracepoint costs
+ * a load and a branch, and when the kernel is built with KTRACE=0 in
+ * Config.mk, nothing at all.
+ *
+ * Tracing starts off; "ktrace on" in kshell turns it on. The ring can be
+ * dumped with "ktrace", or read as a file of ktrace_event_t's from procfs.
+ *
+ * To add a type of event, add it to the enum below, before KT_NTYPES,
+ * and give it a name in ktrace_names in util/ktrace.c.
+ */
+
+#define KTRACE_NEVENTS  4096            /* must be a power of two */
+
+typedef enum {
+        KT_VGET = 1,            /* fs, vno, 1 if it was read in          */
+        KT_VPUT,                /* fs, vno, refcount after               */
+        KT_PFRAME_GET,          /* mmobj, pagenum                        */
+        KT_PFRAME_FILL,         /* mmobj, pagenum                        */
+        KT_PFRAME_CLEAN,        /* mmobj, pagenum                        */
+        KT_SCHED_SWITCH,        /* old thread, new thread, new pid       */
+        KT_KMUTEX_CONTEND,      /* mutex, holder thread                  */
+        KT_SYSCALL_ENTER,       /* sysnum, user argument pointer         */
+        KT_SYSCALL_EXIT,        /* sysnum, return value, errno           */
+        KT_NTYPES
+} ktrace_type_t;
+
+#define KT_TYPE(type)   (1U << (type))
+#define KT_ALL          (~0U)
+
+typedef struct ktrace_event {
+        uint64_t        ke_time;        /* cycle counter                  */
+        uint16_t        ke_type;        /* a ktrace_type_t                */
+        int16_t         ke_pid;         /* curproc, or -1 before there is one */
+        uint32_t        ke_args[3];
+} ktrace_event_t;
+
+/* The types of event being recorded, as KT_TYPE() bits */
+extern uint32_t ktrace_mask;
+
+#ifdef __KTRACE__
+#define ktrace(type, a0, a1, a2)                                        \
+        do {                                                            \
+                if (unlikely(ktrace_mask & KT_TYPE(type)))              \
+                        ktrace_record((type), (uint32_t)(a0),           \
+                                      (uint32_t)(a1), (uint32_t)(a2));  \
+        } while (0)
+#else
+#define ktrace(type, a0, a1, a2) do { } while (0)
+#endif
+
+static inline uint64_t ktrace_time(void)
+{
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return ((uint64_t)hi << 32) | lo;
+}
+
+void ktrace_record(ktrace_type_t type, uint32_t a0, uint32_t a1, uint32_t a2);
+
+void ktrace_start(uint32_t mask);
+void ktrace_stop(void);
+void ktrace_clear(void);
+
+const char *ktrace_name(ktrace_type_t type);
+int ktrace_type(const char *name);
+
+uint32_t ktrace_count(void);
+int ktrace_event(uint32_t i, ktrace_event_t *ev);
+int ktrace_read(off_t offset, void *buf, size_t count);
+size_t ktrace_info(const void *arg, char *buf, size_t osize);
@@ -42,6 +42,10 @@
 #include "fs/vfs_syscall.h"
 #include "fs/fcntl.h"
 #include "fs/stat.h"
+#include "fs/readahead.h"
+#ifdef __S5FS__
+#include "fs/s5fs/s5fs.h"
+#endif
 
 #include "test/kshell/kshell.h"
 #include "test/s5fs_test.h"
@@ -200,15 +204,18 @@ idleproc_run(int arg1, void *arg2)
 
         struct stat statbuf;
         if (do_stat("/dev", &statbuf) < 0) {
-                KASSERT(!(status = do_mkdir("/dev")));
+                status = do_mkdir("/dev");
+                KASSERT(!status);
         }
         if ((fd = do_open("/dev/null", O_RDONLY)) < 0) {
-                KASSERT(!(status = do_mknod("/dev/null", S_IFCHR, MEM_NULL_DEVID)));
+                status = do_mknod("/dev/null", S_IFCHR, MEM_NULL_DEVID);
+                KASSERT(!status);
         } else {
                 do_close(fd);
         }
         if ((fd = do_open("/dev/zero", O_RDONLY)) < 0) {
-                KASSERT(!(status = do_mknod("/dev/zero", S_IFCHR, MEM_ZERO_DEVID)));
+                status = do_mknod("/dev/zero", S_IFCHR, MEM_ZERO_DEVID);
+                KASSERT(!status);
         } else {
                 do_close(fd);
         }
@@ -218,7 +225,8 @@ idleproc_run(int arg1, void *arg2)
                 sprintf(path, "/dev/tty%d", ii);
                 dbg(DBG_INIT, "Creating tty mknod with path %s\n", path);
                 if ((fd = do_open(path, O_RDONLY)) < 0) {
-                        KASSERT(!do_mknod(path, S_IFCHR, MKDEVID(2, ii)));
+                        status = do_mknod(path, S_IFCHR, MKDEVID(2, ii));
+                        KASSERT(!status);
                 } else {
                         do_close(fd);
                 }
@@ -228,7 +236,8 @@ idleproc_run(int arg1, void *arg2)
                 sprintf(path, "/dev/hda%d", ii);
                 dbg(DBG_INIT, "Creating disk mknod with path %s\n", path);
                 if ((fd = do_open(path, O_RDONLY)) < 0) {
-                        KASSERT(!do_mknod(path, S_IFBLK, MKDEVID(1, ii)));
+                        status = do_mknod(path, S_IFBLK, MKDEVID(1, ii));
+                        KASSERT(!status);
                 } else {
                         do_close(fd);
                 }
@@ -259,10 +268,17 @@ idleproc_run(int arg1, void *arg2)
 #ifdef __VFS__
         /* Shutdown the vfs: */
         dbg_print("weenix: vfs shutdown...\n");
+        /* readaheadd holds vnodes until it is done with them */
+        readaheadd_shutdown();
         vput(curproc->p_cwd);
         if (vfs_shutdown())
                 panic("vfs shutdown FAILED!!\n");
 
+#ifdef __S5FS__
+        /* every s5 file system is unmounted, so it has nothing left to do */
+        s5_reclaimd_shutdown();
+#endif
+
 #endif
 
         /* Shutdown the pframe system */
@@ -10,6 +10,7 @@
 #include "util/list.h"
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/printf.h"
 
 #include "vm/shadowd.h"
 
@@ -399,3 +400,34 @@ page_free_count()
 {
         return page_freecount;
 }
+
+/*
+ * Print how many free blocks of each order there are, over all page
+ * groups, and the number of free pages they add up to.
+ */
+size_t
+page_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        struct pagegroup *group;
+        list_link_t *link;
+        uint32_t nfree;
+        int order;
+
+        KASSERT(NULL == arg);
+        KASSERT(NULL != buf);
+
+        iprintf(&buf, &size, "%5s %7s %7s\n", "ORDER", "BLOCKS", "PAGES");
+        for (order = 0; order < PAGE_NSIZES; ++order) {
+                nfree = 0;
+                list_iterate_begin(&pagegroup_list, group, struct pagegroup, pg_link) {
+                        for (link = group->pg_freelist[order].l_next;
+                             link != &group->pg_freelist[order]; link = link->l_next)
+                                nfree++;
+                } list_iterate_end();
+                iprintf(&buf, &size, "%5d %7u %7u\n", order, nfree, nfree << order);
+        }
+        iprintf(&buf, &size, "free pages: %u\n", page_freecount);
+
+        return osize - size;
+}
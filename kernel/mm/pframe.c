@@ -6,6 +6,8 @@
 
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/printf.h"
+#include "util/ktrace.h"
 
 #include "mm/mmobj.h"
 #include "mm/page.h"
@@ -104,6 +106,19 @@ static ktqueue_t pageoutd_waitq;
 /* threads waiting for pageoutd to run sleep on this queue */
 static ktqueue_t alloc_waitq;
 
+/*   Page cache statistics:
+ *     Each counter is kept for the whole cache, here, and for the mmobj
+ *     the page belongs to, in its mmo_stats, except for
+ *     pc_pageoutd_wakeups, which belongs to no one object. pc_resident is
+ *     only filled in by pframe_stats().
+ */
+static struct pcstat pframe_cache_stats;
+#define pframe_count(o, counter)                                        \
+        do {                                                            \
+                pframe_cache_stats.counter++;                           \
+                (o)->mmo_stats.counter++;                               \
+        } while (0)
+
 /* Pageout daemon functions */
 static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
@@ -136,6 +151,8 @@ pframe_init(void)
         for (i = 0; i < PF_HASH_SIZE; ++i)
                 list_init(&pframe_hash[i]);
 
+        memset(&pframe_cache_stats, 0, sizeof(pframe_cache_stats));
+
         /* initialize pageout parameters: */
         nfreepages_target = page_free_count() >> 1;
         nfreepages_min = 0;
@@ -252,6 +269,8 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
         o->mmo_nrespages++;
         list_insert_head(&o->mmo_respages, &pf->pf_olink);
 
+        /* only pframe_get() allocates, for a page it didn't find */
+        pframe_count(o, pc_misses);
         return pf;
 }
 
@@ -265,6 +284,8 @@ pframe_fill(pframe_t *pf)
 {
         int ret;
 
+        pframe_count(pf->pf_obj, pc_fills);
+        ktrace(KT_PFRAME_FILL, pf->pf_obj, pf->pf_pagenum, 0);
         pframe_set_busy(pf);
         ret = pf->pf_obj->mmo_ops->fillpage(pf->pf_obj, pf);
         pframe_clear_busy(pf);
@@ -274,6 +295,18 @@ pframe_fill(pframe_t *pf)
         return ret;
 }
 
+/*
+ * Wake pageoutd and wait for it to free some pages, for a pframe_get() on
+ * o which found too few free (see pageoutd_needed()).
+ */
+static void
+pframe_wait_for_pageoutd(mmobj_t *o)
+{
+        pframe_count(o, pc_alloc_waits);
+        pageoutd_wakeup();
+        sched_sleep_on(&alloc_waitq);
+}
+
 /*
  * Find and return the pframe representing the page identified by the object
  * and page number. If the page is already resident in memory, then we return
@@ -290,6 +323,12 @@ pframe_fill(pframe_t *pf)
  *
  * This routine may block at the mmobj operation level.
  *
+ * Every call counts as a lookup in the page cache statistics, with
+ * pframe_count(o, pc_lookups), and one which finds the page resident as a
+ * hit, with pframe_count(o, pc_hits); pframe_alloc() counts the misses.
+ * Use pframe_wait_for_pageoutd() to wait for free pages, so that the
+ * wait is counted too. Keep the ktrace() call at the top.
+ *
  * @param o the parent object of the page
  * @param pagenum the page number of this page in the object
  * @param result used to return the pframe (NULL if there's an error)
@@ -298,7 +337,42 @@ pframe_fill(pframe_t *pf)
 int
 pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
 {
-        NOT_YET_IMPLEMENTED("S5FS: pframe_get");
+        pframe_t *pf;
+        int ret;
+
+        ktrace(KT_PFRAME_GET, o, pagenum, 0);
+        pframe_count(o, pc_lookups);
+
+        /* each wait may change what is resident, so look again after it */
+        for (;;) {
+                if (NULL != (pf = pframe_get_resident(o, pagenum))) {
+                        if (pframe_is_busy(pf)) {
+                                sched_sleep_on(&pf->pf_waitq);
+                                continue;
+                        }
+                        pframe_count(o, pc_hits);
+                        *result = pf;
+                        return 0;
+                }
+                if (!pageoutd_needed())
+                        break;
+                pframe_wait_for_pageoutd(o);
+        }
+
+        if (NULL == (pf = pframe_alloc(o, pagenum))) {
+                *result = NULL;
+                return -ENOMEM;
+        }
+        if (0 > (ret = pframe_fill(pf))) {
+                pframe_free(pf);
+                *result = NULL;
+                return ret;
+        }
+
+        if (pageoutd_needed())
+                pageoutd_wakeup();
+
+        *result = pf;
         return 0;
 }
 
@@ -433,6 +507,8 @@ pframe_clean(pframe_t *pf)
          * we won't (incorrectly) think the page has been fully cleaned.
          */
         pframe_clear_dirty(pf);
+        pframe_count(pf->pf_obj, pc_cleans);
+        ktrace(KT_PFRAME_CLEAN, pf->pf_obj, pf->pf_pagenum, 0);
 
         /* Make sure a future write to the page will fault (and hence dirty it) */
         tlb_flush((uintptr_t) pf->pf_addr);
@@ -466,6 +542,7 @@ pframe_free(pframe_t *pf)
         dbg(DBG_PFRAME, "uncaching page %d of obj %p\n", pf->pf_pagenum, pf->pf_obj);
 
         mmobj_t *o = pf->pf_obj;
+        pframe_count(o, pc_evictions);
 
 
         /* Flush the TLB */
@@ -528,6 +605,53 @@ list_start:
         dbg(DBG_PFRAME, "pframe_clean_all: completed!\n");
 }
 
+/*
+ * Copy out the page cache statistics of o, or of the whole cache if o is
+ * NULL. Does not block.
+ */
+void
+pframe_stats(mmobj_t *o, struct pcstat *st)
+{
+        if (NULL == o) {
+                *st = pframe_cache_stats;
+                st->pc_resident = nallocated + npinned;
+        } else {
+                *st = o->mmo_stats;
+                st->pc_resident = o->mmo_nrespages;
+        }
+}
+
+/*
+ * Print the page cache statistics of the whole cache, along with how its
+ * pages are split between the allocated and pinned lists and pageoutd's
+ * parameters.
+ */
+size_t
+pframe_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        struct pcstat st;
+
+        KASSERT(NULL == arg);
+        KASSERT(NULL != buf);
+
+        pframe_stats(NULL, &st);
+        iprintf(&buf, &size, "lookups:          %u\n", st.pc_lookups);
+        iprintf(&buf, &size, "hits:             %u\n", st.pc_hits);
+        iprintf(&buf, &size, "misses:           %u\n", st.pc_misses);
+        iprintf(&buf, &size, "fills:            %u\n", st.pc_fills);
+        iprintf(&buf, &size, "cleans:           %u\n", st.pc_cleans);
+        iprintf(&buf, &size, "evictions:        %u\n", st.pc_evictions);
+        iprintf(&buf, &size, "pageoutd wakeups: %u\n", st.pc_pageoutd_wakeups);
+        iprintf(&buf, &size, "alloc waits:      %u\n", st.pc_alloc_waits);
+        iprintf(&buf, &size, "allocated:        %d\n", nallocated);
+        iprintf(&buf, &size, "pinned:           %d\n", npinned);
+        iprintf(&buf, &size, "free target:      %u\n", nfreepages_target);
+        iprintf(&buf, &size, "free min:         %u\n", nfreepages_min);
+
+        return osize - size;
+}
+
 /* Remove a page frame from the page tables of all processes that map it
  * To do that, traverse all processes that map the given page frame into
  * their address space, and zero the corresponding address entry.
@@ -630,6 +754,7 @@ pageoutd_run(int arg1, void *arg2)
                 if (sched_cancellable_sleep_on(&pageoutd_waitq))
                         kthread_exit((void *)0);
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: Waking up\n");
+                pframe_cache_stats.pc_pageoutd_wakeups++;
                 dbg(DBG_PFRAME, "PAGEOUT DEMAON: "
                     "nfreepages_target=|%d| "
                     "nfreepages_min=|%d| "
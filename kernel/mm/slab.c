@@ -20,6 +20,7 @@
 #include "util/gdb.h"
 #include "util/string.h"
 #include "util/debug.h"
+#include "util/printf.h"
 
 #ifdef SLAB_REDZONE
 #define front_rz(obj)           (*(uintptr_t*)(obj))
@@ -473,6 +474,38 @@ free(void *addr)
         kfree(addr);
 }
 
+/*
+ * Print a line for each slab allocator: its object size, how many of
+ * its objects are in use out of how many its slabs hold, and how many
+ * pages those slabs take.
+ */
+size_t
+slab_allocators_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        struct slab_allocator *a;
+        struct slab *slab;
+        int nslabs, inuse;
+
+        KASSERT(NULL == arg);
+        KASSERT(NULL != buf);
+
+        iprintf(&buf, &size, "%-20s %7s %7s %7s %7s\n",
+                "NAME", "OBJSIZE", "INUSE", "TOTAL", "PAGES");
+        for (a = slab_allocators; NULL != a; a = a->sa_next) {
+                nslabs = inuse = 0;
+                for (slab = a->sa_slabs; NULL != slab; slab = slab->s_next) {
+                        nslabs++;
+                        inuse += slab->s_inuse;
+                }
+                iprintf(&buf, &size, "%-20s %7u %7d %7d %7d\n",
+                        a->sa_name, a->sa_objsize, inuse,
+                        nslabs * a->sa_slab_nobjs, nslabs << a->sa_order);
+        }
+
+        return osize - size;
+}
+
 void
 slab_init()
 {
@@ -2,6 +2,7 @@
 #include "errno.h"
 
 #include "util/debug.h"
+#include "util/ktrace.h"
 
 #include "proc/kthread.h"
 #include "proc/kmutex.h"
@@ -34,6 +35,7 @@ kmutex_lock(kmutex_t *mtx)
         KASSERT(curthr && (curthr != mtx->km_holder) && "already owner!!");
         /* if someone owns the mutex, go to sleep */
         if (NULL != mtx->km_holder) {
+                ktrace(KT_KMUTEX_CONTEND, mtx, mtx->km_holder, 0);
                 sched_sleep_on(&mtx->km_waitq);
                 KASSERT(curthr && (curthr == mtx->km_holder));
         } else {
@@ -53,6 +55,7 @@ kmutex_lock_cancellable(kmutex_t *mtx)
         KASSERT(curthr && (curthr != mtx->km_holder) && "already owner!!");
         /* if someone owns the mutex, go to sleep */
         if (NULL != mtx->km_holder) {
+                ktrace(KT_KMUTEX_CONTEND, mtx, mtx->km_holder, 0);
                 if (sched_cancellable_sleep_on(&mtx->km_waitq)) {
                         KASSERT(curthr);
 
@@ -92,3 +95,9 @@ kmutex_unlock(kmutex_t *mtx)
         KASSERT(curthr != mtx->km_holder);
         /* PROCS }}} */
 }
+
+int
+kmutex_owns_mutex(kmutex_t *mtx)
+{
+        return curthr && curthr == mtx->km_holder;
+}
@@ -8,9 +8,22 @@
 
 #include "util/init.h"
 #include "util/debug.h"
+#include "util/printf.h"
+#include "util/ktrace.h"
 
 static ktqueue_t kt_runq;
 
+/* Scheduler counters, for sched_info(). sched_sleep_on(),
+ * sched_wakeup_on() and sched_broadcast_on() are not ours, so their
+ * calls aren't counted. */
+static struct {
+        uint32_t        ss_switches;    /* sched_switch() calls */
+        uint32_t        ss_idle;        /* ... which found nothing to run */
+        uint32_t        ss_runnable;    /* threads put on the run queue */
+        uint32_t        ss_csleeps;     /* cancellable sleeps */
+        uint32_t        ss_cancels;     /* threads cancelled */
+} sched_stats;
+
 static __attribute__((unused)) void
 sched_init(void)
 {
@@ -111,6 +124,7 @@ sched_cancellable_sleep_on(ktqueue_t *q)
                 return -EINTR;
         }
 
+        sched_stats.ss_csleeps++;
         curthr->kt_state = KT_SLEEP_CANCELLABLE;
         ktqueue_enqueue(q, curthr);
         sched_switch();
@@ -137,6 +151,7 @@ sched_cancel(struct kthread *kthr)
 {
         /* PROCS {{{ */
         kthr->kt_cancelled = 1;
+        sched_stats.ss_cancels++;
         if (kthr->kt_state == KT_SLEEP_CANCELLABLE) {
                 KASSERT(kthr->kt_wchan);
                 ktqueue_remove(kthr->kt_wchan, kthr);
@@ -188,6 +203,9 @@ sched_switch(void)
         uint8_t ipl = intr_getipl();
         intr_setipl(IPL_HIGH);
 
+        sched_stats.ss_switches++;
+        if (sched_queue_empty(&kt_runq))
+                sched_stats.ss_idle++;
         while (sched_queue_empty(&kt_runq)) {
                 intr_disable();
                 intr_setipl(IPL_LOW);
@@ -197,6 +215,7 @@ sched_switch(void)
 
         kthread_t *newthr = ktqueue_dequeue(&kt_runq);
         kthread_t *oldthr = curthr;
+        ktrace(KT_SCHED_SWITCH, oldthr, newthr, newthr->kt_proc->p_pid);
         curthr = newthr;
         curproc = newthr->kt_proc;
 
@@ -227,6 +246,7 @@ sched_make_runnable(kthread_t *thr)
         intr_setipl(IPL_HIGH);
 
         KASSERT(&kt_runq != thr->kt_wchan);
+        sched_stats.ss_runnable++;
         thr->kt_state = KT_RUN;
         ktqueue_enqueue(&kt_runq, thr);
 
@@ -234,6 +254,27 @@ sched_make_runnable(kthread_t *thr)
         /* PROCS }}} */
 }
 
+/*
+ * Print the scheduler counters and how many threads are waiting to run.
+ */
+size_t
+sched_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        KASSERT(NULL == arg);
+        KASSERT(NULL != buf);
+
+        iprintf(&buf, &size, "switches:           %u\n", sched_stats.ss_switches);
+        iprintf(&buf, &size, "idle switches:      %u\n", sched_stats.ss_idle);
+        iprintf(&buf, &size, "made runnable:      %u\n", sched_stats.ss_runnable);
+        iprintf(&buf, &size, "cancellable sleeps: %u\n", sched_stats.ss_csleeps);
+        iprintf(&buf, &size, "cancels:            %u\n", sched_stats.ss_cancels);
+        iprintf(&buf, &size, "run queue:          %d\n", kt_runq.tq_size);
+
+        return osize - size;
+}
+
 // Implementation is hidden. You will be provided with these at some point.
 //void sched_sleep_on(ktqueue_t *q);
 //kthread_t * sched_wakeup_on(ktqueue_t *q);
@@ -15,6 +15,7 @@
 
 #include "util/debug.h"
 #include "util/string.h"
+#include "util/ktrace.h"
 
 int kshell_help(kshell_t *ksh, int argc, char **argv)
 {
@@ -60,6 +61,60 @@ int kshell_echo(kshell_t *ksh, int argc, char **argv)
         return 0;
 }
 
+#ifdef __KTRACE__
+/*
+ * One line per event: the cycles since the one before, the pid, the type
+ * and its arguments.
+ */
+static void kshell_ktrace_dump(kshell_t *ksh)
+{
+        char buf[128];
+        ktrace_event_t ev;
+        uint64_t last = 0;
+        uint32_t i;
+
+        ktrace_info(NULL, buf, sizeof(buf));
+        kprintf(ksh, "%s", buf);
+
+        for (i = 0; 0 == ktrace_event(i, &ev); ++i) {
+                uint64_t delta = (0 == i) ? 0 : ev.ke_time - last;
+                last = ev.ke_time;
+                kprintf(ksh, "+%10u %5d %-8s %#x %#x %#x\n",
+                        (uint32_t)MIN(delta, 0xffffffffULL), ev.ke_pid,
+                        ktrace_name(ev.ke_type), ev.ke_args[0],
+                        ev.ke_args[1], ev.ke_args[2]);
+        }
+}
+
+int kshell_ktrace(kshell_t *ksh, int argc, char **argv)
+{
+        uint32_t mask = 0;
+        int i, type;
+
+        if (argc < 2) {
+                kshell_ktrace_dump(ksh);
+        } else if (0 == strcmp(argv[1], "on")) {
+                for (i = 2; i < argc; ++i) {
+                        if (0 > (type = ktrace_type(argv[i]))) {
+                                kprintf(ksh, "ktrace: no event `%s'\n", argv[i]);
+                                return 1;
+                        }
+                        mask |= KT_TYPE(type);
+                }
+                ktrace_start((argc < 3) ? KT_ALL : mask);
+        } else if (0 == strcmp(argv[1], "off")) {
+                ktrace_stop();
+        } else if (0 == strcmp(argv[1], "clear")) {
+                ktrace_clear();
+        } else {
+                kprintf(ksh, "Usage: ktrace [on [events] | off | clear]\n");
+                return 1;
+        }
+
+        return 0;
+}
+#endif
+
 #ifdef __VFS__
 int kshell_cat(kshell_t *ksh, int argc, char **argv)
 {
@@ -68,7 +123,6 @@ int kshell_cat(kshell_t *ksh, int argc, char **argv)
                 return 0;
         }
 
-        char buf[KSH_BUF_SIZE];
         int i;
         for (i = 1; i < argc; ++i) {
                 int fd, retval;
@@ -78,10 +132,9 @@ int kshell_cat(kshell_t *ksh, int argc, char **argv)
                         continue;
                 }
 
-                while ((retval = do_read(fd, buf, KSH_BUF_SIZE)) > 0) {
-                        retval = kshell_write_all(ksh, buf, retval);
-                        if (retval < 0) break;
-                }
+                /* straight from the file to the output, without a buffer */
+                while ((retval = do_sendfile(ksh->ksh_out_fd, fd, NULL, KSH_BUF_SIZE)) > 0)
+                        ;
                 if (retval < 0) {
                         kprintf(ksh, "Error reading or writing %s: %d\n", argv[i], retval);
                 }
@@ -96,12 +149,9 @@ int kshell_cat(kshell_t *ksh, int argc, char **argv)
 
 int kshell_ls(kshell_t *ksh, int argc, char **argv)
 {
-        int arglen, ret, fd;
-        dirent_t dirent;
+        int ret, fd, i;
         struct stat statbuf;
-        char direntname[KSH_BUF_SIZE];
-
-        memset(direntname, '\0', KSH_BUF_SIZE);
+        direntplus_t dp[8];
 
         if (argc > 3) {
                 kprintf(ksh, "Usage: ls <directory>\n");
@@ -124,34 +174,22 @@ int kshell_ls(kshell_t *ksh, int argc, char **argv)
                         kprintf(ksh, "Could not find directory: %s\n", argv[1]);
                         return 0;
                 }
-                arglen = strnlen(argv[1], KSH_BUF_SIZE);
         } else {
                 KASSERT(argc == 1);
                 if ((fd = do_open(".", O_RDONLY)) < 0) {
                         kprintf(ksh, "Could not find directory: .\n");
                         return 0;
                 }
-                arglen = 1;
         }
 
-        if (argc == 2)
-                memcpy(direntname, argv[1], arglen);
-        else
-                direntname[0] = '.';
-
-        direntname[arglen] = '/';
-        direntname[arglen + NAME_LEN + 1] = '\0';
-
-        while ((ret = do_getdent(fd, &dirent)) == sizeof(dirent_t)) {
-                memcpy(direntname + arglen + 1, dirent.d_name, NAME_LEN + 1);
-                if ((ret = do_stat(direntname, &statbuf)) < 0) {
-                        kprintf(ksh, "Error stat\'ing %s\n", dirent.d_name);
-                        continue;
-                }
-                if (S_ISDIR(statbuf.st_mode)) {
-                        kprintf(ksh, "%s/\n", dirent.d_name);
-                } else {
-                        kprintf(ksh, "%s\n", dirent.d_name);
+        /* the entries come with their stat, so nothing is looked up by name */
+        while ((ret = do_getdentsplus(fd, dp, sizeof(dp) / sizeof(dp[0]))) > 0) {
+                for (i = 0; i < ret; i++) {
+                        if (S_ISDIR(dp[i].dp_stat.st_mode)) {
+                                kprintf(ksh, "%s/\n", dp[i].dp_dirent.d_name);
+                        } else {
+                                kprintf(ksh, "%s\n", dp[i].dp_dirent.d_name);
+                        }
                 }
         }
 
@@ -320,4 +358,49 @@ int kshell_stat(kshell_t *ksh, int argc, char **argv)
 
         return exit_val;
 }
+
+static void kshell_print_pcstat(kshell_t *ksh, struct pcstat *st)
+{
+        kprintf(ksh, "Lookups: %u (%u hits, %u misses)\n",
+                st->pc_lookups, st->pc_hits, st->pc_misses);
+        kprintf(ksh, "Fills: %u\n", st->pc_fills);
+        kprintf(ksh, "Cleans: %u\n", st->pc_cleans);
+        kprintf(ksh, "Evictions: %u\n", st->pc_evictions);
+        kprintf(ksh, "Pageoutd wakeups: %u\n", st->pc_pageoutd_wakeups);
+        kprintf(ksh, "Waits for free pages: %u\n", st->pc_alloc_waits);
+        kprintf(ksh, "Resident: %u\n", st->pc_resident);
+}
+
+int kshell_pcstat(kshell_t *ksh, int argc, char **argv)
+{
+        KASSERT(NULL != ksh);
+        KASSERT(NULL != argv);
+
+        int i;
+        int fd;
+        int exit_val = 0;
+        struct pcstat buf;
+
+        if (argc < 2) {
+                do_pcstat(-1, &buf);
+                kshell_print_pcstat(ksh, &buf);
+                return 0;
+        }
+
+        for (i = 1; i < argc; ++i) {
+                if ((fd = do_open(argv[i], O_RDONLY)) < 0) {
+                        char *errstr = strerror(-fd);
+                        kprintf(ksh, "Cannot open `%s': %s\n",
+                                argv[i], errstr);
+                        exit_val = 1;
+                        continue;
+                }
+                do_pcstat(fd, &buf);
+                do_close(fd);
+                kprintf(ksh, "File: `%s'\n", argv[i]);
+                kshell_print_pcstat(ksh, &buf);
+        }
+
+        return exit_val;
+}
 #endif
@@ -8,6 +8,9 @@
 KSHELL_CMD(help);
 KSHELL_CMD(exit);
 KSHELL_CMD(echo);
+#ifdef __KTRACE__
+KSHELL_CMD(ktrace);
+#endif
 #ifdef __VFS__
 KSHELL_CMD(cat);
 KSHELL_CMD(ls);
@@ -17,4 +20,5 @@ KSHELL_CMD(link);
 KSHELL_CMD(rmdir);
 KSHELL_CMD(mkdir);
 KSHELL_CMD(stat);
+KSHELL_CMD(pcstat);
 #endif
@@ -50,6 +50,10 @@ static __attribute__((unused)) void kshell_init()
         kshell_add_command("help", kshell_help,
                            "prints a list of available commands");
         kshell_add_command("echo", kshell_echo, "display a line of text");
+#ifdef __KTRACE__
+        kshell_add_command("ktrace", kshell_ktrace,
+                           "control and dump the kernel trace buffer");
+#endif
 #ifdef __VFS__
         kshell_add_command("cat", kshell_cat,
                            "concatenate files and print on the standard output");
@@ -62,6 +66,8 @@ static __attribute__((unused)) void kshell_init()
                            "remove empty directories");
         kshell_add_command("mkdir", kshell_mkdir, "make directories");
         kshell_add_command("stat", kshell_stat, "display file status");
+        kshell_add_command("pcstat", kshell_pcstat,
+                           "display page cache statistics");
 #endif
 
         kshell_add_command("exit", kshell_exit, "exits the shell");
@@ -0,0 +1,181 @@
+//
+// Tests procfs, on an instance mounted just for the test
+//
+
+#include "globals.h"
+#include "errno.h"
+
+#include "test/usertest.h"
+#include "test/kshell/kshell.h"
+
+#include "proc/proc.h"
+
+#include "mm/kmalloc.h"
+#include "mm/page.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/string.h"
+#include "util/printf.h"
+#include "util/ktrace.h"
+
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/stat.h"
+#include "fs/dirent.h"
+
+static int
+procfs_lookup_path(vnode_t *dir, const char *name, vnode_t **result)
+{
+        return dir->vn_ops->lookup(dir, name, strlen(name), result);
+}
+
+static void
+test_procfs_root(vnode_t *root)
+{
+        vnode_t *vn;
+        char buf[256];
+        struct dirent d;
+        struct stat st;
+        int off, ret, nentries = 0, sawself = 0;
+        char pid[16];
+
+        test_assert(S_ISDIR(root->vn_mode), "root isn't a directory");
+        test_assert(procfs_lookup_path(root, "nosuchfile", &vn) == -ENOENT,
+                    "found a file which doesn't exist");
+        test_assert(procfs_lookup_path(root, "9999", &vn) == -ENOENT,
+                    "found a process which doesn't exist");
+        /* 2^32 + 1 would wrap around to init if the pid overflowed */
+        test_assert(procfs_lookup_path(root, "4294967297", &vn) == -ENOENT,
+                    "found a process past PROC_MAX_COUNT");
+
+        test_assert(procfs_lookup_path(root, "schedstat", &vn) == 0,
+                    "couldn't look up schedstat");
+        test_assert(S_ISREG(vn->vn_mode), "schedstat isn't a file");
+        ret = vn->vn_ops->read(vn, 0, buf, sizeof(buf) - 1);
+        test_assert(ret > 0, "schedstat is empty");
+        test_assert(vn->vn_ops->read(vn, 1 << 20, buf, sizeof(buf)) == 0,
+                    "read past the end of schedstat");
+        test_assert(vn->vn_ops->write(vn, 0, "x", 1) == -EROFS,
+                    "wrote to schedstat");
+        test_assert(vn->vn_ops->stat(vn, &st) == 0 && S_ISREG(st.st_mode),
+                    "couldn't stat schedstat");
+        vput(vn);
+
+        test_assert(root->vn_ops->mkdir(root, "dir", 3) == -EROFS,
+                    "made a directory in procfs");
+        test_assert(root->vn_ops->unlink(root, "pcstat", 6) == -EROFS,
+                    "unlinked a file in procfs");
+
+        snprintf(pid, sizeof(pid), "%d", curproc->p_pid);
+        off = 0;
+        while (0 < (ret = root->vn_ops->readdir(root, off, &d))) {
+                off += ret;
+                nentries++;
+                if (0 == strcmp(d.d_name, pid))
+                        sawself = 1;
+        }
+        test_assert(ret == 0, "readdir failed");
+        test_assert(nentries > 2, "root is empty");
+        test_assert(sawself, "no directory for the current process");
+}
+
+static void
+test_procfs_pid(vnode_t *root)
+{
+        vnode_t *dir, *vn;
+        char buf[256];
+        char pid[16];
+        int ret;
+
+        snprintf(pid, sizeof(pid), "%d", curproc->p_pid);
+        test_assert(procfs_lookup_path(root, pid, &dir) == 0,
+                    "couldn't look up the current process");
+        test_assert(S_ISDIR(dir->vn_mode), "process isn't a directory");
+
+        test_assert(procfs_lookup_path(dir, "status", &vn) == 0,
+                    "couldn't look up status");
+        ret = vn->vn_ops->read(vn, 0, buf, sizeof(buf) - 1);
+        test_assert(ret > 0, "status is empty");
+        buf[MAX(ret, 0)] = '\0';
+        test_assert(NULL != strstr(buf, "pid:"), "status doesn't have a pid");
+        vput(vn);
+
+        test_assert(procfs_lookup_path(dir, "..", &vn) == 0 && vn == root,
+                    ".. of a process isn't the root");
+        vput(vn);
+        vput(dir);
+}
+
+#ifdef __KTRACE__
+static void
+test_procfs_ktrace(vnode_t *root)
+{
+        uint32_t mask = ktrace_mask;
+        ktrace_event_t ev;
+        vnode_t *vn, *trace;
+
+        test_assert(procfs_lookup_path(root, "ktrace", &trace) == 0,
+                    "couldn't look up ktrace");
+
+        ktrace_clear();
+        ktrace_start(KT_TYPE(KT_VGET));
+        test_assert(procfs_lookup_path(root, "pcstat", &vn) == 0,
+                    "couldn't look up pcstat");
+        ktrace_stop();
+
+        test_assert(ktrace_count() == 1, "expected exactly one event");
+        test_assert(trace->vn_ops->read(trace, 0, &ev, sizeof(ev)) == sizeof(ev),
+                    "couldn't read an event");
+        test_assert(ev.ke_type == KT_VGET, "wrong type of event");
+        test_assert(ev.ke_pid == curproc->p_pid, "wrong pid");
+        test_assert(ev.ke_args[0] == (uint32_t)vn->vn_fs
+                    && ev.ke_args[1] == vn->vn_vno, "wrong arguments");
+        test_assert(trace->vn_ops->read(trace, sizeof(ev), &ev, sizeof(ev)) == 0,
+                    "read past the last event");
+
+        vput(vn);
+        vput(trace);
+        ktrace_clear();
+        ktrace_start(mask);
+}
+#endif
+
+static int
+test_procfs(kshell_t *ksh, int argc, char **argv)
+{
+        fs_t *fs;
+
+        test_init();
+
+        fs = kmalloc(sizeof(fs_t));
+        KASSERT(NULL != fs);
+        memset(fs, 0, sizeof(fs_t));
+        strcpy(fs->fs_type, "procfs");
+        test_assert(mountfunc(fs) == 0, "couldn't mount procfs");
+
+        dbg(DBG_TEST, "Testing the procfs root\n");
+        test_procfs_root(fs->fs_root);
+        dbg(DBG_TEST, "Testing procfs process directories\n");
+        test_procfs_pid(fs->fs_root);
+#ifdef __KTRACE__
+        dbg(DBG_TEST, "Testing the ktrace file\n");
+        test_procfs_ktrace(fs->fs_root);
+#endif
+
+        vput(fs->fs_root);
+        kfree(fs);
+
+        test_fini();
+        return 0;
+}
+
+#ifdef __VFS__
+static __attribute__((unused)) void
+test_procfs_init()
+{
+        kshell_add_command("test_procfs", test_procfs, "run procfs tests");
+}
+init_func(test_procfs_init);
+init_depends(kshell_init);
+#endif /* __VFS__ */
@@ -9,14 +9,23 @@
 
 #include "test/usertest.h"
 
+#include "proc/sched.h"
+
+#include "mm/page.h"
+
 #include "util/debug.h"
 #include "util/string.h"
 #include "util/printf.h"
 
 #include "fs/s5fs/s5fs.h"
+#include "fs/s5fs/s5fs_subr.h"
+#include "fs/vfs.h"
+#include "fs/vnode.h"
+#include "fs/file.h"
 #include "fs/vfs_syscall.h"
 #include "fs/lseek.h"
 #include "fs/fcntl.h"
+#include "fs/defrag.h"
 
 #define BUFSIZE 256
 #define BIG_BUFSIZE 2056
@@ -43,7 +52,8 @@ static int write_until_fail(int fd)
                 total_written += res;
         }
         KASSERT(total_written == S5_MAX_FILE_SIZE);
-        KASSERT(do_lseek(fd, 0, SEEK_END) == S5_MAX_FILE_SIZE);
+        test_assert(do_lseek(fd, 0, SEEK_END) == S5_MAX_FILE_SIZE,
+                    "file isn't the maximum size");
 
         return 0;
 }
@@ -217,6 +227,818 @@ static int test_sparseness_indirect_blocks()
         return 0;
 }
 
+// Removing entries leaves holes which later links should fill, and a
+// directory that is mostly holes should shrink back down.
+static void test_directory_slots()
+{
+        const int nfiles = 3 * S5_DIRENTS_PER_BLOCK;
+        char filename[BUFSIZE];
+        struct stat st;
+        int i, fd;
+
+        test_assert(do_mkdir("slotdir") == 0, "couldnt make slotdir");
+        test_assert(do_chdir("slotdir") == 0, "couldnt chdir to slotdir");
+
+        for (i = 0; i < nfiles; ++i) {
+                get_file_name(filename, BUFSIZE, i);
+                fd = do_open(filename, O_RDONLY | O_CREAT);
+                test_assert(fd >= 0, "couldnt create %s", filename);
+                do_close(fd);
+        }
+        test_assert(do_stat(".", &st) == 0, "couldnt stat slotdir");
+        test_assert(st.st_size == (int)((nfiles + 2) * sizeof(s5_dirent_t)),
+                    "slotdir has size %d", st.st_size);
+
+        // punch a hole and fill it again, the size should not change
+        test_assert(do_unlink("file5") == 0, "couldnt unlink file5");
+        fd = do_open("refill", O_RDONLY | O_CREAT);
+        test_assert(fd >= 0, "couldnt create refill");
+        do_close(fd);
+        test_assert(do_stat(".", &st) == 0, "couldnt stat slotdir");
+        test_assert(st.st_size == (int)((nfiles + 2) * sizeof(s5_dirent_t)),
+                    "hole was not reused, size is %d", st.st_size);
+
+        // remove all but the last file, which forces a compaction
+        for (i = 0; i < nfiles - 1; ++i) {
+                if (5 == i)
+                        continue;
+                get_file_name(filename, BUFSIZE, i);
+                test_assert(do_unlink(filename) == 0, "couldnt unlink %s", filename);
+        }
+        test_assert(do_stat(".", &st) == 0, "couldnt stat slotdir");
+        test_assert(st.st_size <= S5_BLOCK_SIZE, "slotdir was not compacted, "
+                    "size is %d", st.st_size);
+
+        get_file_name(filename, BUFSIZE, nfiles - 1);
+        test_assert(do_stat(filename, &st) == 0, "lost %s in compaction", filename);
+        test_assert(do_stat("refill", &st) == 0, "lost refill in compaction");
+
+        test_assert(do_unlink(filename) == 0, "couldnt unlink %s", filename);
+        test_assert(do_unlink("refill") == 0, "couldnt unlink refill");
+        test_assert(do_chdir("..") == 0, "couldnt leave slotdir");
+        test_assert(do_rmdir("slotdir") == 0, "couldnt remove slotdir");
+}
+
+// Preallocated space should read back as zeros, and should only change
+// the file size when asked to.
+static void test_fallocate()
+{
+        const int len = 5 * S5_BLOCK_SIZE;
+        struct stat st;
+        int fd = do_open("preallocated", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create preallocated");
+
+        test_assert(do_fallocate(fd, 0, 0, 0) == -EINVAL, "zero length worked");
+        test_assert(do_fallocate(fd, 0, -1, 1) == -EINVAL, "negative offset worked");
+
+        test_assert(do_fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, len) == 0,
+                    "couldnt preallocate");
+        test_assert(do_stat("preallocated", &st) == 0, "couldnt stat");
+        test_assert(st.st_size == 0, "KEEP_SIZE changed the size to %d", st.st_size);
+
+        test_assert(do_fallocate(fd, 0, 10, len) == 0, "couldnt preallocate");
+        test_assert(do_stat("preallocated", &st) == 0, "couldnt stat");
+        test_assert(st.st_size == len + 10, "size is %d", st.st_size);
+        test_assert(is_first_n_bytes_zero(fd, len + 10) == 1,
+                    "preallocated range isnt zero");
+
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_unlink("preallocated") == 0, "couldnt unlink");
+}
+
+// Shrinking a file should drop the data past the new end, and growing it
+// again should not bring the old data back.
+static void test_truncate()
+{
+        const int len = (S5_NDIRECT_BLOCKS + 2) * S5_BLOCK_SIZE;
+        char buf[BUFSIZE];
+        struct stat st;
+        int i, fd = do_open("truncated", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create truncated");
+
+        memset(buf, 'a', BUFSIZE);
+        for (i = 0; i < len; i += BUFSIZE)
+                test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+
+        test_assert(do_ftruncate(fd, -1) == -EINVAL, "negative length worked");
+        test_assert(do_ftruncate(fd, 10) == 0, "couldnt truncate");
+        test_assert(do_stat("truncated", &st) == 0, "couldnt stat");
+        test_assert(st.st_size == 10, "size is %d", st.st_size);
+
+        test_assert(do_truncate("truncated", len) == 0, "couldnt extend");
+        test_assert(do_stat("truncated", &st) == 0, "couldnt stat");
+        test_assert(st.st_size == len, "size is %d", st.st_size);
+        test_assert(do_lseek(fd, 10, SEEK_SET) == 10, "couldnt seek");
+        test_assert(is_first_n_bytes_zero(fd, len - 10) == 1,
+                    "old data came back after truncate");
+
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_truncate("s5fstest", 0) == -ENOENT, "truncated a missing file");
+        test_assert(do_truncate(".", 0) == -EISDIR, "truncated a directory");
+        test_assert(do_unlink("truncated") == 0, "couldnt unlink");
+}
+
+// Holes and data should be found from the block map, with an implicit
+// hole at the end of the file.
+static void test_seek_hole()
+{
+        char buf[BUFSIZE];
+        int fd = do_open("holey", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create holey");
+
+        memset(buf, 'a', BUFSIZE);
+        test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        test_assert(do_lseek(fd, 4 * S5_BLOCK_SIZE, SEEK_SET) == 4 * S5_BLOCK_SIZE,
+                    "couldnt seek");
+        test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+
+        test_assert(do_lseek(fd, 10, SEEK_DATA) == 10, "data isnt data");
+        test_assert(do_lseek(fd, 10, SEEK_HOLE) == S5_BLOCK_SIZE, "missed the hole");
+        test_assert(do_lseek(fd, S5_BLOCK_SIZE, SEEK_DATA) == 4 * S5_BLOCK_SIZE,
+                    "missed the data after the hole");
+        test_assert(do_lseek(fd, 4 * S5_BLOCK_SIZE, SEEK_HOLE) == 4 * S5_BLOCK_SIZE + BUFSIZE,
+                    "missed the hole at the end");
+        test_assert(do_lseek(fd, 4 * S5_BLOCK_SIZE + BUFSIZE, SEEK_DATA) == -ENXIO,
+                    "found data past the end");
+        test_assert(do_lseek(fd, -1, SEEK_HOLE) == -ENXIO, "negative offset worked");
+
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_unlink("holey") == 0, "couldnt unlink");
+}
+
+// Enough metadata updates to fill several transactions should all still
+// be there after the journal commits, and a sync should leave nothing
+// waiting in it.
+static void test_journal()
+{
+        s5fs_t *s5 = FS_TO_S5FS(vfs_root_vn->vn_fs);
+        char name[S5_NAME_LEN];
+        int i, fd;
+
+        test_assert(do_mkdir("journaled") == 0, "couldnt mkdir");
+        for (i = 0; i < 4 * S5_JOURNAL_COMMIT_AT; i++) {
+                snprintf(name, sizeof(name), "journaled/f%d", i);
+                fd = do_open(name, O_RDWR | O_CREAT);
+                test_assert(fd >= 0, "couldnt create %s", name);
+                test_assert(do_close(fd) == 0, "couldnt close");
+        }
+
+        vfs_sync();
+        if (NULL != s5->s5f_journal)
+                test_assert(s5->s5f_journal->jn_nentries == 0,
+                            "%d blocks left after sync",
+                            s5->s5f_journal->jn_nentries);
+
+        for (i = 0; i < 4 * S5_JOURNAL_COMMIT_AT; i++) {
+                snprintf(name, sizeof(name), "journaled/f%d", i);
+                test_assert(do_unlink(name) == 0, "%s went missing", name);
+        }
+        test_assert(do_rmdir("journaled") == 0, "couldnt rmdir");
+}
+
+// Truncating a file with a populated indirect block frees more blocks
+// than one transaction can log; it should commit in steps along the way
+// instead of overflowing the journal.
+static void test_journal_truncate()
+{
+        s5fs_t *s5 = FS_TO_S5FS(vfs_root_vn->vn_fs);
+        const int len = (S5_NDIRECT_BLOCKS + 64) * S5_BLOCK_SIZE;
+        char buf[BUFSIZE];
+        struct stat st;
+        uint32_t seq;
+        int i, fd = do_open("journaltrunc", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create journaltrunc");
+
+        memset(buf, 'a', BUFSIZE);
+        for (i = 0; i < len; i += BUFSIZE)
+                test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        vfs_sync();
+
+        if (NULL != s5->s5f_journal) {
+                seq = s5->s5f_journal->jn_seq;
+                test_assert(do_ftruncate(fd, 0) == 0, "couldnt truncate");
+                test_assert(s5->s5f_journal->jn_seq != seq,
+                            "truncate never committed");
+                test_assert(s5->s5f_journal->jn_nentries <= S5_JOURNAL_MAX_TRANS,
+                            "%d blocks in one transaction",
+                            s5->s5f_journal->jn_nentries);
+                vfs_sync();
+                test_assert(s5->s5f_journal->jn_nentries == 0,
+                            "%d blocks left after sync",
+                            s5->s5f_journal->jn_nentries);
+        } else {
+                test_assert(do_ftruncate(fd, 0) == 0, "couldnt truncate");
+        }
+        test_assert(do_stat("journaltrunc", &st) == 0, "couldnt stat");
+        test_assert(st.st_size == 0, "size is %d", st.st_size);
+
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_unlink("journaltrunc") == 0, "couldnt unlink");
+}
+
+// An open file should not keep its inode table page pinned once the
+// journal has let go of it.
+static void test_incore_inodes()
+{
+        s5fs_t *s5 = FS_TO_S5FS(vfs_root_vn->vn_fs);
+        struct stat st;
+        pframe_t *pf;
+        int fd = do_open("incore", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create incore");
+
+        test_assert(do_write(fd, "x", 1) == 1, "couldnt write");
+        test_assert(do_stat("incore", &st) == 0, "couldnt stat");
+        vfs_sync();
+        pf = pframe_get_resident(&s5->s5f_bdev->bd_mmobj, S5_INODE_BLOCK(st.st_ino));
+        test_assert(NULL == pf || !pframe_is_pinned(pf),
+                    "inode table page is pinned");
+
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_stat("incore", &st) == 0, "couldnt stat");
+        test_assert(st.st_size == 1, "size is %d", st.st_size);
+        test_assert(do_unlink("incore") == 0, "couldnt unlink");
+}
+
+// A small file should live in its inode, and should move out to blocks
+// without losing data once it grows past the inline area.
+static void test_inline()
+{
+        char buf[BUFSIZE];
+        file_t *f;
+        int fd = do_open("inlined", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create inlined");
+        f = fget(fd);
+
+        memset(buf, 'a', BUFSIZE);
+        test_assert(do_write(fd, buf, 10) == 10, "couldnt write");
+        test_assert(S5_INODE_INLINE & VNODE_TO_S5INODE(f->f_vnode)->s5_flags,
+                    "small file isnt inline");
+        test_assert(do_ftruncate(fd, 5) == 0, "couldnt truncate");
+        test_assert(do_lseek(fd, 0, SEEK_HOLE) == 5, "inline file has a hole");
+
+        test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        test_assert(!(S5_INODE_INLINE & VNODE_TO_S5INODE(f->f_vnode)->s5_flags),
+                    "big file is still inline");
+        vfs_sync();
+        test_assert(do_lseek(fd, 0, SEEK_SET) == 0, "couldnt seek");
+        memset(buf, 0, BUFSIZE);
+        test_assert(do_read(fd, buf, 5) == 5, "couldnt read");
+        test_assert(!strncmp(buf, "aaaaa", 5), "inline data was lost");
+
+        fput(f);
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_unlink("inlined") == 0, "couldnt unlink");
+}
+
+// The free counts kept while mounted (and saved at unmount) should agree
+// with walking the free lists.
+static void test_free_counts()
+{
+        s5fs_t *s5 = FS_TO_S5FS(vfs_root_vn->vn_fs);
+        char buf[BUFSIZE];
+        int i, fd = do_open("counted", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create counted");
+
+        memset(buf, 'a', BUFSIZE);
+        for (i = 0; i < 2 * S5_BLOCK_SIZE; i += BUFSIZE)
+                test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        test_assert(do_close(fd) == 0, "couldnt close");
+        vfs_sync();
+
+        test_assert(s5->s5f_nfree_blocks == s5_count_free_blocks(s5),
+                    "%d free blocks counted, %d on the free list",
+                    s5->s5f_nfree_blocks, s5_count_free_blocks(s5));
+        test_assert(s5->s5f_nfree_inodes == s5_count_free_inodes(s5),
+                    "%d free inodes counted, %d on the free list",
+                    s5->s5f_nfree_inodes, s5_count_free_inodes(s5));
+        test_assert(do_unlink("counted") == 0, "couldnt unlink");
+}
+
+// statfs() should see inodes and blocks go as files are made and filled.
+static void test_statfs()
+{
+        struct statfs before, after;
+        char buf[BUFSIZE];
+        int i, fd;
+
+        test_assert(do_statfs(".", &before) == 0, "couldnt statfs");
+        test_assert(before.f_bsize == S5_BLOCK_SIZE, "block size is %d", before.f_bsize);
+        test_assert(before.f_bfree <= before.f_blocks, "more free blocks than blocks");
+        test_assert(before.f_ffree < before.f_files, "every inode is free");
+
+        fd = do_open("statted", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create statted");
+        memset(buf, 'a', BUFSIZE);
+        for (i = 0; i < 2 * S5_BLOCK_SIZE; i += BUFSIZE)
+                test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+
+        test_assert(do_fstatfs(fd, &after) == 0, "couldnt fstatfs");
+        test_assert(after.f_ffree == before.f_ffree - 1, "%d free inodes, expected %d",
+                    after.f_ffree, before.f_ffree - 1);
+        test_assert(after.f_bfree == before.f_bfree - 2, "%d free blocks, expected %d",
+                    after.f_bfree, before.f_bfree - 2);
+
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_unlink("statted") == 0, "couldnt unlink");
+        test_assert(do_statfs("statted", &after) == -ENOENT, "statfs on a missing file");
+        test_assert(do_fstatfs(fd, &after) == -EBADF, "fstatfs on a closed fd");
+}
+
+static void wait_for_reclaim(s5fs_t *s5)
+{
+        /* s5_reclaimd wakes us after each batch */
+        while (0 != s5->s5f_npending) {
+                s5_reclaim_start(s5);
+                sched_sleep_on(&s5->s5f_reclaim_waitq);
+        }
+}
+
+// Unlinking a file leaves its blocks to s5_reclaimd. They should all end
+// up on the free list along with the inode, and statfs() should count
+// them as free once they have.
+static void test_reclaim()
+{
+        s5fs_t *s5 = FS_TO_S5FS(vfs_root_vn->vn_fs);
+        struct statfs before, after;
+        char buf[BUFSIZE];
+        int i, fd;
+
+        /* earlier tests' files may not be gone yet */
+        wait_for_reclaim(s5);
+        test_assert(do_statfs(".", &before) == 0, "couldnt statfs");
+        test_assert(before.f_bpending == 0, "%d blocks pending", before.f_bpending);
+
+        fd = do_open("reclaimed", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create reclaimed");
+        memset(buf, 'a', BUFSIZE);
+        for (i = 0; i < (S5_NDIRECT_BLOCKS + 100) * S5_BLOCK_SIZE; i += BUFSIZE)
+                test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        test_assert(do_close(fd) == 0, "couldnt close");
+        vfs_sync();
+
+        test_assert(do_unlink("reclaimed") == 0, "couldnt unlink");
+        test_assert(do_statfs(".", &after) == 0, "couldnt statfs");
+        test_assert(after.f_bfree <= before.f_bfree,
+                    "%d free blocks before they were reclaimed, expected at most %d",
+                    after.f_bfree, before.f_bfree);
+
+        wait_for_reclaim(s5);
+        test_assert((uint32_t) -1 == s5->s5f_super->s5s_orphan_inode,
+                    "inode %d still orphaned", s5->s5f_super->s5s_orphan_inode);
+        test_assert(s5->s5f_nfree_blocks == s5_count_free_blocks(s5),
+                    "%d free blocks counted, %d on the free list",
+                    s5->s5f_nfree_blocks, s5_count_free_blocks(s5));
+        test_assert(s5->s5f_nfree_inodes == s5_count_free_inodes(s5),
+                    "%d free inodes counted, %d on the free list",
+                    s5->s5f_nfree_inodes, s5_count_free_inodes(s5));
+        test_assert(do_statfs(".", &after) == 0, "couldnt statfs");
+        test_assert(after.f_bfree == before.f_bfree, "%d free blocks, expected %d",
+                    after.f_bfree, before.f_bfree);
+        test_assert(after.f_bpending == 0, "%d blocks still pending", after.f_bpending);
+        test_assert(after.f_ffree == before.f_ffree, "%d free inodes, expected %d",
+                    after.f_ffree, before.f_ffree);
+}
+
+// Writes through an O_DIRECT descriptor should be seen through the page
+// cache and the other way around, including pages cached before.
+static void test_direct_io()
+{
+        char *page = page_alloc();
+        char buf[BUFSIZE];
+        int i, fd, dfd;
+
+        test_assert(NULL != page, "couldnt allocate a page");
+        fd = do_open("direct", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create direct");
+        dfd = do_open("direct", O_RDWR | O_DIRECT);
+        test_assert(dfd >= 0, "couldnt open direct with O_DIRECT");
+
+        /* cached, then overwritten underneath */
+        memset(buf, 'a', BUFSIZE);
+        for (i = 0; i < 3 * S5_BLOCK_SIZE; i += BUFSIZE)
+                test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        memset(page, 'b', S5_BLOCK_SIZE);
+        test_assert(do_lseek(dfd, S5_BLOCK_SIZE, SEEK_SET) == S5_BLOCK_SIZE, "couldnt seek");
+        test_assert(do_write(dfd, page, S5_BLOCK_SIZE) == S5_BLOCK_SIZE, "couldnt write directly");
+        test_assert(do_lseek(fd, S5_BLOCK_SIZE, SEEK_SET) == S5_BLOCK_SIZE, "couldnt seek");
+        test_assert(do_read(fd, buf, BUFSIZE) == BUFSIZE, "couldnt read");
+        for (i = 0; i < BUFSIZE; ++i)
+                test_assert(buf[i] == 'b', "byte %d is %c, not the one written directly",
+                            i, buf[i]);
+
+        /* dirty in the cache, then read underneath */
+        memset(buf, 'c', BUFSIZE);
+        test_assert(do_lseek(fd, 2 * S5_BLOCK_SIZE, SEEK_SET) == 2 * S5_BLOCK_SIZE, "couldnt seek");
+        test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        test_assert(do_read(dfd, page, S5_BLOCK_SIZE) == S5_BLOCK_SIZE, "couldnt read directly");
+        for (i = 0; i < S5_BLOCK_SIZE; ++i)
+                test_assert(page[i] == (i < BUFSIZE ? 'c' : 'a'),
+                            "byte %d is %c after reading directly", i, page[i]);
+
+        /* extending the file directly, with a partial block at the end */
+        memset(page, 'd', S5_BLOCK_SIZE);
+        test_assert(do_write(dfd, page, S5_BLOCK_SIZE) == S5_BLOCK_SIZE, "couldnt write directly");
+        test_assert(do_write(dfd, page, BUFSIZE) == BUFSIZE, "couldnt write directly");
+        test_assert(do_lseek(fd, 0, SEEK_END) == 4 * S5_BLOCK_SIZE + BUFSIZE,
+                    "file didnt grow");
+
+        page_free(page);
+        test_assert(do_close(dfd) == 0, "couldnt close");
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_unlink("direct") == 0, "couldnt unlink");
+}
+
+// sendfile() should copy a file, reading from the given offset rather
+// than the file position, and splice() should move it through a pipe.
+static void test_sendfile()
+{
+        char buf[BUFSIZE];
+        int i, in, out;
+        off_t off = BUFSIZE;
+#ifdef __PIPES__
+        int fds[2];
+#endif
+
+        in = do_open("sent", O_RDWR | O_CREAT);
+        test_assert(in >= 0, "couldnt create sent");
+        out = do_open("received", O_RDWR | O_CREAT);
+        test_assert(out >= 0, "couldnt create received");
+        for (i = 0; i < 3 * S5_BLOCK_SIZE; i += BUFSIZE) {
+                memset(buf, 'a' + i / BUFSIZE % 26, BUFSIZE);
+                test_assert(do_write(in, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        }
+        test_assert(do_lseek(in, 0, SEEK_SET) == 0, "couldnt seek");
+
+        test_assert(do_sendfile(out, in, &off, 3 * S5_BLOCK_SIZE) == 3 * S5_BLOCK_SIZE - BUFSIZE,
+                    "sendfile didnt stop at the end of the file");
+        test_assert(off == 3 * S5_BLOCK_SIZE, "offset is %d after sendfile", off);
+        test_assert(do_lseek(in, 0, SEEK_CUR) == 0, "sendfile moved the file position");
+        test_assert(do_sendfile(out, in, &off, BUFSIZE) == 0, "sendfile past the end");
+        test_assert(do_sendfile(in, in, NULL, BUFSIZE) == -EINVAL, "sendfile to itself");
+
+        test_assert(do_lseek(out, 0, SEEK_SET) == 0, "couldnt seek");
+        for (i = BUFSIZE; i < 3 * S5_BLOCK_SIZE; i += BUFSIZE) {
+                test_assert(do_read(out, buf, BUFSIZE) == BUFSIZE, "couldnt read");
+                test_assert(buf[0] == 'a' + i / BUFSIZE % 26 && buf[BUFSIZE - 1] == buf[0],
+                            "wrong data sent at %d", i);
+        }
+
+#ifdef __PIPES__
+        test_assert(do_pipe(fds) == 0, "couldnt make a pipe");
+        test_assert(do_splice(in, NULL, out, NULL, BUFSIZE) == -EINVAL,
+                    "splice without a pipe");
+        test_assert(do_splice(fds[0], &off, out, NULL, BUFSIZE) == -ESPIPE,
+                    "splice with an offset for a pipe");
+        test_assert(do_splice(in, NULL, fds[1], NULL, BUFSIZE) == BUFSIZE,
+                    "couldnt splice into the pipe");
+        test_assert(do_lseek(in, 0, SEEK_CUR) == BUFSIZE, "splice didnt move the file position");
+        test_assert(do_read(fds[0], buf, BUFSIZE) == BUFSIZE, "couldnt read the pipe");
+        for (i = 0; i < BUFSIZE; ++i)
+                test_assert(buf[i] == 'a', "wrong data spliced at %d", i);
+
+        test_assert(do_close(fds[0]) == 0, "couldnt close");
+        test_assert(do_close(fds[1]) == 0, "couldnt close");
+#endif
+        test_assert(do_close(in) == 0, "couldnt close");
+        test_assert(do_close(out) == 0, "couldnt close");
+        test_assert(do_unlink("sent") == 0, "couldnt unlink");
+        test_assert(do_unlink("received") == 0, "couldnt unlink");
+}
+
+// copy_file_range() should share the whole blocks of a file rather than
+// copy them, copy a block on write to either file, and only free a block
+// once neither file has it.
+static void test_copy_file_range()
+{
+        s5fs_t *s5 = FS_TO_S5FS(vfs_root_vn->vn_fs);
+        const int size = 4 * S5_BLOCK_SIZE + BUFSIZE;
+        struct statfs start, before, after;
+        char buf[BUFSIZE];
+        int i, in, out, ret;
+        off_t off = 0, eof, outeof;
+
+        wait_for_reclaim(s5);
+        test_assert(do_statfs(".", &start) == 0, "couldnt statfs");
+
+        in = do_open("original", O_RDWR | O_CREAT);
+        test_assert(in >= 0, "couldnt create original");
+        out = do_open("clone", O_RDWR | O_CREAT);
+        test_assert(out >= 0, "couldnt create clone");
+        for (i = 0; i < size; i += BUFSIZE) {
+                memset(buf, 'a' + i / BUFSIZE % 26, BUFSIZE);
+                test_assert(do_write(in, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        }
+
+        test_assert(do_copy_file_range(in, &off, out, NULL, size, 1) == -EINVAL,
+                    "copy_file_range with flags");
+        test_assert(do_copy_file_range(in, &off, in, NULL, size, 0) == -EINVAL,
+                    "copy_file_range to itself");
+
+        /* only the partial block at the end takes space */
+        test_assert(do_statfs(".", &before) == 0, "couldnt statfs");
+        test_assert(do_copy_file_range(in, &off, out, NULL, 2 * size, 0) == size,
+                    "copy_file_range didnt stop at the end of the file");
+        test_assert(off == size, "offset is %d after copy_file_range", off);
+        test_assert(do_lseek(out, 0, SEEK_CUR) == size, "file position not moved");
+        test_assert(do_statfs(".", &after) == 0, "couldnt statfs");
+        test_assert(before.f_bfree - after.f_bfree == 1, "copy took %d blocks",
+                    before.f_bfree - after.f_bfree);
+
+        /* past the end there is nothing to share, and nothing to copy */
+        eof = outeof = 8 * S5_BLOCK_SIZE;
+        ret = do_copy_file_range(in, &eof, out, &outeof, size, 0);
+        test_assert(ret == 0, "copy_file_range past the end returned %d", ret);
+
+        /* writing to the copy gives it a block of its own */
+        memset(buf, 'z', BUFSIZE);
+        test_assert(do_lseek(out, S5_BLOCK_SIZE, SEEK_SET) == S5_BLOCK_SIZE, "couldnt seek");
+        test_assert(do_write(out, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        test_assert(do_statfs(".", &after) == 0, "couldnt statfs");
+        test_assert(before.f_bfree - after.f_bfree == 2, "copy and write took %d blocks",
+                    before.f_bfree - after.f_bfree);
+        vfs_sync();
+
+        test_assert(do_lseek(in, 0, SEEK_SET) == 0, "couldnt seek");
+        test_assert(do_lseek(out, 0, SEEK_SET) == 0, "couldnt seek");
+        for (i = 0; i < size; i += BUFSIZE) {
+                test_assert(do_read(in, buf, BUFSIZE) == BUFSIZE, "couldnt read");
+                test_assert(buf[0] == 'a' + i / BUFSIZE % 26 && buf[BUFSIZE - 1] == buf[0],
+                            "original changed at %d", i);
+                test_assert(do_read(out, buf, BUFSIZE) == BUFSIZE, "couldnt read");
+                test_assert(buf[BUFSIZE - 1] == (i == S5_BLOCK_SIZE ? 'z' : 'a' + i / BUFSIZE % 26),
+                            "wrong data copied at %d", i);
+        }
+
+        /* the shared blocks outlive the original */
+        test_assert(do_close(in) == 0, "couldnt close");
+        test_assert(do_unlink("original") == 0, "couldnt unlink");
+        wait_for_reclaim(s5);
+        test_assert(do_lseek(out, 2 * S5_BLOCK_SIZE, SEEK_SET) == 2 * S5_BLOCK_SIZE,
+                    "couldnt seek");
+        test_assert(do_read(out, buf, BUFSIZE) == BUFSIZE, "couldnt read");
+        test_assert(buf[0] == 'a' + 2 * S5_BLOCK_SIZE / BUFSIZE % 26,
+                    "shared block lost with the original");
+
+        test_assert(do_close(out) == 0, "couldnt close");
+        test_assert(do_unlink("clone") == 0, "couldnt unlink");
+        wait_for_reclaim(s5);
+        test_assert(s5->s5f_nfree_blocks == s5_count_free_blocks(s5),
+                    "%d free blocks counted, %d on the free list",
+                    s5->s5f_nfree_blocks, s5_count_free_blocks(s5));
+        test_assert(do_statfs(".", &after) == 0, "couldnt statfs");
+        test_assert(after.f_bfree == start.f_bfree, "%d free blocks, expected %d",
+                    after.f_bfree, start.f_bfree);
+}
+
+// fadvise() should drop a file's clean pages for POSIX_FADV_DONTNEED,
+// have readaheadd bring them back for POSIX_FADV_WILLNEED, and leave
+// what the file reads the same whatever the advice.
+static void test_fadvise()
+{
+        const int npages = 4;
+        char buf[BUFSIZE];
+        vnode_t *vn;
+        int i, fd;
+
+        fd = do_open("advised", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create advised");
+        vn = curproc->p_files[fd]->f_vnode;
+        for (i = 0; i < npages * S5_BLOCK_SIZE; i += BUFSIZE) {
+                memset(buf, 'a' + i / BUFSIZE % 26, BUFSIZE);
+                test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        }
+
+        test_assert(do_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE + 1) == -EINVAL,
+                    "fadvise with unknown advice");
+        test_assert(do_fadvise(fd, -1, 0, POSIX_FADV_NORMAL) == -EINVAL,
+                    "fadvise with a negative offset");
+        test_assert(do_fadvise(-1, 0, 0, POSIX_FADV_NORMAL) == -EBADF,
+                    "fadvise on a bad fd");
+
+        /* dirty pages stay until they are written back */
+        test_assert(do_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0, "couldnt fadvise");
+        test_assert(vn->vn_mmobj.mmo_nrespages == npages, "dirty pages dropped");
+        vfs_sync();
+        test_assert(do_fadvise(fd, S5_BLOCK_SIZE, S5_BLOCK_SIZE, POSIX_FADV_DONTNEED) == 0,
+                    "couldnt fadvise");
+        test_assert(vn->vn_mmobj.mmo_nrespages == npages - 1, "%d pages resident, expected %d",
+                    vn->vn_mmobj.mmo_nrespages, npages - 1);
+        test_assert(do_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0, "couldnt fadvise");
+        test_assert(vn->vn_mmobj.mmo_nrespages == 0, "%d pages still resident",
+                    vn->vn_mmobj.mmo_nrespages);
+
+        /* readaheadd reads them while we wait */
+        test_assert(do_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED) == 0, "couldnt fadvise");
+        for (i = 0; i < 100 && vn->vn_mmobj.mmo_nrespages < npages; ++i) {
+                sched_make_runnable(curthr);
+                sched_switch();
+        }
+        test_assert(vn->vn_mmobj.mmo_nrespages == npages, "%d pages read ahead, expected %d",
+                    vn->vn_mmobj.mmo_nrespages, npages);
+
+        test_assert(do_fadvise(fd, 0, 0, POSIX_FADV_NOREUSE) == 0, "couldnt fadvise");
+        test_assert(vn->vn_advice == POSIX_FADV_NOREUSE, "advice not kept");
+        test_assert(do_lseek(fd, 0, SEEK_SET) == 0, "couldnt seek");
+        for (i = 0; i < npages * S5_BLOCK_SIZE; i += BUFSIZE) {
+                test_assert(do_read(fd, buf, BUFSIZE) == BUFSIZE, "couldnt read");
+                test_assert(buf[0] == 'a' + i / BUFSIZE % 26 && buf[BUFSIZE - 1] == buf[0],
+                            "wrong data read at %d", i);
+        }
+        test_assert(do_read(fd, buf, BUFSIZE) == 0, "read past the end");
+
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_unlink("advised") == 0, "couldnt unlink");
+}
+
+// The page cache counts should follow a file's pages being dropped and
+// read back in, both for the file and for the whole cache.
+static void test_pcstat()
+{
+        struct pcstat before, after, cache_before, cache_after;
+        char buf[BUFSIZE];
+        int i, fd;
+
+        fd = do_open("counted", O_RDWR | O_CREAT);
+        test_assert(fd >= 0, "couldnt create counted");
+        memset(buf, 'a', BUFSIZE);
+        for (i = 0; i < 2 * S5_BLOCK_SIZE; i += BUFSIZE)
+                test_assert(do_write(fd, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        test_assert(do_pcstat(-2, &before) == -EBADF, "pcstat on a bad fd");
+
+        /* no readahead to muddle the counts */
+        test_assert(do_fadvise(fd, 0, 0, POSIX_FADV_RANDOM) == 0, "couldnt fadvise");
+        vfs_sync();
+        test_assert(do_pcstat(fd, &before) == 0, "couldnt pcstat");
+        test_assert(do_pcstat(-1, &cache_before) == 0, "couldnt pcstat the cache");
+        test_assert(before.pc_resident == 2, "%d pages resident", before.pc_resident);
+        test_assert(before.pc_cleans >= 2, "only %d pages cleaned", before.pc_cleans);
+        test_assert(before.pc_hits > 0, "no hits writing a page at a time");
+
+        test_assert(do_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0, "couldnt fadvise");
+        test_assert(do_lseek(fd, 0, SEEK_SET) == 0, "couldnt seek");
+        test_assert(do_read(fd, buf, BUFSIZE) == BUFSIZE, "couldnt read");
+        test_assert(do_pcstat(fd, &after) == 0, "couldnt pcstat");
+        test_assert(do_pcstat(-1, &cache_after) == 0, "couldnt pcstat the cache");
+
+        test_assert(after.pc_evictions - before.pc_evictions == 2, "%d pages evicted",
+                    after.pc_evictions - before.pc_evictions);
+        test_assert(after.pc_misses - before.pc_misses == 1, "%d misses",
+                    after.pc_misses - before.pc_misses);
+        test_assert(after.pc_fills - before.pc_fills == 1, "%d fills",
+                    after.pc_fills - before.pc_fills);
+        test_assert(after.pc_lookups > before.pc_lookups, "read looked nothing up");
+        test_assert(after.pc_lookups == after.pc_hits + after.pc_misses,
+                    "%d lookups, %d hits and %d misses",
+                    after.pc_lookups, after.pc_hits, after.pc_misses);
+        test_assert(after.pc_resident == 1, "%d pages resident", after.pc_resident);
+        test_assert(cache_after.pc_evictions - cache_before.pc_evictions >= 2,
+                    "evictions not counted for the whole cache");
+        test_assert(cache_after.pc_fills - cache_before.pc_fills >= 1,
+                    "fills not counted for the whole cache");
+
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_unlink("counted") == 0, "couldnt unlink");
+}
+
+// Two files grown a block at a time in turn end up interleaved on disk;
+// defragmenting one should leave it in a single run with its data intact.
+static void test_defrag()
+{
+        const int nblocks = 8;
+        struct defrag_info info;
+        char buf[BUFSIZE];
+        int i, fd1, fd2;
+
+        fd1 = do_open("frag1", O_RDWR | O_CREAT);
+        fd2 = do_open("frag2", O_RDWR | O_CREAT);
+        test_assert(fd1 >= 0 && fd2 >= 0, "couldnt create frag files");
+        for (i = 0; i < nblocks; i++) {
+                test_assert(do_fallocate(fd1, 0, i * S5_BLOCK_SIZE, S5_BLOCK_SIZE) == 0,
+                            "couldnt fallocate");
+                test_assert(do_fallocate(fd2, 0, i * S5_BLOCK_SIZE, S5_BLOCK_SIZE) == 0,
+                            "couldnt fallocate");
+        }
+        for (i = 0; i < nblocks; i++) {
+                memset(buf, 'a' + i, BUFSIZE);
+                test_assert(do_lseek(fd1, i * S5_BLOCK_SIZE, SEEK_SET) == i * S5_BLOCK_SIZE,
+                            "couldnt seek");
+                test_assert(do_write(fd1, buf, BUFSIZE) == BUFSIZE, "couldnt write");
+        }
+
+        test_assert(do_defrag(fd1, &info) == 0, "couldnt defrag");
+        test_assert(info.di_blocks == nblocks, "%d blocks", info.di_blocks);
+        test_assert(info.di_before > 1, "files werent interleaved");
+        test_assert(info.di_after == 1, "%d extents after defrag", info.di_after);
+
+        vfs_sync();
+        for (i = 0; i < nblocks; i++) {
+                test_assert(do_lseek(fd1, i * S5_BLOCK_SIZE, SEEK_SET) == i * S5_BLOCK_SIZE,
+                            "couldnt seek");
+                test_assert(do_read(fd1, buf, BUFSIZE) == BUFSIZE, "couldnt read");
+                test_assert(buf[0] == 'a' + i && buf[BUFSIZE - 1] == 'a' + i,
+                            "block %d moved wrong", i);
+        }
+
+        test_assert(do_defrag(fd1, &info) == 0, "couldnt defrag again");
+        test_assert(info.di_before == 1 && info.di_after == 1,
+                    "defragmenting a contiguous file changed it");
+
+        test_assert(do_close(fd1) == 0 && do_close(fd2) == 0, "couldnt close");
+        test_assert(do_unlink("frag1") == 0 && do_unlink("frag2") == 0,
+                    "couldnt unlink");
+}
+
+// The write-to-temp-then-rename pattern: the file keeps its inode and
+// link count, and the file it replaces goes away.
+static void test_rename()
+{
+        struct stat st, old;
+        char buf[8];
+        int fd;
+
+        fd = do_open("target", O_RDWR | O_CREAT);
+        test_assert(fd >= 0 && do_write(fd, "old", 3) == 3, "couldnt write target");
+        test_assert(do_close(fd) == 0, "couldnt close");
+        fd = do_open("target.tmp", O_RDWR | O_CREAT);
+        test_assert(fd >= 0 && do_write(fd, "new", 3) == 3, "couldnt write temp");
+        test_assert(do_close(fd) == 0, "couldnt close");
+        test_assert(do_stat("target.tmp", &old) == 0, "couldnt stat temp");
+
+        test_assert(do_rename("target.tmp", "target") == 0, "couldnt rename over target");
+        test_assert(do_stat("target.tmp", &st) == -ENOENT, "temp still exists");
+        test_assert(do_stat("target", &st) == 0, "couldnt stat target");
+        test_assert(st.st_ino == old.st_ino, "target is inode %d, expected %d",
+                    st.st_ino, old.st_ino);
+        test_assert(st.st_nlink == 1, "target has %d links", st.st_nlink);
+        fd = do_open("target", O_RDONLY);
+        test_assert(do_read(fd, buf, sizeof(buf)) == 3 && 0 == memcmp(buf, "new", 3),
+                    "target has the wrong contents");
+        test_assert(do_close(fd) == 0, "couldnt close");
+
+        test_assert(do_mkdir("renamedir") == 0, "couldnt mkdir");
+        test_assert(do_rename("target", "renamedir/moved") == 0, "couldnt move target");
+        test_assert(do_stat("renamedir/moved", &st) == 0 && st.st_ino == old.st_ino,
+                    "moved file lost");
+        test_assert(do_rename("renamedir/moved", "renamedir/moved") == 0,
+                    "couldnt rename a file to itself");
+        test_assert(do_rename("renamedir", "elsewhere") == -EPERM, "renamed a directory");
+        test_assert(do_rename("renamedir/moved", "renamedir") == -EISDIR,
+                    "renamed over a directory");
+        test_assert(do_rename("missing", "renamedir/missing") == -ENOENT,
+                    "renamed a missing file");
+
+        test_assert(do_unlink("renamedir/moved") == 0, "couldnt unlink");
+        test_assert(do_rmdir("renamedir") == 0, "couldnt rmdir");
+}
+
+// Every entry getdentsplus() returns should carry the same stat as
+// looking the entry up by name would.
+static void test_readdirplus()
+{
+        direntplus_t dp[4];
+        struct stat st;
+        char name[8], buf[BUFSIZE];
+        int i, n, fd, seen = 0;
+
+        test_assert(do_mkdir("plusdir") == 0, "couldnt mkdir");
+        test_assert(do_chdir("plusdir") == 0, "couldnt chdir");
+        memset(buf, 'p', BUFSIZE);
+        for (i = 0; i < 10; i++) {
+                get_file_name(name, sizeof(name), i);
+                fd = do_open(name, O_RDWR | O_CREAT);
+                test_assert(fd >= 0, "couldnt create %s", name);
+                for (n = 0; n < i; n++)
+                        test_assert(do_write(fd, buf, BUFSIZE / 2) == BUFSIZE / 2,
+                                    "couldnt write");
+                test_assert(do_close(fd) == 0, "couldnt close");
+        }
+
+        fd = do_open(".", O_RDONLY);
+        test_assert(fd >= 0, "couldnt open plusdir");
+        while ((n = do_getdentsplus(fd, dp, 4)) > 0) {
+                for (i = 0; i < n; i++, seen++) {
+                        test_assert(do_stat(dp[i].dp_dirent.d_name, &st) == 0,
+                                    "couldnt stat %s", dp[i].dp_dirent.d_name);
+                        test_assert(st.st_ino == dp[i].dp_stat.st_ino
+                                    && st.st_mode == dp[i].dp_stat.st_mode
+                                    && st.st_size == dp[i].dp_stat.st_size
+                                    && st.st_nlink == dp[i].dp_stat.st_nlink
+                                    && st.st_blocks == dp[i].dp_stat.st_blocks,
+                                    "stat of %s differs", dp[i].dp_dirent.d_name);
+                }
+        }
+        test_assert(n == 0, "getdentsplus failed: %d", n);
+        test_assert(seen == 12, "saw %d entries, expected 12", seen);
+        test_assert(do_getdentsplus(fd, dp, 4) == 0, "read past the end");
+        test_assert(do_close(fd) == 0, "couldnt close");
+
+        for (i = 0; i < 10; i++) {
+                get_file_name(name, sizeof(name), i);
+                test_assert(do_unlink(name) == 0, "couldnt unlink %s", name);
+        }
+        test_assert(do_chdir("..") == 0, "couldnt chdir");
+        test_assert(do_rmdir("plusdir") == 0, "couldnt rmdir");
+}
 
 int s5fs_test_main()
 {
@@ -224,14 +1046,53 @@ int s5fs_test_main()
 
         test_init();
 
-        KASSERT(do_mkdir("s5fstest") == 0);
-        KASSERT(do_chdir("s5fstest") == 0);
+        test_assert(do_mkdir("s5fstest") == 0, "couldn't make test dir");
+        test_assert(do_chdir("s5fstest") == 0, "couldn't chdir to test dir");
         dbg(DBG_TEST, "Test dir initialized\n");
 
         dbg(DBG_TEST, "Testing sparseness for direct blocks\n");
         test_sparseness_direct_blocks();
         dbg(DBG_TEST, "Testing sparseness for indirect blocks\n");
         test_sparseness_indirect_blocks();
+        dbg(DBG_TEST, "Testing SEEK_DATA and SEEK_HOLE\n");
+        test_seek_hole();
+
+        dbg(DBG_TEST, "Testing preallocation\n");
+        test_fallocate();
+        dbg(DBG_TEST, "Testing truncation\n");
+        test_truncate();
+        dbg(DBG_TEST, "Testing reuse of directory slots\n");
+        test_directory_slots();
+        dbg(DBG_TEST, "Testing the metadata journal\n");
+        test_journal();
+        dbg(DBG_TEST, "Testing truncating through the journal\n");
+        test_journal_truncate();
+        dbg(DBG_TEST, "Testing in-core inodes\n");
+        test_incore_inodes();
+        dbg(DBG_TEST, "Testing inline files\n");
+        test_inline();
+        dbg(DBG_TEST, "Testing free counts\n");
+        test_free_counts();
+        dbg(DBG_TEST, "Testing statfs\n");
+        test_statfs();
+        dbg(DBG_TEST, "Testing deferred reclamation\n");
+        test_reclaim();
+        dbg(DBG_TEST, "Testing direct I/O\n");
+        test_direct_io();
+        dbg(DBG_TEST, "Testing sendfile and splice\n");
+        test_sendfile();
+        dbg(DBG_TEST, "Testing copy_file_range\n");
+        test_copy_file_range();
+        dbg(DBG_TEST, "Testing fadvise\n");
+        test_fadvise();
+        dbg(DBG_TEST, "Testing page cache statistics\n");
+        test_pcstat();
+        dbg(DBG_TEST, "Testing defragmenting\n");
+        test_defrag();
+        dbg(DBG_TEST, "Testing rename\n");
+        test_rename();
+        dbg(DBG_TEST, "Testing readdirplus\n");
+        test_readdirplus();
 
         dbg(DBG_TEST, "Testing running out of inodes\n");
         test_running_out_of_inodes();
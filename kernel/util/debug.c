@@ -79,6 +79,29 @@ void dbg_print(char *fmt, ...)
         dbg_puts(buf);
 }
 
+/* What dbg() prints: the message in the mode's color, after where it's from */
+void dbg_print_at(uint64_t mode, const char *file, int line, const char *func,
+                  const char *fmt, ...)
+{
+        va_list args;
+        char buf[BUFFER_SIZE];
+        int count;
+
+        dbg_print("%s", dbg_color(mode));
+        dbg_print("%s:%d %s(): ", file, line, func);
+
+        va_start(args, fmt);
+        count = vsnprintf(buf, BUFFER_SIZE, fmt, args);
+        va_end(args);
+
+        if (count >= BUFFER_SIZE) {
+                dbg_puts("WARNING: The following message has been "
+                         " truncated due to buffer size limitations.\n");
+        }
+        dbg_puts(buf);
+        dbg_print("%s", _NORMAL_);
+}
+
 void dbg_printinfo(dbg_infofunc_t func, const void *data)
 {
         char buf[BUFFER_SIZE];
@@ -0,0 +1,162 @@
+#include "kernel.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "proc/proc.h"
+
+#include "util/string.h"
+#include "util/printf.h"
+#include "util/ktrace.h"
+
+/*
+ * The ring. ktrace_next counts the events recorded since it was last
+ * cleared; event n is in slot n % KTRACE_NEVENTS, so the last
+ * KTRACE_NEVENTS of them are held. It wraps around to 0 along with the
+ * slots, as KTRACE_NEVENTS divides 2^32.
+ */
+static ktrace_event_t ktrace_ring[KTRACE_NEVENTS];
+static uint32_t ktrace_next = 0;
+
+uint32_t ktrace_mask = 0;
+
+static const char *ktrace_names[KT_NTYPES] = {
+        [KT_VGET]               = "vget",
+        [KT_VPUT]               = "vput",
+        [KT_PFRAME_GET]         = "pfget",
+        [KT_PFRAME_FILL]        = "pffill",
+        [KT_PFRAME_CLEAN]       = "pfclean",
+        [KT_SCHED_SWITCH]       = "switch",
+        [KT_KMUTEX_CONTEND]     = "mutex",
+        [KT_SYSCALL_ENTER]      = "sysenter",
+        [KT_SYSCALL_EXIT]       = "sysexit",
+};
+
+/*
+ * Record an event; called through ktrace(), which checks that its type
+ * is being traced. The slot is claimed with a single locked add rather
+ * than by raising the IPL, which is cheaper, and is enough for an
+ * interrupt handler tracing while we fill it in to get the next slot.
+ */
+void
+ktrace_record(ktrace_type_t type, uint32_t a0, uint32_t a1, uint32_t a2)
+{
+        uint32_t n = __sync_fetch_and_add(&ktrace_next, 1);
+        ktrace_event_t *ev = &ktrace_ring[n & (KTRACE_NEVENTS - 1)];
+
+        ev->ke_time = ktrace_time();
+        ev->ke_type = (uint16_t)type;
+        ev->ke_pid = (NULL == curproc) ? -1 : (int16_t)curproc->p_pid;
+        ev->ke_args[0] = a0;
+        ev->ke_args[1] = a1;
+        ev->ke_args[2] = a2;
+}
+
+/* Record the types of event in mask, as KT_TYPE() bits, from now on */
+void
+ktrace_start(uint32_t mask)
+{
+        ktrace_mask = mask;
+}
+
+void
+ktrace_stop(void)
+{
+        ktrace_mask = 0;
+}
+
+/* Forget the events recorded so far */
+void
+ktrace_clear(void)
+{
+        ktrace_next = 0;
+}
+
+/* The name of a type of event, or NULL if there is no such type */
+const char *
+ktrace_name(ktrace_type_t type)
+{
+        if (0 >= (int)type || KT_NTYPES <= type)
+                return NULL;
+        return ktrace_names[type];
+}
+
+/* The type of event with the given name, or -EINVAL if there isn't one */
+int
+ktrace_type(const char *name)
+{
+        int type;
+
+        for (type = 1; type < KT_NTYPES; ++type)
+                if (0 == strcmp(name, ktrace_names[type]))
+                        return type;
+        return -EINVAL;
+}
+
+/* The number of events held in the ring */
+uint32_t
+ktrace_count(void)
+{
+        return MIN(ktrace_next, (uint32_t)KTRACE_NEVENTS);
+}
+
+/*
+ * Copy the i'th oldest event held into ev. Returns 0, or -EINVAL if
+ * there are not that many events.
+ */
+int
+ktrace_event(uint32_t i, ktrace_event_t *ev)
+{
+        uint32_t next = ktrace_next;
+        uint32_t count = MIN(next, (uint32_t)KTRACE_NEVENTS);
+
+        if (i >= count)
+                return -EINVAL;
+        *ev = ktrace_ring[(next - count + i) & (KTRACE_NEVENTS - 1)];
+        return 0;
+}
+
+/*
+ * Read the events held, oldest first, as if they were a file of
+ * ktrace_event_t's, for procfs. Tracing should be stopped first, as events
+ * recorded while reading move those already read. Returns the number of
+ * bytes read.
+ */
+int
+ktrace_read(off_t offset, void *buf, size_t count)
+{
+        size_t total = ktrace_count() * sizeof(ktrace_event_t);
+        size_t done = 0, skip, n;
+        ktrace_event_t ev;
+
+        if (0 > offset || (size_t)offset >= total)
+                return 0;
+        count = MIN(count, total - offset);
+
+        while (done < count) {
+                if (0 > ktrace_event((offset + done) / sizeof(ktrace_event_t), &ev))
+                        break;
+                skip = (offset + done) % sizeof(ktrace_event_t);
+                n = MIN(sizeof(ktrace_event_t) - skip, count - done);
+                memcpy((char *)buf + done, (char *)&ev + skip, n);
+                done += n;
+        }
+        return (int)done;
+}
+
+size_t
+ktrace_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        int type;
+
+        iprintf(&buf, &size, "tracing:");
+        for (type = 1; type < KT_NTYPES; ++type)
+                if (ktrace_mask & KT_TYPE(type))
+                        iprintf(&buf, &size, " %s", ktrace_names[type]);
+        iprintf(&buf, &size, "\n");
+        iprintf(&buf, &size, "recorded: %u\n", ktrace_next);
+        iprintf(&buf, &size, "held: %u of %u\n", ktrace_count(),
+                KTRACE_NEVENTS);
+
+        return osize - size;
+}
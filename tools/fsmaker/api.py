@@ -3,8 +3,13 @@ import math
 import struct
 
 S5_MAGIC = 0x727f
-S5_CURRENT_VERSION = 3
+S5_CURRENT_VERSION = 9
+S5_STATE_DIRTY = 0x0
+S5_STATE_CLEAN = 0x1
+S5_JOURNAL_MAGIC = 0x6a6e6c68
+S5_JOURNAL_DEFAULT_BLOCKS = 128
 S5_BLOCK_SIZE = 4096
+S5_REFCNTS_PER_BLOCK = S5_BLOCK_SIZE
 
 S5_NBLKS_PER_FNODE = 30
 S5_NDIRECT_BLOCKS = 28
@@ -14,8 +19,10 @@ S5_MAX_FILE_SIZE = S5_MAX_FILE_BLOCKS * S5_BLOCK_SIZE
 S5_NAME_LEN = 28
 S5_DIRENT_SIZE = S5_NAME_LEN + 4
 
-S5_INODE_SIZE = 16 + S5_NDIRECT_BLOCKS * 4
+S5_INODE_SIZE = 256
 S5_INODES_PER_BLOCK = S5_BLOCK_SIZE / S5_INODE_SIZE
+S5_INLINE_SIZE = 240
+S5_INODE_INLINE = 0x1
 
 S5_TYPE_FREE = 0x0
 S5_TYPE_DATA = 0x1
@@ -68,6 +75,11 @@ class Block:
             self._simdisk._simfile.write('\0')
 
     def free(self):
+        # a shared block only loses a reference
+        refs = self._simdisk.get_block_refs(self._blockno)
+        if (refs > 0):
+            self._simdisk.set_block_refs(self._blockno, refs - 1)
+            return
         if (self._simdisk.get_nfree() < S5_NBLKS_PER_FNODE - 1):
             self._simdisk.set_free_block(self._simdisk.get_nfree(), self._blockno)
             self._simdisk.set_nfree(self._simdisk.get_nfree() + 1)
@@ -77,6 +89,7 @@ class Block:
             self.write((S5_NBLKS_PER_FNODE - 1) * 4, struct.pack("I", self._simdisk.get_last_free_block()))
             self._simdisk.set_last_free_block(self._blockno)
             self._simdisk.set_nfree(0)
+        self._simdisk.set_nfree_blocks(self._simdisk.get_nfree_blocks() + 1)
 
 class Dirent:
     
@@ -157,6 +170,30 @@ class Inode:
         self._simfile.seek(int(self._offset + 12 + 4 * S5_NDIRECT_BLOCKS))
         self._simfile.write(struct.pack("I", val))
 
+    def get_flags(self):
+        self._simfile.seek(int(self._offset + 12 + S5_INLINE_SIZE))
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_flags(self, val):
+        self._simfile.seek(int(self._offset + 12 + S5_INLINE_SIZE))
+        self._simfile.write(struct.pack("I", val))
+
+    def is_inline(self):
+        return (self.get_flags() & S5_INODE_INLINE) != 0
+
+    def _zero_inline(self, offset=0):
+        self._simfile.seek(int(self._offset + 12 + offset))
+        self._simfile.write('\0' * (S5_INLINE_SIZE - offset))
+
+    def _uninline(self):
+        # the data moves out to ordinary blocks for good
+        data = self.read()
+        self.set_flags(self.get_flags() & ~S5_INODE_INLINE)
+        self._zero_inline()
+        self.set_size(0)
+        if (len(data) > 0):
+            self.write(0, data)
+
     def get_type_str(self, short=False):
         t = self.get_type()
         name = "INV" if short else "INVALID"
@@ -187,6 +224,9 @@ class Inode:
             elif (self.get_type() == S5_TYPE_DIR):
                 res += " ({0} dirents)".format(self.get_size() / S5_DIRENT_SIZE)
             res += "\n"
+            if (self.is_inline()):
+                res += "data stored inline\n"
+                return res[:-1]
             res += "direct blocks ({0}):\n".format(S5_NDIRECT_BLOCKS)
             for i in xrange(S5_NDIRECT_BLOCKS):
                 res += " {0:5}".format(self.get_direct_blockno(i))
@@ -206,6 +246,11 @@ class Inode:
         if (self.get_type() not in set([ S5_TYPE_DATA, S5_TYPE_DIR ])):
             raise S5fsException("cannot read from inode of type " + self.get_type_str())
         size = min(size, min(S5_MAX_FILE_SIZE, self.get_size()) - offset)
+        if (self.is_inline()):
+            if (size <= 0):
+                return ""
+            self._simfile.seek(int(self._offset + 12 + offset))
+            return self._simfile.read(size)
         res = ""
         while (size > 0):
             blockno = math.floor(offset / S5_BLOCK_SIZE)
@@ -234,6 +279,14 @@ class Inode:
             raise S5fsException("cannot write to inode of type " + self.get_type_str())
         if (offset + len(data) > S5_MAX_FILE_SIZE):
             raise S5fsException("cannot write up to byte {0}, max file size is {1}".format(offset + len(data), S5_MAX_FILE_SIZE))
+        if (self.is_inline()):
+            if (offset + len(data) <= S5_INLINE_SIZE):
+                self._simfile.seek(int(self._offset + 12 + offset))
+                self._simfile.write(data)
+                if (offset + len(data) > self.get_size()):
+                    self.set_size(offset + len(data))
+                return
+            self._uninline()
         remaining = len(data)
         while (remaining > 0):
             blockloc = math.floor(offset / S5_BLOCK_SIZE)
@@ -270,6 +323,14 @@ class Inode:
             self.set_size(offset)
 
     def truncate(self, size=0):
+        if (self.is_inline()):
+            if (size > S5_INLINE_SIZE):
+                self._uninline()
+            else:
+                if (size < self.get_size()):
+                    self._zero_inline(size)
+                self.set_size(size)
+                return
         target = math.floor((size - 1) / S5_BLOCK_SIZE)
         curr = math.floor(self.get_size() / S5_BLOCK_SIZE)
         while (curr > target):
@@ -379,26 +440,27 @@ class Inode:
             inode.set_type(S5_TYPE_DATA)
             inode.set_size(0)
             inode.set_link_count(1)
-            for i in xrange(S5_NDIRECT_BLOCKS):
-                inode.set_direct_blockno(i, 0)
-            inode.set_indirect_blockno(0)
+            # small files keep their data in the inode
+            inode._zero_inline()
+            inode.set_flags(S5_INODE_INLINE)
             self._make_dirent(inode.get_number(), name)
             return inode
         except S5fsException as e:
             inode.free()
             raise e
 
-    def mkdir(self, name):
+    def mkdir(self, name, dots=True):
+        # without dots the new directory is left empty, with no block,
+        # until _make_dots() is called on it
         inode = self._simdisk.alloc_inode()
         try:
             inode.set_type(S5_TYPE_DIR)
             inode.set_size(0)
             inode.set_link_count(1)
-            for i in xrange(S5_NDIRECT_BLOCKS):
-                inode.set_direct_blockno(i, 0)
-            inode.set_indirect_blockno(0)
-            inode._make_dirent(inode.get_number(), ".")
-            inode._make_dirent(self.get_number(), "..")
+            inode._zero_inline()
+            inode.set_flags(0)
+            if (dots):
+                inode._make_dots(self)
             self.set_link_count(self.get_link_count() + 1)
             self._make_dirent(inode.get_number(), name)
             return inode
@@ -406,6 +468,10 @@ class Inode:
             inode.free()
             raise e
 
+    def _make_dots(self, parent):
+        self._make_dirent(self.get_number(), ".")
+        self._make_dirent(parent.get_number(), "..")
+
     def getdents(self):
         if (self.get_type() != S5_TYPE_DIR):
             raise S5fsException("cannot get dirents from inode of type " + self.get_type_str())
@@ -461,9 +527,11 @@ class Inode:
     def free(self):
         if (self.get_size() != 0):
             self.truncate()
+        self.set_flags(0)
         self.set_type(S5_TYPE_FREE)
         self.set_next_free(self._simdisk.get_free_inode())
         self._simdisk.set_free_inode(self._number)
+        self._simdisk.set_nfree_inodes(self._simdisk.get_nfree_inodes() + 1)
 
 class Simdisk:
 
@@ -536,13 +604,108 @@ class Simdisk:
         self._simfile.seek(20 + 4 * S5_NBLKS_PER_FNODE)
         self._simfile.write(struct.pack("I", val))
 
+    def get_journal_start(self):
+        self._simfile.seek(24 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_journal_start(self, val):
+        self._simfile.seek(24 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_journal_nblocks(self):
+        self._simfile.seek(28 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_journal_nblocks(self, val):
+        self._simfile.seek(28 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_state(self):
+        self._simfile.seek(32 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_state(self, val):
+        self._simfile.seek(32 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_nfree_blocks(self):
+        self._simfile.seek(36 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_nfree_blocks(self, val):
+        self._simfile.seek(36 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_nfree_inodes(self):
+        self._simfile.seek(40 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_nfree_inodes(self, val):
+        self._simfile.seek(40 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_num_blocks(self):
+        self._simfile.seek(44 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_num_blocks(self, val):
+        self._simfile.seek(44 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_orphan_inode(self):
+        self._simfile.seek(48 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_orphan_inode(self, val):
+        self._simfile.seek(48 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_refcnt_start(self):
+        self._simfile.seek(52 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_refcnt_start(self, val):
+        self._simfile.seek(52 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_refcnt_nblocks(self):
+        self._simfile.seek(56 + 4 * S5_NBLKS_PER_FNODE)
+        return struct.unpack("I", self._simfile.read(4))[0]
+
+    def set_refcnt_nblocks(self, val):
+        self._simfile.seek(56 + 4 * S5_NBLKS_PER_FNODE)
+        self._simfile.write(struct.pack("I", val))
+
+    def get_block_refs(self, blockno):
+        if (self.get_refcnt_nblocks() == 0):
+            return 0
+        self._simfile.seek((self.get_refcnt_start() + blockno / S5_REFCNTS_PER_BLOCK) * S5_BLOCK_SIZE + blockno % S5_REFCNTS_PER_BLOCK)
+        return struct.unpack("B", self._simfile.read(1))[0]
+
+    def set_block_refs(self, blockno, val):
+        self._simfile.seek((self.get_refcnt_start() + blockno / S5_REFCNTS_PER_BLOCK) * S5_BLOCK_SIZE + blockno % S5_REFCNTS_PER_BLOCK)
+        self._simfile.write(struct.pack("B", val))
+
     def get_super_block_summary(self):
         res = ""
         res += "magic:      0x{0:04x} ({1})\n".format(self.get_magic(), "VALID" if self.get_magic() == S5_MAGIC else "INVALID")
         res += "version:    0x{0:04x}{1}\n".format(self.get_version(), "" if self.get_version() == S5_CURRENT_VERSION else " (INVALID)")
-        res += "num inodes: {0}\n".format(self.get_num_inodes())
+        res += "num blocks: {0}\n".format(self.get_num_blocks())
+        res += "state:      {0}\n".format("clean" if self.get_state() == S5_STATE_CLEAN else "dirty")
+        res += "num inodes: {0} ({1} free)\n".format(self.get_num_inodes(), self.get_nfree_inodes())
         res += "free inode: {0}{1}\n".format(self.get_free_inode(), "" if self.get_free_inode() < self.get_num_inodes() else " (INVALID)")
         res += "root inode: {0}{1}\n".format(self.get_root_inode(), "" if self.get_root_inode() < self.get_num_inodes() else " (INVALID)")
+        if (self.get_orphan_inode() != 0xffffffff):
+            res += "orphans:    from inode {0}{1}\n".format(self.get_orphan_inode(), "" if self.get_orphan_inode() < self.get_num_inodes() else " (INVALID)")
+        if (self.get_journal_nblocks() == 0):
+            res += "journal:    none\n"
+        else:
+            res += "journal:    blocks {0}-{1}\n".format(self.get_journal_start(), self.get_journal_start() + self.get_journal_nblocks() - 1)
+        if (self.get_refcnt_nblocks() == 0):
+            res += "refcounts:  none\n"
+        else:
+            res += "refcounts:  blocks {0}-{1}\n".format(self.get_refcnt_start(), self.get_refcnt_start() + self.get_refcnt_nblocks() - 1)
+        res += "free block count: {0}\n".format(self.get_nfree_blocks())
         res += "free blocks ({0}{1}):\n".format(self.get_nfree(), "" if self.get_nfree() <= S5_NBLKS_PER_FNODE else (", too large shouldn't exceed " + str(S5_NBLKS_PER_FNODE)))
         for i in xrange(min(self.get_nfree(), S5_NBLKS_PER_FNODE - 1)):
             res += "  {0}".format(self.get_free_block(i))
@@ -553,7 +716,7 @@ class Simdisk:
         res += "  last free block: {0}\n".format(self.get_last_free_block())
         return res
 
-    def format(self, inodes, size):
+    def format(self, inodes, size, journal=S5_JOURNAL_DEFAULT_BLOCKS):
         if (inodes < 1):
             raise S5fsException("cannot format disk with {0} inodes, must have at least one".format(inodes))
         if (size % S5_BLOCK_SIZE != 0):
@@ -562,13 +725,21 @@ class Simdisk:
         iblocks = int(math.floor((inodes - 1) / S5_INODES_PER_BLOCK) + 1)
         if (iblocks + 1 >= blocks):
             raise S5fsException("cannot format disk of size {0} with {1} inodes, the inodes require at least {2} bytes of space".format(size, inodes, (1 + iblocks) * S5_BLOCK_SIZE))
+        if (iblocks + 1 + journal >= blocks):
+            raise S5fsException("cannot format disk of size {0} with a journal of {1} blocks, the inodes and journal require at least {2} bytes of space".format(size, journal, (1 + iblocks + journal) * S5_BLOCK_SIZE))
+        refcnt = int(math.floor((blocks - 1) / S5_REFCNTS_PER_BLOCK) + 1)
+        if (iblocks + 1 + journal + refcnt >= blocks):
+            raise S5fsException("cannot format disk of size {0}, the inodes, journal and reference counts require at least {1} bytes of space".format(size, (1 + iblocks + journal + refcnt) * S5_BLOCK_SIZE))
         self._simfile.truncate()
         self._simfile.seek(size)
         self._simfile.write("")
 
         self.set_magic(S5_MAGIC)
         self.set_version(S5_CURRENT_VERSION)
+        self.set_state(S5_STATE_CLEAN)
+        self.set_num_blocks(blocks)
         self.set_num_inodes(inodes)
+        self.set_nfree_inodes(inodes)
         for i in xrange(inodes):
             inode = self.get_inode(i)
             inode.set_number(i)
@@ -576,21 +747,26 @@ class Simdisk:
             inode.set_next_free(i + 1)
         inode.set_next_free(0xffffffff)
         self.set_free_inode(0)
-
-        self.set_last_free_block(0xffffffff)
-        i = 0
-        for num in xrange(iblocks+1, blocks):
-            if (i == S5_NBLKS_PER_FNODE - 1):
-                block = self.get_block(num)
-                for j in xrange(S5_NBLKS_PER_FNODE - 1):
-                    block.write(j * 4, struct.pack("I", self.get_free_block(j)))
-                block.write((S5_NBLKS_PER_FNODE - 1) * 4, struct.pack("I", self.get_last_free_block()))
-                self.set_last_free_block(num)
-                i = 0
-            else:
-                self.set_free_block(i, num)
-                i += 1
-        self.set_nfree(i)
+        self.set_orphan_inode(0xffffffff)
+
+        # the journal goes right after the inodes, and starts out with
+        # just a header block
+        self.set_journal_start(iblocks + 1 if journal > 0 else 0)
+        self.set_journal_nblocks(journal)
+        if (journal > 0):
+            header = self.get_block(iblocks + 1)
+            header.zero()
+            header.write(0, struct.pack("II", S5_JOURNAL_MAGIC, 1))
+
+        # then the reference counts of shared blocks, all zero since
+        # nothing is shared yet
+        self.set_refcnt_start(iblocks + 1 + journal)
+        self.set_refcnt_nblocks(refcnt)
+        for i in xrange(refcnt):
+            self.get_block(iblocks + 1 + journal + i).zero()
+
+        self.set_nfree_blocks(blocks - (iblocks + 1 + journal + refcnt))
+        self._set_free_list(range(iblocks + 1 + journal + refcnt, blocks))
 
         root = self.alloc_inode()
         for i in xrange(S5_NDIRECT_BLOCKS):
@@ -624,6 +800,7 @@ class Simdisk:
             raise S5fsException("disk is out of inodes")
         inode = self.get_inode(self.get_free_inode())
         self.set_free_inode(inode.get_next_free())
+        self.set_nfree_inodes(self.get_nfree_inodes() - 1)
         return inode
 
     def get_block(self, index):
@@ -631,6 +808,11 @@ class Simdisk:
         return Block(self, offset, index)
 
     def alloc_block(self):
+        block = self._take_free_block()
+        self.set_nfree_blocks(self.get_nfree_blocks() - 1)
+        return block
+
+    def _take_free_block(self):
         if (self.get_nfree() > S5_NBLKS_PER_FNODE - 1):
             raise S5fsException("nfree {0} is invalid, maximum value is {1}".format(self.get_nfree(), S5_NBLKS_PER_FNODE - 1))
         if (self.get_nfree() == 0):
@@ -647,5 +829,79 @@ class Simdisk:
             self.set_nfree(self.get_nfree() - 1)
             return self.get_block(self.get_free_block(self.get_nfree()))
 
+    def free_blocks(self):
+        for i in xrange(self.get_nfree()):
+            yield self.get_free_block(i)
+        bnext = self.get_last_free_block()
+        while (bnext != 0xffffffff):
+            block = self.get_block(bnext)
+            yield bnext
+            for i in xrange(S5_NBLKS_PER_FNODE - 1):
+                yield struct.unpack("I", block.read(i * 4, 4))[0]
+            bnext = struct.unpack("I", block.read((S5_NBLKS_PER_FNODE - 1) * 4, 4))[0]
+
+    def _set_free_list(self, blocks):
+        # lays out the free list so that alloc_block() hands the blocks
+        # out in the order given: the superblock array is popped from the
+        # top, then each free list node is returned before its entries
+        blocks = list(blocks)
+        head = len(blocks) % S5_NBLKS_PER_FNODE
+        for i in xrange(head):
+            self.set_free_block(i, blocks[head - 1 - i])
+        self.set_nfree(head)
+        self.set_last_free_block(blocks[head] if head < len(blocks) else 0xffffffff)
+        for start in xrange(head, len(blocks), S5_NBLKS_PER_FNODE):
+            node = self.get_block(blocks[start])
+            for i in xrange(S5_NBLKS_PER_FNODE - 1):
+                node.write(i * 4, struct.pack("I", blocks[start + S5_NBLKS_PER_FNODE - 1 - i]))
+            if (start + S5_NBLKS_PER_FNODE < len(blocks)):
+                bnext = blocks[start + S5_NBLKS_PER_FNODE]
+            else:
+                bnext = 0xffffffff
+            node.write((S5_NBLKS_PER_FNODE - 1) * 4, struct.pack("I", bnext))
+
+    def import_tree(self, hostdir, first=("bin", "lib")):
+        """Copies the host directory tree hostdir into the root directory,
+        laying the image out for reading: every file's blocks are
+        contiguous, each directory's blocks sit right before its entries'
+        inodes and data, and the top level directories named in first
+        are imported ahead of the other directories."""
+        self._set_free_list(sorted(self.free_blocks()))
+        self._import_dir(self.get_inode(self.get_root_inode()), hostdir, first)
+
+    def _import_dir(self, directory, hostdir, first=(), parent=None):
+        names = sorted(os.listdir(hostdir))
+        names = [ n for n in first if n in names ] + [ n for n in names if n not in first ]
+        dirs = [ n for n in names if os.path.isdir(os.path.join(hostdir, n)) ]
+        # the directory gets its block only now, right before its contents
+        if (parent is not None):
+            directory._make_dots(parent)
+        # every entry is made before any data is written, so that the
+        # directory's blocks come first and the entries' inodes are
+        # adjacent; subdirectories get their own entries, and so their
+        # blocks, when they are imported in turn
+        entries = {}
+        for name in names:
+            if (name in dirs):
+                entries[name] = directory.mkdir(name, dots=False)
+            else:
+                entries[name] = directory.create(name)
+        for name in names:
+            if (name not in dirs):
+                with open(os.path.join(hostdir, name), 'r') as source:
+                    self._import_file(entries[name], source.read())
+        for name in dirs:
+            self._import_dir(entries[name], os.path.join(hostdir, name), parent=directory)
+
+    def _import_file(self, inode, data):
+        if (len(data) > S5_NDIRECT_BLOCKS * S5_BLOCK_SIZE):
+            # allocate the indirect block ahead of the data, otherwise it
+            # would split the file in two after the direct blocks
+            inode._uninline()
+            indirect = self.alloc_block()
+            indirect.zero()
+            inode.set_indirect_blockno(indirect.get_blockno())
+        inode.write(0, data)
+
     def open(self, path, create=False):
         return self.get_inode(self.get_root_inode()).open(path, create=create)
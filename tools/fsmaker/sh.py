@@ -61,7 +61,7 @@ class FsmakerShell(cmd.Cmd):
         self._parse_getfile = OptionParser(usage="usage: %prog <source> <dest>", prog="getfile", description="gets a file from the real disk and puts it on the simdisk")
         self._parse_putfile = OptionParser(usage="usage: %prog <source> <dest>", prog="putfile", description="puts a file from the simdisk onto the real disk")
 
-        self._parse_format = OptionParser(usage="usage: %prog -i <inode count> [-s <size>|-b <blocks>]", prog="format", description="formats the simdisk to an empty file system")
+        self._parse_format = OptionParser(usage="usage: %prog -i <inode count> [-s <size>|-b <blocks>] [-j <journal blocks>] [-d <directory> [-o]]", prog="format", description="formats the simdisk to an empty file system")
         self._parse_format.add_option("-s", "--size", action="store", type="int", default=None,
                                       help="size for the new file system in bytes, must specify either this option or -b but not both")
         self._parse_format.add_option("-b", "--blocks", action="store", type="int", default=None,
@@ -70,6 +70,10 @@ class FsmakerShell(cmd.Cmd):
                                       help="number of inodes to put on the disk, this must be specified and be compatible with the size of the disk (there must be enough space for the inodes)")
         self._parse_format.add_option("-d", "--directory", action="store", type="str", default=None,
                                       help="initializes the disk with the contents of the specified directory")
+        self._parse_format.add_option("-o", "--optimize", action="store_true", default=False,
+                                      help="with -d, lays the image out for fast reads: files are contiguous, directories sit right before their contents and /bin and /lib go first")
+        self._parse_format.add_option("-j", "--journal", action="store", type="int", default=api.S5_JOURNAL_DEFAULT_BLOCKS,
+                                      help="number of blocks to reserve for the metadata journal, 0 for none (default {0})".format(api.S5_JOURNAL_DEFAULT_BLOCKS))
 
     def open(self, path, create=False):
         if (path.startswith("/")):
@@ -294,7 +298,7 @@ class FsmakerShell(cmd.Cmd):
                 else:
                     try:
                         print(inode.get_summary())
-                        if (options.indirect and inode.get_type() in set([ api.S5_TYPE_DATA, api.S5_TYPE_DIR ]) and inode.get_indirect_blockno() != 0):
+                        if (options.indirect and inode.get_type() in set([ api.S5_TYPE_DATA, api.S5_TYPE_DIR ]) and not inode.is_inline() and inode.get_indirect_blockno() != 0):
                             try:
                                 iblock = self._simdisk.get_block(inode.get_indirect_blockno())
                                 for i in xrange(api.S5_BLOCK_SIZE / 4):
@@ -648,9 +652,11 @@ class FsmakerShell(cmd.Cmd):
                 size = options.size
             else:
                 size = options.blocks * api.S5_BLOCK_SIZE
-            self._simdisk.format(options.inodes, size)
+            self._simdisk.format(options.inodes, size, options.journal)
 
-        if (options.directory):
+        if (options.directory and options.optimize):
+            self._simdisk.import_tree(options.directory)
+        elif (options.directory):
             q = Queue.Queue()
             q.put(".")
             while(not q.empty()):
@@ -0,0 +1,26 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+  const char *path = (argc > 1) ? argv[1] : "/";
+  if (argc > 2) {
+    printf("usage: df [file]\n");
+    return 1;
+  }
+
+  struct statfs sfs;
+  int rc = statfs(path, &sfs);
+  if (rc == -1) {
+    printf("df: %s\n", strerror(errno));
+    return 1;
+  }
+
+  printf("Block size: %d\n", sfs.f_bsize);
+  printf("    Blocks: %d (%d free, %d pending)\n", sfs.f_blocks, sfs.f_bfree,
+         sfs.f_bpending);
+  printf("    Inodes: %d (%d free)\n", sfs.f_files, sfs.f_ffree);
+  return 0;
+}
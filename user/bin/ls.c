@@ -10,13 +10,12 @@
 static int do_ls(const char *dir)
 {
         int             fd;
-        struct dirent   *dirent;
+        direntplus_t    *dp;
         int             nbytes;
-        char            tmpbuf[256];
-        struct stat     sbuf;
 
+        /* the entries come with their stat, so nothing is looked up by name */
         union {
-                struct dirent   dirent;
+                direntplus_t    dp;
                 char            buf[4096];
         } lsb;
 
@@ -28,31 +27,22 @@ static int do_ls(const char *dir)
                 return 1;
         }
 
-        while ((nbytes = getdents(fd, &lsb.dirent, sizeof(lsb))) > 0) {
-                dirent = &lsb.dirent;
+        while ((nbytes = getdentsplus(fd, &lsb.dp, sizeof(lsb))) > 0) {
+                dp = &lsb.dp;
 
-                if (nbytes % sizeof(struct dirent)) {
+                if (nbytes % sizeof(direntplus_t)) {
                         fprintf(stderr,
-                                "ls: incorrect return value from getdents (%d):"
-                                " not a multiple of sizeof(struct dirent) (%d)\n",
-                                nbytes, sizeof(struct dirent));
+                                "ls: incorrect return value from getdentsplus (%d):"
+                                " not a multiple of sizeof(direntplus_t) (%d)\n",
+                                nbytes, sizeof(direntplus_t));
                         return 1;
                 }
                 do {
-                        int reclen;
-                        int size;
-
-                        snprintf(tmpbuf, 256, "%s/%s", dir, dirent->d_name);
-                        if (0 == stat(tmpbuf, &sbuf))
-                                size = sbuf.st_size;
-                        else
-                                size = 0;
-
-                        reclen = sizeof(struct dirent);
                         fprintf(stdout, "%7d  %-20s   %d\n",
-                                size, dirent->d_name, dirent->d_ino);
-                        dirent = (struct dirent *)(((char *)dirent) + reclen);
-                        nbytes -= reclen;
+                                dp->dp_stat.st_size, dp->dp_dirent.d_name,
+                                dp->dp_dirent.d_ino);
+                        dp++;
+                        nbytes -= sizeof(direntplus_t);
                 } while (nbytes);
         }
         if (nbytes < 0) {
@@ -0,0 +1,39 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/pcstat.h>
+#include <unistd.h>
+
+int main(int argc, char **argv) {
+  if (argc > 2) {
+    printf("usage: pcstat [file]\n");
+    return 1;
+  }
+
+  int fd = -1;
+  if (argc > 1 && (fd = open(argv[1], O_RDONLY, 0)) == -1) {
+    printf("pcstat: %s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+
+  struct pcstat pcs;
+  int rc = pcstat(fd, &pcs);
+  if (fd != -1) {
+    close(fd);
+  }
+  if (rc == -1) {
+    printf("pcstat: %s\n", strerror(errno));
+    return 1;
+  }
+
+  printf("   Lookups: %u (%u hits, %u misses)\n", pcs.pc_lookups, pcs.pc_hits,
+         pcs.pc_misses);
+  printf("     Fills: %u\n", pcs.pc_fills);
+  printf("    Cleans: %u\n", pcs.pc_cleans);
+  printf(" Evictions: %u\n", pcs.pc_evictions);
+  printf("  Pageoutd: %u wakeups, %u waits for free pages\n",
+         pcs.pc_pageoutd_wakeups, pcs.pc_alloc_waits);
+  printf("  Resident: %u pages\n", pcs.pc_resident);
+  return 0;
+}
@@ -7,8 +7,10 @@
 
 #ifdef __KERNEL__
 #include "config.h"
+#include "fs/stat.h"
 #else
 #include "weenix/config.h"
+#include "sys/stat.h"
 #endif
 
 typedef struct dirent {
@@ -18,3 +20,10 @@ typedef struct dirent {
 } dirent_t;
 
 #define d_fileno d_ino
+
+/* A directory entry together with the stat() of the file it names, as
+ * returned by getdentsplus(). */
+typedef struct direntplus {
+        dirent_t        dp_dirent;
+        struct stat     dp_stat;
+} direntplus_t;
@@ -15,3 +15,15 @@
 #define O_CREAT         0x100   /* Create file if non-existent. */
 #define O_TRUNC         0x200   /* Truncate to zero length. */
 #define O_APPEND        0x400   /* Append to file. */
+#define O_DIRECT        0x800   /* Bypass the page cache. */
+
+/* Mode flags for fallocate(). */
+#define FALLOC_FL_KEEP_SIZE     0x1     /* Don't extend the file. */
+
+/* Advice for fadvise(). */
+#define POSIX_FADV_NORMAL       0       /* No particular pattern. */
+#define POSIX_FADV_RANDOM       1       /* Don't read ahead. */
+#define POSIX_FADV_SEQUENTIAL   2       /* Read ahead further. */
+#define POSIX_FADV_WILLNEED     3       /* Read the range in now. */
+#define POSIX_FADV_DONTNEED     4       /* Drop the range's clean pages. */
+#define POSIX_FADV_NOREUSE      5       /* Drop pages once they're read. */
@@ -0,0 +1,14 @@
+/*
+ *  FILE: defrag.h
+ *  DESC: what defrag() did to a file
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+struct defrag_info {
+        int di_blocks;  /* data blocks in the file */
+        int di_before;  /* contiguous runs they were in before */
+        int di_after;   /* and are in now */
+};
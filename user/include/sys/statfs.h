@@ -0,0 +1,18 @@
+/*
+ *  FILE: statfs.h
+ *  DESC: file system usage, as reported by statfs() and fstatfs()
+ */
+
+#pragma once
+
+/* Kernel and user header (via symlink) */
+
+struct statfs {
+        int f_bsize;    /* block size, in bytes */
+        int f_blocks;   /* total data blocks */
+        int f_bfree;    /* free data blocks */
+        int f_bpending; /* data blocks of removed files, not yet free */
+        int f_files;    /* total inodes */
+        int f_ffree;    /* free inodes */
+        int f_namelen;  /* longest file name */
+};
@@ -7,6 +7,9 @@
 #include "sys/types.h"
 #include "weenix/config.h"
 #include "sys/stat.h"
+#include "sys/statfs.h"
+#include "sys/pcstat.h"
+#include "sys/defrag.h"
 #include "lseek.h"
 
 #ifndef NULL
@@ -14,6 +17,7 @@
 #endif
 
 struct dirent;
+struct direntplus;
 
 /* User exec-related */
 int     fork(void);
@@ -42,6 +46,12 @@ int     close(int fd);
 int     read(int fd, void *buf, size_t nbytes);
 int     write(int fd, const void *buf, size_t nbytes);
 off_t   lseek(int fd, off_t offset, int whence);
+int     fallocate(int fd, int mode, off_t offset, off_t len);
+int     posix_fallocate(int fd, off_t offset, off_t len);
+int     fadvise(int fd, off_t offset, off_t len, int advice);
+int     posix_fadvise(int fd, off_t offset, off_t len, int advice);
+int     truncate(const char *path, off_t length);
+int     ftruncate(int fd, off_t length);
 int     dup(int fd);
 int     dup2(int ofd, int nfd);
 int     mkdir(const char *path, int mode);
@@ -51,7 +61,16 @@ int     link(const char *to, const char *from);
 int     rename(const char *oldname, const char *newname);
 int     chdir(const char *path);
 int     getdents(int fd, struct dirent *dir, size_t size);
+int     getdentsplus(int fd, struct direntplus *dir, size_t size);
 int     stat(const char *path, struct stat *buf);
+int     statfs(const char *path, struct statfs *buf);
+int     fstatfs(int fd, struct statfs *buf);
+int     pcstat(int fd, struct pcstat *buf);
+int     defrag(int fd, struct defrag_info *info);
+int     sendfile(int out_fd, int in_fd, off_t *offset, size_t count);
+int     splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len);
+int     copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                        size_t len, unsigned int flags);
 int     pipe(int pipefd[2]);
 
 /* VM-related */
@@ -56,6 +56,18 @@
 #define SYS_mount               45
 #define SYS_umount              46
 #define SYS_stat                47
+#define SYS_fallocate           48
+#define SYS_truncate            49
+#define SYS_ftruncate           50
+#define SYS_statfs              51
+#define SYS_fstatfs             52
+#define SYS_defrag              53
+#define SYS_getdentsplus        54
+#define SYS_sendfile            55
+#define SYS_splice              56
+#define SYS_copy_file_range     57
+#define SYS_fadvise             58
+#define SYS_pcstat              59
 
 /*
  * ... what does the scouter say about his syscall?
@@ -67,6 +79,10 @@
 
 struct regs;
 struct stat;
+struct statfs;
+struct pcstat;
+struct defrag_info;
+struct direntplus;
 
 typedef struct argstr {
         const char *as_str;
@@ -143,12 +159,35 @@ typedef struct getdents_args {
         size_t         count;
 } getdents_args_t;
 
+typedef struct getdentsplus_args {
+        int                fd;
+        struct direntplus *dirp;
+        size_t             count;
+} getdentsplus_args_t;
+
 typedef struct lseek_args {
         int fd;
         int offset;
         int whence;
 } lseek_args_t;
 
+typedef struct fallocate_args {
+        int   fd;
+        int   mode;
+        off_t offset;
+        off_t len;
+} fallocate_args_t;
+
+typedef struct truncate_args {
+        argstr_t path;
+        off_t    length;
+} truncate_args_t;
+
+typedef struct ftruncate_args {
+        int   fd;
+        off_t length;
+} ftruncate_args_t;
+
 typedef struct dup2_args {
         int ofd;
         int nfd;
@@ -167,4 +206,55 @@ typedef struct stat_args {
         struct stat *buf;
 } stat_args_t;
 
+typedef struct statfs_args {
+        argstr_t       path;
+        struct statfs *buf;
+} statfs_args_t;
+
+typedef struct fstatfs_args {
+        int            fd;
+        struct statfs *buf;
+} fstatfs_args_t;
+
+typedef struct defrag_args {
+        int                 fd;
+        struct defrag_info *info;
+} defrag_args_t;
+
+typedef struct sendfile_args {
+        int     out_fd;
+        int     in_fd;
+        off_t  *offset;
+        size_t  count;
+} sendfile_args_t;
+
+typedef struct splice_args {
+        int     fd_in;
+        off_t  *off_in;
+        int     fd_out;
+        off_t  *off_out;
+        size_t  len;
+} splice_args_t;
+
+typedef struct copy_file_range_args {
+        int     fd_in;
+        off_t  *off_in;
+        int     fd_out;
+        off_t  *off_out;
+        size_t  len;
+        unsigned int flags;
+} copy_file_range_args_t;
+
+typedef struct fadvise_args {
+        int   fd;
+        off_t offset;
+        off_t len;
+        int   advice;
+} fadvise_args_t;
+
+typedef struct pcstat_args {
+        int            fd;
+        struct pcstat *buf;
+} pcstat_args_t;
+
 struct utsname;
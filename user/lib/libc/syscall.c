@@ -5,6 +5,7 @@
 #include "stdlib.h"
 
 #include "unistd.h"
+#include "errno.h"
 #include "weenix/trap.h"
 
 #include "dirent.h"
@@ -187,6 +188,64 @@ off_t lseek(int fd, off_t offset, int whence)
         return trap(SYS_lseek, (uint32_t) &args);
 }
 
+int fallocate(int fd, int mode, off_t offset, off_t len)
+{
+        fallocate_args_t args;
+
+        args.fd = fd;
+        args.mode = mode;
+        args.offset = offset;
+        args.len = len;
+
+        return trap(SYS_fallocate, (uint32_t) &args);
+}
+
+int posix_fallocate(int fd, off_t offset, off_t len)
+{
+        if (0 > fallocate(fd, 0, offset, len))
+                return errno;
+        return 0;
+}
+
+int fadvise(int fd, off_t offset, off_t len, int advice)
+{
+        fadvise_args_t args;
+
+        args.fd = fd;
+        args.offset = offset;
+        args.len = len;
+        args.advice = advice;
+
+        return trap(SYS_fadvise, (uint32_t) &args);
+}
+
+int posix_fadvise(int fd, off_t offset, off_t len, int advice)
+{
+        if (0 > fadvise(fd, offset, len, advice))
+                return errno;
+        return 0;
+}
+
+int truncate(const char *path, off_t length)
+{
+        truncate_args_t args;
+
+        args.path.as_len = strlen(path);
+        args.path.as_str = path;
+        args.length = length;
+
+        return trap(SYS_truncate, (uint32_t) &args);
+}
+
+int ftruncate(int fd, off_t length)
+{
+        ftruncate_args_t args;
+
+        args.fd = fd;
+        args.length = length;
+
+        return trap(SYS_ftruncate, (uint32_t) &args);
+}
 
 int read(int fd, void *buf, size_t nbytes)
 {
@@ -355,6 +414,17 @@ int getdents(int fd, dirent_t *dir, size_t size)
         return trap(SYS_getdents, (uint32_t) &args);
 }
 
+int getdentsplus(int fd, direntplus_t *dir, size_t size)
+{
+        getdentsplus_args_t args;
+
+        args.fd = fd;
+        args.dirp = dir;
+        args.count = size;
+
+        return trap(SYS_getdentsplus, (uint32_t) &args);
+}
+
 #ifdef __MOUNTING__
 int
 mount(const char *spec, const char *dir, const char *fstype)
@@ -395,6 +465,94 @@ stat(const char *path, struct stat *buf)
         return trap(SYS_stat, (uint32_t) &args);
 }
 
+int
+statfs(const char *path, struct statfs *buf)
+{
+        statfs_args_t args;
+
+        args.path.as_len = strlen(path);
+        args.path.as_str = path;
+        args.buf = buf;
+
+        return trap(SYS_statfs, (uint32_t) &args);
+}
+
+int
+fstatfs(int fd, struct statfs *buf)
+{
+        fstatfs_args_t args;
+
+        args.fd = fd;
+        args.buf = buf;
+
+        return trap(SYS_fstatfs, (uint32_t) &args);
+}
+
+int
+pcstat(int fd, struct pcstat *buf)
+{
+        pcstat_args_t args;
+
+        args.fd = fd;
+        args.buf = buf;
+
+        return trap(SYS_pcstat, (uint32_t) &args);
+}
+
+int
+defrag(int fd, struct defrag_info *info)
+{
+        defrag_args_t args;
+
+        args.fd = fd;
+        args.info = info;
+
+        return trap(SYS_defrag, (uint32_t) &args);
+}
+
+int
+sendfile(int out_fd, int in_fd, off_t *offset, size_t count)
+{
+        sendfile_args_t args;
+
+        args.out_fd = out_fd;
+        args.in_fd = in_fd;
+        args.offset = offset;
+        args.count = count;
+
+        return trap(SYS_sendfile, (uint32_t) &args);
+}
+
+int
+splice(int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len)
+{
+        splice_args_t args;
+
+        args.fd_in = fd_in;
+        args.off_in = off_in;
+        args.fd_out = fd_out;
+        args.off_out = off_out;
+        args.len = len;
+
+        return trap(SYS_splice, (uint32_t) &args);
+}
+
+int
+copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                size_t len, unsigned int flags)
+{
+        copy_file_range_args_t args;
+
+        args.fd_in = fd_in;
+        args.off_in = off_in;
+        args.fd_out = fd_out;
+        args.off_out = off_out;
+        args.len = len;
+        args.flags = flags;
+
+        return trap(SYS_copy_file_range, (uint32_t) &args);
+}
+
 int
 pipe(int pipefd[2])
 {
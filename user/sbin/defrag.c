@@ -0,0 +1,92 @@
+/*
+ * defrag - lay files out contiguously on disk
+ *
+ * Defragments each file named, and every regular file under each
+ * directory named, printing how many contiguous runs of blocks each
+ * was in before and after.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/defrag.h>
+
+static int defrag_path(const char *path);
+
+static int defrag_dir(const char *dir)
+{
+        union {
+                struct dirent   dirent;
+                char            buf[4096];
+        } db;
+        struct dirent *d;
+        char path[1024];
+        int fd, nbytes, ret = 0;
+
+        if (0 > (fd = open(dir, O_RDONLY, 0))) {
+                fprintf(stderr, "defrag: %s: %s\n", dir, strerror(errno));
+                return 1;
+        }
+
+        while (0 < (nbytes = getdents(fd, &db.dirent, sizeof(db)))) {
+                for (d = &db.dirent; nbytes > 0; d++, nbytes -= sizeof(*d)) {
+                        if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, ".."))
+                                continue;
+                        snprintf(path, sizeof(path), "%s/%s", dir, d->d_name);
+                        ret |= defrag_path(path);
+                }
+        }
+        if (0 > nbytes) {
+                fprintf(stderr, "defrag: %s: %s\n", dir, strerror(errno));
+                ret = 1;
+        }
+
+        close(fd);
+        return ret;
+}
+
+static int defrag_path(const char *path)
+{
+        struct defrag_info info;
+        struct stat st;
+        int fd, ret;
+
+        if (0 > stat(path, &st)) {
+                fprintf(stderr, "defrag: %s: %s\n", path, strerror(errno));
+                return 1;
+        }
+        if (S_ISDIR(st.st_mode))
+                return defrag_dir(path);
+        if (!S_ISREG(st.st_mode))
+                return 0;
+
+        if (0 > (fd = open(path, O_RDONLY, 0))) {
+                fprintf(stderr, "defrag: %s: %s\n", path, strerror(errno));
+                return 1;
+        }
+        ret = defrag(fd, &info);
+        close(fd);
+
+        if (0 > ret) {
+                fprintf(stderr, "defrag: %s: %s\n", path, strerror(errno));
+                return 1;
+        }
+        printf("%-40s %6d blocks, %4d -> %4d extents\n", path,
+               info.di_blocks, info.di_before, info.di_after);
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        int i, ret = 0;
+
+        if (argc < 2)
+                return defrag_path("/");
+        for (i = 1; i < argc; i++)
+                ret |= defrag_path(argv[i]);
+        return ret;
+}